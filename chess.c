@@ -1,21 +1,159 @@
 #include "core/game.h"
+#include "core/archive.h"
+#include "core/bench.h"
+#include "core/book.h"
+#include "core/book_build.h"
+#include "core/dedupe.h"
+#include "core/epd.h"
+#include "core/fen.h"
+#include "core/journal.h"
+#include "core/mate.h"
 #include "core/network.h"
+#include "core/perft.h"
+#include "core/position_index.h"
 #include "core/replay.h"
+#include "core/search.h"
+#include "core/selfplay.h"
 #include "core/serialization.h"
+#include "core/signature.h"
+#include "core/tablebase.h"
+#include "core/tag_index.h"
+#include "core/tb_gen.h"
+#include "core/validate.h"
 #include "core/log.h"
 
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 const char *GAME_MODE_COMMANDS[] = {
 	[GAME_MODE_LOCAL] = "local", [GAME_MODE_LOAD] = "load",
 	[GAME_MODE_REPLAY] = "replay", [GAME_MODE_HOST] = "host",
-	[GAME_MODE_JOIN] = "join"
+	[GAME_MODE_JOIN] = "join", [GAME_MODE_PERFT] = "perft",
+	[GAME_MODE_BENCH] = "bench", [GAME_MODE_SEARCH] = "search",
+	[GAME_MODE_BOOK_BUILD] = "book-build", [GAME_MODE_TB_GEN] = "tb-gen",
+	[GAME_MODE_MATE] = "mate", [GAME_MODE_VALIDATE] = "validate",
+	[GAME_MODE_SELFPLAY] = "selfplay", [GAME_MODE_ARCHIVE] = "archive",
+	[GAME_MODE_UNARCHIVE] = "unarchive", [GAME_MODE_INDEX] = "index",
+	[GAME_MODE_QUERY] = "query", [GAME_MODE_SIGNATURES] = "signatures",
+	[GAME_MODE_MATCH] = "match", [GAME_MODE_TAG_INDEX] = "tag-index",
+	[GAME_MODE_FILTER] = "filter", [GAME_MODE_DEDUPE] = "dedupe",
+	[GAME_MODE_EPD] = "epd", [GAME_MODE_JOURNAL] = "journal"
 };
 
+/**
+ * Positional arguments a mode needs and its usage, shown when they are
+ * missing.
+ */
+static const struct {
+	int positionals;
+	const char *usage;
+} GAME_MODE_ARGS[GAME_NUM_MODES] = {
+	[GAME_MODE_REPLAY] = {
+		1, "<pgn> [--game N] [--ply N] [--keyframes N]"
+	},
+	[GAME_MODE_PERFT] = {
+		1, "<depth> [fen] [--threads N] [--hash MB] [--scaling]"
+	},
+	[GAME_MODE_SEARCH] = {
+		1, "<depth> [fen] [--nodes N] [--time MS] [--book FILE] "
+		   "[--tablebases DIR]"
+	},
+	[GAME_MODE_TB_GEN] = {
+		1, "<directory> [--pieces N] [--threads N]"
+	},
+	[GAME_MODE_MATE] = { 2, "<moves> <fen> [--hash MB]" },
+	[GAME_MODE_SELFPLAY] = {
+		1, "<games> [--depth N] [--nodes N] [--book FILE] [--fen FEN] "
+		   "[--output FILE]"
+	},
+	[GAME_MODE_QUERY] = { 2, "<index> <fen>" },
+	[GAME_MODE_MATCH] = {
+		1, "<signatures> [--material KRPvKR] [--pattern Kg1,pe5]"
+	},
+	[GAME_MODE_TAG_INDEX] = { 1, "<pgn> [--output FILE]" },
+	[GAME_MODE_FILTER] = {
+		2, "<pgn> <tag index> [--player NAME] [--min-elo N] "
+		   "[--since DATE] [--until DATE] [--result RESULT] "
+		   "[--output FILE]"
+	},
+	[GAME_MODE_EPD] = {
+		1, "<epd> [--depth N] [--time MS] [--threads N]"
+	},
+	[GAME_MODE_JOURNAL] = {
+		1, "<journal> [--sync-moves N] [--sync-ms MS]"
+	},
+};
+
+// Options that take no value, every other "--option" is followed by one.
+static const char *FLAG_OPTIONS[] = { "--scaling" };
+
+static bool is_flag_option(const char *arg)
+{
+	for (size_t i = 0; i < sizeof(FLAG_OPTIONS) / sizeof(char *); i++) {
+		if (strcmp(arg, FLAG_OPTIONS[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+static bool has_flag(int argc, char **argv, const char *name)
+{
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], name) == 0)
+			return true;
+	}
+	return false;
+}
+
+static const char *get_option(int argc, char **argv, const char *name)
+{
+	for (int i = 2; i < argc - 1; i++) {
+		if (strcmp(argv[i], name) == 0)
+			return argv[i + 1];
+	}
+	return NULL;
+}
+
+static size_t get_size_option(int argc, char **argv, const char *name,
+			      size_t fallback)
+{
+	const char *value = get_option(argc, argv, name);
+	return value ? strtoul(value, NULL, 10) : fallback;
+}
+
+/**
+ * The nth argument after the mode that is not an option.
+ */
+static const char *get_positional(int argc, char **argv, int index)
+{
+	for (int i = 2; i < argc; i++) {
+		if (strncmp(argv[i], "--", 2) == 0) {
+			if (!is_flag_option(argv[i]))
+				i++;
+			continue;
+		}
+		if (index-- == 0)
+			return argv[i];
+	}
+	return NULL;
+}
+
+/**
+ * Every argument after the mode that is not an option, e.g. input files.
+ */
+static size_t get_positionals(int argc, char **argv, const char **dest)
+{
+	size_t count = 0;
+	const char *arg;
+	while ((arg = get_positional(argc, argv, count)) != NULL)
+		dest[count++] = arg;
+	return count;
+}
+
 static void init_args(ChessArgs *args)
 {
 	args->prog_mode = GAME_MODE_INVALID;
@@ -36,7 +174,7 @@ static void parse_args(ChessArgs *args, int argc, char **argv)
 			   strlen(GAME_MODE_COMMANDS[GAME_MODE_LOAD]))
 		   == 0) {
 		args->prog_mode = GAME_MODE_LOAD;
-	} else if (argc == 3 &&
+	} else if (argc >= 3 &&
 		   strncmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_REPLAY],
 			   strlen(GAME_MODE_COMMANDS[GAME_MODE_REPLAY]))
 		   == 0) {
@@ -52,6 +190,79 @@ static void parse_args(ChessArgs *args, int argc, char **argv)
 				  [GAME_MODE_JOIN])) == 0
 		   ) {
 		args->prog_mode = GAME_MODE_JOIN;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_PERFT]) == 0) {
+		args->prog_mode = GAME_MODE_PERFT;
+	} else if ((argc == 2 || argc == 3) &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_BENCH]) == 0) {
+		args->prog_mode = GAME_MODE_BENCH;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_SEARCH]) == 0) {
+		args->prog_mode = GAME_MODE_SEARCH;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1],
+			  GAME_MODE_COMMANDS[GAME_MODE_BOOK_BUILD]) == 0) {
+		args->prog_mode = GAME_MODE_BOOK_BUILD;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_TB_GEN]) == 0) {
+		args->prog_mode = GAME_MODE_TB_GEN;
+	} else if (argc >= 4 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_MATE]) == 0) {
+		args->prog_mode = GAME_MODE_MATE;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1],
+			  GAME_MODE_COMMANDS[GAME_MODE_VALIDATE]) == 0) {
+		args->prog_mode = GAME_MODE_VALIDATE;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1],
+			  GAME_MODE_COMMANDS[GAME_MODE_SELFPLAY]) == 0) {
+		args->prog_mode = GAME_MODE_SELFPLAY;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1],
+			  GAME_MODE_COMMANDS[GAME_MODE_ARCHIVE]) == 0) {
+		args->prog_mode = GAME_MODE_ARCHIVE;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1],
+			  GAME_MODE_COMMANDS[GAME_MODE_UNARCHIVE]) == 0) {
+		args->prog_mode = GAME_MODE_UNARCHIVE;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_INDEX]) == 0) {
+		args->prog_mode = GAME_MODE_INDEX;
+	} else if (argc >= 4 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_QUERY]) == 0) {
+		args->prog_mode = GAME_MODE_QUERY;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1],
+			  GAME_MODE_COMMANDS[GAME_MODE_SIGNATURES]) == 0) {
+		args->prog_mode = GAME_MODE_SIGNATURES;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_MATCH]) == 0) {
+		args->prog_mode = GAME_MODE_MATCH;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1],
+			  GAME_MODE_COMMANDS[GAME_MODE_TAG_INDEX]) == 0) {
+		args->prog_mode = GAME_MODE_TAG_INDEX;
+	} else if (argc >= 4 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_FILTER]) == 0) {
+		args->prog_mode = GAME_MODE_FILTER;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_DEDUPE]) == 0) {
+		args->prog_mode = GAME_MODE_DEDUPE;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_EPD]) == 0) {
+		args->prog_mode = GAME_MODE_EPD;
+	} else if (argc >= 3 &&
+		   strcmp(argv[1], GAME_MODE_COMMANDS[GAME_MODE_JOURNAL]) == 0) {
+		args->prog_mode = GAME_MODE_JOURNAL;
+	}
+
+	int positionals = GAME_MODE_ARGS[args->prog_mode].positionals;
+	if (positionals > 0 &&
+	    get_positional(argc, argv, positionals - 1) == NULL) {
+		ERROR_LOG("Usage: %s %s %s\n", argv[0],
+			  GAME_MODE_COMMANDS[args->prog_mode],
+			  GAME_MODE_ARGS[args->prog_mode].usage);
+		args->prog_mode = GAME_MODE_INVALID;
 	}
 }
 
@@ -81,9 +292,22 @@ int main(int argc, char **argv)
 		}
 		play_chess(&game);
 		break;
-	case GAME_MODE_REPLAY:
-		replay_chess(&game, argv[2]);
-		break;
+	case GAME_MODE_REPLAY: {
+		// Seeking shows one ply to step from, otherwise the games are played
+		// through.
+		if (get_option(argc, argv, "--ply") == NULL) {
+			replay_chess(&game, get_positional(argc, argv, 0));
+			break;
+		}
+		ReplaySeekArgs seek_args = {
+			.filepath = get_positional(argc, argv, 0),
+			.game = get_size_option(argc, argv, "--game", 1),
+			.ply = get_size_option(argc, argv, "--ply", 0),
+			.interval = get_size_option(argc, argv, "--keyframes",
+						    REPLAY_KEYFRAME_INTERVAL),
+		};
+		return !run_replay_seek(&seek_args);
+	}
 	case GAME_MODE_HOST:
 		// Port is optional.
 		connection_fd = host_server(argc < 3 ? NULL : argv[2]);
@@ -102,6 +326,228 @@ int main(int argc, char **argv)
 		play_chess_networked(args.prog_mode, &game, connection_fd);
 		close(connection_fd);
 		break;
+	case GAME_MODE_PERFT: {
+		const char *fen = get_positional(argc, argv, 1);
+		PerftArgs perft_args = {
+			.fen = fen ? fen : STARTING_FEN,
+			.depth = strtoul(get_positional(argc, argv, 0), NULL,
+					 10),
+			.threads = get_size_option(argc, argv, "--threads",
+						   sysconf(_SC_NPROCESSORS_ONLN)),
+			.hash_mb = get_size_option(argc, argv, "--hash",
+						   PERFT_DEFAULT_HASH_MB),
+			.scaling = has_flag(argc, argv, "--scaling"),
+		};
+		return !run_perft(&perft_args);
+	}
+	case GAME_MODE_BENCH:
+		return !run_bench(argc < 3 ? BENCH_DEFAULT_DEPTH :
+				  strtoul(argv[2], NULL, 10));
+	case GAME_MODE_SEARCH: {
+		static Book book;
+		static Tablebases tablebases;
+		const char *fen = get_positional(argc, argv, 1);
+		const char *book_path = get_option(argc, argv, "--book");
+		const char *tb_path = get_option(argc, argv, "--tablebases");
+		SearchLimits limits = {
+			.depth = strtoul(get_positional(argc, argv, 0), NULL,
+					 10),
+			.nodes = get_size_option(argc, argv, "--nodes", 0),
+			.time_ms = get_size_option(argc, argv, "--time", 0),
+			.book = book_path ? &book : NULL,
+			.tablebases = tb_path ? &tablebases : NULL,
+		};
+		if (book_path && !open_book(&book, book_path))
+			return 1;
+		if (tb_path &&
+		    !open_tablebases(&tablebases, tb_path,
+				     get_size_option(argc, argv,
+						     "--tablebase-pieces",
+						     TB_MAX_PIECES)))
+			return 1;
+		int result = run_search(fen ? fen : STARTING_FEN, &limits);
+		if (book_path)
+			close_book(&book);
+		if (tb_path)
+			close_tablebases(&tablebases);
+		return !result;
+	}
+	case GAME_MODE_BOOK_BUILD: {
+		const char *inputs[argc];
+		const char *output = get_option(argc, argv, "--output");
+		BookBuildArgs build_args = {
+			.inputs = inputs,
+			.num_inputs = get_positionals(argc, argv, inputs),
+			.output = output ? output : BOOK_BUILD_DEFAULT_OUTPUT,
+			.plies = get_size_option(argc, argv, "--plies",
+						 BOOK_BUILD_DEFAULT_PLIES),
+			.memory_mb = get_size_option(argc, argv, "--memory",
+						     BOOK_BUILD_DEFAULT_MEMORY_MB),
+			.threads = get_size_option(argc, argv, "--threads",
+						   sysconf(_SC_NPROCESSORS_ONLN)),
+		};
+		return !run_book_build(&build_args);
+	}
+	case GAME_MODE_TB_GEN: {
+		TbGenArgs gen_args = {
+			.directory = get_positional(argc, argv, 0),
+			.pieces = get_size_option(argc, argv, "--pieces",
+						  TB_GEN_MAX_PIECES),
+			.threads = get_size_option(argc, argv, "--threads",
+						   sysconf(_SC_NPROCESSORS_ONLN)),
+		};
+		return !run_tb_gen(&gen_args);
+	}
+	case GAME_MODE_MATE: {
+		MateArgs mate_args = {
+			.moves = strtoul(get_positional(argc, argv, 0), NULL,
+					 10),
+			.fen = get_positional(argc, argv, 1),
+			.hash_mb = get_size_option(argc, argv, "--hash",
+						   MATE_DEFAULT_HASH_MB),
+		};
+		return !run_mate(&mate_args);
+	}
+	case GAME_MODE_VALIDATE: {
+		const char *inputs[argc];
+		ValidateArgs validate_args = {
+			.inputs = inputs,
+			.num_inputs = get_positionals(argc, argv, inputs),
+			.threads = get_size_option(argc, argv, "--threads",
+						   sysconf(_SC_NPROCESSORS_ONLN)),
+			.output = get_option(argc, argv, "--output"),
+		};
+		return !run_validate(&validate_args);
+	}
+	case GAME_MODE_SELFPLAY: {
+		const char *output = get_option(argc, argv, "--output");
+		SelfPlayArgs selfplay_args = {
+			.games = strtoul(get_positional(argc, argv, 0), NULL,
+					 10),
+			.depth = get_size_option(argc, argv, "--depth",
+						 SELFPLAY_DEFAULT_DEPTH),
+			.nodes = get_size_option(argc, argv, "--nodes", 0),
+			.book = get_option(argc, argv, "--book"),
+			.fen = get_option(argc, argv, "--fen"),
+			.output = output ? output : SELFPLAY_DEFAULT_OUTPUT,
+		};
+		return !run_selfplay(&selfplay_args);
+	}
+	case GAME_MODE_ARCHIVE:
+	case GAME_MODE_UNARCHIVE: {
+		const char *inputs[argc];
+		const char *output = get_option(argc, argv, "--output");
+		bool archive = args.prog_mode == GAME_MODE_ARCHIVE;
+		ArchiveArgs archive_args = {
+			.inputs = inputs,
+			.num_inputs = get_positionals(argc, argv, inputs),
+			.output = output ? output :
+				  archive ? ARCHIVE_DEFAULT_OUTPUT :
+				  UNARCHIVE_DEFAULT_OUTPUT,
+			.threads = get_size_option(argc, argv, "--threads",
+						   sysconf(_SC_NPROCESSORS_ONLN)),
+		};
+		return archive ? !run_archive(&archive_args) :
+		       !run_unarchive(&archive_args);
+	}
+	case GAME_MODE_INDEX: {
+		const char *inputs[argc];
+		const char *output = get_option(argc, argv, "--output");
+		IndexArgs index_args = {
+			.inputs = inputs,
+			.num_inputs = get_positionals(argc, argv, inputs),
+			.output = output ? output :
+				  POSITION_INDEX_DEFAULT_OUTPUT,
+			.memory_mb = get_size_option(argc, argv, "--memory",
+						     POSITION_INDEX_DEFAULT_MEMORY_MB),
+			.threads = get_size_option(argc, argv, "--threads",
+						   sysconf(_SC_NPROCESSORS_ONLN)),
+		};
+		return !run_index(&index_args);
+	}
+	case GAME_MODE_QUERY: {
+		IndexQueryArgs query_args = {
+			.index = get_positional(argc, argv, 0),
+			.fen = get_positional(argc, argv, 1),
+		};
+		return !run_index_query(&query_args);
+	}
+	case GAME_MODE_SIGNATURES: {
+		const char *inputs[argc];
+		const char *output = get_option(argc, argv, "--output");
+		SignatureArgs signature_args = {
+			.inputs = inputs,
+			.num_inputs = get_positionals(argc, argv, inputs),
+			.output = output ? output : SIGNATURE_DEFAULT_OUTPUT,
+			.threads = get_size_option(argc, argv, "--threads",
+						   sysconf(_SC_NPROCESSORS_ONLN)),
+		};
+		return !run_signatures(&signature_args);
+	}
+	case GAME_MODE_MATCH: {
+		MatchArgs match_args = {
+			.table = get_positional(argc, argv, 0),
+			.material = get_option(argc, argv, "--material"),
+			.pattern = get_option(argc, argv, "--pattern"),
+		};
+		return !run_match(&match_args);
+	}
+	case GAME_MODE_TAG_INDEX: {
+		const char *output = get_option(argc, argv, "--output");
+		TagIndexArgs tag_index_args = {
+			.input = get_positional(argc, argv, 0),
+			.output = output ? output : TAG_INDEX_DEFAULT_OUTPUT,
+		};
+		return !run_tag_index(&tag_index_args);
+	}
+	case GAME_MODE_FILTER: {
+		TagFilterArgs filter_args = {
+			.input = get_positional(argc, argv, 0),
+			.index = get_positional(argc, argv, 1),
+			.player = get_option(argc, argv, "--player"),
+			.min_elo = get_size_option(argc, argv, "--min-elo", 0),
+			.since = get_option(argc, argv, "--since"),
+			.until = get_option(argc, argv, "--until"),
+			.result = get_option(argc, argv, "--result"),
+			.output = get_option(argc, argv, "--output"),
+		};
+		return !run_tag_filter(&filter_args);
+	}
+	case GAME_MODE_DEDUPE: {
+		const char *inputs[argc];
+		const char *output = get_option(argc, argv, "--output");
+		DedupeArgs dedupe_args = {
+			.inputs = inputs,
+			.num_inputs = get_positionals(argc, argv, inputs),
+			.output = output ? output : DEDUPE_DEFAULT_OUTPUT,
+			.memory_mb = get_size_option(argc, argv, "--memory",
+						     DEDUPE_DEFAULT_MEMORY_MB),
+			.threads = get_size_option(argc, argv, "--threads",
+						   sysconf(_SC_NPROCESSORS_ONLN)),
+		};
+		return !run_dedupe(&dedupe_args);
+	}
+	case GAME_MODE_EPD: {
+		EpdArgs epd_args = {
+			.input = get_positional(argc, argv, 0),
+			.depth = get_size_option(argc, argv, "--depth", 0),
+			.time_ms = get_size_option(argc, argv, "--time", 0),
+			.threads = get_size_option(argc, argv, "--threads",
+						   sysconf(_SC_NPROCESSORS_ONLN)),
+		};
+		return !run_epd(&epd_args);
+	}
+	case GAME_MODE_JOURNAL: {
+		JournalArgs journal_args = {
+			.filepath = get_positional(argc, argv, 0),
+			.sync_moves = get_size_option(argc, argv,
+						      "--sync-moves",
+						      JOURNAL_DEFAULT_SYNC_MOVES),
+			.sync_ms = get_size_option(argc, argv, "--sync-ms",
+						   JOURNAL_DEFAULT_SYNC_MS),
+		};
+		return !run_journal(&game, &journal_args);
+	}
 	default:
 		INFO_LOG("Error parsing args etc....\n");
 		return 0;
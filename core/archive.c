@@ -0,0 +1,386 @@
+#include "archive.h"
+#include "attacks.h"
+#include "binary.h"
+#include "fen.h"
+#include "pgn_batch.h"
+#include "position.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+// Flags in the first byte of a game record.
+#define RECORD_VALID 0x01
+#define RECORD_FEN 0x02
+// Flags, result, tag count and move count, then the FEN if flagged, the tags
+// as length prefixed names and values, and a byte per move.
+#define RECORD_HEADER_SIZE 6
+#define MAX_RECORD_SIZE \
+	(RECORD_HEADER_SIZE + 1 + FEN_MAX_LENGTH + \
+	 PGN_MAX_TAGS * (2 + PGN_MAX_TAG_NAME_LEN + PGN_MAX_TAG_VALUE_LEN) + \
+	 PGN_MAX_PLIES)
+
+typedef struct {
+	const uint8_t *at;
+	const uint8_t *end;
+} RecordCursor;
+
+static inline uint32_t move_key(Move move)
+{
+	return (uint32_t)move.origin << 16 | move.target << 8 | move.promotion;
+}
+
+/**
+ * Legal moves of one piece in a fixed order, so that stored indices do not
+ * depend on the order the generator happens to produce them in.
+ */
+static size_t sorted_origin_moves(Position *position, int origin, int king,
+				  bool check, Move moves[MAX_POSSIBLE_MOVES])
+{
+	size_t num_moves = generate_origin_moves(position, origin, king, check,
+						 moves);
+	// The list is short and mostly in order already.
+	for (size_t i = 1; i < num_moves; i++) {
+		Move move = moves[i];
+		size_t j = i;
+		for (; j > 0 && move_key(moves[j - 1]) > move_key(move); j--)
+			moves[j] = moves[j - 1];
+		moves[j] = move;
+	}
+	return num_moves;
+}
+
+/**
+ * A move is stored as its index in the sorted list of legal moves, which is
+ * in origin order. Pieces before the move's origin are only counted, so
+ * neither side builds or sorts the whole list. Fails if the move is not
+ * legal.
+ */
+static bool encode_move(Position *position, Move move, uint8_t *index)
+{
+	int king = find_king(position->board, position->turn);
+	bool check = is_in_check(position);
+	size_t before = 0;
+	for (int origin = 0; origin < BOARD_SIZE * BOARD_SIZE; origin++) {
+		if (position->board[origin].type == PIECE_NONE ||
+		    position->board[origin].colour != position->turn)
+			continue;
+		Move moves[MAX_POSSIBLE_MOVES];
+		size_t num_moves = sorted_origin_moves(position, origin, king,
+						       check, moves);
+		if (origin != move.origin) {
+			before += num_moves;
+			continue;
+		}
+		for (size_t i = 0; i < num_moves; i++) {
+			if (move_key(moves[i]) == move_key(move)) {
+				*index = before + i;
+				return true;
+			}
+		}
+		return false;
+	}
+	return false;
+}
+
+/**
+ * The legal move stored as index, false if there are not that many.
+ */
+static bool decode_move(Position *position, size_t index, Move *move)
+{
+	int king = find_king(position->board, position->turn);
+	bool check = is_in_check(position);
+	for (int origin = 0; origin < BOARD_SIZE * BOARD_SIZE; origin++) {
+		if (position->board[origin].type == PIECE_NONE ||
+		    position->board[origin].colour != position->turn)
+			continue;
+		Move moves[MAX_POSSIBLE_MOVES];
+		size_t num_moves = sorted_origin_moves(position, origin, king,
+						       check, moves);
+		if (index < num_moves) {
+			*move = moves[index];
+			return true;
+		}
+		index -= num_moves;
+	}
+	return false;
+}
+
+bool open_archive_writer(ArchiveWriter *writer, const char *filepath)
+{
+	memset(writer, 0, sizeof(ArchiveWriter));
+	writer->file = fopen(filepath, "wb");
+	if (writer->file == NULL) {
+		ERROR_LOG("Unable to open %s\n", filepath);
+		return false;
+	}
+	// The header is filled in once the games are counted.
+	uint8_t header[ARCHIVE_HEADER_SIZE] = { 0 };
+	if (fwrite(header, ARCHIVE_HEADER_SIZE, 1, writer->file) != 1) {
+		fclose(writer->file);
+		return false;
+	}
+	writer->position = ARCHIVE_HEADER_SIZE;
+	return true;
+}
+
+bool write_archive_game(ArchiveWriter *writer, const PgnGame *game)
+{
+	uint8_t record[MAX_RECORD_SIZE];
+	Position position = game->start;
+	char fen[FEN_MAX_LENGTH];
+	size_t fen_length = format_fen(&position, fen);
+	bool has_fen = strcmp(fen, STARTING_FEN) != 0;
+	record[0] = (game->valid ? RECORD_VALID : 0) |
+		    (has_fen ? RECORD_FEN : 0);
+	record[1] = game->result;
+	write_le(record + 2, game->num_tags, 2);
+	write_le(record + 4, game->num_moves, 2);
+	size_t length = RECORD_HEADER_SIZE;
+	if (has_fen) {
+		record[length++] = fen_length;
+		memcpy(record + length, fen, fen_length);
+		length += fen_length;
+	}
+	for (size_t i = 0; i < game->num_tags; i++) {
+		const PgnTag *tag = &game->tags[i];
+		size_t name_length = strlen(tag->name);
+		size_t value_length = strlen(tag->value);
+		record[length++] = name_length;
+		memcpy(record + length, tag->name, name_length);
+		length += name_length;
+		record[length++] = value_length;
+		memcpy(record + length, tag->value, value_length);
+		length += value_length;
+	}
+
+	for (size_t i = 0; i < game->num_moves; i++) {
+		if (!encode_move(&position, game->moves[i], &record[length++])) {
+			ERROR_LOG("Game %zu has an illegal move\n",
+				  writer->num_games + 1);
+			return false;
+		}
+		make_move(&position, game->moves[i]);
+	}
+
+	if (writer->num_games == writer->capacity) {
+		size_t capacity = writer->capacity ? writer->capacity * 2 :
+				  1024;
+		uint64_t *offsets = realloc(writer->offsets,
+					    capacity * sizeof(uint64_t));
+		if (offsets == NULL)
+			return false;
+		writer->offsets = offsets;
+		writer->capacity = capacity;
+	}
+	if (fwrite(record, length, 1, writer->file) != 1)
+		return false;
+	writer->offsets[writer->num_games++] = writer->position;
+	writer->position += length;
+	return true;
+}
+
+/**
+ * Write the index after the games and fill in the header.
+ */
+bool close_archive_writer(ArchiveWriter *writer)
+{
+	bool ok = true;
+	uint8_t offset[8];
+	for (size_t i = 0; ok && i < writer->num_games; i++) {
+		write_le(offset, writer->offsets[i], 8);
+		ok = fwrite(offset, 8, 1, writer->file) == 1;
+	}
+
+	uint8_t header[ARCHIVE_HEADER_SIZE];
+	memcpy(header, ARCHIVE_MAGIC, 3);
+	header[3] = ARCHIVE_VERSION;
+	write_le(header + 4, writer->num_games, 8);
+	write_le(header + 12, writer->position, 8);
+	ok = ok && fseek(writer->file, 0, SEEK_SET) == 0 &&
+	     fwrite(header, ARCHIVE_HEADER_SIZE, 1, writer->file) == 1;
+	if (fclose(writer->file) != 0)
+		ok = false;
+	free(writer->offsets);
+	writer->offsets = NULL;
+	return ok;
+}
+
+/**
+ * Map an archive, games are only read in as they are asked for.
+ */
+bool open_archive(ArchiveReader *reader, const char *filepath)
+{
+	memset(reader, 0, sizeof(ArchiveReader));
+	reader->data = map_file(filepath, ARCHIVE_HEADER_SIZE, MADV_NORMAL,
+				&reader->size);
+	if (reader->data == NULL) {
+		ERROR_LOG("Unable to open archive: %s\n", filepath);
+		return false;
+	}
+
+	uint64_t num_games = read_le(reader->data + 4, 8);
+	uint64_t index = read_le(reader->data + 12, 8);
+	if (memcmp(reader->data, ARCHIVE_MAGIC, 3) != 0 ||
+	    reader->data[3] != ARCHIVE_VERSION ||
+	    index < ARCHIVE_HEADER_SIZE || index > reader->size ||
+	    num_games > (reader->size - index) / 8) {
+		ERROR_LOG("Invalid archive: %s\n", filepath);
+		close_archive(reader);
+		return false;
+	}
+	reader->num_games = num_games;
+	reader->index = reader->data + index;
+	return true;
+}
+
+void close_archive(ArchiveReader *reader)
+{
+	unmap_file(reader->data, reader->size);
+	memset(reader, 0, sizeof(ArchiveReader));
+}
+
+static const uint8_t *take(RecordCursor *cursor, size_t bytes)
+{
+	if ((size_t)(cursor->end - cursor->at) < bytes)
+		return NULL;
+	const uint8_t *taken = cursor->at;
+	cursor->at += bytes;
+	return taken;
+}
+
+/**
+ * Copy a length prefixed string out of the record, cut to fit.
+ */
+static bool take_string(RecordCursor *cursor, char *string, size_t size)
+{
+	const uint8_t *length = take(cursor, 1);
+	const uint8_t *text = length ? take(cursor, *length) : NULL;
+	if (text == NULL)
+		return false;
+	size_t copied = *length < size ? *length : size - 1;
+	memcpy(string, text, copied);
+	string[copied] = '\0';
+	return true;
+}
+
+/**
+ * Decode the game at the index, replaying its moves. Fails if the record is
+ * damaged.
+ */
+bool read_archive_game(const ArchiveReader *reader, size_t index,
+		       PgnGame *game)
+{
+	if (index >= reader->num_games)
+		return false;
+	uint64_t offset = read_le(reader->index + index * 8, 8);
+	RecordCursor cursor = { reader->data + offset, reader->index };
+	const uint8_t *header = offset < (uint64_t)(reader->index -
+						    reader->data) ?
+				take(&cursor, RECORD_HEADER_SIZE) : NULL;
+	if (header == NULL || header[1] >= GAME_RESULT_NUM_TYPES)
+		return false;
+	game->valid = header[0] & RECORD_VALID;
+	game->result = header[1];
+	game->num_tags = read_le(header + 2, 2);
+	game->num_moves = read_le(header + 4, 2);
+	if (game->num_tags > PGN_MAX_TAGS || game->num_moves > PGN_MAX_PLIES)
+		return false;
+
+	new_position(&game->start);
+	if (header[0] & RECORD_FEN) {
+		char fen[FEN_MAX_LENGTH];
+		if (!take_string(&cursor, fen, FEN_MAX_LENGTH) ||
+		    !parse_fen(fen, &game->start))
+			return false;
+	}
+	for (size_t i = 0; i < game->num_tags; i++) {
+		if (!take_string(&cursor, game->tags[i].name,
+				 PGN_MAX_TAG_NAME_LEN) ||
+		    !take_string(&cursor, game->tags[i].value,
+				 PGN_MAX_TAG_VALUE_LEN))
+			return false;
+	}
+
+	const uint8_t *indices = take(&cursor, game->num_moves);
+	if (indices == NULL)
+		return false;
+	Position position = game->start;
+	for (size_t i = 0; i < game->num_moves; i++) {
+		if (!decode_move(&position, indices[i], &game->moves[i]))
+			return false;
+		make_move(&position, game->moves[i]);
+	}
+	game->end = position;
+	return true;
+}
+
+static bool archive_pgn_game(const PgnGame *game, void *context)
+{
+	return write_archive_game(context, game);
+}
+
+/**
+ * Convert PGN files into one archive.
+ */
+int run_archive(ArchiveArgs *args)
+{
+	ArchiveWriter writer;
+	if (!open_archive_writer(&writer, args->output))
+		return 0;
+	bool ok = true;
+	for (size_t i = 0; ok && i < args->num_inputs; i++) {
+		INFO_LOG("Reading %s\n", args->inputs[i]);
+		ok = read_pgn_games(args->inputs[i], args->threads,
+				    archive_pgn_game, &writer);
+	}
+	size_t num_games = writer.num_games;
+	uint64_t size = writer.position + 8 * num_games;
+	if (!close_archive_writer(&writer) || !ok) {
+		ERROR_LOG("Unable to write %s\n", args->output);
+		return 0;
+	}
+	INFO_LOG("Games: %zu written to %s (%lu bytes)\n", num_games,
+		 args->output, size);
+	return 1;
+}
+
+/**
+ * Convert archives back into one PGN file.
+ */
+int run_unarchive(ArchiveArgs *args)
+{
+	static PgnWriter writer;
+	PgnGame *game = malloc(sizeof(PgnGame));
+	if (game == NULL || !open_pgn_writer(&writer, args->output)) {
+		free(game);
+		return 0;
+	}
+	bool ok = true;
+	for (size_t i = 0; ok && i < args->num_inputs; i++) {
+		ArchiveReader reader;
+		if (!open_archive(&reader, args->inputs[i])) {
+			ok = false;
+			break;
+		}
+		for (size_t g = 0; ok && g < reader.num_games; g++) {
+			ok = read_archive_game(&reader, g, game);
+			if (!ok)
+				ERROR_LOG("Game %zu of %s is damaged\n", g + 1,
+					  args->inputs[i]);
+			ok = ok && write_pgn_game(&writer, game);
+		}
+		close_archive(&reader);
+	}
+	if (!close_pgn_writer(&writer))
+		ok = false;
+	free(game);
+	if (ok)
+		INFO_LOG("Games: %zu written to %s\n", writer.games,
+			 args->output);
+	return ok;
+}
@@ -0,0 +1,62 @@
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+
+#include "pgn.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Games stored one byte per ply, each move being its index in the sorted list
+ * of legal moves. The file starts with a header:
+ *
+ *   magic "CGA", version, game count (8 bytes), index offset (8 bytes)
+ *
+ * then the game records, then an index of each record's offset so any game
+ * can be read without reading those before it. Numbers are little endian.
+ */
+#define ARCHIVE_MAGIC "CGA"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 20
+#define ARCHIVE_DEFAULT_OUTPUT "games.cga"
+#define UNARCHIVE_DEFAULT_OUTPUT "games.pgn"
+
+typedef struct {
+	FILE *file;
+	// Offsets of the records written so far, the index.
+	uint64_t *offsets;
+	size_t num_games;
+	size_t capacity;
+	uint64_t position;
+} ArchiveWriter;
+
+typedef struct {
+	// The mapped file.
+	const uint8_t *data;
+	size_t size;
+	size_t num_games;
+	// Little endian record offsets, num_games of them.
+	const uint8_t *index;
+} ArchiveReader;
+
+typedef struct {
+	const char **inputs;
+	size_t num_inputs;
+	const char *output;
+	// Games are parsed on this many threads, and stored in file order.
+	size_t threads;
+} ArchiveArgs;
+
+bool open_archive_writer(ArchiveWriter *writer, const char *filepath);
+bool write_archive_game(ArchiveWriter *writer, const PgnGame *game);
+bool close_archive_writer(ArchiveWriter *writer);
+bool open_archive(ArchiveReader *reader, const char *filepath);
+bool read_archive_game(const ArchiveReader *reader, size_t index,
+		       PgnGame *game);
+void close_archive(ArchiveReader *reader);
+int run_archive(ArchiveArgs *args);
+int run_unarchive(ArchiveArgs *args);
+
+#endif
@@ -0,0 +1,189 @@
+#include "attacks.h"
+#include "board.h"
+
+#include <stdbool.h>
+
+static const int KNIGHT_STEPS[8][2] = {
+	{ 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 },
+	{ -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 },
+};
+
+static const int KING_STEPS[8][2] = {
+	{ 0, 1 }, { 1, 1 }, { 1, 0 }, { 1, -1 },
+	{ 0, -1 }, { -1, -1 }, { -1, 0 }, { -1, 1 },
+};
+
+static inline bool on_board(int x, int y)
+{
+	return x >= 0 && x < BOARD_SIZE && y >= 0 && y < BOARD_SIZE;
+}
+
+static inline bool piece_at(Board board, int x, int y, EChessPiece type,
+			    EPlayerColour colour)
+{
+	PlayPiece *piece = &board[y * BOARD_SIZE + x];
+	return piece->type == type && piece->colour == colour;
+}
+
+/**
+ * Walk a ray away from the square and report if the first piece hit is one of
+ * the attacker's sliders.
+ */
+static bool slider_attack(Board board, int x, int y, int dx, int dy,
+			  EPlayerColour attacker, EChessPiece slider)
+{
+	for (x += dx, y += dy; on_board(x, y); x += dx, y += dy) {
+		PlayPiece *piece = &board[y * BOARD_SIZE + x];
+		if (piece->type == PIECE_NONE)
+			continue;
+		return piece->colour == attacker &&
+		       (piece->type == slider || piece->type == PIECE_QUEEN);
+	}
+	return false;
+}
+
+int find_king(Board board, EPlayerColour colour)
+{
+	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
+		if (board[i].type == PIECE_KING && board[i].colour == colour)
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * Could any of the attacker's pieces capture on this square? Looks outwards
+ * from the square instead of generating every enemy move.
+ */
+bool is_square_attacked(Board board, int square, EPlayerColour attacker)
+{
+	int x = square % BOARD_SIZE;
+	int y = square / BOARD_SIZE;
+
+	// Pawns attack diagonally forward, so look one row behind the square.
+	int pawn_y = y + (attacker == COLOUR_WHITE ? -1 : 1);
+	for (int dx = -1; dx <= 1; dx += 2) {
+		if (on_board(x + dx, pawn_y) &&
+		    piece_at(board, x + dx, pawn_y, PIECE_PAWN, attacker))
+			return true;
+	}
+
+	for (int i = 0; i < 8; i++) {
+		int kx = x + KNIGHT_STEPS[i][0];
+		int ky = y + KNIGHT_STEPS[i][1];
+		if (on_board(kx, ky) &&
+		    piece_at(board, kx, ky, PIECE_KNIGHT, attacker))
+			return true;
+	}
+
+	for (int i = 0; i < 8; i++) {
+		int kx = x + KING_STEPS[i][0];
+		int ky = y + KING_STEPS[i][1];
+		if (on_board(kx, ky) &&
+		    piece_at(board, kx, ky, PIECE_KING, attacker))
+			return true;
+	}
+
+	// Odd steps are diagonal, even steps are parallel.
+	for (int i = 0; i < 8; i++) {
+		if (slider_attack(board, x, y, KING_STEPS[i][0],
+				  KING_STEPS[i][1], attacker,
+				  i % 2 ? PIECE_BISHOP : PIECE_ROOK))
+			return true;
+	}
+	return false;
+}
+
+static inline int sign(int number)
+{
+	return (number > 0) - (number < 0);
+}
+
+/**
+ * Would a piece of this type and colour on square attack target once the
+ * vacated square is empty? Checks the one piece instead of every attacker.
+ */
+bool piece_attacks(Board board, int square, EChessPiece type,
+		   EPlayerColour colour, int target, int vacated)
+{
+	int x = square % BOARD_SIZE;
+	int y = square / BOARD_SIZE;
+	int tx = target % BOARD_SIZE - x;
+	int ty = target / BOARD_SIZE - y;
+	switch (type) {
+	case PIECE_PAWN:
+		return ty == (colour == COLOUR_WHITE ? 1 : -1) &&
+		       (tx == 1 || tx == -1);
+	case PIECE_KNIGHT:
+		return tx * tx + ty * ty == 5;
+	case PIECE_KING:
+		return (tx || ty) && tx * tx <= 1 && ty * ty <= 1;
+	case PIECE_BISHOP:
+		if (tx != ty && tx != -ty)
+			return false;
+		break;
+	case PIECE_ROOK:
+		if (tx != 0 && ty != 0)
+			return false;
+		break;
+	case PIECE_QUEEN:
+		if (tx != 0 && ty != 0 && tx != ty && tx != -ty)
+			return false;
+		break;
+	default:
+		return false;
+	}
+	if (tx == 0 && ty == 0)
+		return false;
+
+	int dx = sign(tx);
+	int dy = sign(ty);
+	for (int between = square + dy * BOARD_SIZE + dx; between != target;
+	     between += dy * BOARD_SIZE + dx) {
+		if (between != vacated && board[between].type != PIECE_NONE)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Would moving the piece on square to target uncover an attack on the king
+ * by one of the attacker's sliders lined up behind it?
+ */
+bool discovers_attack(Board board, int king, int square, int target,
+		      EPlayerColour attacker)
+{
+	int kx = king % BOARD_SIZE;
+	int ky = king / BOARD_SIZE;
+	int x = square % BOARD_SIZE;
+	int y = square / BOARD_SIZE;
+	if (x != kx && y != ky && x - kx != y - ky && x - kx != ky - y)
+		return false;
+	int dx = sign(x - kx);
+	int dy = sign(y - ky);
+	for (int sx = kx + dx, sy = ky + dy; sx != x || sy != y;
+	     sx += dx, sy += dy) {
+		if (board[sy * BOARD_SIZE + sx].type != PIECE_NONE)
+			return false;
+	}
+
+	// Moving along the pin keeps the king covered.
+	int tx = target % BOARD_SIZE - kx;
+	int ty = target / BOARD_SIZE - ky;
+	if (sign(tx) == dx && sign(ty) == dy &&
+	    (dx == 0 || dy == 0 || tx == ty || tx == -ty))
+		return false;
+	return slider_attack(board, x, y, dx, dy, attacker,
+			     dx && dy ? PIECE_BISHOP : PIECE_ROOK);
+}
+
+/**
+ * Would moving the piece on square to target uncover an attack on its king by
+ * a slider? Only pins are looked for, the king must not already be in check.
+ */
+bool exposes_king(Board board, int king, int square, int target)
+{
+	return discovers_attack(board, king, square, target,
+				(board[square].colour + 1) %
+				PLAYER_NUM_COLOURS);
+}
@@ -0,0 +1,17 @@
+#ifndef _ATTACKS_H
+#define _ATTACKS_H
+
+#include "board.h"
+#include "players.h"
+
+#include <stdbool.h>
+
+int find_king(Board board, EPlayerColour colour);
+bool is_square_attacked(Board board, int square, EPlayerColour attacker);
+bool piece_attacks(Board board, int square, EChessPiece type,
+		   EPlayerColour colour, int target, int vacated);
+bool discovers_attack(Board board, int king, int square, int target,
+		      EPlayerColour attacker);
+bool exposes_king(Board board, int king, int square, int target);
+
+#endif
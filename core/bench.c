@@ -0,0 +1,66 @@
+#include "bench.h"
+#include "fen.h"
+#include "position.h"
+#include "search.h"
+#include "timing.h"
+#include "log.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Openings, middlegames and endgames. Changing this list changes the
+// signature, so only ever append.
+static const char *BENCH_POSITIONS[] = {
+	STARTING_FEN,
+	"r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3",
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+	"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+	"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+	"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+	"2rq1rk1/pp1bppbp/2np1np1/8/3NP3/1BN1BP2/PPPQ2PP/2KR3R b - - 6 11",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+	"6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+	"8/8/8/4k3/8/8/4P3/4K3 w - - 0 1",
+	"8/5pk1/6p1/8/3R4/6P1/5PK1/r7 b - - 0 40",
+	"4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+};
+
+#define NUM_BENCH_POSITIONS (sizeof(BENCH_POSITIONS) / sizeof(char *))
+
+/**
+ * Search every embedded position to a fixed depth. The search is single
+ * threaded with no time limits, so the total node count is a signature of the
+ * search behaviour.
+ */
+int run_bench(size_t depth)
+{
+	uint64_t total_nodes = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (size_t i = 0; i < NUM_BENCH_POSITIONS; i++) {
+		Position position;
+		if (!parse_fen(BENCH_POSITIONS[i], &position)) {
+			ERROR_LOG("Invalid bench position: %s\n",
+				  BENCH_POSITIONS[i]);
+			return 0;
+		}
+		SearchLimits limits = { .depth = depth };
+		SearchResult result;
+		char move[MOVE_COORDS_LENGTH] = "none";
+		if (search_position(&position, NULL, &limits, &result))
+			format_move_coords(result.best_move, move);
+		INFO_LOG("Position %2zu: %-5s %6d cp %10lu nodes  %s\n", i + 1,
+			 move, result.score, result.nodes, BENCH_POSITIONS[i]);
+		total_nodes += result.nodes;
+	}
+
+	double seconds = elapsed_seconds(&start);
+	INFO_LOG("===========================\n");
+	INFO_LOG("Depth: %zu\n", depth);
+	INFO_LOG("Total time (ms): %.0f\n", seconds * 1000);
+	INFO_LOG("Nodes searched: %lu\n", total_nodes);
+	INFO_LOG("Nodes/second: %.0f\n", seconds > 0 ? total_nodes / seconds : 0);
+	return 1;
+}
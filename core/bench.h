@@ -0,0 +1,10 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stddef.h>
+
+#define BENCH_DEFAULT_DEPTH 5
+
+int run_bench(size_t depth);
+
+#endif
@@ -0,0 +1,58 @@
+#include "binary.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+uint32_t fnv1a_32(const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+uint64_t fnv1a_64(const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	return hash;
+}
+
+/**
+ * Map a whole file read only, with an madvise hint for how it will be read.
+ * NULL if it cannot be opened or is shorter than min_size, which must be at
+ * least one byte.
+ */
+const uint8_t *map_file(const char *filepath, size_t min_size, int advice,
+			size_t *size)
+{
+	int fd = open(filepath, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	struct stat info;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && (size_t)info.st_size >= min_size)
+		data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping keeps the file alive.
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+	madvise(data, info.st_size, advice);
+	*size = info.st_size;
+	return data;
+}
+
+void unmap_file(const uint8_t *data, size_t size)
+{
+	if (data != NULL)
+		munmap((void *)data, size);
+}
@@ -0,0 +1,44 @@
+#ifndef _BINARY_H
+#define _BINARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Helpers shared by the binary file formats: numbers are stored little
+ * endian whatever the host, checksums and name hashes are FNV-1a and files
+ * are read through read only mappings. Big endian reads are for the outside
+ * formats that use it, Polyglot books and Syzygy tables.
+ */
+
+// Inline, they sit in the inner loops of every reader and writer.
+static inline void write_le(uint8_t *data, uint64_t value, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; i++)
+		data[i] = value >> (8 * i);
+}
+
+static inline uint64_t read_le(const uint8_t *data, size_t bytes)
+{
+	uint64_t value = 0;
+	for (size_t i = bytes; i > 0; i--)
+		value = value << 8 | data[i - 1];
+	return value;
+}
+
+static inline uint64_t read_be(const uint8_t *data, size_t bytes)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < bytes; i++)
+		value = value << 8 | data[i];
+	return value;
+}
+
+uint32_t fnv1a_32(const void *data, size_t size);
+uint64_t fnv1a_64(const void *data, size_t size);
+const uint8_t *map_file(const char *filepath, size_t min_size, int advice,
+			size_t *size);
+void unmap_file(const uint8_t *data, size_t size);
+
+#endif
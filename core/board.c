@@ -1,5 +1,6 @@
 #include "board.h"
 
+#include <stdbool.h>
 #include <string.h>
 
 #define CREATE_PIECE(_colour, _type)                                           \
@@ -41,3 +42,53 @@ void inline set_board(Board src, Board dest)
 {
 	memcpy(dest, src, sizeof(Board));
 }
+
+static inline bool unmoved_piece(Board board, int location, EChessPiece type,
+				 EPlayerColour colour)
+{
+	return board[location].type == type &&
+	       board[location].colour == colour && board[location].moves == 0;
+}
+
+/**
+ * Castling rights still available to either player, as ECastleRights flags.
+ */
+int get_castling_rights(Board board)
+{
+	int rights = CASTLE_NONE;
+	for (EPlayerColour colour = COLOUR_WHITE; colour < PLAYER_NUM_COLOURS;
+	     colour++) {
+		int row = colour == COLOUR_WHITE ? 0 : (BOARD_SIZE - 1) *
+			  BOARD_SIZE;
+		if (!unmoved_piece(board, row + 4, PIECE_KING, colour))
+			continue;
+		if (unmoved_piece(board, row + BOARD_SIZE - 1, PIECE_ROOK,
+				  colour))
+			rights |= colour == COLOUR_WHITE ? CASTLE_WHITE_KING :
+				  CASTLE_BLACK_KING;
+		if (unmoved_piece(board, row, PIECE_ROOK, colour))
+			rights |= colour == COLOUR_WHITE ? CASTLE_WHITE_QUEEN :
+				  CASTLE_BLACK_QUEEN;
+	}
+	return rights;
+}
+
+/**
+ * The square a pawn skipped over with a long jump on the previous move, or -1
+ * if the last move was not a long jump.
+ */
+int get_en_passant_square(Board board, EPlayerColour turn, size_t move_count)
+{
+	// The opponent's pawn must be on its fourth rank, having only moved
+	// once, on the last move.
+	int row = turn == COLOUR_WHITE ? BOARD_SIZE / 2 : BOARD_SIZE / 2 - 1;
+	for (int x = 0; x < BOARD_SIZE; x++) {
+		PlayPiece *pawn = &board[row * BOARD_SIZE + x];
+		if (pawn->type == PIECE_PAWN && pawn->colour != turn &&
+		    pawn->moves == 1 && pawn->last_move + 1 == move_count) {
+			return (turn == COLOUR_WHITE ? row + 1 : row - 1) *
+			       BOARD_SIZE + x;
+		}
+	}
+	return -1;
+}
@@ -5,6 +5,15 @@
 
 #define BOARD_SIZE 8
 
+// Castling rights, derived from whether the king and rooks have moved.
+typedef enum {
+	CASTLE_NONE = 0x00,
+	CASTLE_WHITE_KING = 0x01,
+	CASTLE_WHITE_QUEEN = 0x02,
+	CASTLE_BLACK_KING = 0x04,
+	CASTLE_BLACK_QUEEN = 0x08,
+} ECastleRights;
+
 typedef struct {
 	EChessPiece type;
 	EPlayerColour colour;
@@ -25,4 +34,8 @@ void new_board(Board dest);
 
 void set_board(Board src, Board dest);
 
+int get_castling_rights(Board board);
+
+int get_en_passant_square(Board board, EPlayerColour turn, size_t move_count);
+
 #endif
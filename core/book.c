@@ -0,0 +1,172 @@
+#include "book.h"
+#include "binary.h"
+#include "board.h"
+#include "position.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+// Polyglot promotion codes.
+static const EChessPiece BOOK_PROMOTIONS[] = {
+	PIECE_NONE, PIECE_KNIGHT, PIECE_BISHOP, PIECE_ROOK, PIECE_QUEEN,
+};
+
+/**
+ * Map a Polyglot book. Nothing is read up front, so opening costs the same
+ * regardless of the book size.
+ */
+bool open_book(Book *book, const char *filepath)
+{
+	memset(book, 0, sizeof(Book));
+	// Probes are binary searches, don't bother reading ahead.
+	book->data = map_file(filepath, BOOK_ENTRY_SIZE, MADV_RANDOM,
+			      &book->size);
+	if (book->data == NULL) {
+		ERROR_LOG("Unable to open book: %s\n", filepath);
+		return false;
+	}
+	if (book->size % BOOK_ENTRY_SIZE != 0) {
+		ERROR_LOG("Invalid book: %s\n", filepath);
+		close_book(book);
+		return false;
+	}
+	book->num_entries = book->size / BOOK_ENTRY_SIZE;
+	book->random_state = ((uint64_t)time(NULL) ^
+			      (uint64_t)getpid() * 0x9E3779B97F4A7C15ULL) | 1;
+	return true;
+}
+
+void close_book(Book *book)
+{
+	unmap_file(book->data, book->size);
+	memset(book, 0, sizeof(Book));
+}
+
+BookEntry read_book_entry(const Book *book, size_t index)
+{
+	const uint8_t *data = book->data + index * BOOK_ENTRY_SIZE;
+	return (BookEntry){
+		       .key = read_be(data, 8),
+		       .move = read_be(data + 8, 2),
+		       .weight = read_be(data + 10, 2),
+		       .learn = read_be(data + 12, 4),
+	};
+}
+
+/**
+ * Polyglot move encoding, castling is written as the king taking its own
+ * rook.
+ */
+uint16_t encode_book_move(Move move)
+{
+	int target = move.target;
+	if (move.type == MOVEMENT_KING_CASTLE) {
+		target = (move.origin / BOARD_SIZE) * BOARD_SIZE +
+			 (move.target > move.origin ? BOARD_SIZE - 1 : 0);
+	}
+	uint16_t promotion = 0;
+	for (uint16_t i = 1; i < 5; i++) {
+		if (BOOK_PROMOTIONS[i] == move.promotion)
+			promotion = i;
+	}
+	return (target % BOARD_SIZE) | (target / BOARD_SIZE) << 3 |
+	       (move.origin % BOARD_SIZE) << 6 |
+	       (move.origin / BOARD_SIZE) << 9 | promotion << 12;
+}
+
+static bool decode_book_move(uint16_t book_move, Move legal[MAX_LEGAL_MOVES],
+			     size_t num_legal, Move *move)
+{
+	for (size_t i = 0; i < num_legal; i++) {
+		if (encode_book_move(legal[i]) == book_move) {
+			*move = legal[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t lower_bound(const Book *book, uint64_t key)
+{
+	size_t low = 0;
+	size_t high = book->num_entries;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (read_be(book->data + mid * BOOK_ENTRY_SIZE, 8) < key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/**
+ * Every legal book move for the position, with its weight.
+ */
+size_t probe_book(const Book *book, Position *position,
+		  Move moves[MAX_BOOK_MOVES], uint16_t weights[MAX_BOOK_MOVES])
+{
+	if (book->data == NULL)
+		return 0;
+	uint64_t key = hash_position(position);
+	size_t index = lower_bound(book, key);
+	if (index >= book->num_entries)
+		return 0;
+
+	Move legal[MAX_LEGAL_MOVES];
+	size_t num_legal = generate_legal_moves(position, legal);
+	size_t num_moves = 0;
+	for (; index < book->num_entries && num_moves < MAX_BOOK_MOVES;
+	     index++) {
+		BookEntry entry = read_book_entry(book, index);
+		if (entry.key != key)
+			break;
+		// Skip moves that are illegal here, e.g. from a key collision.
+		if (!decode_book_move(entry.move, legal, num_legal,
+				      &moves[num_moves]))
+			continue;
+		weights[num_moves++] = entry.weight;
+	}
+	return num_moves;
+}
+
+static uint64_t next_random(Book *book)
+{
+	// xorshift64*.
+	book->random_state ^= book->random_state >> 12;
+	book->random_state ^= book->random_state << 25;
+	book->random_state ^= book->random_state >> 27;
+	return book->random_state * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * Choose a book move at random, in proportion to the entry weights.
+ */
+bool pick_book_move(Book *book, Position *position, Move *move)
+{
+	Move moves[MAX_BOOK_MOVES];
+	uint16_t weights[MAX_BOOK_MOVES];
+	size_t num_moves = probe_book(book, position, moves, weights);
+	uint64_t total = 0;
+	for (size_t i = 0; i < num_moves; i++)
+		total += weights[i];
+	if (total == 0)
+		return false;
+
+	// The high bits of xorshift64* are the best mixed.
+	uint64_t pick = (next_random(book) >> 32) % total;
+	for (size_t i = 0; i < num_moves; i++) {
+		if (pick < weights[i]) {
+			*move = moves[i];
+			return true;
+		}
+		pick -= weights[i];
+	}
+	return false;
+}
@@ -0,0 +1,39 @@
+#ifndef _BOOK_H
+#define _BOOK_H
+
+#include "movement.h"
+#include "position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Polyglot entries are 16 bytes, big endian, sorted by key.
+#define BOOK_ENTRY_SIZE 16
+#define MAX_BOOK_MOVES 64
+
+typedef struct {
+	uint64_t key;
+	uint16_t move;
+	uint16_t weight;
+	uint32_t learn;
+} BookEntry;
+
+typedef struct {
+	// The mapped file, pages are only read in as they are probed.
+	const uint8_t *data;
+	size_t num_entries;
+	size_t size;
+	// State for weighted random move selection.
+	uint64_t random_state;
+} Book;
+
+bool open_book(Book *book, const char *filepath);
+void close_book(Book *book);
+BookEntry read_book_entry(const Book *book, size_t index);
+uint16_t encode_book_move(Move move);
+size_t probe_book(const Book *book, Position *position,
+		  Move moves[MAX_BOOK_MOVES], uint16_t weights[MAX_BOOK_MOVES]);
+bool pick_book_move(Book *book, Position *position, Move *move);
+
+#endif
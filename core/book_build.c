@@ -0,0 +1,272 @@
+#include "book_build.h"
+#include "book.h"
+#include "pgn_batch.h"
+#include "position.h"
+#include "sorted_runs.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Distinct moves seen in one position, far more than are ever legal.
+#define MAX_GROUP_MOVES MAX_LEGAL_MOVES
+// Spill once the table is this full.
+#define MAX_LOAD_PERCENT 75
+
+// Outcomes of a move in a position, from the point of view of the mover.
+typedef struct {
+	uint64_t key;
+	uint32_t wins;
+	uint32_t draws;
+	uint32_t losses;
+	uint16_t move;
+	// Empty table slots have no games.
+	uint16_t used;
+} BookRecord;
+
+typedef struct {
+	BookRecord *records;
+	size_t capacity;
+	size_t count;
+	// Sorted runs spilled to temporary files.
+	SortedRuns runs;
+} BookTable;
+
+// Moves of the position being merged.
+typedef struct {
+	FILE *output;
+	BookRecord group[MAX_GROUP_MOVES];
+	size_t count;
+	size_t written;
+} BookGroup;
+
+static inline uint64_t record_slot(uint64_t key, uint16_t move)
+{
+	return (key ^ (uint64_t)move * 0x9E3779B97F4A7C15ULL);
+}
+
+static int compare_records(const void *a, const void *b)
+{
+	const BookRecord *left = a;
+	const BookRecord *right = b;
+	if (left->key != right->key)
+		return left->key < right->key ? -1 : 1;
+	return (int)left->move - (int)right->move;
+}
+
+/**
+ * Sort the table and write it out as a run, leaving the table empty.
+ */
+static bool spill_run(BookTable *table)
+{
+	// Compact the used slots to the front, then sort them.
+	size_t count = 0;
+	for (size_t i = 0; i < table->capacity; i++) {
+		if (table->records[i].used)
+			table->records[count++] = table->records[i];
+	}
+	if (!spill_sorted_run(&table->runs, table->records, count))
+		return false;
+	memset(table->records, 0, sizeof(BookRecord) * table->capacity);
+	table->count = 0;
+	return true;
+}
+
+static bool add_record(BookTable *table, uint64_t key, uint16_t move,
+		       int score)
+{
+	size_t index = record_slot(key, move) & (table->capacity - 1);
+	BookRecord *record = &table->records[index];
+	// Linear probing.
+	while (record->used && (record->key != key || record->move != move)) {
+		index = (index + 1) & (table->capacity - 1);
+		record = &table->records[index];
+	}
+	if (!record->used) {
+		*record = (BookRecord){ .key = key, .move = move, .used = 1 };
+		table->count++;
+	}
+	if (score > 0)
+		record->wins++;
+	else if (score < 0)
+		record->losses++;
+	else
+		record->draws++;
+
+	if (table->count * 100 >= table->capacity * MAX_LOAD_PERCENT)
+		return spill_run(table);
+	return true;
+}
+
+static bool add_game(BookTable *table, const PgnGame *game, size_t plies)
+{
+	Position position = game->start;
+	for (size_t i = 0; i < game->num_moves && i < plies; i++) {
+		// Score the result for the player making this move.
+		int score = 0;
+		if (game->result == GAME_RESULT_WHITE_WIN)
+			score = position.turn == COLOUR_WHITE ? 1 : -1;
+		else if (game->result == GAME_RESULT_BLACK_WIN)
+			score = position.turn == COLOUR_BLACK ? 1 : -1;
+		if (!add_record(table, hash_position(&position),
+				encode_book_move(game->moves[i]),
+				score))
+			return false;
+		make_move(&position, game->moves[i]);
+	}
+	return true;
+}
+
+static bool write_book_entry(FILE *output, uint64_t key, uint16_t move,
+			     uint16_t weight)
+{
+	uint8_t entry[BOOK_ENTRY_SIZE] = { 0 };
+	for (int i = 0; i < 8; i++)
+		entry[i] = key >> (56 - i * 8);
+	entry[8] = move >> 8;
+	entry[9] = move;
+	entry[10] = weight >> 8;
+	entry[11] = weight;
+	return fwrite(entry, BOOK_ENTRY_SIZE, 1, output) == 1;
+}
+
+/**
+ * Write every move of one position, weighted by 2 per win and 1 per draw and
+ * scaled so the best move fits in 16 bits.
+ */
+static bool write_group(FILE *output, BookRecord *group, size_t count,
+			size_t *written)
+{
+	uint64_t max_weight = 0;
+	for (size_t i = 0; i < count; i++) {
+		uint64_t weight = 2 * (uint64_t)group[i].wins + group[i].draws;
+		if (weight > max_weight)
+			max_weight = weight;
+	}
+	for (size_t i = 0; i < count; i++) {
+		uint64_t weight = 2 * (uint64_t)group[i].wins + group[i].draws;
+		if (max_weight > UINT16_MAX)
+			weight = weight * UINT16_MAX / max_weight;
+		// Moves that never scored are never picked, leave them out.
+		if (weight == 0)
+			continue;
+		if (!write_book_entry(output, group[i].key, group[i].move,
+				      weight))
+			return false;
+		(*written)++;
+	}
+	return true;
+}
+
+/**
+ * Combine the records of the same move, writing the book one position at a
+ * time as the merge moves past it.
+ */
+static bool add_merged_record(const void *merged, void *context)
+{
+	BookGroup *group = context;
+	const BookRecord *record = merged;
+	bool ok = true;
+	if (group->count > 0 && group->group[0].key != record->key) {
+		ok = write_group(group->output, group->group, group->count,
+				 &group->written);
+		group->count = 0;
+	}
+	BookRecord *last = group->count ? &group->group[group->count - 1] :
+			   NULL;
+	if (last != NULL && last->move == record->move) {
+		last->wins += record->wins;
+		last->draws += record->draws;
+		last->losses += record->losses;
+	} else if (group->count < MAX_GROUP_MOVES) {
+		group->group[group->count++] = *record;
+	}
+	return ok;
+}
+
+static bool merge_runs(BookTable *table, FILE *output, size_t *written)
+{
+	BookGroup group = { .output = output };
+	bool ok = merge_sorted_runs(&table->runs, add_merged_record, &group);
+	if (ok && group.count > 0)
+		ok = write_group(output, group.group, group.count,
+				 &group.written);
+	*written = group.written;
+	return ok;
+}
+
+typedef struct {
+	BookTable *table;
+	size_t plies;
+	size_t games;
+	size_t invalid;
+} BookInput;
+
+static bool add_pgn_game(const PgnGame *game, void *context)
+{
+	BookInput *input = context;
+	// The moves before an illegal one are still good.
+	if (!game->valid)
+		input->invalid++;
+	input->games++;
+	return add_game(input->table, game, input->plies);
+}
+
+/**
+ * Build a Polyglot book from PGN files. Moves are aggregated in a hash table
+ * which is spilled to disk as a sorted run whenever it fills, so the corpus
+ * can be far larger than the memory budget.
+ */
+int run_book_build(BookBuildArgs *args)
+{
+	BookTable table = {
+		.runs = {
+			.record_size = sizeof(BookRecord),
+			.compare = compare_records,
+		},
+	};
+	table.capacity = 1;
+	while (table.capacity * 2 * sizeof(BookRecord) <=
+	       args->memory_mb * 1024 * 1024)
+		table.capacity *= 2;
+	table.records = calloc(table.capacity, sizeof(BookRecord));
+	if (table.records == NULL) {
+		ERROR_LOG("Unable to allocate %zu MB\n", args->memory_mb);
+		return 0;
+	}
+
+	BookInput input = { .table = &table, .plies = args->plies };
+	bool ok = true;
+	for (size_t i = 0; ok && i < args->num_inputs; i++) {
+		INFO_LOG("Reading %s\n", args->inputs[i]);
+		ok = read_pgn_games(args->inputs[i], args->threads,
+				    add_pgn_game, &input);
+	}
+	// The final partial table becomes the last run.
+	if (ok)
+		ok = spill_run(&table);
+	free(table.records);
+
+	size_t written = 0;
+	FILE *output = ok ? fopen(args->output, "wb") : NULL;
+	if (ok && output == NULL)
+		ERROR_LOG("Unable to open %s\n", args->output);
+	ok = output != NULL && merge_runs(&table, output, &written);
+	if (output != NULL && fclose(output) != 0)
+		ok = false;
+	size_t num_runs = table.runs.num_runs;
+	close_sorted_runs(&table.runs);
+
+	if (!ok) {
+		ERROR_LOG("Book build failed\n");
+		return 0;
+	}
+	INFO_LOG("Games: %zu (%zu with illegal moves)\n", input.games,
+		 input.invalid);
+	INFO_LOG("Runs merged: %zu\n", num_runs);
+	INFO_LOG("Book entries: %zu written to %s\n", written, args->output);
+	return 1;
+}
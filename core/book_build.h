@@ -0,0 +1,24 @@
+#ifndef _BOOK_BUILD_H
+#define _BOOK_BUILD_H
+
+#include <stddef.h>
+
+#define BOOK_BUILD_DEFAULT_PLIES 16
+#define BOOK_BUILD_DEFAULT_MEMORY_MB 256
+#define BOOK_BUILD_DEFAULT_OUTPUT "book.bin"
+
+typedef struct {
+	const char **inputs;
+	size_t num_inputs;
+	const char *output;
+	// Only the first plies of each game go in the book.
+	size_t plies;
+	// Aggregation memory, sorted runs are spilled to disk beyond this.
+	size_t memory_mb;
+	// Games are parsed on this many threads, and added in file order.
+	size_t threads;
+} BookBuildArgs;
+
+int run_book_build(BookBuildArgs *args);
+
+#endif
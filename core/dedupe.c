@@ -0,0 +1,294 @@
+#include "dedupe.h"
+#include "archive.h"
+#include "pgn.h"
+#include "pgn_batch.h"
+#include "position.h"
+#include "timing.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Candidate set slots to start with, doubled whenever half full.
+#define CANDIDATE_SET_INITIAL_SIZE 1024
+
+typedef enum {
+	DEDUPE_PASS_FILTER,
+	DEDUPE_PASS_WRITE,
+} EDedupePass;
+
+typedef struct {
+	// 0 for an empty slot.
+	uint64_t key;
+	bool written;
+} CandidateSlot;
+
+/**
+ * The first pass runs every game's hash through a Bloom filter, the hashes it
+ * has maybe seen before become candidates. Only candidates can be
+ * duplicates, so the second pass writes every other game straight away and
+ * each candidate once. Memory is the filter plus the candidates, however
+ * large the inputs are.
+ */
+typedef struct {
+	EDedupePass pass;
+	uint64_t *bloom;
+	size_t bloom_bits;
+	CandidateSlot *candidates;
+	size_t num_candidates;
+	size_t num_slots;
+	bool archive;
+	PgnWriter *pgn;
+	ArchiveWriter *writer;
+	size_t games;
+	size_t unique;
+	size_t duplicates;
+} Deduper;
+
+static inline uint64_t mix(uint64_t hash)
+{
+	// The splitmix64 finaliser.
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+	return hash ^ (hash >> 31);
+}
+
+/**
+ * Hash of the start position, then of each move rolled in, then of the final
+ * position, whether every move was legal and the result. Games differing
+ * only in their other tags hash the same.
+ */
+static uint64_t hash_game(const PgnGame *game)
+{
+	Position start = game->start;
+	Position end = game->end;
+	uint64_t hash = hash_position(&start);
+	for (size_t i = 0; i < game->num_moves; i++) {
+		Move move = game->moves[i];
+		hash = mix(hash ^ ((uint64_t)move.origin << 16 |
+				   move.target << 8 | move.promotion));
+	}
+	hash = mix(hash ^ game->num_moves) ^ hash_position(&end);
+	// The same moves with another result, or cut short by an illegal
+	// move, are another game.
+	hash = mix(hash ^ ((uint64_t)game->valid << 8 | game->result));
+	// 0 marks an empty candidate slot.
+	return hash ? hash : 1;
+}
+
+/**
+ * Set the game's bits, returns whether they were all set already.
+ */
+static bool bloom_test_and_set(Deduper *deduper, uint64_t hash)
+{
+	// Double hashing, the step is odd so the bits differ.
+	uint64_t step = mix(hash) | 1;
+	bool seen = true;
+	for (size_t i = 0; i < DEDUPE_BLOOM_HASHES; i++) {
+		uint64_t bit = (hash + i * step) % deduper->bloom_bits;
+		uint64_t mask = 1ULL << (bit % 64);
+		seen &= (deduper->bloom[bit / 64] & mask) != 0;
+		deduper->bloom[bit / 64] |= mask;
+	}
+	return seen;
+}
+
+static CandidateSlot *find_candidate(Deduper *deduper, uint64_t hash)
+{
+	size_t slot = mix(hash) & (deduper->num_slots - 1);
+	while (deduper->candidates[slot].key != 0 &&
+	       deduper->candidates[slot].key != hash)
+		slot = (slot + 1) & (deduper->num_slots - 1);
+	return &deduper->candidates[slot];
+}
+
+static bool add_candidate(Deduper *deduper, uint64_t hash)
+{
+	if (2 * (deduper->num_candidates + 1) > deduper->num_slots) {
+		size_t num_slots = deduper->num_slots ?
+				   deduper->num_slots * 2 :
+				   CANDIDATE_SET_INITIAL_SIZE;
+		CandidateSlot *old = deduper->candidates;
+		size_t old_slots = deduper->num_slots;
+		deduper->candidates = calloc(num_slots, sizeof(CandidateSlot));
+		if (deduper->candidates == NULL) {
+			ERROR_LOG("Unable to allocate %zu candidates\n",
+				  num_slots);
+			deduper->candidates = old;
+			return false;
+		}
+		deduper->num_slots = num_slots;
+		for (size_t i = 0; i < old_slots; i++) {
+			if (old[i].key != 0)
+				*find_candidate(deduper, old[i].key) = old[i];
+		}
+		free(old);
+	}
+	CandidateSlot *slot = find_candidate(deduper, hash);
+	if (slot->key == 0) {
+		slot->key = hash;
+		deduper->num_candidates++;
+	}
+	return true;
+}
+
+static bool write_unique(Deduper *deduper, const PgnGame *game)
+{
+	deduper->unique++;
+	return deduper->archive ? write_archive_game(deduper->writer, game) :
+	       write_pgn_game(deduper->pgn, game);
+}
+
+static bool dedupe_game(const PgnGame *game, void *context)
+{
+	Deduper *deduper = context;
+	uint64_t hash = hash_game(game);
+	if (deduper->pass == DEDUPE_PASS_FILTER) {
+		deduper->games++;
+		return !bloom_test_and_set(deduper, hash) ||
+		       add_candidate(deduper, hash);
+	}
+
+	if (deduper->num_slots == 0)
+		return write_unique(deduper, game);
+	CandidateSlot *slot = find_candidate(deduper, hash);
+	if (slot->key == 0)
+		return write_unique(deduper, game);
+	if (slot->written) {
+		deduper->duplicates++;
+		return true;
+	}
+	slot->written = true;
+	return write_unique(deduper, game);
+}
+
+static bool is_archive(const char *filepath)
+{
+	char magic[3];
+	FILE *file = fopen(filepath, "rb");
+	bool archive = file != NULL && fread(magic, 1, 3, file) == 3 &&
+		       memcmp(magic, ARCHIVE_MAGIC, 3) == 0;
+	if (file != NULL)
+		fclose(file);
+	return archive;
+}
+
+static bool read_archive_games(const char *filepath, PgnGameHandler handler,
+			       void *context)
+{
+	ArchiveReader reader;
+	PgnGame *game = malloc(sizeof(PgnGame));
+	if (game == NULL || !open_archive(&reader, filepath)) {
+		free(game);
+		return false;
+	}
+	bool ok = true;
+	for (size_t i = 0; ok && i < reader.num_games; i++) {
+		ok = read_archive_game(&reader, i, game);
+		if (!ok)
+			ERROR_LOG("Game %zu of %s is damaged\n", i + 1,
+				  filepath);
+		ok = ok && handler(game, context);
+	}
+	close_archive(&reader);
+	free(game);
+	return ok;
+}
+
+static bool read_inputs(DedupeArgs *args, Deduper *deduper)
+{
+	bool ok = true;
+	for (size_t i = 0; ok && i < args->num_inputs; i++) {
+		DEBUG_LOG("Reading %s\n", args->inputs[i]);
+		ok = is_archive(args->inputs[i]) ?
+		     read_archive_games(args->inputs[i], dedupe_game,
+					deduper) :
+		     read_pgn_games(args->inputs[i], args->threads,
+				    dedupe_game, deduper);
+	}
+	return ok;
+}
+
+static bool open_output(Deduper *deduper, const char *filepath)
+{
+	size_t length = strlen(filepath);
+	deduper->archive = length >= 4 &&
+			   strcmp(filepath + length - 4, ".cga") == 0;
+	if (deduper->archive) {
+		deduper->writer = malloc(sizeof(ArchiveWriter));
+		if (deduper->writer != NULL &&
+		    open_archive_writer(deduper->writer, filepath))
+			return true;
+		free(deduper->writer);
+		deduper->writer = NULL;
+	} else {
+		deduper->pgn = malloc(sizeof(PgnWriter));
+		if (deduper->pgn != NULL && open_pgn_writer(deduper->pgn,
+							    filepath))
+			return true;
+		free(deduper->pgn);
+		deduper->pgn = NULL;
+	}
+	return false;
+}
+
+static bool close_output(Deduper *deduper)
+{
+	bool ok = true;
+	if (deduper->writer != NULL)
+		ok = close_archive_writer(deduper->writer);
+	if (deduper->pgn != NULL)
+		ok = close_pgn_writer(deduper->pgn);
+	free(deduper->writer);
+	free(deduper->pgn);
+	return ok;
+}
+
+/**
+ * Copy every game of the inputs that has not been seen before, in order.
+ * The inputs are read twice, so they must be files.
+ */
+int run_dedupe(DedupeArgs *args)
+{
+	Deduper deduper = { 0 };
+	size_t words = (args->memory_mb ? args->memory_mb : 1) * 1024 * 1024 /
+		       sizeof(uint64_t);
+	deduper.bloom_bits = words * 64;
+	deduper.bloom = calloc(words, sizeof(uint64_t));
+	if (deduper.bloom == NULL) {
+		ERROR_LOG("Unable to allocate a %zu MB filter\n",
+			  args->memory_mb);
+		return 0;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool ok = read_inputs(args, &deduper);
+	// The filter is done with, free it before the second pass.
+	free(deduper.bloom);
+	deduper.bloom = NULL;
+	INFO_LOG("Games: %zu\nCandidates: %zu\n", deduper.games,
+		 deduper.num_candidates);
+
+	deduper.pass = DEDUPE_PASS_WRITE;
+	if (ok && open_output(&deduper, args->output)) {
+		ok = read_inputs(args, &deduper);
+		if (!close_output(&deduper))
+			ok = false;
+	} else {
+		ok = false;
+	}
+	free(deduper.candidates);
+	if (!ok) {
+		ERROR_LOG("Dedupe failed\n");
+		return 0;
+	}
+	INFO_LOG("Unique: %zu written to %s\nDuplicates: %zu\nTime: %.3fs\n",
+		 deduper.unique, args->output, deduper.duplicates,
+		 elapsed_seconds(&start));
+	return 1;
+}
@@ -0,0 +1,26 @@
+#ifndef _DEDUPE_H
+#define _DEDUPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DEDUPE_DEFAULT_OUTPUT "unique.pgn"
+// Size of the Bloom filter of the first pass.
+#define DEDUPE_DEFAULT_MEMORY_MB 64
+// Bits set in the Bloom filter per game.
+#define DEDUPE_BLOOM_HASHES 4
+
+typedef struct {
+	// PGN files or archives, told apart by their magic.
+	const char **inputs;
+	size_t num_inputs;
+	// Written as an archive if it ends in ".cga", as PGN otherwise.
+	const char *output;
+	size_t memory_mb;
+	// PGN files are parsed on this many threads, games stay in order.
+	size_t threads;
+} DedupeArgs;
+
+int run_dedupe(DedupeArgs *args);
+
+#endif
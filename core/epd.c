@@ -0,0 +1,408 @@
+#include "epd.h"
+#include "fen.h"
+#include "san.h"
+#include "search.h"
+#include "timing.h"
+#include "log.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Upper bounds in seconds of the time to solution buckets, the last bucket
+// takes the rest.
+static const double EPD_TIME_BUCKETS[] = { 0.01, 0.1, 1, 10 };
+#define EPD_NUM_TIME_BUCKETS \
+	(sizeof(EPD_TIME_BUCKETS) / sizeof(EPD_TIME_BUCKETS[0]))
+
+typedef struct {
+	EpdRecord record;
+	// Line of the file the record is on.
+	size_t line;
+	// Filled in by the worker that searched it.
+	Move move;
+	size_t depth;
+	uint64_t nodes;
+	double seconds;
+	bool solved;
+	// Since the search started, to the end of the iteration from which on
+	// the best move solved the position.
+	double solve_seconds;
+	size_t solve_depth;
+} EpdPosition;
+
+typedef struct {
+	EpdPosition *positions;
+	size_t num_positions;
+	atomic_size_t next;
+	size_t depth;
+	uint64_t time_ms;
+} EpdJob;
+
+typedef struct {
+	EpdPosition *position;
+	struct timespec start;
+} EpdProgress;
+
+static inline bool same_move(Move a, Move b)
+{
+	return a.origin == b.origin && a.target == b.target &&
+	       a.promotion == b.promotion;
+}
+
+static bool solves(const EpdRecord *record, Move move)
+{
+	for (size_t i = 0; i < record->num_avoid; i++) {
+		if (same_move(move, record->avoid[i]))
+			return false;
+	}
+	for (size_t i = 0; i < record->num_best; i++) {
+		if (same_move(move, record->best[i]))
+			return true;
+	}
+	return record->num_best == 0;
+}
+
+static const char *skip_field(const char *text)
+{
+	while (isspace((unsigned char)*text))
+		text++;
+	while (*text != '\0' && !isspace((unsigned char)*text))
+		text++;
+	return text;
+}
+
+/**
+ * Resolve the SAN moves of a bm or am operand, e.g. "Qxf7+ Nd5".
+ */
+static bool parse_epd_moves(Position *position, const char *text,
+			    const char *end, Move *moves, size_t *num_moves)
+{
+	while (text < end) {
+		while (text < end && isspace((unsigned char)*text))
+			text++;
+		const char *start = text;
+		while (text < end && !isspace((unsigned char)*text))
+			text++;
+		if (start == text)
+			break;
+		SanData san;
+		Move move;
+		if (!parse_san(start, text - start, position->turn, &san) ||
+		    !resolve_san(position, &san, &move))
+			return false;
+		if (*num_moves < EPD_MAX_MOVES)
+			moves[(*num_moves)++] = move;
+	}
+	return true;
+}
+
+/**
+ * Parse one EPD record: the four position fields of a FEN, then operations
+ * ended by semicolons. Only bm, am and id are read, others are skipped.
+ */
+bool parse_epd(const char *line, EpdRecord *record)
+{
+	memset(record, 0, sizeof(EpdRecord));
+	if (!parse_fen(line, &record->position))
+		return false;
+	const char *text = line;
+	for (size_t i = 0; i < 4; i++)
+		text = skip_field(text);
+	// Records written as full FENs still carry the two counters.
+	for (size_t i = 0; i < 2; i++) {
+		while (isspace((unsigned char)*text))
+			text++;
+		if (!isdigit((unsigned char)*text))
+			break;
+		text = skip_field(text);
+	}
+
+	while (*text != '\0') {
+		while (isspace((unsigned char)*text))
+			text++;
+		if (*text == '\0')
+			break;
+		const char *opcode = text;
+		while (*text != '\0' && *text != ';' &&
+		       !isspace((unsigned char)*text))
+			text++;
+		size_t opcode_length = text - opcode;
+		const char *operand = text;
+		// Semicolons inside quoted strings do not end the operation.
+		bool quoted = false;
+		while (*text != '\0' && (quoted || *text != ';')) {
+			if (*text == '"')
+				quoted = !quoted;
+			text++;
+		}
+		const char *end = text;
+		if (*text == ';')
+			text++;
+
+		if (opcode_length == 2 && strncmp(opcode, "bm", 2) == 0) {
+			if (!parse_epd_moves(&record->position, operand, end,
+					     record->best, &record->num_best))
+				return false;
+		} else if (opcode_length == 2 && strncmp(opcode, "am", 2) == 0) {
+			if (!parse_epd_moves(&record->position, operand, end,
+					     record->avoid, &record->num_avoid))
+				return false;
+		} else if (opcode_length == 2 && strncmp(opcode, "id", 2) == 0) {
+			const char *open = memchr(operand, '"', end - operand);
+			const char *close = open ? memchr(open + 1, '"',
+							  end - open - 1) : NULL;
+			if (close != NULL) {
+				size_t length = close - open - 1;
+				if (length >= EPD_MAX_ID_LENGTH)
+					length = EPD_MAX_ID_LENGTH - 1;
+				memcpy(record->id, open + 1, length);
+				record->id[length] = '\0';
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Read the records worth searching, those with a bm or am operation. Bad
+ * lines are reported and skipped.
+ */
+static EpdPosition *read_epd_file(const char *filepath, size_t *num_positions)
+{
+	FILE *file = fopen(filepath, "r");
+	if (file == NULL) {
+		ERROR_LOG("Unable to open %s\n", filepath);
+		return NULL;
+	}
+
+	EpdPosition *positions = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	char *line = NULL;
+	size_t line_capacity = 0;
+	ssize_t length;
+	bool ok = true;
+	for (size_t number = 1;
+	     ok && (length = getline(&line, &line_capacity, file)) >= 0;
+	     number++) {
+		while (length > 0 && isspace((unsigned char)line[length - 1]))
+			line[--length] = '\0';
+		const char *text = line;
+		while (isspace((unsigned char)*text))
+			text++;
+		if (*text == '\0' || *text == '#')
+			continue;
+
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 256;
+			EpdPosition *grown = realloc(positions, capacity *
+						     sizeof(EpdPosition));
+			if (grown == NULL) {
+				ERROR_LOG("Unable to allocate %zu positions\n",
+					  capacity);
+				ok = false;
+				break;
+			}
+			positions = grown;
+		}
+		EpdPosition *position = &positions[count];
+		memset(position, 0, sizeof(EpdPosition));
+		position->line = number;
+		if (!parse_epd(text, &position->record)) {
+			ERROR_LOG("%s:%zu: invalid EPD record\n", filepath,
+				  number);
+		} else if (position->record.num_best == 0 &&
+			   position->record.num_avoid == 0) {
+			ERROR_LOG("%s:%zu: no bm or am operation\n", filepath,
+				  number);
+		} else {
+			if (position->record.id[0] == '\0')
+				snprintf(position->record.id,
+					 EPD_MAX_ID_LENGTH, "line %zu", number);
+			count++;
+		}
+	}
+	free(line);
+	fclose(file);
+	if (!ok) {
+		free(positions);
+		return NULL;
+	}
+	*num_positions = count;
+	return positions;
+}
+
+static void note_iteration(const SearchResult *result, void *context)
+{
+	EpdProgress *progress = context;
+	EpdPosition *position = progress->position;
+	bool solved = solves(&position->record, result->best_move);
+	if (solved && !position->solved) {
+		position->solve_seconds = elapsed_seconds(&progress->start);
+		position->solve_depth = result->depth;
+	}
+	position->solved = solved;
+}
+
+static void *epd_worker(void *arg)
+{
+	EpdJob *job = arg;
+	size_t index;
+	while ((index = atomic_fetch_add(&job->next, 1)) < job->num_positions) {
+		EpdPosition *position = &job->positions[index];
+		EpdProgress progress = { .position = position };
+		SearchLimits limits = {
+			.depth = job->depth,
+			.time_ms = job->time_ms,
+			.on_iteration = note_iteration,
+			.context = &progress,
+		};
+		SearchResult result;
+		Position root = position->record.position;
+		clock_gettime(CLOCK_MONOTONIC, &progress.start);
+		bool moved = search_position(&root, NULL, &limits, &result);
+		position->seconds = elapsed_seconds(&progress.start);
+		position->move = result.best_move;
+		position->depth = result.depth;
+		position->nodes = result.nodes;
+		if (!moved)
+			position->solved = false;
+	}
+	return NULL;
+}
+
+static int compare_seconds(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void report_position(EpdPosition *position)
+{
+	EpdRecord *record = &position->record;
+	char move[SAN_MAX_LENGTH];
+	move_to_san(&record->position, position->move, move);
+	if (position->solved) {
+		INFO_LOG("%s: solved %s at depth %zu in %.3fs\n", record->id,
+			 move, position->solve_depth, position->solve_seconds);
+		return;
+	}
+	INFO_LOG("%s: failed %s at depth %zu,", record->id, move,
+		 position->depth);
+	char expected[SAN_MAX_LENGTH];
+	if (record->num_best > 0)
+		INFO_LOG(" bm");
+	for (size_t i = 0; i < record->num_best; i++) {
+		move_to_san(&record->position, record->best[i], expected);
+		INFO_LOG(" %s", expected);
+	}
+	if (record->num_avoid > 0)
+		INFO_LOG(" am");
+	for (size_t i = 0; i < record->num_avoid; i++) {
+		move_to_san(&record->position, record->avoid[i], expected);
+		INFO_LOG(" %s", expected);
+	}
+	INFO_LOG("\n");
+}
+
+static void report_times(EpdPosition *positions, size_t num_positions,
+			 size_t solved)
+{
+	double *times = malloc(sizeof(double) * (solved ? solved : 1));
+	if (times == NULL)
+		return;
+	size_t buckets[EPD_NUM_TIME_BUCKETS + 1] = { 0 };
+	size_t count = 0;
+	double total = 0;
+	for (size_t i = 0; i < num_positions; i++) {
+		if (!positions[i].solved)
+			continue;
+		double seconds = positions[i].solve_seconds;
+		size_t bucket = 0;
+		while (bucket < EPD_NUM_TIME_BUCKETS &&
+		       seconds >= EPD_TIME_BUCKETS[bucket])
+			bucket++;
+		buckets[bucket]++;
+		times[count++] = seconds;
+		total += seconds;
+	}
+
+	INFO_LOG("Time to solution:\n");
+	for (size_t i = 0; i < EPD_NUM_TIME_BUCKETS; i++)
+		INFO_LOG("  < %gs: %zu\n", EPD_TIME_BUCKETS[i], buckets[i]);
+	INFO_LOG("  >= %gs: %zu\n", EPD_TIME_BUCKETS[EPD_NUM_TIME_BUCKETS - 1],
+		 buckets[EPD_NUM_TIME_BUCKETS]);
+	if (count > 0) {
+		qsort(times, count, sizeof(double), compare_seconds);
+		INFO_LOG("Mean: %.3fs, median: %.3fs, 90th percentile: %.3fs, "
+			 "max: %.3fs\n", total / count, times[count / 2],
+			 times[(count * 9) / 10 < count ? (count * 9) / 10 :
+			       count - 1], times[count - 1]);
+	}
+	free(times);
+}
+
+/**
+ * Search every bm/am position of an EPD file to a fixed depth or for a fixed
+ * time, handing the positions out to a pool of threads. Results are reported
+ * in file order once every search is done.
+ */
+int run_epd(EpdArgs *args)
+{
+	if (args->depth == 0 && args->time_ms == 0)
+		args->depth = EPD_DEFAULT_DEPTH;
+	if (args->threads < 1)
+		args->threads = 1;
+	size_t num_positions = 0;
+	EpdPosition *positions = read_epd_file(args->input, &num_positions);
+	if (positions == NULL)
+		return 0;
+
+	EpdJob job = {
+		.positions = positions,
+		.num_positions = num_positions,
+		.depth = args->depth ? args->depth : SEARCH_MAX_PLY,
+		.time_ms = args->time_ms,
+	};
+	atomic_init(&job.next, 0);
+	size_t threads = args->threads < num_positions ? args->threads :
+			 num_positions;
+	pthread_t *workers = calloc(threads ? threads : 1, sizeof(pthread_t));
+	if (workers == NULL) {
+		ERROR_LOG("Unable to allocate %zu EPD workers\n", threads);
+		free(positions);
+		return 0;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t t = 0; t < threads; t++)
+		pthread_create(&workers[t], NULL, epd_worker, &job);
+	for (size_t t = 0; t < threads; t++)
+		pthread_join(workers[t], NULL);
+	double seconds = elapsed_seconds(&start);
+
+	size_t solved = 0;
+	uint64_t nodes = 0;
+	for (size_t i = 0; i < num_positions; i++) {
+		report_position(&positions[i]);
+		solved += positions[i].solved;
+		nodes += positions[i].nodes;
+	}
+	INFO_LOG("Solved: %zu of %zu (%.1f%%)\n", solved, num_positions,
+		 num_positions ? 100.0 * solved / num_positions : 0);
+	report_times(positions, num_positions, solved);
+	INFO_LOG("Threads: %zu\nNodes: %lu\nWall time: %.3fs\nNPS: %.0f\n",
+		 threads, nodes, seconds, seconds > 0 ? nodes / seconds : 0);
+
+	free(workers);
+	free(positions);
+	return 1;
+}
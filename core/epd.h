@@ -0,0 +1,41 @@
+#ifndef _EPD_H
+#define _EPD_H
+
+#include "movement.h"
+#include "position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Used when neither a depth nor a time is given.
+#define EPD_DEFAULT_DEPTH 6
+// Moves kept per bm or am operation, further ones are ignored.
+#define EPD_MAX_MOVES 8
+#define EPD_MAX_ID_LENGTH 64
+
+// One test position with the moves it is scored on.
+typedef struct {
+	Position position;
+	// The id operation, empty if there is none.
+	char id[EPD_MAX_ID_LENGTH];
+	// Playing any best move solves the position, an avoided move fails it.
+	size_t num_best;
+	Move best[EPD_MAX_MOVES];
+	size_t num_avoid;
+	Move avoid[EPD_MAX_MOVES];
+} EpdRecord;
+
+typedef struct {
+	const char *input;
+	// Either limit may be 0 for none, but not both.
+	size_t depth;
+	uint64_t time_ms;
+	// Positions are solved on this many threads, one search each.
+	size_t threads;
+} EpdArgs;
+
+bool parse_epd(const char *line, EpdRecord *record);
+int run_epd(EpdArgs *args);
+
+#endif
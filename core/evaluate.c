@@ -0,0 +1,99 @@
+#include "evaluate.h"
+#include "board.h"
+#include "position.h"
+
+// Centipawns.
+const int PIECE_VALUES[PIECE_NUM_PIECES] = {
+	[PIECE_NONE] = 0, [PIECE_PAWN] = 100, [PIECE_KNIGHT] = 320,
+	[PIECE_BISHOP] = 330, [PIECE_ROOK] = 500, [PIECE_QUEEN] = 900,
+	[PIECE_KING] = 0,
+};
+
+// Piece square tables from white's point of view, eighth rank first.
+static const int PIECE_SQUARE_TABLES[PIECE_NUM_PIECES][BOARD_SIZE *
+						       BOARD_SIZE] = {
+	[PIECE_PAWN] = {
+		0,  0,   0,   0,   0,   0,   0,   0,
+		50, 50,  50,  50,  50,  50,  50,  50,
+		10, 10,  20,  30,  30,  20,  10,  10,
+		5,  5,   10,  25,  25,  10,  5,   5,
+		0,  0,   0,   20,  20,  0,   0,   0,
+		5,  -5,  -10, 0,   0,   -10, -5,  5,
+		5,  10,  10,  -20, -20, 10,  10,  5,
+		0,  0,   0,   0,   0,   0,   0,   0,
+	},
+	[PIECE_KNIGHT] = {
+		-50, -40, -30, -30, -30, -30, -40, -50,
+		-40, -20, 0,   0,   0,   0,   -20, -40,
+		-30, 0,   10,  15,  15,  10,  0,   -30,
+		-30, 5,   15,  20,  20,  15,  5,   -30,
+		-30, 0,   15,  20,  20,  15,  0,   -30,
+		-30, 5,   10,  15,  15,  10,  5,   -30,
+		-40, -20, 0,   5,   5,   0,   -20, -40,
+		-50, -40, -30, -30, -30, -30, -40, -50,
+	},
+	[PIECE_BISHOP] = {
+		-20, -10, -10, -10, -10, -10, -10, -20,
+		-10, 0,   0,   0,   0,   0,   0,   -10,
+		-10, 0,   5,   10,  10,  5,   0,   -10,
+		-10, 5,   5,   10,  10,  5,   5,   -10,
+		-10, 0,   10,  10,  10,  10,  0,   -10,
+		-10, 10,  10,  10,  10,  10,  10,  -10,
+		-10, 5,   0,   0,   0,   0,   5,   -10,
+		-20, -10, -10, -10, -10, -10, -10, -20,
+	},
+	[PIECE_ROOK] = {
+		0,  0,  0,  0,  0,  0,  0,  0,
+		5,  10, 10, 10, 10, 10, 10, 5,
+		-5, 0,  0,  0,  0,  0,  0,  -5,
+		-5, 0,  0,  0,  0,  0,  0,  -5,
+		-5, 0,  0,  0,  0,  0,  0,  -5,
+		-5, 0,  0,  0,  0,  0,  0,  -5,
+		-5, 0,  0,  0,  0,  0,  0,  -5,
+		0,  0,  0,  5,  5,  0,  0,  0,
+	},
+	[PIECE_QUEEN] = {
+		-20, -10, -10, -5, -5, -10, -10, -20,
+		-10, 0,   0,   0,  0,  0,   0,   -10,
+		-10, 0,   5,   5,  5,  5,   0,   -10,
+		-5,  0,   5,   5,  5,  5,   0,   -5,
+		0,   0,   5,   5,  5,  5,   0,   -5,
+		-10, 5,   5,   5,  5,  5,   0,   -10,
+		-10, 0,   5,   0,  0,  0,   0,   -10,
+		-20, -10, -10, -5, -5, -10, -10, -20,
+	},
+	[PIECE_KING] = {
+		-30, -40, -40, -50, -50, -40, -40, -30,
+		-30, -40, -40, -50, -50, -40, -40, -30,
+		-30, -40, -40, -50, -50, -40, -40, -30,
+		-30, -40, -40, -50, -50, -40, -40, -30,
+		-20, -30, -30, -40, -40, -30, -30, -20,
+		-10, -20, -20, -20, -20, -20, -20, -10,
+		20,  20,  0,   0,   0,   0,   20,  20,
+		20,  30,  10,  0,   0,   10,  30,  20,
+	},
+};
+
+/**
+ * Static evaluation in centipawns, from the point of view of the player to
+ * move.
+ */
+int evaluate(Position *position)
+{
+	int score = 0;
+	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
+		PlayPiece *piece = &position->board[i];
+		if (piece->type == PIECE_NONE)
+			continue;
+		int x = i % BOARD_SIZE;
+		int y = i / BOARD_SIZE;
+		// Tables are drawn with the eighth rank first, mirror for
+		// black.
+		int square = piece->colour == COLOUR_WHITE
+			     ? (BOARD_SIZE - 1 - y) * BOARD_SIZE + x : i;
+		int value = PIECE_VALUES[piece->type] +
+			    PIECE_SQUARE_TABLES[piece->type][square];
+		score += piece->colour == COLOUR_WHITE ? value : -value;
+	}
+	return position->turn == COLOUR_WHITE ? score : -score;
+}
@@ -0,0 +1,11 @@
+#ifndef _EVALUATE_H
+#define _EVALUATE_H
+
+#include "pieces.h"
+#include "position.h"
+
+extern const int PIECE_VALUES[PIECE_NUM_PIECES];
+
+int evaluate(Position *position);
+
+#endif
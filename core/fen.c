@@ -0,0 +1,288 @@
+#include "fen.h"
+#include "board.h"
+#include "position.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char FEN_PIECE_SYMBOLS[PIECE_NUM_PIECES] = {
+	[PIECE_PAWN] = 'p', [PIECE_KNIGHT] = 'n', [PIECE_BISHOP] = 'b',
+	[PIECE_ROOK] = 'r', [PIECE_QUEEN] = 'q', [PIECE_KING] = 'k',
+};
+
+// Indexed by character, PIECE_NONE for anything that is not a piece.
+static const EChessPiece FEN_SYMBOL_PIECES[128] = {
+	['p'] = PIECE_PAWN, ['n'] = PIECE_KNIGHT, ['b'] = PIECE_BISHOP,
+	['r'] = PIECE_ROOK, ['q'] = PIECE_QUEEN, ['k'] = PIECE_KING,
+	['P'] = PIECE_PAWN, ['N'] = PIECE_KNIGHT, ['B'] = PIECE_BISHOP,
+	['R'] = PIECE_ROOK, ['Q'] = PIECE_QUEEN, ['K'] = PIECE_KING,
+};
+
+static inline EChessPiece fen_sym_to_piece(char sym)
+{
+	return (unsigned char)sym < 128 ? FEN_SYMBOL_PIECES[(int)sym] :
+	       PIECE_NONE;
+}
+
+static inline const char *skip_spaces(const char *str)
+{
+	while (*str == ' ')
+		str++;
+	return str;
+}
+
+/**
+ * Our pieces remember how often they have moved rather than holding castling
+ * and en passant flags, so invent a move history matching the FEN fields.
+ * Pawns on their starting row can still long jump, the rest have moved at
+ * least twice so are not en passant targets; other pieces have moved once.
+ */
+static inline size_t placed_piece_moves(EChessPiece type, EPlayerColour colour,
+					int y)
+{
+	if (type != PIECE_PAWN)
+		return 1;
+	return y == (colour == COLOUR_WHITE ? 1 : BOARD_SIZE - 2) ? 0 : 2;
+}
+
+/**
+ * Undo the invented moves of the kings and rooks that can still castle and
+ * of the pawn that can be taken en passant.
+ */
+static void set_piece_history(Position *position, int rights, int en_passant)
+{
+	int corners[4] = { 7, 0, 63, 56 };
+	for (int i = 0; i < 4; i++) {
+		if (!(rights & (1 << i)))
+			continue;
+		EPlayerColour colour = i < 2 ? COLOUR_WHITE : COLOUR_BLACK;
+		int king = colour == COLOUR_WHITE ? 4 : 60;
+		if (position->board[king].type == PIECE_KING &&
+		    position->board[king].colour == colour &&
+		    position->board[corners[i]].type == PIECE_ROOK &&
+		    position->board[corners[i]].colour == colour) {
+			position->board[king].moves = 0;
+			position->board[corners[i]].moves = 0;
+		}
+	}
+
+	if (en_passant != -1) {
+		int pawn = en_passant + (position->turn == COLOUR_WHITE ?
+					 -BOARD_SIZE : BOARD_SIZE);
+		if (position->board[pawn].type == PIECE_PAWN) {
+			position->board[pawn].moves = 1;
+			position->board[pawn].last_move =
+				position->move_count - 1;
+		}
+	}
+}
+
+/**
+ * Give the pieces of a board placed square by square the move history that
+ * castling rights and an en passant square describe, for formats storing the
+ * same fields as FEN. The en passant square is -1 for none.
+ */
+void set_position_rights(Position *position, int rights, int en_passant)
+{
+	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
+		PlayPiece *piece = &position->board[i];
+		piece->last_move = 0;
+		piece->moves = piece->type == PIECE_NONE ? 0 :
+			       placed_piece_moves(piece->type, piece->colour,
+						  i / BOARD_SIZE);
+	}
+	set_piece_history(position, rights, en_passant);
+}
+
+/**
+ * Parse a FEN string. The halfmove clock and move number are optional so EPD
+ * records can be read too. Positions without exactly one king a side, or with
+ * pawns on the first or last rank, are rejected as nothing can play them.
+ */
+bool parse_fen(const char *fen, Position *position)
+{
+	// Every square is written once by a valid placement, so the board is
+	// not cleared first. This is on the hot path of bulk EPD loading.
+	Position local;
+
+	// Piece placement, from the eighth rank down.
+	int kings[PLAYER_NUM_COLOURS] = { 0 };
+	const char *str = skip_spaces(fen);
+	int x = 0;
+	int y = BOARD_SIZE - 1;
+	for (; *str && *str != ' '; str++) {
+		if (*str == '/') {
+			if (x != BOARD_SIZE || y == 0)
+				return false;
+			x = 0;
+			y--;
+		} else if (*str >= '1' && *str <= '8') {
+			int end = x + *str - '0';
+			if (end > BOARD_SIZE)
+				return false;
+			for (; x < end; x++)
+				local.board[y * BOARD_SIZE + x] = empty_space;
+		} else {
+			EChessPiece type = fen_sym_to_piece(*str);
+			if (type == PIECE_NONE || x >= BOARD_SIZE)
+				return false;
+			EPlayerColour colour = *str < 'a' ? COLOUR_WHITE :
+					       COLOUR_BLACK;
+			if (type == PIECE_PAWN &&
+			    (y == 0 || y == BOARD_SIZE - 1))
+				return false;
+			if (type == PIECE_KING)
+				kings[colour]++;
+			local.board[y * BOARD_SIZE + x] = (PlayPiece){
+				.type = type,
+				.colour = colour,
+				.moves = placed_piece_moves(type, colour, y),
+			};
+			x++;
+		}
+	}
+	if (x != BOARD_SIZE || y != 0 || kings[COLOUR_WHITE] != 1 ||
+	    kings[COLOUR_BLACK] != 1)
+		return false;
+
+	// Player to move.
+	str = skip_spaces(str);
+	if (*str == 'w')
+		local.turn = COLOUR_WHITE;
+	else if (*str == 'b')
+		local.turn = COLOUR_BLACK;
+	else
+		return false;
+	str++;
+
+	// Castling rights.
+	str = skip_spaces(str);
+	int rights = CASTLE_NONE;
+	for (; *str && *str != ' '; str++) {
+		switch (*str) {
+		case 'K':
+			rights |= CASTLE_WHITE_KING;
+			break;
+		case 'Q':
+			rights |= CASTLE_WHITE_QUEEN;
+			break;
+		case 'k':
+			rights |= CASTLE_BLACK_KING;
+			break;
+		case 'q':
+			rights |= CASTLE_BLACK_QUEEN;
+			break;
+		case '-':
+			break;
+		default:
+			return false;
+		}
+	}
+
+	// En passant square.
+	str = skip_spaces(str);
+	int en_passant = -1;
+	if (*str >= 'a' && *str <= 'h' && (str[1] == '3' || str[1] == '6')) {
+		en_passant = (str[1] - '1') * BOARD_SIZE + str[0] - 'a';
+		str += 2;
+	} else if (*str == '-') {
+		str++;
+	} else {
+		return false;
+	}
+
+	// Optional halfmove clock and move number.
+	str = skip_spaces(str);
+	char *end;
+	long halfmove = isdigit(*str) ? strtol(str, &end, 10) : 0;
+	if (isdigit(*str))
+		str = skip_spaces(end);
+	long fullmove = isdigit(*str) ? strtol(str, &end, 10) : 1;
+	if (fullmove < 1)
+		fullmove = 1;
+
+	local.halfmove_clock = halfmove;
+	local.move_count = (fullmove - 1) * 2 + local.turn;
+	// A long jump needs a previous ply to have happened on.
+	if (en_passant != -1 && local.move_count == 0)
+		local.move_count = 2;
+	set_piece_history(&local, rights, en_passant);
+	memcpy(position, &local, sizeof(Position));
+	return true;
+}
+
+static char *write_number(char *out, size_t number)
+{
+	char digits[20];
+	size_t length = 0;
+	do {
+		digits[length++] = '0' + number % 10;
+		number /= 10;
+	} while (number > 0);
+	while (length > 0)
+		*out++ = digits[--length];
+	return out;
+}
+
+/**
+ * Write the position as FEN, castling and en passant come from the pieces'
+ * move history. Returns the length written.
+ */
+size_t format_fen(Position *position, char buffer[FEN_MAX_LENGTH])
+{
+	char *out = buffer;
+	for (int y = BOARD_SIZE - 1; y >= 0; y--) {
+		int empty = 0;
+		for (int x = 0; x < BOARD_SIZE; x++) {
+			PlayPiece *piece = &position->board[y * BOARD_SIZE + x];
+			if (piece->type == PIECE_NONE) {
+				empty++;
+				continue;
+			}
+			if (empty > 0)
+				*out++ = '0' + empty;
+			empty = 0;
+			char sym = FEN_PIECE_SYMBOLS[piece->type];
+			*out++ = piece->colour == COLOUR_WHITE ? sym - 'a' + 'A' :
+				 sym;
+		}
+		if (empty > 0)
+			*out++ = '0' + empty;
+		if (y > 0)
+			*out++ = '/';
+	}
+	*out++ = ' ';
+	*out++ = position->turn == COLOUR_WHITE ? 'w' : 'b';
+	*out++ = ' ';
+
+	int rights = get_castling_rights(position->board);
+	if (rights == CASTLE_NONE)
+		*out++ = '-';
+	if (rights & CASTLE_WHITE_KING)
+		*out++ = 'K';
+	if (rights & CASTLE_WHITE_QUEEN)
+		*out++ = 'Q';
+	if (rights & CASTLE_BLACK_KING)
+		*out++ = 'k';
+	if (rights & CASTLE_BLACK_QUEEN)
+		*out++ = 'q';
+	*out++ = ' ';
+
+	int en_passant = get_en_passant_square(position->board, position->turn,
+					       position->move_count);
+	if (en_passant == -1) {
+		*out++ = '-';
+	} else {
+		*out++ = en_passant % BOARD_SIZE + 'a';
+		*out++ = en_passant / BOARD_SIZE + '1';
+	}
+	*out++ = ' ';
+	out = write_number(out, position->halfmove_clock);
+	*out++ = ' ';
+	out = write_number(out, position->move_count / 2 + 1);
+	*out = '\0';
+	return out - buffer;
+}
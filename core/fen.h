@@ -0,0 +1,18 @@
+#ifndef _FEN_H
+#define _FEN_H
+
+#include "position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define STARTING_FEN \
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+// Longest FEN written, with the terminator.
+#define FEN_MAX_LENGTH 100
+
+bool parse_fen(const char *fen, Position *position);
+size_t format_fen(Position *position, char buffer[FEN_MAX_LENGTH]);
+void set_position_rights(Position *position, int rights, int en_passant);
+
+#endif
@@ -1,12 +1,15 @@
 #include "game.h"
 #include "board.h"
 #include "display.h"
+#include "history.h"
 #include "input.h"
+#include "journal.h"
 #include "logic.h"
 #include "movement.h"
 #include "network.h"
 #include "pieces.h"
 #include "serialization.h"
+#include "zobrist.h"
 #include "log.h"
 
 #include <ctype.h>
@@ -29,6 +32,18 @@ void clear_input_buffer(ChessGame *game)
 	memset(game->input_buffer, 0, sizeof(char) * INPUT_BUFFER_SIZE);
 }
 
+/**
+ * Read a line of input into the game's buffer, false at the end of input.
+ * Journaled moves are synced first, none wait unsynced on the player.
+ */
+static bool read_game_line(ChessGame *game)
+{
+	if (game->journal != NULL && !sync_journal(game->journal))
+		ERROR_LOG("Unable to sync the journal\n");
+	clear_input_buffer(game);
+	return read_line(game->input_buffer, &game->input_pointer);
+}
+
 void init_chess_game(ChessGame *game)
 {
 	// Initialize the boards.
@@ -45,6 +60,76 @@ void init_chess_game(ChessGame *game)
 	clear_piece_selection(game);
 	// Input parsing.
 	clear_input_buffer(game);
+	// The starting position is the first in the history.
+	reset_position_history(game);
+	get_game_position(game, &game->start);
+	game->num_moves = 0;
+}
+
+/**
+ * Start a fresh position history from the current board, e.g. after loading.
+ */
+void reset_position_history(ChessGame *game)
+{
+	clear_position_history(&game->history);
+	push_position(&game->history,
+		      hash_board(game->board, game->turn, game->move_count),
+		      true);
+}
+
+/**
+ * Start a fresh game from a position, e.g. one loaded from FEN.
+ */
+void set_game_position(ChessGame *game, const Position *position)
+{
+	init_chess_game(game);
+	memcpy(game->board, position->board, sizeof(Board));
+	set_board(game->board, game->next_board);
+	game->turn = position->turn;
+	game->move_count = position->move_count;
+	start_position_history(&game->history,
+			       hash_board(game->board, game->turn,
+					  game->move_count),
+			       position->halfmove_clock);
+	game->start = *position;
+}
+
+/**
+ * The bare position of a game, e.g. to save it as FEN.
+ */
+void get_game_position(ChessGame *game, Position *position)
+{
+	memcpy(position->board, game->board, sizeof(Board));
+	position->turn = game->turn;
+	position->move_count = game->move_count;
+	position->halfmove_clock = get_halfmove_clock(&game->history);
+}
+
+/**
+ * Add a played move to the game's move list.
+ */
+void record_game_move(ChessGame *game, Move move)
+{
+	if (game->num_moves < GAME_MAX_MOVES)
+		game->moves[game->num_moves] = move;
+	game->num_moves++;
+}
+
+/**
+ * Has the game been drawn by threefold repetition or the fifty move rule?
+ */
+bool is_game_drawn(ChessGame *game)
+{
+	if (is_fifty_move_draw(&game->history)) {
+		INFO_LOG("Fifty moves without a capture or pawn move, "
+			 "game ends in draw!\n");
+		return true;
+	}
+	if (is_threefold_repetition(&game->history)) {
+		INFO_LOG("Threefold repetition! Game ends in draw!\n");
+		return true;
+	}
+	return false;
 }
 
 void toggle_player_turn(ChessGame *game)
@@ -84,6 +169,15 @@ void clear_piece_selection(ChessGame *game)
 }
 
 bool move_piece_loc(ChessGame *game, int loc)
+{
+	return move_piece_to(game, loc, PIECE_NONE);
+}
+
+/**
+ * Move the selected piece to loc, a pawn reaching the last rank becomes the
+ * given piece. With PIECE_NONE the player is asked for one instead.
+ */
+bool move_piece_to(ChessGame *game, int loc, EChessPiece promotion)
 {
 	// Copy of piece we selected before we modify the board.
 	PlayPiece selected_piece = game->board[game->selected_piece];
@@ -110,7 +204,10 @@ bool move_piece_loc(ChessGame *game, int loc)
 			 loc, game->check);
 
 	// Handle a promotion?
-	if (selected_move.type == MOVEMENT_PAWN_PROMOTION) {
+	if (selected_move.type == MOVEMENT_PAWN_PROMOTION &&
+	    promotion != PIECE_NONE) {
+		game->next_board[loc].type = promotion;
+	} else if (selected_move.type == MOVEMENT_PAWN_PROMOTION) {
 		// Special input mode to capture user promotion input.
 		game->mode = OPERATION_PROMOTION;
 		ECommand promotion_result = COMMAND_INVALID;
@@ -119,11 +216,13 @@ bool move_piece_loc(ChessGame *game, int loc)
 		PlayPiece *promoted_piece = &game->next_board[loc];
 		while (promotion_result != COMMAND_PROMOTION) {
 			show_promotion_prompt(game->turn, loc);
-			// Reset the buffer.
-			memset(game->input_buffer, 0, INPUT_BUFFER_SIZE);
-			game->input_pointer = 0;
-			// Read a new line.
-			read_line(game->input_buffer, &game->input_pointer);
+			// Read a new line, the move is dropped if there are
+			// none left.
+			if (!read_game_line(game)) {
+				INFO_LOG("No promotion chosen, move aborted!\n");
+				set_board(game->board, game->next_board);
+				return false;
+			}
 			promotion_result = parse_input(game->input_buffer,
 						       game->mode);
 		}
@@ -160,6 +259,26 @@ bool move_piece_loc(ChessGame *game, int loc)
 	set_board(game->next_board, game->board);
 	game->move_count++;
 
+	// Record the new position, the turn is toggled by the caller.
+	bool irreversible = selected_piece.type == PIECE_PAWN ||
+			    target_piece.type != PIECE_NONE;
+	push_position(&game->history,
+		      hash_board(game->board,
+				 (game->turn + 1) % PLAYER_NUM_COLOURS,
+				 game->move_count), irreversible);
+
+	Move move = {
+		.origin = game->selected_piece,
+		.target = loc,
+		.type = selected_move.type,
+		.promotion = selected_move.type == MOVEMENT_PAWN_PROMOTION ?
+			     game->board[loc].type : PIECE_NONE,
+	};
+	record_game_move(game, move);
+	// A failed write loses the journal's tail, not the game.
+	if (game->journal != NULL && !append_journal_move(game->journal, move))
+		ERROR_LOG("Unable to journal the move\n");
+
 	// Display the result.
 	switch (selected_move.type) {
 	case MOVEMENT_KING_CASTLE:
@@ -187,7 +306,7 @@ bool move_piece_loc(ChessGame *game, int loc)
 			game->turn + 1,
 			PLAYER_COLOUR_STRINGS[game->turn],
 			CHESS_PIECE_STRINGS[PIECE_PAWN],
-			CHESS_PIECE_STRINGS[selected_piece.type], INT_TO_COORD(
+			CHESS_PIECE_STRINGS[game->board[loc].type], INT_TO_COORD(
 				game->selected_piece), INT_TO_COORD(
 				loc));
 		break;
@@ -246,6 +365,9 @@ void play_chess(ChessGame *game)
 						      PLAYER_NUM_COLOURS]);
 		}
 
+		if (is_game_drawn(game))
+			break;
+
 		// Show the selected piece if we have one.
 		EChessPiece type = game->selected_piece == -1
 			  ? PIECE_NONE
@@ -256,11 +378,11 @@ void play_chess(ChessGame *game)
 
 		// Get some input.
 		show_prompt(game->turn, type);
-		// Reset the buffer.
-		memset(game->input_buffer, 0, INPUT_BUFFER_SIZE);
-		game->input_pointer = 0;
-		// Read a new line.
-		read_line(game->input_buffer, &game->input_pointer);
+		// Read a new line, the game stops with the input.
+		if (!read_game_line(game)) {
+			INFO_LOG("End of input, quitting...\n");
+			return;
+		}
 		// See if the input was syntactically valid.
 		ECommand command = parse_input(game->input_buffer, game->mode);
 		switch (command) {
@@ -278,6 +400,9 @@ void play_chess(ChessGame *game)
 				INFO_LOG("Unable to load game...\n");
 				continue;
 			}
+			if (game->journal != NULL &&
+			    !restart_journal(game->journal, game))
+				INFO_LOG("Unable to restart the journal...\n");
 			INFO_LOG("Game loaded...\n");
 			view_board(game->board, game->selected_piece,
 				   game->num_possible_moves,
@@ -373,6 +498,9 @@ void play_chess_networked(EGameMode mode, ChessGame *game,
 			break;
 		}
 
+		if (is_game_drawn(game))
+			break;
+
 		// Show the selected piece if we have one.
 		EChessPiece type = game->selected_piece == -1
 			  ? PIECE_NONE
@@ -389,7 +517,11 @@ void play_chess_networked(EGameMode mode, ChessGame *game,
 		if (game->turn == game->player) {
 			// From user this user.
 			show_prompt(game->turn, type);
-			read_line(game->input_buffer, &game->input_pointer);
+			if (!read_line(game->input_buffer,
+				       &game->input_pointer)) {
+				INFO_LOG("End of input, quitting...\n");
+				return;
+			}
 		} else {
 			// From connection (other player).
 			INFO_LOG("waiting for other player's turn\n");
@@ -2,11 +2,16 @@
 #define _GAME_H
 
 #include "board.h"
+#include "history.h"
 #include "input.h"
 #include "movement.h"
+#include "position.h"
 
 #include <stdbool.h>
 
+// Moves past this many are still played but not kept, see ChessGame.moves.
+#define GAME_MAX_MOVES 1024
+
 typedef enum {
 	GAME_MODE_INVALID,
 	GAME_MODE_LOAD,
@@ -14,6 +19,25 @@ typedef enum {
 	GAME_MODE_REPLAY,
 	GAME_MODE_HOST,
 	GAME_MODE_JOIN,
+	GAME_MODE_PERFT,
+	GAME_MODE_BENCH,
+	GAME_MODE_SEARCH,
+	GAME_MODE_BOOK_BUILD,
+	GAME_MODE_TB_GEN,
+	GAME_MODE_MATE,
+	GAME_MODE_VALIDATE,
+	GAME_MODE_SELFPLAY,
+	GAME_MODE_ARCHIVE,
+	GAME_MODE_UNARCHIVE,
+	GAME_MODE_INDEX,
+	GAME_MODE_QUERY,
+	GAME_MODE_SIGNATURES,
+	GAME_MODE_MATCH,
+	GAME_MODE_TAG_INDEX,
+	GAME_MODE_FILTER,
+	GAME_MODE_DEDUPE,
+	GAME_MODE_EPD,
+	GAME_MODE_JOURNAL,
 	GAME_NUM_MODES
 } EGameMode;
 
@@ -40,6 +64,15 @@ typedef struct ChessGame {
 	EPlayerColour turn;
 	// How many turns have happened in this game?
 	size_t move_count;
+	// Hashes of every position reached, for repetition and fifty move draws.
+	PositionHistory history;
+	// The position the game started from and every move since, to export
+	// it as PGN. num_moves keeps counting past GAME_MAX_MOVES.
+	Position start;
+	size_t num_moves;
+	Move moves[GAME_MAX_MOVES];
+	// Moves are appended to it as they are played, NULL for none.
+	struct MoveJournal *journal;
 	// How checkmated is this player? (How many ways are they in check.)
 	size_t check;
 	// Operation mode.
@@ -58,11 +91,17 @@ void init_chess_game(ChessGame *game);
 void play_chess(ChessGame *game);
 void play_chess_networked(
 	EGameMode mode, ChessGame *game, int connection_fd);
+void reset_position_history(ChessGame *game);
+void set_game_position(ChessGame *game, const Position *position);
+void get_game_position(ChessGame *game, Position *position);
+void record_game_move(ChessGame *game, Move move);
+bool is_game_drawn(ChessGame *game);
 void toggle_player_turn(ChessGame *game);
 bool select_piece(ChessGame *game);
 bool select_piece_loc(ChessGame *game, int selected);
 void clear_piece_selection(ChessGame *game);
 bool move_piece(ChessGame *game);
 bool move_piece_loc(ChessGame *game, int selected);
+bool move_piece_to(ChessGame *game, int loc, EChessPiece promotion);
 
 #endif
@@ -0,0 +1,109 @@
+#include "history.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+static inline const HistoryEntry *history_entry(const PositionHistory *history,
+						size_t ply)
+{
+	return &history->entries[ply % POSITION_HISTORY_SIZE];
+}
+
+void clear_position_history(PositionHistory *history)
+{
+	history->length = 0;
+	memset(history->entries, 0,
+	       sizeof(HistoryEntry) * POSITION_HISTORY_SIZE);
+}
+
+/**
+ * Start a history at a position that may be part way to a fifty move draw,
+ * e.g. one loaded from FEN. Earlier positions are unknown.
+ */
+void start_position_history(PositionHistory *history, uint64_t hash,
+			    size_t halfmove_clock)
+{
+	clear_position_history(history);
+	history->entries[0] = (HistoryEntry){
+		.hash = hash,
+		.halfmove_clock = halfmove_clock,
+	};
+	history->length = 1;
+}
+
+/**
+ * Record the position reached after a move. Captures and pawn moves are
+ * irreversible and reset the halfmove clock.
+ */
+void push_position(PositionHistory *history, uint64_t hash, bool irreversible)
+{
+	size_t halfmove_clock = 0;
+	if (!irreversible && history->length > 0) {
+		halfmove_clock = history_entry(history, history->length -
+					       1)->halfmove_clock + 1;
+	}
+	history->entries[history->length % POSITION_HISTORY_SIZE] =
+		(HistoryEntry){
+		.hash = hash,
+		.halfmove_clock = halfmove_clock,
+	};
+	history->length++;
+}
+
+void pop_position(PositionHistory *history)
+{
+	if (history->length > 0)
+		history->length--;
+}
+
+size_t get_halfmove_clock(const PositionHistory *history)
+{
+	if (history->length == 0)
+		return 0;
+	return history_entry(history, history->length - 1)->halfmove_clock;
+}
+
+/**
+ * How many times has the latest position occurred? Only positions with the
+ * same player to move since the last irreversible move are compared.
+ */
+size_t count_repetitions(const PositionHistory *history)
+{
+	if (history->length == 0)
+		return 0;
+	const HistoryEntry *current = history_entry(history,
+						    history->length - 1);
+	size_t limit = current->halfmove_clock;
+	if (limit > history->length - 1)
+		limit = history->length - 1;
+	if (limit > POSITION_HISTORY_SIZE - 1)
+		limit = POSITION_HISTORY_SIZE - 1;
+
+	size_t count = 1;
+	for (size_t back = 2; back <= limit; back += 2) {
+		if (history_entry(history, history->length - 1 - back)->hash ==
+		    current->hash)
+			count++;
+	}
+	return count;
+}
+
+/**
+ * Has the latest position been seen before? Enough for a search to score it
+ * as a draw.
+ */
+bool is_repetition(const PositionHistory *history)
+{
+	return count_repetitions(history) > 1;
+}
+
+bool is_threefold_repetition(const PositionHistory *history)
+{
+	return count_repetitions(history) >= 3;
+}
+
+bool is_fifty_move_draw(const PositionHistory *history)
+{
+	return get_halfmove_clock(history) >= FIFTY_MOVE_RULE_PLIES;
+}
@@ -0,0 +1,37 @@
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Repetitions can only reach back as far as the last capture or pawn move,
+// which the fifty move rule caps at 100 plies, so a small ring is enough.
+#define POSITION_HISTORY_SIZE 256
+#define FIFTY_MOVE_RULE_PLIES 100
+
+typedef struct {
+	uint64_t hash;
+	// Plies since the last capture or pawn move.
+	size_t halfmove_clock;
+} HistoryEntry;
+
+typedef struct {
+	// Total positions recorded, the ring only keeps the latest.
+	size_t length;
+	HistoryEntry entries[POSITION_HISTORY_SIZE];
+} PositionHistory;
+
+void clear_position_history(PositionHistory *history);
+void start_position_history(PositionHistory *history, uint64_t hash,
+			    size_t halfmove_clock);
+void push_position(PositionHistory *history, uint64_t hash,
+		   bool irreversible);
+void pop_position(PositionHistory *history);
+size_t get_halfmove_clock(const PositionHistory *history);
+size_t count_repetitions(const PositionHistory *history);
+bool is_repetition(const PositionHistory *history);
+bool is_threefold_repetition(const PositionHistory *history);
+bool is_fifty_move_draw(const PositionHistory *history);
+
+#endif
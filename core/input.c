@@ -20,11 +20,19 @@ int input_to_index(char x, char y)
 	return ((y - '1') * BOARD_SIZE) + tolower(x) - 'a';
 }
 
-void read_line(char *input_buffer, size_t *input_pointer)
+/**
+ * Read a line from standard input, false once the input has ended with
+ * nothing left to read.
+ */
+bool read_line(char *input_buffer, size_t *input_pointer)
 {
-	char c;
+	int c;
 	while (true) {
 		c = fgetc(stdin);
+		if (c == EOF && *input_pointer == 0) {
+			input_buffer[0] = '\0';
+			return false;
+		}
 		if (c == EOF || c == '\n')
 			break;
 		else if (c == '\b' && *input_pointer > 0) {
@@ -38,6 +46,17 @@ void read_line(char *input_buffer, size_t *input_pointer)
 		}
 	}
 	input_buffer[*input_pointer] = '\0';
+	return true;
+}
+
+/**
+ * Is the input this command word, alone or followed by an argument?
+ */
+static inline bool is_command(const char *input_buffer, const char *command)
+{
+	size_t length = strlen(command);
+	return strncmp(input_buffer, command, length) == 0 &&
+	       (input_buffer[length] == '\0' || input_buffer[length] == ' ');
 }
 
 static inline bool valid_char_pairing(char x, char y)
@@ -69,11 +88,11 @@ ECommand parse_input(char input_buffer[INPUT_BUFFER_SIZE], EOperationMode mode)
 		return COMMAND_HELP;
 	}
 
-	if (strncmp(input_buffer, "save", INPUT_BUFFER_SIZE) >= 0) {
+	if (is_command(input_buffer, "save")) {
 		return COMMAND_SAVE;
 	}
 
-	if (strncmp(input_buffer, "load", INPUT_BUFFER_SIZE) >= 0) {
+	if (is_command(input_buffer, "load")) {
 		return COMMAND_LOAD;
 	}
 
@@ -1,6 +1,7 @@
 #ifndef _INPUT_H
 #define _INPUT_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #define INPUT_BUFFER_SIZE 1024
@@ -31,7 +32,7 @@ typedef enum {
 extern const char *COMMAND_STRINGS[];
 
 int input_to_index(char x, char y);
-void read_line(char *input_buffer, size_t *input_pointer);
+bool read_line(char *input_buffer, size_t *input_pointer);
 ECommand parse_input(char input_buffer[INPUT_BUFFER_SIZE], EOperationMode mode);
 
 #endif
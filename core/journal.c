@@ -0,0 +1,289 @@
+#include "journal.h"
+#include "binary.h"
+#include "position.h"
+#include "timing.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static bool write_all(int fd, const uint8_t *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t written = write(fd, data, size);
+		if (written < 0)
+			return false;
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+/**
+ * Sync the directory holding the file, so a rename into it survives a power
+ * cut.
+ */
+static bool sync_directory(const char *filepath)
+{
+	char directory[JOURNAL_MAX_PATH];
+	const char *slash = strrchr(filepath, '/');
+	if (slash == NULL)
+		strcpy(directory, ".");
+	else if (slash == filepath)
+		strcpy(directory, "/");
+	else
+		snprintf(directory, sizeof(directory), "%.*s",
+			 (int)(slash - filepath), filepath);
+	int fd = open(directory, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return false;
+	bool synced = fsync(fd) == 0;
+	return close(fd) == 0 && synced;
+}
+
+/**
+ * Start the journal over from the game's current position, e.g. a new game
+ * or one just loaded from a save. The new header is written and synced to a
+ * temporary file which is then renamed over the journal, so a crash leaves
+ * either the old game or the new one, never an empty file.
+ */
+bool restart_journal(MoveJournal *journal, ChessGame *game)
+{
+	uint8_t header[JOURNAL_HEADER_SIZE + 8 * POSITION_HISTORY_SIZE] = { 0 };
+	Position position;
+	get_game_position(game, &position);
+	memcpy(header, JOURNAL_MAGIC, 3);
+	header[3] = JOURNAL_VERSION;
+	pack_position(&position, header + 8);
+	header[8 + PACKED_POSITION_SIZE] = game->player;
+	size_t num_hashes = pack_position_history(&game->history,
+						  header + JOURNAL_HEADER_SIZE);
+	write_le(header + 8 + PACKED_POSITION_SIZE + 2, num_hashes, 2);
+	size_t size = JOURNAL_HEADER_SIZE + 8 * num_hashes;
+	write_le(header + 4, fnv1a_32(header + 8, size - 8), 4);
+
+	char temporary[JOURNAL_MAX_PATH + 4];
+	snprintf(temporary, sizeof(temporary), "%s.tmp", journal->filepath);
+	int fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd < 0) {
+		ERROR_LOG("Unable to create %s\n", temporary);
+		return false;
+	}
+	if (!write_all(fd, header, size) || fsync(fd) != 0 ||
+	    rename(temporary, journal->filepath) != 0) {
+		ERROR_LOG("Unable to write the journal header\n");
+		close(fd);
+		remove(temporary);
+		return false;
+	}
+	// The old journal is gone either way, carry on with the new one.
+	if (!sync_directory(journal->filepath))
+		ERROR_LOG("Unable to sync the directory of %s\n",
+			  journal->filepath);
+
+	// Moves written to the old file are dropped with it.
+	close(journal->fd);
+	journal->fd = fd;
+	journal->num_moves = 0;
+	journal->unsynced = 0;
+	return true;
+}
+
+static bool find_journal_move(Position *position, const uint8_t *record,
+			      Move *move)
+{
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	for (size_t i = 0; i < num_moves; i++) {
+		if (moves[i].origin == record[0] &&
+		    moves[i].target == record[1] &&
+		    moves[i].promotion == record[2]) {
+			*move = moves[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Replay a journal onto its start position. Returns the length of the valid
+ * part of the file, 0 if the header itself is bad.
+ */
+static size_t replay_journal(const uint8_t *data, size_t size,
+			     ChessGame *game, size_t *num_moves)
+{
+	if (size < JOURNAL_HEADER_SIZE || memcmp(data, JOURNAL_MAGIC, 3) != 0 ||
+	    data[3] != JOURNAL_VERSION)
+		return 0;
+	size_t num_hashes = read_le(data + 8 + PACKED_POSITION_SIZE + 2, 2);
+	size_t header_size = JOURNAL_HEADER_SIZE + 8 * num_hashes;
+	if (size < header_size ||
+	    read_le(data + 4, 4) != fnv1a_32(data + 8, header_size - 8))
+		return 0;
+	Position position;
+	PositionHistory history;
+	EPlayerColour player = data[8 + PACKED_POSITION_SIZE];
+	if (!unpack_position(data + 8, &position) || player > COLOUR_BLACK ||
+	    !unpack_position_history(data + JOURNAL_HEADER_SIZE, num_hashes,
+				     &position, &history))
+		return 0;
+	set_game_position(game, &position);
+	game->player = player;
+	memcpy(&game->history, &history, sizeof(PositionHistory));
+
+	size_t offset = header_size;
+	size_t ply = 0;
+	for (; offset + JOURNAL_RECORD_SIZE <= size;
+	     offset += JOURNAL_RECORD_SIZE, ply++) {
+		const uint8_t *record = data + offset;
+		Move move;
+		if (read_le(record + 4, 2) != (ply & 0xffff) ||
+		    read_le(record + 6, 2) != (fnv1a_32(record, 6) & 0xffff) ||
+		    !find_journal_move(&position, record, &move))
+			break;
+		bool irreversible =
+			position.board[move.origin].type == PIECE_PAWN ||
+			position.board[move.target].type != PIECE_NONE;
+		make_move(&position, move);
+		push_position(&game->history, hash_position(&position),
+			      irreversible);
+		record_game_move(game, move);
+	}
+
+	memcpy(game->board, position.board, sizeof(Board));
+	set_board(game->board, game->next_board);
+	game->turn = position.turn;
+	game->move_count = position.move_count;
+	*num_moves = ply;
+	return offset;
+}
+
+/**
+ * Open a game's journal, replaying it into the game if the file has one, or
+ * starting it from the game's position if the file is new or empty.
+ */
+bool open_journal(MoveJournal *journal, const char *filepath, ChessGame *game,
+		  size_t sync_moves, uint64_t sync_ms)
+{
+	memset(journal, 0, sizeof(MoveJournal));
+	if (strlen(filepath) >= JOURNAL_MAX_PATH) {
+		ERROR_LOG("Journal path too long: %s\n", filepath);
+		return false;
+	}
+	strcpy(journal->filepath, filepath);
+	journal->sync_moves = sync_moves;
+	journal->sync_ms = sync_ms;
+	journal->fd = open(filepath, O_RDWR | O_CREAT | O_APPEND, 0644);
+	struct stat info;
+	if (journal->fd < 0 || fstat(journal->fd, &info) != 0) {
+		ERROR_LOG("Unable to open journal %s\n", filepath);
+		if (journal->fd >= 0)
+			close(journal->fd);
+		return false;
+	}
+	if (info.st_size == 0) {
+		if (!restart_journal(journal, game)) {
+			close(journal->fd);
+			return false;
+		}
+		INFO_LOG("Started journal %s\n", filepath);
+		return true;
+	}
+
+	size_t size = info.st_size;
+	void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, journal->fd, 0);
+	if (data == MAP_FAILED) {
+		ERROR_LOG("Unable to map journal %s\n", filepath);
+		close(journal->fd);
+		return false;
+	}
+	size_t valid = replay_journal(data, size, game, &journal->num_moves);
+	munmap(data, size);
+	if (valid == 0) {
+		ERROR_LOG("%s is not a version %d journal\n", filepath,
+			  JOURNAL_VERSION);
+		close(journal->fd);
+		return false;
+	}
+	// Cut off a record torn by a crash, appends follow the last good one.
+	if (valid < size) {
+		INFO_LOG("Dropped %zu bytes after move %zu of %s\n",
+			 size - valid, journal->num_moves, filepath);
+		if (ftruncate(journal->fd, valid) != 0 ||
+		    fsync(journal->fd) != 0) {
+			ERROR_LOG("Unable to truncate journal %s\n", filepath);
+			close(journal->fd);
+			return false;
+		}
+	}
+	INFO_LOG("Recovered %zu moves from %s\n", journal->num_moves,
+		 filepath);
+	return true;
+}
+
+bool sync_journal(MoveJournal *journal)
+{
+	if (journal->unsynced == 0)
+		return true;
+	journal->unsynced = 0;
+	return fsync(journal->fd) == 0;
+}
+
+/**
+ * Append one move, a single write. The journal is synced once enough moves
+ * are waiting or the oldest of them has waited long enough.
+ */
+bool append_journal_move(MoveJournal *journal, Move move)
+{
+	uint8_t record[JOURNAL_RECORD_SIZE] = {
+		move.origin, move.target, move.promotion, 0
+	};
+	write_le(record + 4, journal->num_moves & 0xffff, 2);
+	write_le(record + 6, fnv1a_32(record, 6) & 0xffff, 2);
+	if (!write_all(journal->fd, record, JOURNAL_RECORD_SIZE))
+		return false;
+	journal->num_moves++;
+
+	if (journal->unsynced++ == 0)
+		clock_gettime(CLOCK_MONOTONIC, &journal->oldest_unsynced);
+	if ((journal->sync_moves &&
+	     journal->unsynced >= journal->sync_moves) ||
+	    (journal->sync_ms &&
+	     elapsed_seconds(&journal->oldest_unsynced) * 1e3 >=
+		     journal->sync_ms))
+		return sync_journal(journal);
+	return true;
+}
+
+bool close_journal(MoveJournal *journal)
+{
+	bool ok = sync_journal(journal);
+	return close(journal->fd) == 0 && ok;
+}
+
+/**
+ * Play a local game journaled to a file, carrying on from the journal's last
+ * move if it already holds a game.
+ */
+int run_journal(ChessGame *game, JournalArgs *args)
+{
+	static MoveJournal journal;
+	if (!open_journal(&journal, args->filepath, game, args->sync_moves,
+			  args->sync_ms))
+		return 0;
+	game->journal = &journal;
+	play_chess(game);
+	game->journal = NULL;
+	if (!close_journal(&journal)) {
+		ERROR_LOG("Unable to sync journal %s\n", args->filepath);
+		return 0;
+	}
+	return 1;
+}
@@ -0,0 +1,73 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include "game.h"
+#include "movement.h"
+#include "serialization.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * An append-only log of one game's moves, so persisting a move costs one
+ * small write instead of rewriting a save. The file starts with a header:
+ *
+ *   magic "CGJ", version, checksum (4 bytes), packed start position, this
+ *   player's colour, a zero byte, history length (2 bytes), position hashes
+ *
+ * The hashes are those of the positions since the last capture or pawn move
+ * up to the start, as in a binary save, so a game restarted part way keeps
+ * detecting repetitions. Then comes a fixed size record per move:
+ *
+ *   origin, target, promotion, a zero byte, ply (2 bytes), checksum (2 bytes)
+ *
+ * The header's checksum is FNV-1a of every header byte after it, a record's
+ * of the bytes before it. The ply counts from the start position and wraps.
+ * Numbers are little endian. A game is recovered by replaying the records
+ * onto the start position, stopping at the first torn, corrupt or illegal
+ * one, which is cut off so appends carry on after the last good move.
+ */
+#define JOURNAL_MAGIC "CGJ"
+#define JOURNAL_VERSION 2
+// Without the hashes, 8 bytes each.
+#define JOURNAL_HEADER_SIZE (8 + PACKED_POSITION_SIZE + 4)
+#define JOURNAL_RECORD_SIZE 8
+// Every move is written at once and survives the process dying, fsync is
+// batched and bounds what a power cut can lose. Moves are also synced before
+// the game waits on a player.
+#define JOURNAL_DEFAULT_SYNC_MOVES 16
+#define JOURNAL_DEFAULT_SYNC_MS 1000
+#define JOURNAL_MAX_PATH 4096
+
+typedef struct MoveJournal {
+	int fd;
+	// Restarting writes a new file beside this one and renames it over.
+	char filepath[JOURNAL_MAX_PATH];
+	// Records in the file, the next one's ply.
+	size_t num_moves;
+	// Sync once this many moves are unsynced, 0 to only sync on close.
+	size_t sync_moves;
+	// Or once the oldest unsynced move is this old, 0 for no limit.
+	// Checked as moves are appended.
+	uint64_t sync_ms;
+	size_t unsynced;
+	struct timespec oldest_unsynced;
+} MoveJournal;
+
+typedef struct {
+	const char *filepath;
+	size_t sync_moves;
+	uint64_t sync_ms;
+} JournalArgs;
+
+bool open_journal(MoveJournal *journal, const char *filepath, ChessGame *game,
+		  size_t sync_moves, uint64_t sync_ms);
+bool restart_journal(MoveJournal *journal, ChessGame *game);
+bool append_journal_move(MoveJournal *journal, Move move);
+bool sync_journal(MoveJournal *journal);
+bool close_journal(MoveJournal *journal);
+int run_journal(ChessGame *game, JournalArgs *args);
+
+#endif
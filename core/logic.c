@@ -30,16 +30,15 @@ EMovementType process_movement(Board board, size_t move_count, int selected,
 		board[dest] = *selected_piece;
 		// Save king.
 		board[selected] = empty_space;
-		int selected_x = selected % BOARD_SIZE;
 		int selected_y = selected / BOARD_SIZE;
 		// Queen side or King side.
-		bool queen_side = BOARD_SIZE - selected_x > BOARD_SIZE / 2;
+		bool queen_side = dest < selected;
 		int rook_loc = (queen_side ? 0 : BOARD_SIZE - 1) + selected_y *
 			       BOARD_SIZE;
 
 		assert(board[rook_loc].type == PIECE_ROOK);
 		// Move rook left or right depending on castle side.
-		int new_rook_loc = rook_loc == 0 ? dest + 1 : dest - 1;
+		int new_rook_loc = queen_side ? dest + 1 : dest - 1;
 		board[new_rook_loc] = board[rook_loc];
 		// Insert empty space.
 		board[rook_loc] = empty_space;
@@ -47,7 +46,7 @@ EMovementType process_movement(Board board, size_t move_count, int selected,
 	case MOVEMENT_PAWN_EN_PASSANT:
 		// Remove target pawn.
 		board[dest +
-		      (colour == COLOUR_WHITE ? BOARD_SIZE : -BOARD_SIZE)] =
+		      (colour == COLOUR_WHITE ? -BOARD_SIZE : BOARD_SIZE)] =
 			empty_space;
 	case MOVEMENT_PIECE_CAPTURE:
 	case MOVEMENT_PAWN_PROMOTION:
@@ -0,0 +1,268 @@
+#include "mate.h"
+#include "fen.h"
+#include "position.h"
+#include "timing.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Proof and disproof numbers at or above this are settled.
+#define PN_INFINITY 100000000u
+
+typedef struct {
+	uint64_t key;
+	uint32_t pn;
+	uint32_t dn;
+} MateEntry;
+
+typedef struct {
+	MateEntry *entries;
+	size_t mask;
+	uint64_t nodes;
+} MateSolver;
+
+static bool init_solver(MateSolver *solver, size_t hash_mb)
+{
+	memset(solver, 0, sizeof(MateSolver));
+	size_t bytes = (hash_mb ? hash_mb : 1) * 1024 * 1024;
+	size_t count = 1;
+	while (count * 2 * sizeof(MateEntry) <= bytes)
+		count *= 2;
+	solver->entries = calloc(count, sizeof(MateEntry));
+	solver->mask = count - 1;
+	return solver->entries != NULL;
+}
+
+/**
+ * The same position is a different node with a different number of attacker
+ * moves left, the mate being looked for is bounded by them.
+ */
+static inline uint64_t node_key(Position *position, size_t moves_left)
+{
+	return hash_position(position) ^
+	       ((moves_left + 1) * 0x9e3779b97f4a7c15ULL);
+}
+
+static inline uint32_t saturate(uint64_t number)
+{
+	return number < PN_INFINITY ? number : PN_INFINITY;
+}
+
+static void lookup(MateSolver *solver, uint64_t key, uint32_t *pn,
+		   uint32_t *dn)
+{
+	MateEntry *entry = &solver->entries[key & solver->mask];
+	if (entry->key == key) {
+		*pn = entry->pn;
+		*dn = entry->dn;
+	} else {
+		*pn = 1;
+		*dn = 1;
+	}
+}
+
+static void store(MateSolver *solver, uint64_t key, uint32_t pn, uint32_t dn)
+{
+	MateEntry *entry = &solver->entries[key & solver->mask];
+	entry->key = key;
+	entry->pn = pn;
+	entry->dn = dn;
+}
+
+/**
+ * Depth first proof number search. The attacker's nodes are OR nodes, one
+ * mating move proves them; the defender's nodes are AND nodes, every reply
+ * must be mated. Search below a node until its numbers cross the thresholds,
+ * the children's numbers live in the transposition table.
+ */
+static void mid(MateSolver *solver, Position *position, size_t moves_left,
+		bool attacker, uint32_t thpn, uint32_t thdn)
+{
+	solver->nodes++;
+	uint64_t key = node_key(position, moves_left);
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	if (num_moves == 0) {
+		bool mated = !attacker && is_in_check(position);
+		store(solver, key, mated ? 0 : PN_INFINITY,
+		      mated ? PN_INFINITY : 0);
+		return;
+	}
+
+	// The defender's replies use up one of the attacker's moves.
+	size_t child_moves = attacker ? moves_left : moves_left - 1;
+	uint64_t keys[MAX_LEGAL_MOVES];
+	for (size_t i = 0; i < num_moves; i++) {
+		Position child = *position;
+		make_move(&child, moves[i]);
+		keys[i] = node_key(&child, child_moves);
+	}
+
+	uint32_t pn, dn;
+	for (;;) {
+		// OR nodes take the smallest proof number, AND nodes the
+		// smallest disproof number; the other number is summed.
+		uint64_t sum = 0;
+		uint32_t best = PN_INFINITY + 1;
+		uint32_t second = PN_INFINITY;
+		uint32_t best_pn = 0, best_dn = 0;
+		size_t best_move = 0;
+		for (size_t i = 0; i < num_moves; i++) {
+			uint32_t child_pn, child_dn;
+			if (!attacker && child_moves == 0) {
+				// Out of moves, the attacker cannot mate.
+				child_pn = PN_INFINITY;
+				child_dn = 0;
+			} else {
+				lookup(solver, keys[i], &child_pn, &child_dn);
+			}
+			uint32_t minimised = attacker ? child_pn : child_dn;
+			sum += attacker ? child_dn : child_pn;
+			if (minimised < best) {
+				second = best;
+				best = minimised;
+				best_move = i;
+				best_pn = child_pn;
+				best_dn = child_dn;
+			} else if (minimised < second) {
+				second = minimised;
+			}
+		}
+		pn = attacker ? best : saturate(sum);
+		dn = attacker ? saturate(sum) : best;
+		if (pn >= thpn || dn >= thdn || pn == 0 || dn == 0)
+			break;
+
+		uint32_t child_thpn, child_thdn;
+		if (attacker) {
+			child_thpn = thpn < second + 1 ? thpn : second + 1;
+			child_thdn = saturate((uint64_t)thdn - dn + best_dn);
+		} else {
+			child_thdn = thdn < second + 1 ? thdn : second + 1;
+			child_thpn = saturate((uint64_t)thpn - pn + best_pn);
+		}
+		Position child = *position;
+		make_move(&child, moves[best_move]);
+		mid(solver, &child, child_moves, !attacker, child_thpn,
+		    child_thdn);
+	}
+	store(solver, key, pn, dn);
+}
+
+static bool prove(MateSolver *solver, Position *position, size_t moves_left,
+		  bool attacker)
+{
+	if (attacker && moves_left == 0)
+		return false;
+	mid(solver, position, moves_left, attacker, PN_INFINITY, PN_INFINITY);
+	uint32_t pn, dn;
+	lookup(solver, node_key(position, moves_left), &pn, &dn);
+	return pn == 0;
+}
+
+/**
+ * Follow a proven mate: the quickest mating move for the attacker and the
+ * reply that holds out longest for the defender. Returns the line length.
+ */
+static size_t build_line(MateSolver *solver, Position *position,
+			 size_t moves_left, Move *line)
+{
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	for (size_t k = 1; k <= moves_left; k++) {
+		for (size_t i = 0; i < num_moves; i++) {
+			Position reply = *position;
+			make_move(&reply, moves[i]);
+			if (!prove(solver, &reply, k, false))
+				continue;
+			line[0] = moves[i];
+
+			Move replies[MAX_LEGAL_MOVES];
+			size_t num_replies = generate_legal_moves(&reply,
+								  replies);
+			size_t longest = 0;
+			Position hardest;
+			for (size_t r = 0; r < num_replies; r++) {
+				Position next = reply;
+				make_move(&next, replies[r]);
+				size_t j = 1;
+				while (j < k && !prove(solver, &next, j, true))
+					j++;
+				if (j > longest) {
+					longest = j;
+					hardest = next;
+					line[1] = replies[r];
+				}
+			}
+			if (longest == 0)
+				return 1;
+			return 2 + build_line(solver, &hardest, longest,
+					      line + 2);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Look for the shortest forced mate by the player to move, trying mates in
+ * 1, 2, ... up to max_moves moves.
+ */
+bool solve_mate(Position *position, size_t max_moves, size_t hash_mb,
+		MateResult *result)
+{
+	memset(result, 0, sizeof(MateResult));
+	MateSolver solver;
+	if (!init_solver(&solver, hash_mb)) {
+		ERROR_LOG("Unable to allocate %zu MB mate hash\n", hash_mb);
+		return false;
+	}
+	if (max_moves > MATE_MAX_MOVES)
+		max_moves = MATE_MAX_MOVES;
+
+	for (size_t moves = 1; moves <= max_moves; moves++) {
+		if (prove(&solver, position, moves, true)) {
+			result->moves = moves;
+			result->length = build_line(&solver, position, moves,
+						    result->line);
+			break;
+		}
+	}
+	result->nodes = solver.nodes;
+	free(solver.entries);
+	return true;
+}
+
+int run_mate(MateArgs *args)
+{
+	Position position;
+	if (!parse_fen(args->fen, &position)) {
+		ERROR_LOG("Invalid FEN: %s\n", args->fen);
+		return 0;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	MateResult result;
+	if (!solve_mate(&position, args->moves, args->hash_mb, &result))
+		return 0;
+	double seconds = elapsed_seconds(&start);
+
+	if (result.moves == 0) {
+		INFO_LOG("No mate in %zu\n", args->moves);
+	} else {
+		char move[MOVE_COORDS_LENGTH];
+		INFO_LOG("Mate in %zu:", result.moves);
+		for (size_t i = 0; i < result.length; i++) {
+			format_move_coords(result.line[i], move);
+			INFO_LOG(" %s", move);
+		}
+		INFO_LOG("\n");
+	}
+	INFO_LOG("Nodes: %lu\nTime: %.3fs\nNPS: %.0f\n", result.nodes, seconds,
+		 seconds > 0 ? result.nodes / seconds : 0);
+	return 1;
+}
@@ -0,0 +1,34 @@
+#ifndef _MATE_H
+#define _MATE_H
+
+#include "movement.h"
+#include "position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MATE_MAX_MOVES 32
+#define MATE_DEFAULT_HASH_MB 64
+
+typedef struct {
+	const char *fen;
+	// Longest mate looked for, in moves of the attacker.
+	size_t moves;
+	size_t hash_mb;
+} MateArgs;
+
+typedef struct {
+	// Mate in this many moves, 0 if none was found.
+	size_t moves;
+	// Attacker moves with the longest defence in between.
+	size_t length;
+	Move line[2 * MATE_MAX_MOVES];
+	uint64_t nodes;
+} MateResult;
+
+bool solve_mate(Position *position, size_t max_moves, size_t hash_mb,
+		MateResult *result);
+int run_mate(MateArgs *args);
+
+#endif
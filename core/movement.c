@@ -1,5 +1,6 @@
 #include "movement_stats.h"
 #include "movement.h"
+#include "attacks.h"
 #include "log.h"
 
 #include <stdbool.h>
@@ -174,7 +175,8 @@ EMovementType pawn_movement_algorithm(Board board, int start, int target,
 			return MOVEMENT_ILLEGAL;
 		}
 		// No piece in the way?
-		if (board[target].type != PIECE_NONE) {
+		if (board[target].type != PIECE_NONE ||
+		    board[(start + target) / 2].type != PIECE_NONE) {
 			return MOVEMENT_ILLEGAL;
 		}
 		// Can move!
@@ -199,19 +201,17 @@ EMovementType pawn_movement_algorithm(Board board, int start, int target,
 		// Piece at target that is not our own?
 		if (board[target].type != PIECE_NONE &&
 		    board[start].colour != board[target].colour) {
+			if (end_row(board[start].colour, stats.target_y)) {
+				return MOVEMENT_PAWN_PROMOTION;
+			}
 			return MOVEMENT_PIECE_CAPTURE;
 		}
-		// En passant opportunity?
-		int dir = (stats.direction == DIRECTION_EAST ||
-			   stats.direction == DIRECTION_NORTH_EAST ||
-			   stats.direction == DIRECTION_NORTH_EAST)
-		  ? 1
-		  : -1;
-		// Target space has to be empty, enemy pawn the same row.
+		// En passant opportunity? Target space has to be the one the
+		// enemy pawn skipped with a long jump on the last move.
 		if (board[target].type == PIECE_NONE &&
-		    board[start].colour != board[start + dir].colour &&
-		    board[start + dir].type == PIECE_PAWN &&
-		    board[start + dir].last_move == move_count - 1) {
+		    target == get_en_passant_square(board,
+						    board[start].colour,
+						    move_count)) {
 			return MOVEMENT_PAWN_EN_PASSANT;
 		}
 		return MOVEMENT_ILLEGAL;
@@ -313,13 +313,22 @@ EMovementType king_movement_algorithm(Board board, int start, int target,
 
 		// Check there are no pieces in the way.
 		MoveStats rook_stats = get_move_stats(target + modifier,
-						      start +
-						      (stats.direction ==
-						       DIRECTION_EAST ? 1 : -1));
+						      start);
 		if (!parallel_movement(board,
 				       &rook_stats)) {
 			return MOVEMENT_ILLEGAL;
 		}
+
+		// The king cannot pass through or land on an attacked square.
+		EPlayerColour opponent = (king->colour + 1) %
+					 PLAYER_NUM_COLOURS;
+		int step = stats.direction == DIRECTION_EAST ? 1 : -1;
+		for (int square = start; square != target + step;
+		     square += step) {
+			if (is_square_attacked(board, square, opponent)) {
+				return MOVEMENT_ILLEGAL;
+			}
+		}
 		return MOVEMENT_KING_CASTLE;
 	}
 
@@ -4,15 +4,29 @@
 #include "movement_stats.h"
 #include "board.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 
-#define MAX_POSSIBLE_MOVES 24
+// A queen in the middle of an empty board has 27 moves.
+#define MAX_POSSIBLE_MOVES 28
+// No position has more than 218 legal moves.
+#define MAX_LEGAL_MOVES 256
 
 typedef struct {
 	EMovementType type;
 	int target;
 } PossibleMove;
 
+// A fully specified move, compact enough to store in bulk.
+typedef struct {
+	uint8_t origin;
+	uint8_t target;
+	// EMovementType.
+	uint8_t type;
+	// EChessPiece to promote to, PIECE_NONE otherwise.
+	uint8_t promotion;
+} Move;
+
 EMovementType none_movement_algorithm(
 	Board board, int start, int target, size_t move_count, size_t check);
 EMovementType pawn_movement_algorithm(
@@ -0,0 +1,304 @@
+#include "perft.h"
+#include "fen.h"
+#include "position.h"
+#include "timing.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Subtree counts never get near 2^56, the depth lives in the top byte.
+#define PERFT_DEPTH_SHIFT 56
+#define PERFT_NODES_MASK ((1ULL << PERFT_DEPTH_SHIFT) - 1)
+// Split two plies deep from this depth so every worker stays busy.
+#define PERFT_SPLIT_DEPTH 4
+
+// Lockless entry, check holds key ^ data so a torn write never matches.
+typedef struct {
+	_Atomic uint64_t check;
+	_Atomic uint64_t data;
+} PerftEntry;
+
+typedef struct {
+	PerftEntry *entries;
+	size_t mask;
+} PerftCache;
+
+typedef struct {
+	Position position;
+	// Which root move this subtree belongs to.
+	size_t root;
+	uint64_t nodes;
+} PerftWork;
+
+typedef struct {
+	PerftWork *work;
+	size_t num_work;
+	atomic_size_t next;
+	// Depth left below each work item.
+	size_t depth;
+	PerftCache *cache;
+} PerftJob;
+
+typedef struct {
+	PerftJob *job;
+	pthread_t thread;
+	size_t items;
+	uint64_t nodes;
+	double busy;
+} PerftWorker;
+
+/**
+ * Count the leaf nodes of the move tree, the plain single threaded version.
+ */
+uint64_t perft(Position *position, size_t depth)
+{
+	if (depth == 0)
+		return 1;
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	if (depth == 1)
+		return num_moves;
+
+	uint64_t nodes = 0;
+	for (size_t i = 0; i < num_moves; i++) {
+		Position child = *position;
+		make_move(&child, moves[i]);
+		nodes += perft(&child, depth - 1);
+	}
+	return nodes;
+}
+
+static uint64_t perft_cached(Position *position, size_t depth,
+			     PerftCache *cache)
+{
+	if (depth == 0)
+		return 1;
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	if (depth == 1)
+		return num_moves;
+
+	uint64_t key = 0;
+	PerftEntry *entry = NULL;
+	if (cache->entries != NULL) {
+		key = hash_position(position);
+		entry = &cache->entries[key & cache->mask];
+		uint64_t data = atomic_load_explicit(&entry->data,
+						     memory_order_relaxed);
+		uint64_t check = atomic_load_explicit(&entry->check,
+						      memory_order_relaxed);
+		if ((check ^ data) == key &&
+		    data >> PERFT_DEPTH_SHIFT == depth)
+			return data & PERFT_NODES_MASK;
+	}
+
+	uint64_t nodes = 0;
+	for (size_t i = 0; i < num_moves; i++) {
+		Position child = *position;
+		make_move(&child, moves[i]);
+		nodes += perft_cached(&child, depth - 1, cache);
+	}
+
+	if (entry != NULL) {
+		uint64_t data = nodes | (uint64_t)depth << PERFT_DEPTH_SHIFT;
+		atomic_store_explicit(&entry->data, data,
+				      memory_order_relaxed);
+		atomic_store_explicit(&entry->check, key ^ data,
+				      memory_order_relaxed);
+	}
+	return nodes;
+}
+
+static void *perft_worker(void *arg)
+{
+	PerftWorker *worker = arg;
+	PerftJob *job = worker->job;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	size_t index;
+	while ((index = atomic_fetch_add(&job->next, 1)) < job->num_work) {
+		PerftWork *work = &job->work[index];
+		work->nodes = perft_cached(&work->position, job->depth,
+					   job->cache);
+		worker->nodes += work->nodes;
+		worker->items++;
+	}
+	worker->busy = elapsed_seconds(&start);
+	return NULL;
+}
+
+static PerftWork *add_work(PerftWork **work, size_t *num_work,
+			   size_t *capacity)
+{
+	if (*num_work == *capacity) {
+		size_t grown = *capacity ? *capacity * 2 : MAX_LEGAL_MOVES;
+		PerftWork *resized = realloc(*work, sizeof(PerftWork) * grown);
+		if (resized == NULL)
+			return NULL;
+		*work = resized;
+		*capacity = grown;
+	}
+	return &(*work)[(*num_work)++];
+}
+
+/**
+ * Break the tree into subtrees one or two plies below the root.
+ */
+static size_t split_work(Position *root, Move moves[MAX_LEGAL_MOVES],
+			 size_t num_moves, size_t plies, PerftWork **work)
+{
+	size_t num_work = 0;
+	size_t capacity = 0;
+	*work = NULL;
+	for (size_t i = 0; i < num_moves; i++) {
+		Position child = *root;
+		make_move(&child, moves[i]);
+		Move replies[MAX_LEGAL_MOVES];
+		size_t num_replies = plies == 1 ? 1 :
+				     generate_legal_moves(&child, replies);
+		for (size_t r = 0; r < num_replies; r++) {
+			PerftWork *item = add_work(work, &num_work, &capacity);
+			if (item == NULL) {
+				free(*work);
+				*work = NULL;
+				return 0;
+			}
+			item->position = child;
+			item->root = i;
+			item->nodes = 0;
+			if (plies > 1)
+				make_move(&item->position, replies[r]);
+		}
+	}
+	return num_work;
+}
+
+static bool init_cache(PerftCache *cache, size_t hash_mb)
+{
+	cache->entries = NULL;
+	cache->mask = 0;
+	if (hash_mb == 0)
+		return true;
+	// Round down to a power of two so we can mask instead of divide.
+	size_t num_entries = 1;
+	while (num_entries * 2 * sizeof(PerftEntry) <= hash_mb * 1024 * 1024)
+		num_entries *= 2;
+	cache->entries = calloc(num_entries, sizeof(PerftEntry));
+	if (cache->entries == NULL)
+		return false;
+	cache->mask = num_entries - 1;
+	return true;
+}
+
+/**
+ * Run one perft over a worker pool, filling in the per root move counts.
+ */
+static int run_perft_threads(Position *root, Move moves[MAX_LEGAL_MOVES],
+			     size_t num_moves, PerftArgs *args, size_t threads,
+			     uint64_t *root_nodes, bool report)
+{
+	PerftCache cache;
+	if (!init_cache(&cache, args->hash_mb)) {
+		ERROR_LOG("Unable to allocate %zu MB perft hash\n",
+			  args->hash_mb);
+		return 0;
+	}
+
+	size_t plies = args->depth >= PERFT_SPLIT_DEPTH && threads > 1 ? 2 : 1;
+	PerftJob job = { .depth = args->depth - plies, .cache = &cache };
+	atomic_init(&job.next, 0);
+	job.num_work = split_work(root, moves, num_moves, plies, &job.work);
+	PerftWorker *workers = calloc(threads, sizeof(PerftWorker));
+	if ((job.work == NULL && num_moves > 0) || workers == NULL) {
+		ERROR_LOG("Unable to allocate perft work\n");
+		free(job.work);
+		free(workers);
+		free(cache.entries);
+		return 0;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t t = 0; t < threads; t++) {
+		workers[t].job = &job;
+		pthread_create(&workers[t].thread, NULL, perft_worker,
+			       &workers[t]);
+	}
+	for (size_t t = 0; t < threads; t++)
+		pthread_join(workers[t].thread, NULL);
+	double seconds = elapsed_seconds(&start);
+
+	uint64_t total = 0;
+	memset(root_nodes, 0, sizeof(uint64_t) * num_moves);
+	for (size_t i = 0; i < job.num_work; i++)
+		root_nodes[job.work[i].root] += job.work[i].nodes;
+	for (size_t i = 0; i < num_moves; i++)
+		total += root_nodes[i];
+
+	INFO_LOG("Threads: %zu, nodes: %lu, time: %.3fs, nps: %.0f\n",
+		 threads, total, seconds, seconds > 0 ? total / seconds : 0);
+	for (size_t t = 0; report && t < threads; t++) {
+		INFO_LOG("  thread %zu: %zu subtrees, %lu nodes, busy %.3fs, "
+			 "%.0f nps\n", t, workers[t].items, workers[t].nodes,
+			 workers[t].busy,
+			 workers[t].busy > 0 ? workers[t].nodes /
+			 workers[t].busy : 0);
+	}
+
+	free(job.work);
+	free(workers);
+	free(cache.entries);
+	return 1;
+}
+
+int run_perft(PerftArgs *args)
+{
+	Position root;
+	if (!parse_fen(args->fen, &root)) {
+		ERROR_LOG("Invalid FEN: %s\n", args->fen);
+		return 0;
+	}
+	if (args->threads < 1)
+		args->threads = 1;
+
+	INFO_LOG("Perft depth %zu: %s\n", args->depth, args->fen);
+	if (args->depth == 0) {
+		INFO_LOG("Nodes: 1\n");
+		return 1;
+	}
+
+	Move moves[MAX_LEGAL_MOVES];
+	uint64_t root_nodes[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(&root, moves);
+
+	if (args->scaling) {
+		for (size_t threads = 1; threads < args->threads;
+		     threads *= 2) {
+			if (!run_perft_threads(&root, moves, num_moves, args,
+					       threads, root_nodes, false))
+				return 0;
+		}
+	}
+	if (!run_perft_threads(&root, moves, num_moves, args, args->threads,
+			       root_nodes, true))
+		return 0;
+
+	// Divide, per root move counts for comparing against other engines.
+	uint64_t total = 0;
+	for (size_t i = 0; i < num_moves; i++) {
+		char move[MOVE_COORDS_LENGTH];
+		format_move_coords(moves[i], move);
+		INFO_LOG("%s: %lu\n", move, root_nodes[i]);
+		total += root_nodes[i];
+	}
+	INFO_LOG("Moves: %zu\nNodes: %lu\n", num_moves, total);
+	return 1;
+}
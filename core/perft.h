@@ -0,0 +1,26 @@
+#ifndef _PERFT_H
+#define _PERFT_H
+
+#include "position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PERFT_DEFAULT_HASH_MB 64
+
+typedef struct {
+	const char *fen;
+	size_t depth;
+	// Worker threads, the root is split across them.
+	size_t threads;
+	// Subtree count cache size, 0 to disable.
+	size_t hash_mb;
+	// Repeat the run with 1, 2, 4... threads up to threads.
+	bool scaling;
+} PerftArgs;
+
+uint64_t perft(Position *position, size_t depth);
+int run_perft(PerftArgs *args);
+
+#endif
@@ -1,184 +1,631 @@
-#include "pieces.h"
-#include "display.h"
-#include "replay.h"
-#include "san.h"
 #include "pgn.h"
+#include "fen.h"
+#include "san.h"
 #include "log.h"
 
-#include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-static inline bool valid_char_pairing(char x, char y)
+const char *GAME_RESULT_STRINGS[GAME_RESULT_NUM_TYPES] = {
+	[GAME_RESULT_UNKNOWN] = "*",
+	[GAME_RESULT_WHITE_WIN] = "1-0",
+	[GAME_RESULT_BLACK_WIN] = "0-1",
+	[GAME_RESULT_DRAW] = "1/2-1/2",
+};
+
+bool init_pgn_reader_stream(PgnReader *reader, int fd)
 {
-	return !(tolower(x) < 'a' || tolower(x) > 'a' + BOARD_SIZE || y < '0' ||
-		 y > '0' + BOARD_SIZE);
+	memset(reader, 0, sizeof(PgnReader));
+	reader->fd = fd;
+	reader->capacity = PGN_STREAM_BUFFER_SIZE;
+	reader->buffer = malloc(reader->capacity);
+	reader->data = reader->buffer;
+	return reader->buffer != NULL;
 }
 
-static void set_msg(SanData* san_data, char *input_buffer,
-		    size_t *input_pointer)
+void init_pgn_reader_memory(PgnReader *reader, const char *data, size_t size)
 {
-	// Convert coordinates to our format and write to input buffer.
-	snprintf(input_buffer, 6, "%c%c %c%c",
-		 san_data->origin[0] + 'a', san_data->origin[1] + '1',
-		 san_data->destination[0] + 'a',
-		 san_data->destination[1] + '1');
-	*input_pointer = 5;
+	memset(reader, 0, sizeof(PgnReader));
+	reader->fd = -1;
+	reader->data = data;
+	reader->size = size;
 }
 
-// Determine the origin if missing of a sans formatted.
-void determine_origin(SanData *san_data, ChessGame *game)
+/**
+ * Put text back in front of a stream's unread text, such as the characters a
+ * caller read from the descriptor to tell what it holds.
+ */
+bool unread_pgn_text(PgnReader *reader, const char *text, size_t length)
 {
-	debug_show_piece((PlayPiece) { .colour = san_data->colour,
-				       .type = san_data->piece });
-	if (san_data->origin[0] != -1 && san_data->origin[1] != -1)
-		return;
+	size_t kept = reader->size - reader->pos;
+	if (reader->buffer == NULL || kept + length > reader->capacity)
+		return false;
+	memmove(reader->buffer + length, reader->buffer + reader->pos, kept);
+	memcpy(reader->buffer, text, length);
+	reader->pos = 0;
+	reader->size = kept + length;
+	return true;
+}
 
-	int destination_square = san_data->destination[0] +
-				 (san_data->destination[1] *
-				  BOARD_SIZE);
+/**
+ * Map a regular file whole, anything else such as a pipe is streamed. "-"
+ * reads standard input, which is mapped too if it is redirected from a file.
+ */
+bool open_pgn_reader(PgnReader *reader, const char *filepath)
+{
+	// The reader closes its descriptor, keep standard input open.
+	int fd = strcmp(filepath, PGN_STDIN_PATH) == 0 ?
+		 dup(STDIN_FILENO) : open(filepath, O_RDONLY);
+	if (fd < 0) {
+		ERROR_LOG("Unable to open %s\n", filepath);
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+	    info.st_size > 0) {
+		void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE,
+				  fd, 0);
+		if (data != MAP_FAILED) {
+			madvise(data, info.st_size, MADV_SEQUENTIAL);
+			close(fd);
+			init_pgn_reader_memory(reader, data, info.st_size);
+			reader->mapped = true;
+			return true;
+		}
+	}
+	if (!init_pgn_reader_stream(reader, fd)) {
+		ERROR_LOG("Unable to allocate a buffer for %s\n", filepath);
+		close(fd);
+		return false;
+	}
+	return true;
+}
 
-	// Now we need to use the board to determine the full coordinates.
-	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
-		// We have found our start location, we are done here.
-		if ((san_data->origin[0] != -1 &&
-		     san_data->origin[1] != -1)) {
-			break;
+void close_pgn_reader(PgnReader *reader)
+{
+	if (reader->mapped)
+		munmap((void *)reader->data, reader->size);
+	free(reader->buffer);
+	if (reader->fd >= 0)
+		close(reader->fd);
+	memset(reader, 0, sizeof(PgnReader));
+	reader->fd = -1;
+}
+
+/**
+ * Read more of a stream, keeping the unconsumed text and moving it to the
+ * front of the buffer. Returns false at the end of the text.
+ */
+static bool refill(PgnReader *reader)
+{
+	if (reader->buffer == NULL || reader->eof)
+		return false;
+	size_t kept = reader->size - reader->pos;
+	reader->consumed += reader->pos;
+	memmove(reader->buffer, reader->buffer + reader->pos, kept);
+	reader->pos = 0;
+	reader->size = kept;
+	if (kept == reader->capacity) {
+		char *buffer = realloc(reader->buffer, reader->capacity * 2);
+		if (buffer == NULL)
+			return false;
+		reader->buffer = buffer;
+		reader->data = buffer;
+		reader->capacity *= 2;
+	}
+
+	ssize_t count;
+	do {
+		count = read(reader->fd, reader->buffer + reader->size,
+			     reader->capacity - reader->size);
+	} while (count < 0 && errno == EINTR);
+	if (count <= 0) {
+		reader->eof = true;
+		return false;
+	}
+	reader->size += count;
+	return true;
+}
+
+/**
+ * The character offset bytes past the current one, EOF past the end.
+ */
+static inline int peek(PgnReader *reader, size_t offset)
+{
+	while (reader->pos + offset >= reader->size) {
+		if (!refill(reader))
+			return EOF;
+	}
+	return (unsigned char)reader->data[reader->pos + offset];
+}
+
+/**
+ * Offset of the next given character from offset on, -1 if there is none.
+ */
+static ptrdiff_t find_char(PgnReader *reader, size_t offset, int current)
+{
+	for (;;) {
+		if (reader->pos + offset < reader->size) {
+			const char *found = memchr(
+				reader->data + reader->pos + offset, current,
+				reader->size - reader->pos - offset);
+			if (found != NULL)
+				return found - (reader->data + reader->pos);
+			offset = reader->size - reader->pos;
 		}
+		if (!refill(reader))
+			return -1;
+	}
+}
 
-		PlayPiece selected = game->board[i];
-		if (selected.colour != san_data->colour ||
-		    selected.type != san_data->piece) {
-			continue;
+/**
+ * Consume the text up to and including the next given character, comments
+ * are dropped block by block so a stream never holds more than one.
+ */
+static void skip_past(PgnReader *reader, int end)
+{
+	for (;;) {
+		const char *found = memchr(reader->data + reader->pos, end,
+					   reader->size - reader->pos);
+		if (found != NULL) {
+			reader->pos = found - reader->data + 1;
+			return;
 		}
+		reader->pos = reader->size;
+		if (!refill(reader))
+			return;
+	}
+}
+
+static void skip_variation(PgnReader *reader)
+{
+	// Variations nest, and may hold comments with brackets in them.
+	int depth = 1;
+	int current;
+	while (depth > 0 && (current = peek(reader, 0)) != EOF) {
+		reader->pos++;
+		if (current == '(')
+			depth++;
+		else if (current == ')')
+			depth--;
+		else if (current == '{')
+			skip_past(reader, '}');
+	}
+}
 
-		game->selected_piece = i;
+static inline bool is_token_end(int current)
+{
+	return current == EOF || isspace(current) || current == '{' ||
+	       current == '(' || current == ')' || current == ';' ||
+	       current == '[';
+}
 
-		// Determine if it can make the proposed move.
-		game->num_possible_moves = get_possible_moves_for_piece(
-			game->board, game->selected_piece,
-			game->possible_moves,
-			game->move_count, game->check);
+/**
+ * A tag pair sits on one line, find its closing bracket outside the quoted
+ * value. Returns the offset of the bracket or of the end of the line.
+ */
+static size_t find_tag_end(PgnReader *reader)
+{
+	ptrdiff_t line = find_char(reader, 0, '\n');
+	size_t end = line < 0 ? reader->size - reader->pos : (size_t)line;
+	const char *text = reader->data + reader->pos;
+	size_t offset = 0;
+	for (;;) {
+		const char *bracket = memchr(text + offset, ']', end - offset);
+		const char *quote = memchr(text + offset, '"', end - offset);
+		if (bracket == NULL)
+			return end;
+		if (quote == NULL || bracket < quote)
+			return bracket - text;
+		// Skip the value, its quotes may be escaped.
+		offset = quote - text + 1;
+		while (offset < end && text[offset] != '"')
+			offset += text[offset] == '\\' ? 2 : 1;
+		if (offset >= end)
+			return end;
+		offset++;
+	}
+}
 
-		for (size_t j = 0; j < game->num_possible_moves; j++) {
-			if (game->possible_moves[j].target !=
-			    destination_square) {
+/**
+ * Hand out the next tag or symbol, skipping comments, variations and
+ * annotation glyphs. Tokens point into the reader's text, nothing is copied.
+ */
+static void next_token(PgnReader *reader, PgnToken *token)
+{
+	if (reader->has_pending) {
+		*token = reader->pending;
+		reader->has_pending = false;
+		return;
+	}
+	int current;
+	while ((current = peek(reader, 0)) != EOF) {
+		switch (current) {
+		case '[': {
+			reader->pos++;
+			size_t length = find_tag_end(reader);
+			token->type = PGN_TOKEN_TAG;
+			token->start = reader->data + reader->pos;
+			token->length = length;
+			// The bracket is already buffered if there is one.
+			reader->pos += length;
+			if (reader->pos < reader->size &&
+			    reader->data[reader->pos] == ']')
+				reader->pos++;
+			return;
+		}
+		case '{':
+			reader->pos++;
+			skip_past(reader, '}');
+			continue;
+		case ';':
+		case '%':
+			skip_past(reader, '\n');
+			continue;
+		case '(':
+			reader->pos++;
+			skip_variation(reader);
+			continue;
+		case ')':
+			reader->pos++;
+			continue;
+		case '$':
+			// Numeric annotation glyph.
+			reader->pos++;
+			while (isdigit(peek(reader, 0)))
+				reader->pos++;
+			continue;
+		default:
+			if (isspace(current)) {
+				reader->pos++;
 				continue;
 			}
-			san_data->origin[0] = i % BOARD_SIZE;
-			san_data->origin[1] = i / BOARD_SIZE;
 			break;
 		}
+
+		size_t length = 1;
+		while (!is_token_end(peek(reader, length)))
+			length++;
+		token->type = PGN_TOKEN_SYMBOL;
+		token->start = reader->data + reader->pos;
+		token->length = length;
+		reader->pos += length;
+		return;
 	}
+	token->type = PGN_TOKEN_END;
+	token->start = NULL;
+	token->length = 0;
+}
 
-	if (san_data->origin[0] == -1 || san_data->origin[1] == -1) {
-		ERROR_LOG("\n!!!!\n!!!!!Unable to determine origin!!!!!\n!!!!\n");
-		ERROR_LOG("%c%c\n", san_data->destination[0] + 'a',
-			  san_data->destination[1] + '1');
-		view_board(game->board, game->selected_piece,
-			   game->num_possible_moves, game->possible_moves);
-	}
-}
-
-EReplayInput read_pgn_move(FILE *file, ChessGame *game,
-			   char *input_buffer,
-			   size_t *input_pointer)
-{
-	static int move_num;
-	static SanData cached_move;
-	// Are we dealing with a cached move?
-	if (move_num != 0) {
-		move_num = 0;
-		determine_origin(&cached_move, game);
-		if (cached_move.origin[0] == -1 ||
-		    cached_move.destination[0] == -1)
-			return REPLAY_INPUT_INVALID;
-
-		set_msg(&cached_move, input_buffer, input_pointer);
-		return REPLAY_INPUT_COORDS;
-	}
-
-// Reasonable size, we don't expect more than 10000 moves.
-	char move_number[5];
-	memset(move_number, '\0', 5);
-	int move_number_len = 0;
-	char current;
-// printf("move_umber\n");
-	while (1) {
-		current = fgetc(file);
-		// Game ongoing but replay is finished.
-		if (current == '*') {
-			DEBUG_LOG("REPLAY OVER, GAME ONGOING\n");
-			return REPLAY_INPUT_REPLAY_OVER;
+static EGameResult token_to_result(const char *token, size_t length)
+{
+	for (EGameResult result = GAME_RESULT_UNKNOWN;
+	     result < GAME_RESULT_NUM_TYPES; result++) {
+		const char *string = GAME_RESULT_STRINGS[result];
+		if (strlen(string) == length &&
+		    memcmp(token, string, length) == 0)
+			return result;
+	}
+	return GAME_RESULT_NUM_TYPES;
+}
+
+/**
+ * Apply one movetext token, a SAN move optionally prefixed by its move
+ * number, e.g. "12.Nf3" or "12...". Marks the game invalid if the move cannot
+ * be played.
+ */
+static void apply_pgn_token(PgnGame *game, Position *position,
+			    const char *token, size_t length)
+{
+	// Strip the move number.
+	size_t start = 0;
+	while (start < length && isdigit(token[start]))
+		start++;
+	if (start < length && token[start] == '.') {
+		while (start < length && token[start] == '.')
+			start++;
+	} else {
+		start = 0;
+	}
+	if (start == length || !game->valid)
+		return;
+
+	SanData san;
+	Move move;
+	if (game->num_moves >= PGN_MAX_PLIES ||
+	    !parse_san(token + start, length - start, position->turn, &san) ||
+	    !resolve_san(position, &san, &move)) {
+		game->valid = false;
+		return;
+	}
+	game->moves[game->num_moves++] = move;
+	make_move(position, move);
+}
+
+/**
+ * Parse a tag pair such as [Event "Casual game"] from the inside of its
+ * brackets. Quotes and backslashes in the value may be escaped.
+ */
+static void parse_pgn_tag(const char *text, size_t length, PgnGame *game)
+{
+	PgnTag discard;
+	PgnTag *tag = game->num_tags < PGN_MAX_TAGS ?
+		      &game->tags[game->num_tags] : &discard;
+	size_t i = 0;
+	while (i < length && isspace(text[i]))
+		i++;
+	size_t name_length = 0;
+	while (i < length && !isspace(text[i]) && text[i] != '"') {
+		if (name_length < PGN_MAX_TAG_NAME_LEN - 1)
+			tag->name[name_length++] = text[i];
+		i++;
+	}
+	tag->name[name_length] = '\0';
+
+	const char *quote = memchr(text + i, '"', length - i);
+	size_t value_length = 0;
+	if (quote != NULL) {
+		for (i = quote - text + 1; i < length && text[i] != '"'; i++) {
+			if (text[i] == '\\' && ++i == length)
+				break;
+			if (value_length < PGN_MAX_TAG_VALUE_LEN - 1)
+				tag->value[value_length++] = text[i];
 		}
-		if (move_number_len == 1) {
-			// Game is over and we have a result.
-			if (current == '-') {
-				EPlayerColour won = move_number[0] ==
-						    '0' ? COLOUR_WHITE :
-						    COLOUR_BLACK;
-				// DEBUG_LOG("REPLAY: GAME OVER, WINNER: %s\n",
-				// 	 PLAYER_COLOUR_STRINGS[won]);
-				return won ==
-				       COLOUR_WHITE ? REPLAY_INPUT_WIN_WHITE :
-				       REPLAY_INPUT_WIN_BLACK;
-			} else if (current == '/') {
-				// DEBUG_LOG("REPLAY: GAME OVER, DRAW\n");
-				return REPLAY_INPUT_DRAW;
-			}
+	}
+	tag->value[value_length] = '\0';
+	if (tag != &discard && name_length > 0)
+		game->num_tags++;
+}
+
+/**
+ * Value of the first tag with the given name, NULL if there is none.
+ */
+const char *get_pgn_tag(const PgnGame *game, const char *name)
+{
+	for (size_t i = 0; i < game->num_tags; i++) {
+		if (strcmp(game->tags[i].name, name) == 0)
+			return game->tags[i].value;
+	}
+	return NULL;
+}
+
+/**
+ * Add a tag to a game being built, longer names and values are cut short.
+ * Fails once the game has no room for more tags.
+ */
+bool add_pgn_tag(PgnGame *game, const char *name, const char *value)
+{
+	if (game->num_tags >= PGN_MAX_TAGS)
+		return false;
+	PgnTag *tag = &game->tags[game->num_tags++];
+	snprintf(tag->name, PGN_MAX_TAG_NAME_LEN, "%s", name);
+	snprintf(tag->value, PGN_MAX_TAG_VALUE_LEN, "%s", value);
+	return true;
+}
+
+/**
+ * The tags are all read by the first move, set up the FEN tag's position if
+ * there is one.
+ */
+static void start_movetext(PgnGame *game, Position *position)
+{
+	const char *fen = get_pgn_tag(game, "FEN");
+	if (fen != NULL && !parse_fen(fen, &game->start))
+		game->valid = false;
+	*position = game->start;
+}
+
+static void finish_game(PgnReader *reader, PgnGame *game, Position *position,
+			bool terminated)
+{
+	game->end = *position;
+	// Fall back on the Result tag if the movetext has no result.
+	const char *tag = get_pgn_tag(game, "Result");
+	if (!terminated && tag != NULL) {
+		EGameResult result = token_to_result(tag, strlen(tag));
+		if (result != GAME_RESULT_NUM_TYPES)
+			game->result = result;
+	}
+	reader->games++;
+}
+
+/**
+ * Read the next game, returns false once there are no games left. The reader
+ * only keeps its text, so any number of readers may run side by side and
+ * games are streamed one at a time.
+ */
+bool read_pgn_game(PgnReader *reader, PgnGame *game)
+{
+	game->num_tags = 0;
+	new_position(&game->start);
+	game->result = GAME_RESULT_UNKNOWN;
+	game->valid = true;
+	game->num_moves = 0;
+	Position position = game->start;
+
+	bool found = false;
+	bool movetext = false;
+	PgnToken token;
+	for (next_token(reader, &token); token.type != PGN_TOKEN_END;
+	     next_token(reader, &token)) {
+		if (!found) {
+			// Tags start one character earlier, at the bracket.
+			game->offset = reader->consumed +
+				       (token.start - reader->data) -
+				       (token.type == PGN_TOKEN_TAG);
+			found = true;
 		}
-		if (current >= '0' && current <= '9') {
-			if (move_number_len >= 4) {
-				ERROR_LOG("Invalid number of moves.\n");
-				return REPLAY_INPUT_INVALID;
+		if (token.type == PGN_TOKEN_TAG) {
+			// A tag after movetext starts the next game.
+			if (movetext) {
+				reader->pending = token;
+				reader->has_pending = true;
+				finish_game(reader, game, &position, false);
+				return true;
 			}
-			move_number[move_number_len] = current;
-			move_number_len++;
-		} else if (current == '.') {
-			break;
+			parse_pgn_tag(token.start, token.length, game);
+			continue;
 		}
+		if (!movetext) {
+			movetext = true;
+			start_movetext(game, &position);
+		}
+
+		EGameResult result = token_to_result(token.start, token.length);
+		if (result != GAME_RESULT_NUM_TYPES) {
+			game->result = result;
+			finish_game(reader, game, &position, true);
+			return true;
+		}
+		if (!reader->skip_moves)
+			apply_pgn_token(game, &position, token.start,
+					token.length);
+	}
+	if (found) {
+		if (!movetext)
+			start_movetext(game, &position);
+		finish_game(reader, game, &position, false);
+	}
+	return found;
+}
+
+bool open_pgn_writer(PgnWriter *writer, const char *filepath)
+{
+	writer->fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	writer->length = 0;
+	writer->column = 0;
+	writer->failed = false;
+	writer->games = 0;
+	if (writer->fd < 0) {
+		ERROR_LOG("Unable to open %s\n", filepath);
+		return false;
 	}
+	return true;
+}
 
-	// Set move num.
-	move_num = atoi(move_number);
-	SanData san_data[2] = { EMPTY_SAN_DATA, EMPTY_SAN_DATA };
+static void flush_pgn_writer(PgnWriter *writer)
+{
+	size_t written = 0;
+	while (!writer->failed && written < writer->length) {
+		ssize_t count = write(writer->fd, writer->buffer + written,
+				      writer->length - written);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			writer->failed = true;
+		else
+			written += count;
+	}
+	writer->length = 0;
+}
 
-	// Parse san moves.
-	read_san_moves(file, (SanData *)&san_data);
-	cached_move = san_data[1];
+static void put_text(PgnWriter *writer, const char *text, size_t length)
+{
+	while (length > 0) {
+		if (writer->length == PGN_WRITER_BUFFER_SIZE)
+			flush_pgn_writer(writer);
+		size_t count = PGN_WRITER_BUFFER_SIZE - writer->length;
+		if (count > length)
+			count = length;
+		memcpy(writer->buffer + writer->length, text, count);
+		writer->length += count;
+		text += count;
+		length -= count;
+	}
+}
 
-	determine_origin(&san_data[0], game);
-	if (san_data[0].origin[0] == -1 || san_data[0].destination[0] == -1)
-		return REPLAY_INPUT_INVALID;
-	set_msg(&san_data[0], input_buffer, input_pointer);
-	return REPLAY_INPUT_COORDS;
+/**
+ * Movetext tokens are separated by spaces and wrapped into lines.
+ */
+static void put_token(PgnWriter *writer, const char *token, size_t length)
+{
+	if (writer->column > 0 &&
+	    writer->column + 1 + length >= PGN_LINE_LENGTH) {
+		put_text(writer, "\n", 1);
+		writer->column = 0;
+	} else if (writer->column > 0) {
+		put_text(writer, " ", 1);
+		writer->column++;
+	}
+	put_text(writer, token, length);
+	writer->column += length;
 }
 
-EReplayInput parse_pgn_input(FILE *file, ChessGame *game, char *input_buffer,
-			     size_t *input_pointer)
+static void put_tag(PgnWriter *writer, const char *name, const char *value)
 {
-	// Read the first character to determine if we are dealing with a comment
-	// or some metadata.
-	char first = fgetc(file);
-	// Rewind.
-	fseek(file, -1, SEEK_CUR);
-	if (first == EOF) {
-		return REPLAY_INPUT_EOF;
+	put_text(writer, "[", 1);
+	put_text(writer, name, strlen(name));
+	put_text(writer, " \"", 2);
+	for (const char *current = value; *current; current++) {
+		if (*current == '"' || *current == '\\')
+			put_text(writer, "\\", 1);
+		put_text(writer, current, 1);
 	}
+	put_text(writer, "\"]\n", 3);
+}
 
-	if (first == '[' || first == '{' || first == ';') {
-		read_line_from_file(file, input_buffer, input_pointer);
-		return REPLAY_INPUT_COMMENT;
+/**
+ * Write a game in export format: its tags, plus the Result and the FEN of a
+ * non standard start if it does not have them, then the movetext in SAN. An
+ * invalid game's legal moves are followed by a comment marking the illegal
+ * one.
+ */
+bool write_pgn_game(PgnWriter *writer, const PgnGame *game)
+{
+	for (size_t i = 0; i < game->num_tags; i++)
+		put_tag(writer, game->tags[i].name, game->tags[i].value);
+	const char *result = GAME_RESULT_STRINGS[game->result];
+	if (get_pgn_tag(game, "Result") == NULL)
+		put_tag(writer, "Result", result);
+	char fen[FEN_MAX_LENGTH];
+	Position position = game->start;
+	format_fen(&position, fen);
+	if (get_pgn_tag(game, "FEN") == NULL && strcmp(fen, STARTING_FEN)) {
+		put_tag(writer, "SetUp", "1");
+		put_tag(writer, "FEN", fen);
 	}
+	put_text(writer, "\n", 1);
 
-	return read_pgn_move(file, game, input_buffer, input_pointer);
+	writer->column = 0;
+	char token[SAN_MAX_LENGTH + 24];
+	for (size_t i = 0; i < game->num_moves; i++) {
+		size_t number = position.move_count / 2 + 1;
+		if (position.turn == COLOUR_WHITE)
+			put_token(writer, token,
+				  sprintf(token, "%zu.", number));
+		else if (i == 0)
+			put_token(writer, token,
+				  sprintf(token, "%zu...", number));
+		put_token(writer, token,
+			  move_to_san(&position, game->moves[i], token));
+		make_move(&position, game->moves[i]);
+	}
+	// The moves stop short of an invalid game's end, say so instead of
+	// writing a shorter game that looks legal.
+	if (!game->valid)
+		put_token(writer, token,
+			  sprintf(token, "{illegal move at ply %zu}",
+				  game->num_moves + 1));
+	put_token(writer, result, strlen(result));
+	put_text(writer, "\n\n", 2);
+	writer->games++;
+	return !writer->failed;
 }
 
-EReplayInput read_next_move_pgn(FILE *file, ChessGame *game,
-				char *input_buffer,
-				size_t *input_pointer)
+/**
+ * Flush and close the file, false if any game could not be written.
+ */
+bool close_pgn_writer(PgnWriter *writer)
 {
-	return parse_pgn_input(file, game,
-			       input_buffer,
-			       input_pointer);
+	flush_pgn_writer(writer);
+	if (close(writer->fd) != 0)
+		writer->failed = true;
+	writer->fd = -1;
+	return !writer->failed;
 }
@@ -1,12 +1,127 @@
 #ifndef PGN_H
 #define PGN_H
 
-#include "replay.h"
-#include "game.h"
+#include "movement.h"
+#include "position.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 
-EReplayInput read_next_move_pgn(FILE *file, ChessGame *game, char *input_buffer,
-				size_t *input_pointer);
+// Longer games are cut short and marked invalid.
+#define PGN_MAX_PLIES 1024
+// Streams are read in blocks of this size, grown for longer tokens.
+#define PGN_STREAM_BUFFER_SIZE (1 << 20)
+// Written games are buffered in blocks of this size.
+#define PGN_WRITER_BUFFER_SIZE (1 << 16)
+// Read from standard input instead of a file.
+#define PGN_STDIN_PATH "-"
+// Movetext is wrapped before this column, as the export format asks.
+#define PGN_LINE_LENGTH 80
+// Further tags are skipped, longer names and values are cut short.
+#define PGN_MAX_TAGS 32
+#define PGN_MAX_TAG_NAME_LEN 32
+#define PGN_MAX_TAG_VALUE_LEN 256
+
+typedef enum {
+	GAME_RESULT_UNKNOWN,
+	GAME_RESULT_WHITE_WIN,
+	GAME_RESULT_BLACK_WIN,
+	GAME_RESULT_DRAW,
+	GAME_RESULT_NUM_TYPES
+} EGameResult;
+
+extern const char *GAME_RESULT_STRINGS[GAME_RESULT_NUM_TYPES];
+
+typedef enum {
+	PGN_TOKEN_END,
+	// The inside of a tag pair, without the brackets.
+	PGN_TOKEN_TAG,
+	// A move, move number or result.
+	PGN_TOKEN_SYMBOL,
+} EPgnToken;
+
+// A slice of the reader's text, valid until the next token is read.
+typedef struct {
+	EPgnToken type;
+	const char *start;
+	size_t length;
+} PgnToken;
+
+/**
+ * Reads game after game from PGN text, all parser state lives here. The text
+ * is either whole in memory, usually a mapped file, or streamed through a
+ * buffer from a descriptor.
+ */
+typedef struct {
+	const char *data;
+	size_t size;
+	size_t pos;
+	// Streams only, -1 and NULL otherwise.
+	int fd;
+	char *buffer;
+	size_t capacity;
+	bool eof;
+	bool mapped;
+	// Text dropped from the front of a stream's buffer, so offsets into
+	// data are offsets into the whole text.
+	size_t consumed;
+	// Only read the tags, movetext is scanned for the end of the game but
+	// its moves are not played.
+	bool skip_moves;
+	// A tag read past the end of a game, handed out first next time.
+	bool has_pending;
+	PgnToken pending;
+	// Games read so far.
+	size_t games;
+} PgnReader;
+
+typedef struct {
+	char name[PGN_MAX_TAG_NAME_LEN];
+	char value[PGN_MAX_TAG_VALUE_LEN];
+} PgnTag;
+
+// Writes games to a PGN file through a buffer, one write per block.
+typedef struct {
+	int fd;
+	char buffer[PGN_WRITER_BUFFER_SIZE];
+	size_t length;
+	// Column of the movetext line being written.
+	size_t column;
+	// Set once a write fails, later games are dropped.
+	bool failed;
+	// Games written so far.
+	size_t games;
+} PgnWriter;
+
+// One game, reused from game to game by the caller.
+typedef struct {
+	// Of the game's first tag or move in the reader's text.
+	size_t offset;
+	size_t num_tags;
+	PgnTag tags[PGN_MAX_TAGS];
+	// The standard position, or the FEN tag's.
+	Position start;
+	// After the last move that could be played.
+	Position end;
+	EGameResult result;
+	// False if a move could not be parsed or was illegal, the moves up to
+	// that point are kept.
+	bool valid;
+	size_t num_moves;
+	Move moves[PGN_MAX_PLIES];
+} PgnGame;
+
+bool open_pgn_reader(PgnReader *reader, const char *filepath);
+bool init_pgn_reader_stream(PgnReader *reader, int fd);
+bool unread_pgn_text(PgnReader *reader, const char *text, size_t length);
+void init_pgn_reader_memory(PgnReader *reader, const char *data, size_t size);
+void close_pgn_reader(PgnReader *reader);
+bool read_pgn_game(PgnReader *reader, PgnGame *game);
+const char *get_pgn_tag(const PgnGame *game, const char *name);
+bool add_pgn_tag(PgnGame *game, const char *name, const char *value);
+bool open_pgn_writer(PgnWriter *writer, const char *filepath);
+bool write_pgn_game(PgnWriter *writer, const PgnGame *game);
+bool close_pgn_writer(PgnWriter *writer);
 
 #endif
@@ -0,0 +1,291 @@
+#include "pgn_batch.h"
+#include "log.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+	BATCH_EMPTY,
+	// Its text is known, waiting for a worker.
+	BATCH_SPLIT,
+	BATCH_PARSING,
+	BATCH_PARSED,
+} EBatchState;
+
+typedef struct {
+	EBatchState state;
+	const char *text;
+	size_t size;
+	// Of the text in the file, game offsets are made relative to the file.
+	size_t offset;
+	PgnGame *games;
+	size_t num_games;
+	size_t capacity;
+	bool failed;
+} PgnBatch;
+
+/**
+ * One thread splits the text into batches of games, the workers parse them
+ * and the calling thread hands them out in order. Batches cycle through a
+ * ring of slots so that only a few are in memory at once.
+ */
+typedef struct {
+	const char *data;
+	size_t size;
+	PgnBatch *batches;
+	size_t num_batches;
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	// Sequence numbers of the next batch to split and to parse.
+	size_t next_split;
+	size_t next_parse;
+	bool split_done;
+	bool stopped;
+} PgnPipeline;
+
+/**
+ * Offset where the game following the next few starts, or the end of the
+ * text. Like the reader, a game ends at a tag after movetext; comments and
+ * variations are followed so that brackets in them do not count.
+ */
+static size_t find_batch_end(const char *data, size_t size, size_t pos,
+			     size_t games)
+{
+	bool movetext = false;
+	bool comment = false;
+	size_t depth = 0;
+	while (pos < size) {
+		const char *newline = memchr(data + pos, '\n', size - pos);
+		size_t end = newline ? (size_t)(newline - data) + 1 : size;
+		if (!comment && depth == 0 && data[pos] == '[') {
+			if (movetext && --games == 0)
+				return pos;
+			movetext = false;
+			pos = end;
+			continue;
+		}
+
+		for (size_t i = pos; i < end; i++) {
+			if (comment) {
+				const char *close = memchr(data + i, '}',
+							   end - i);
+				if (close == NULL)
+					break;
+				i = close - data;
+				comment = false;
+				continue;
+			}
+			switch (data[i]) {
+			case '{':
+				comment = true;
+				break;
+			case '(':
+				depth++;
+				break;
+			case ')':
+				if (depth > 0)
+					depth--;
+				break;
+			case ';':
+			case '%':
+				i = end;
+				break;
+			default:
+				if (!isspace((unsigned char)data[i]))
+					movetext = true;
+				break;
+			}
+		}
+		pos = end;
+	}
+	return size;
+}
+
+static void parse_batch(PgnBatch *batch)
+{
+	PgnReader reader;
+	init_pgn_reader_memory(&reader, batch->text, batch->size);
+	batch->num_games = 0;
+	for (;;) {
+		if (batch->num_games == batch->capacity) {
+			size_t capacity = batch->capacity ?
+					  batch->capacity * 2 : PGN_BATCH_GAMES;
+			PgnGame *games = realloc(batch->games,
+						 capacity * sizeof(PgnGame));
+			if (games == NULL) {
+				batch->failed = true;
+				break;
+			}
+			batch->games = games;
+			batch->capacity = capacity;
+		}
+		PgnGame *game = &batch->games[batch->num_games];
+		if (!read_pgn_game(&reader, game))
+			break;
+		game->offset += batch->offset;
+		batch->num_games++;
+	}
+	close_pgn_reader(&reader);
+}
+
+static void *split_worker(void *arg)
+{
+	PgnPipeline *pipeline = arg;
+	size_t pos = 0;
+	for (size_t sequence = 0; pos < pipeline->size; sequence++) {
+		size_t end = find_batch_end(pipeline->data, pipeline->size,
+					    pos, PGN_BATCH_GAMES);
+		PgnBatch *batch = &pipeline->batches[sequence %
+						     pipeline->num_batches];
+		pthread_mutex_lock(&pipeline->mutex);
+		while (batch->state != BATCH_EMPTY && !pipeline->stopped)
+			pthread_cond_wait(&pipeline->changed, &pipeline->mutex);
+		if (pipeline->stopped) {
+			pthread_mutex_unlock(&pipeline->mutex);
+			break;
+		}
+		batch->text = pipeline->data + pos;
+		batch->size = end - pos;
+		batch->offset = pos;
+		batch->state = BATCH_SPLIT;
+		pipeline->next_split = sequence + 1;
+		pthread_cond_broadcast(&pipeline->changed);
+		pthread_mutex_unlock(&pipeline->mutex);
+		pos = end;
+	}
+
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->split_done = true;
+	pthread_cond_broadcast(&pipeline->changed);
+	pthread_mutex_unlock(&pipeline->mutex);
+	return NULL;
+}
+
+static void *parse_worker(void *arg)
+{
+	PgnPipeline *pipeline = arg;
+	pthread_mutex_lock(&pipeline->mutex);
+	for (;;) {
+		while (!pipeline->stopped && !pipeline->split_done &&
+		       pipeline->next_parse == pipeline->next_split)
+			pthread_cond_wait(&pipeline->changed, &pipeline->mutex);
+		if (pipeline->stopped ||
+		    pipeline->next_parse == pipeline->next_split)
+			break;
+		PgnBatch *batch = &pipeline->batches[pipeline->next_parse %
+						     pipeline->num_batches];
+		pipeline->next_parse++;
+		batch->state = BATCH_PARSING;
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		parse_batch(batch);
+
+		pthread_mutex_lock(&pipeline->mutex);
+		batch->state = BATCH_PARSED;
+		pthread_cond_broadcast(&pipeline->changed);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+	return NULL;
+}
+
+/**
+ * Hand the parsed batches to the handler in file order. Returns false if the
+ * handler stopped the read or a batch could not be parsed.
+ */
+static bool consume_batches(PgnPipeline *pipeline, PgnGameHandler handler,
+			    void *context)
+{
+	bool ok = true;
+	for (size_t sequence = 0; ok; sequence++) {
+		PgnBatch *batch = &pipeline->batches[sequence %
+						     pipeline->num_batches];
+		pthread_mutex_lock(&pipeline->mutex);
+		while (batch->state != BATCH_PARSED &&
+		       !(pipeline->split_done &&
+			 sequence >= pipeline->next_split))
+			pthread_cond_wait(&pipeline->changed, &pipeline->mutex);
+		bool parsed = batch->state == BATCH_PARSED;
+		pthread_mutex_unlock(&pipeline->mutex);
+		if (!parsed)
+			break;
+
+		if (batch->failed) {
+			ERROR_LOG("Unable to allocate a batch of games\n");
+			ok = false;
+		}
+		for (size_t i = 0; ok && i < batch->num_games; i++)
+			ok = handler(&batch->games[i], context);
+
+		pthread_mutex_lock(&pipeline->mutex);
+		batch->state = BATCH_EMPTY;
+		pipeline->stopped = !ok;
+		pthread_cond_broadcast(&pipeline->changed);
+		pthread_mutex_unlock(&pipeline->mutex);
+	}
+	return ok;
+}
+
+static bool read_pgn_games_parallel(const char *data, size_t size,
+				    size_t threads, PgnGameHandler handler,
+				    void *context)
+{
+	PgnPipeline pipeline = {
+		.data = data,
+		.size = size,
+		.num_batches = 2 * threads,
+	};
+	pipeline.batches = calloc(pipeline.num_batches, sizeof(PgnBatch));
+	pthread_t *workers = calloc(threads + 1, sizeof(pthread_t));
+	if (pipeline.batches == NULL || workers == NULL) {
+		ERROR_LOG("Unable to allocate %zu PGN workers\n", threads);
+		free(pipeline.batches);
+		free(workers);
+		return false;
+	}
+	pthread_mutex_init(&pipeline.mutex, NULL);
+	pthread_cond_init(&pipeline.changed, NULL);
+
+	pthread_create(&workers[0], NULL, split_worker, &pipeline);
+	for (size_t i = 1; i <= threads; i++)
+		pthread_create(&workers[i], NULL, parse_worker, &pipeline);
+	bool ok = consume_batches(&pipeline, handler, context);
+	for (size_t i = 0; i <= threads; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_cond_destroy(&pipeline.changed);
+	pthread_mutex_destroy(&pipeline.mutex);
+	for (size_t i = 0; i < pipeline.num_batches; i++)
+		free(pipeline.batches[i].games);
+	free(pipeline.batches);
+	free(workers);
+	return ok;
+}
+
+/**
+ * Read every game of a PGN file, parsing batches of games on threads worker
+ * threads. The handler still sees the games one by one in file order, so the
+ * output does not depend on the number of threads. Files that cannot be
+ * mapped, such as pipes, are read on the calling thread.
+ */
+bool read_pgn_games(const char *filepath, size_t threads,
+		    PgnGameHandler handler, void *context)
+{
+	PgnReader reader;
+	if (!open_pgn_reader(&reader, filepath))
+		return false;
+	bool ok = true;
+	if (threads > 1 && reader.mapped) {
+		ok = read_pgn_games_parallel(reader.data, reader.size, threads,
+					     handler, context);
+	} else {
+		PgnGame *game = malloc(sizeof(PgnGame));
+		ok = game != NULL;
+		while (ok && read_pgn_game(&reader, game))
+			ok = handler(game, context);
+		free(game);
+	}
+	close_pgn_reader(&reader);
+	return ok;
+}
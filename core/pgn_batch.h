@@ -0,0 +1,21 @@
+#ifndef _PGN_BATCH_H
+#define _PGN_BATCH_H
+
+#include "pgn.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Games handed to a worker at a time.
+#define PGN_BATCH_GAMES 64
+
+/**
+ * Called with every game of a file in file order, from the calling thread.
+ * Returning false stops the read.
+ */
+typedef bool (*PgnGameHandler)(const PgnGame *game, void *context);
+
+bool read_pgn_games(const char *filepath, size_t threads,
+		    PgnGameHandler handler, void *context);
+
+#endif
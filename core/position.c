@@ -0,0 +1,203 @@
+#include "position.h"
+#include "attacks.h"
+#include "board.h"
+#include "logic.h"
+#include "movement.h"
+#include "zobrist.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+static const EChessPiece PROMOTION_PIECES[] = {
+	PIECE_QUEEN, PIECE_ROOK, PIECE_BISHOP, PIECE_KNIGHT,
+};
+
+void new_position(Position *position)
+{
+	new_board(position->board);
+	position->turn = COLOUR_WHITE;
+	position->move_count = 0;
+	position->halfmove_clock = 0;
+}
+
+uint64_t hash_position(Position *position)
+{
+	return hash_board(position->board, position->turn,
+			  position->move_count);
+}
+
+bool is_in_check(Position *position)
+{
+	int king = find_king(position->board, position->turn);
+	return king != -1 &&
+	       is_square_attacked(position->board, king,
+				  (position->turn + 1) % PLAYER_NUM_COLOURS);
+}
+
+/**
+ * Does a legal move give check? Looked up from the enemy king: a direct
+ * check from the piece on its target, or a discovered one from a slider
+ * behind the square it left. Castling and en passant move a second piece
+ * and are played out instead.
+ */
+bool gives_check(Position *position, Move move)
+{
+	if (move.type == MOVEMENT_KING_CASTLE ||
+	    move.type == MOVEMENT_PAWN_EN_PASSANT) {
+		Position next = *position;
+		make_move(&next, move);
+		return is_in_check(&next);
+	}
+	PlayPiece *piece = &position->board[move.origin];
+	int king = find_king(position->board,
+			     (piece->colour + 1) % PLAYER_NUM_COLOURS);
+	if (king == -1)
+		return false;
+	EChessPiece type = move.promotion != PIECE_NONE ? move.promotion :
+			   piece->type;
+	return piece_attacks(position->board, move.target, type,
+			     piece->colour, king, move.origin) ||
+	       discovers_attack(position->board, king, move.origin,
+				move.target, piece->colour);
+}
+
+/**
+ * Does the move leave its own king safe? Pinned pieces are spotted from the
+ * king, moves out of check, king moves and en passant, which takes a second
+ * piece off the board, are played out on a scratch board.
+ */
+bool is_legal(Position *position, int king, bool check, Move move)
+{
+	if (!check && position->board[move.origin].type != PIECE_KING &&
+	    move.type != MOVEMENT_PAWN_EN_PASSANT)
+		return !exposes_king(position->board, king, move.origin,
+				     move.target);
+
+	Board scratch;
+	set_board(position->board, scratch);
+	process_movement(scratch, position->move_count, move.origin,
+			 move.target, check);
+	if (position->board[move.origin].type == PIECE_KING)
+		king = move.target;
+	return !is_square_attacked(scratch, king,
+				   (position->turn + 1) % PLAYER_NUM_COLOURS);
+}
+
+/**
+ * Legal moves of the piece on origin, with one move per promotion piece. The
+ * king's square and whether it is in check are the caller's, so a caller
+ * walking several pieces only looks them up once.
+ */
+size_t generate_origin_moves(Position *position, int origin, int king,
+			     bool check, Move moves[MAX_POSSIBLE_MOVES])
+{
+	PossibleMove possible[MAX_POSSIBLE_MOVES];
+	size_t num_possible = get_possible_moves_for_piece(
+		position->board, origin, possible, position->move_count,
+		check);
+	size_t num_moves = 0;
+	for (size_t m = 0; m < num_possible; m++) {
+		Move move = {
+			.origin = origin,
+			.target = possible[m].target,
+			.type = possible[m].type,
+			.promotion = PIECE_NONE,
+		};
+		if (!is_legal(position, king, check, move))
+			continue;
+		if (possible[m].type != MOVEMENT_PAWN_PROMOTION) {
+			moves[num_moves++] = move;
+			continue;
+		}
+		for (size_t p = 0; p < 4; p++) {
+			move.promotion = PROMOTION_PIECES[p];
+			moves[num_moves++] = move;
+		}
+	}
+	return num_moves;
+}
+
+/**
+ * Every legal move for the player to move. Pseudo legal moves come from the
+ * piece movement algorithms, each is then played out on a scratch board to
+ * check it does not leave the king attacked.
+ */
+size_t generate_legal_moves(Position *position, Move moves[MAX_LEGAL_MOVES])
+{
+	size_t num_moves = 0;
+	EPlayerColour opponent = (position->turn + 1) % PLAYER_NUM_COLOURS;
+	size_t check = is_in_check(position);
+	Board scratch;
+
+	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
+		if (position->board[i].type == PIECE_NONE ||
+		    position->board[i].colour != position->turn) {
+			continue;
+		}
+		PossibleMove possible[MAX_POSSIBLE_MOVES];
+		size_t num_possible = get_possible_moves_for_piece(
+			position->board, i, possible, position->move_count,
+			check);
+		for (size_t m = 0; m < num_possible; m++) {
+			set_board(position->board, scratch);
+			process_movement(scratch, position->move_count, i,
+					 possible[m].target, check);
+			int king = position->board[i].type == PIECE_KING
+				   ? possible[m].target
+				   : find_king(scratch, position->turn);
+			if (is_square_attacked(scratch, king, opponent))
+				continue;
+
+			Move move = {
+				.origin = i,
+				.target = possible[m].target,
+				.type = possible[m].type,
+				.promotion = PIECE_NONE,
+			};
+			if (possible[m].type != MOVEMENT_PAWN_PROMOTION) {
+				moves[num_moves++] = move;
+				continue;
+			}
+			for (size_t p = 0; p < 4; p++) {
+				move.promotion = PROMOTION_PIECES[p];
+				moves[num_moves++] = move;
+			}
+		}
+	}
+	return num_moves;
+}
+
+/**
+ * Play a legal move from generate_legal_moves and hand the turn over.
+ */
+void make_move(Position *position, Move move)
+{
+	bool irreversible = position->board[move.origin].type == PIECE_PAWN ||
+			    position->board[move.target].type != PIECE_NONE;
+	process_movement(position->board, position->move_count, move.origin,
+			 move.target, 0);
+	if (move.promotion != PIECE_NONE)
+		position->board[move.target].type = move.promotion;
+	position->halfmove_clock = irreversible ? 0 :
+				   position->halfmove_clock + 1;
+	position->move_count++;
+	position->turn = (position->turn + 1) % PLAYER_NUM_COLOURS;
+}
+
+/**
+ * Long algebraic coordinates, e.g. "e2e4" or "e7e8q".
+ */
+void format_move_coords(Move move, char buffer[MOVE_COORDS_LENGTH])
+{
+	static const char PROMOTION_SYMBOLS[PIECE_NUM_PIECES] = {
+		[PIECE_KNIGHT] = 'n', [PIECE_BISHOP] = 'b',
+		[PIECE_ROOK] = 'r', [PIECE_QUEEN] = 'q',
+	};
+	buffer[0] = move.origin % BOARD_SIZE + 'a';
+	buffer[1] = move.origin / BOARD_SIZE + '1';
+	buffer[2] = move.target % BOARD_SIZE + 'a';
+	buffer[3] = move.target / BOARD_SIZE + '1';
+	buffer[4] = PROMOTION_SYMBOLS[move.promotion];
+	buffer[5] = '\0';
+}
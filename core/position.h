@@ -0,0 +1,38 @@
+#ifndef _POSITION_H
+#define _POSITION_H
+
+#include "board.h"
+#include "movement.h"
+#include "players.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// e.g. "e7e8q" and the terminator.
+#define MOVE_COORDS_LENGTH 6
+
+// A bare position, everything needed to generate and make moves without the
+// interactive state carried by ChessGame.
+typedef struct {
+	Board board;
+	// Player to move.
+	EPlayerColour turn;
+	// Plies played, pieces record the ply they last moved on.
+	size_t move_count;
+	// Plies since the last capture or pawn move.
+	size_t halfmove_clock;
+} Position;
+
+void new_position(Position *position);
+uint64_t hash_position(Position *position);
+bool is_in_check(Position *position);
+bool gives_check(Position *position, Move move);
+bool is_legal(Position *position, int king, bool check, Move move);
+size_t generate_origin_moves(Position *position, int origin, int king,
+			     bool check, Move moves[MAX_POSSIBLE_MOVES]);
+size_t generate_legal_moves(Position *position, Move moves[MAX_LEGAL_MOVES]);
+void make_move(Position *position, Move move);
+void format_move_coords(Move move, char buffer[MOVE_COORDS_LENGTH]);
+
+#endif
@@ -0,0 +1,264 @@
+#include "position_index.h"
+#include "binary.h"
+#include "fen.h"
+#include "pgn_batch.h"
+#include "position.h"
+#include "sorted_runs.h"
+#include "timing.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+typedef struct {
+	IndexEntry *entries;
+	size_t capacity;
+	size_t count;
+	// Sorted runs spilled to temporary files.
+	SortedRuns runs;
+	size_t games;
+} IndexTable;
+
+typedef struct {
+	FILE *output;
+	IndexEntry last;
+	size_t written;
+} IndexOutput;
+
+static int compare_entries(const void *a, const void *b)
+{
+	const IndexEntry *left = a;
+	const IndexEntry *right = b;
+	if (left->key != right->key)
+		return left->key < right->key ? -1 : 1;
+	if (left->game != right->game)
+		return left->game < right->game ? -1 : 1;
+	return left->ply < right->ply ? -1 : left->ply > right->ply;
+}
+
+/**
+ * Sort the table and write it out as a run, leaving the table empty.
+ */
+static bool spill_run(IndexTable *table)
+{
+	if (!spill_sorted_run(&table->runs, table->entries, table->count))
+		return false;
+	table->count = 0;
+	return true;
+}
+
+/**
+ * Add every position of a game, the start being ply 0.
+ */
+static bool index_game(const PgnGame *game, void *context)
+{
+	IndexTable *table = context;
+	table->games++;
+	Position position = game->start;
+	for (size_t ply = 0; ply <= game->num_moves; ply++) {
+		if (table->count == table->capacity && !spill_run(table))
+			return false;
+		table->entries[table->count++] = (IndexEntry){
+			.key = hash_position(&position),
+			.game = table->games,
+			.ply = ply,
+		};
+		if (ply < game->num_moves)
+			make_move(&position, game->moves[ply]);
+	}
+	return true;
+}
+
+/**
+ * Write the merged entries out. A game reaching a position more than once
+ * keeps only its first ply.
+ */
+static bool write_merged_entry(const void *merged, void *context)
+{
+	IndexOutput *output = context;
+	const IndexEntry *entry = merged;
+	if (output->written > 0 && entry->key == output->last.key &&
+	    entry->game == output->last.game)
+		return true;
+
+	uint8_t bytes[POSITION_INDEX_ENTRY_SIZE];
+	write_le(bytes, entry->key, 8);
+	write_le(bytes + 8, entry->game, 4);
+	write_le(bytes + 12, entry->ply, 4);
+	output->last = *entry;
+	output->written++;
+	return fwrite(bytes, POSITION_INDEX_ENTRY_SIZE, 1, output->output) == 1;
+}
+
+static bool write_index(IndexTable *table, const char *filepath,
+			size_t *written)
+{
+	FILE *output = fopen(filepath, "wb");
+	if (output == NULL) {
+		ERROR_LOG("Unable to open %s\n", filepath);
+		return false;
+	}
+	// The header is filled in once the entries are counted.
+	uint8_t header[POSITION_INDEX_HEADER_SIZE] = { 0 };
+	IndexOutput merged = { .output = output };
+	bool ok = fwrite(header, POSITION_INDEX_HEADER_SIZE, 1, output) == 1 &&
+		  merge_sorted_runs(&table->runs, write_merged_entry, &merged);
+	*written = merged.written;
+
+	memcpy(header, POSITION_INDEX_MAGIC, 3);
+	header[3] = POSITION_INDEX_VERSION;
+	write_le(header + 4, *written, 8);
+	write_le(header + 12, table->games, 8);
+	ok = ok && fseek(output, 0, SEEK_SET) == 0 &&
+	     fwrite(header, POSITION_INDEX_HEADER_SIZE, 1, output) == 1;
+	if (fclose(output) != 0)
+		ok = false;
+	return ok;
+}
+
+/**
+ * Index every position of the PGN files. Entries are sorted in memory and
+ * spilled as runs whenever the memory budget fills, then merged into one
+ * immutable table that queries map and binary search.
+ */
+int run_index(IndexArgs *args)
+{
+	IndexTable table = {
+		.runs = {
+			.record_size = sizeof(IndexEntry),
+			.compare = compare_entries,
+		},
+	};
+	table.capacity = args->memory_mb * 1024 * 1024 / sizeof(IndexEntry);
+	if (table.capacity < PGN_MAX_PLIES + 1)
+		table.capacity = PGN_MAX_PLIES + 1;
+	table.entries = malloc(table.capacity * sizeof(IndexEntry));
+	if (table.entries == NULL) {
+		ERROR_LOG("Unable to allocate %zu MB\n", args->memory_mb);
+		return 0;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool ok = true;
+	for (size_t i = 0; ok && i < args->num_inputs; i++) {
+		INFO_LOG("Reading %s\n", args->inputs[i]);
+		ok = read_pgn_games(args->inputs[i], args->threads,
+				    index_game, &table);
+	}
+	// The final partial table becomes the last run.
+	if (ok)
+		ok = spill_run(&table);
+	free(table.entries);
+
+	size_t written = 0;
+	ok = ok && write_index(&table, args->output, &written);
+	size_t num_runs = table.runs.num_runs;
+	close_sorted_runs(&table.runs);
+	if (!ok) {
+		ERROR_LOG("Index build failed\n");
+		return 0;
+	}
+	INFO_LOG("Games: %zu\nRuns merged: %zu\n", table.games, num_runs);
+	INFO_LOG("Positions: %zu written to %s\nTime: %.3fs\n", written,
+		 args->output, elapsed_seconds(&start));
+	return 1;
+}
+
+bool open_position_index(PositionIndex *index, const char *filepath)
+{
+	memset(index, 0, sizeof(PositionIndex));
+	// Lookups are binary searches, don't bother reading ahead.
+	index->data = map_file(filepath, POSITION_INDEX_HEADER_SIZE,
+			       MADV_RANDOM, &index->size);
+	if (index->data == NULL) {
+		ERROR_LOG("Unable to open index: %s\n", filepath);
+		return false;
+	}
+	index->num_entries = read_le(index->data + 4, 8);
+	index->num_games = read_le(index->data + 12, 8);
+	if (memcmp(index->data, POSITION_INDEX_MAGIC, 3) != 0 ||
+	    index->data[3] != POSITION_INDEX_VERSION ||
+	    index->num_entries != (index->size - POSITION_INDEX_HEADER_SIZE) /
+	    POSITION_INDEX_ENTRY_SIZE) {
+		ERROR_LOG("Invalid index: %s\n", filepath);
+		close_position_index(index);
+		return false;
+	}
+	return true;
+}
+
+void close_position_index(PositionIndex *index)
+{
+	unmap_file(index->data, index->size);
+	memset(index, 0, sizeof(PositionIndex));
+}
+
+IndexEntry read_index_entry(const PositionIndex *index, size_t i)
+{
+	const uint8_t *data = index->data + POSITION_INDEX_HEADER_SIZE +
+			      i * POSITION_INDEX_ENTRY_SIZE;
+	return (IndexEntry){
+		       .key = read_le(data, 8),
+		       .game = read_le(data + 8, 4),
+		       .ply = read_le(data + 12, 4),
+	};
+}
+
+/**
+ * Binary search for the entries of a position. Returns how many there are,
+ * first is set to where they start.
+ */
+size_t find_position(const PositionIndex *index, uint64_t key, size_t *first)
+{
+	size_t low = 0;
+	size_t high = index->num_entries;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (read_index_entry(index, middle).key < key)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	*first = low;
+	size_t end = low;
+	while (end < index->num_entries &&
+	       read_index_entry(index, end).key == key)
+		end++;
+	return end - low;
+}
+
+/**
+ * List every game reaching the position, with the ply it first got there.
+ */
+int run_index_query(IndexQueryArgs *args)
+{
+	Position position;
+	if (!parse_fen(args->fen, &position)) {
+		ERROR_LOG("Invalid FEN: %s\n", args->fen);
+		return 0;
+	}
+	PositionIndex index;
+	if (!open_position_index(&index, args->index))
+		return 0;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t first;
+	size_t count = find_position(&index, hash_position(&position), &first);
+	double seconds = elapsed_seconds(&start);
+	for (size_t i = first; i < first + count; i++) {
+		IndexEntry entry = read_index_entry(&index, i);
+		INFO_LOG("Game %u ply %u\n", entry.game, entry.ply);
+	}
+	INFO_LOG("Games: %zu of %zu\nTime: %.3fms\n", count, index.num_games,
+		 seconds * 1000);
+	close_position_index(&index);
+	return 1;
+}
@@ -0,0 +1,62 @@
+#ifndef _POSITION_INDEX_H
+#define _POSITION_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Every position reached in a corpus, as sorted fixed size entries of
+ * position hash, game number and the first ply the game reached it on. The
+ * header is:
+ *
+ *   magic "CPI", version, entry count (8 bytes), game count (8 bytes)
+ *
+ * Numbers are little endian. Games are numbered from 1 across the input files
+ * in order, the same numbering an archive of those files has.
+ */
+#define POSITION_INDEX_MAGIC "CPI"
+#define POSITION_INDEX_VERSION 1
+#define POSITION_INDEX_HEADER_SIZE 20
+#define POSITION_INDEX_ENTRY_SIZE 16
+#define POSITION_INDEX_DEFAULT_OUTPUT "games.cpi"
+#define POSITION_INDEX_DEFAULT_MEMORY_MB 256
+
+typedef struct {
+	uint64_t key;
+	uint32_t game;
+	uint32_t ply;
+} IndexEntry;
+
+typedef struct {
+	// The mapped file, only the pages probed are read in.
+	const uint8_t *data;
+	size_t size;
+	size_t num_entries;
+	size_t num_games;
+} PositionIndex;
+
+typedef struct {
+	const char **inputs;
+	size_t num_inputs;
+	const char *output;
+	// Entries are sorted in memory, spilling runs to disk beyond this.
+	size_t memory_mb;
+	// Games are parsed on this many threads, and numbered in file order.
+	size_t threads;
+} IndexArgs;
+
+typedef struct {
+	const char *index;
+	const char *fen;
+} IndexQueryArgs;
+
+bool open_position_index(PositionIndex *index, const char *filepath);
+void close_position_index(PositionIndex *index);
+IndexEntry read_index_entry(const PositionIndex *index, size_t i);
+size_t find_position(const PositionIndex *index, uint64_t key,
+		     size_t *first);
+int run_index(IndexArgs *args);
+int run_index_query(IndexQueryArgs *args);
+
+#endif
@@ -1,14 +1,20 @@
 #include "replay.h"
 #include "display.h"
+#include "fen.h"
 #include "game.h"
 #include "logic.h"
 #include "pgn.h"
+#include "timing.h"
 #include "log.h"
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 
 char *REPLAY_INPUT_STRINGS[REPLAY_INPUT_NUM_TYPES] = {
 	"REPLAY_INPUT_INVALID",
@@ -33,6 +39,20 @@ const char *FILE_FORMAT_EXTENSIONS[] = {
 	[FORMAT_PGN] = "pgn"
 };
 
+// Where the moves come from, all reader state lives here.
+typedef struct {
+	// Raw files only.
+	FILE *file;
+	EFileFormat format;
+	// PGN files are read a game at a time.
+	PgnReader reader;
+	PgnGame game;
+	// Next move of the current PGN game.
+	size_t next_move;
+	// What the move last handed out promotes to, PIECE_NONE to ask.
+	EChessPiece promotion;
+} ReplaySource;
+
 EFileFormat determine_file_format(const char *filepath)
 {
 	// Warning: this function is lazy and assumes that all files have an
@@ -91,10 +111,11 @@ int read_line_from_file(FILE *file, char *input_buffer,
 	}
 }
 
-EReplayInput read_next_move_raw(FILE *file, ChessGame *game, char *input_buffer,
-				size_t *input_pointer)
+EReplayInput read_next_move_raw(ReplaySource *source, ChessGame *game,
+				char *input_buffer, size_t *input_pointer)
 {
-	int result = read_line_from_file(file, input_buffer, input_pointer);
+	int result = read_line_from_file(source->file, input_buffer,
+					 input_pointer);
 	if (result == 0 && *input_pointer == 0)
 		return REPLAY_INPUT_EOF;
 
@@ -108,36 +129,166 @@ EReplayInput read_next_move_raw(FILE *file, ChessGame *game, char *input_buffer,
 	      input_buffer[1] > '0' + BOARD_SIZE))
 		return REPLAY_INPUT_COORDS;
 
+	// The player to move forfeits.
 	if (strcmp(input_buffer, "ff") == 0)
 		return game->turn ==
-		       COLOUR_WHITE ? REPLAY_INPUT_WIN_WHITE :
-		       REPLAY_INPUT_WIN_BLACK;
+		       COLOUR_WHITE ? REPLAY_INPUT_WIN_BLACK :
+		       REPLAY_INPUT_WIN_WHITE;
 
 	return REPLAY_INPUT_INVALID;
 }
 
-EReplayInput (*READ_NEXT_MOVE[])(FILE *file, ChessGame *game,
+/**
+ * Hand out the moves of the current PGN game as coordinates with their
+ * promotion kept aside, then its result.
+ */
+EReplayInput read_next_move_pgn(ReplaySource *source, ChessGame *game,
+				char *input_buffer, size_t *input_pointer)
+{
+	PgnGame *pgn = &source->game;
+	if (source->next_move < pgn->num_moves) {
+		Move move = pgn->moves[source->next_move++];
+		source->promotion = move.promotion;
+		snprintf(input_buffer, 6, "%c%c %c%c",
+			 move.origin % BOARD_SIZE + 'a',
+			 move.origin / BOARD_SIZE + '1',
+			 move.target % BOARD_SIZE + 'a',
+			 move.target / BOARD_SIZE + '1');
+		*input_pointer = 5;
+		return REPLAY_INPUT_COORDS;
+	}
+	if (!pgn->valid) {
+		snprintf(input_buffer, INPUT_BUFFER_SIZE,
+			 "illegal move after ply %zu", pgn->num_moves);
+		return REPLAY_INPUT_INVALID;
+	}
+
+	switch (pgn->result) {
+	case GAME_RESULT_WHITE_WIN:
+		return REPLAY_INPUT_WIN_WHITE;
+	case GAME_RESULT_BLACK_WIN:
+		return REPLAY_INPUT_WIN_BLACK;
+	case GAME_RESULT_DRAW:
+		return REPLAY_INPUT_DRAW;
+	default:
+		return REPLAY_INPUT_REPLAY_OVER;
+	}
+}
+
+EReplayInput (*READ_NEXT_MOVE[])(ReplaySource *source, ChessGame *game,
 				 char *input_buffer,
 				 size_t *input_pointer) = {
 	[FORMAT_RAW] = &read_next_move_raw,
 	[FORMAT_PGN] = &read_next_move_pgn
 };
 
+/**
+ * Move on to the next game of a PGN file, false at the end of the file or
+ * for any other format.
+ */
+static bool next_replay_game(ReplaySource *source, ChessGame *game)
+{
+	if (source->format != FORMAT_PGN ||
+	    !read_pgn_game(&source->reader, &source->game))
+		return false;
+
+	PgnGame *pgn = &source->game;
+	INFO_LOG("Game %zu\n", source->reader.games);
+	for (size_t i = 0; i < pgn->num_tags; i++)
+		INFO_LOG("(TAG) %s: %s\n", pgn->tags[i].name,
+			 pgn->tags[i].value);
+
+	set_game_position(game, &pgn->start);
+	source->next_move = 0;
+	return true;
+}
+
+/**
+ * Standard input may be a pipe, so it cannot be rewound once read. Read up to
+ * the first character that is not a space, tell the format from it, then
+ * push it back in front of the rest: raw files start with a square or a
+ * comment, anything else is taken as PGN.
+ */
+static bool open_replay_stdin(ReplaySource *source)
+{
+	char first;
+	ssize_t count;
+	do {
+		count = read(STDIN_FILENO, &first, 1);
+	} while ((count < 0 && errno == EINTR) ||
+		 (count == 1 && isspace((unsigned char)first)));
+	if (count != 1)
+		return false;
+
+	source->format = isalpha((unsigned char)first) || first == '#' ?
+			 FORMAT_RAW : FORMAT_PGN;
+	// The source closes its descriptor, keep standard input open.
+	int fd = dup(STDIN_FILENO);
+	if (fd < 0)
+		return false;
+	if (source->format == FORMAT_PGN) {
+		if (!init_pgn_reader_stream(&source->reader, fd)) {
+			close(fd);
+			return false;
+		}
+		return unread_pgn_text(&source->reader, &first, 1);
+	}
+	if ((source->file = fdopen(fd, "r")) == NULL) {
+		close(fd);
+		return false;
+	}
+	return ungetc(first, source->file) != EOF;
+}
+
+static void close_replay_source(ReplaySource *source)
+{
+	if (source->format == FORMAT_PGN)
+		close_pgn_reader(&source->reader);
+	else
+		fclose(source->file);
+	free(source);
+}
+
 void replay_chess(ChessGame *game, const char *filepath)
 {
 	INFO_LOG("Attempting to replay: %s\n", filepath);
-	// Read the extention of the file and determine what it claims to be.
-	EFileFormat format = determine_file_format(filepath);
+	// Read the extention of the file and determine what it claims to be,
+	// standard input is told apart by its first character instead.
+	bool stdin_input = strcmp(filepath, PGN_STDIN_PATH) == 0;
+	EFileFormat format = stdin_input ? FORMAT_RAW :
+			     determine_file_format(filepath);
+	if (format == FORMAT_INVALID) {
+		ERROR_LOG("Unknown replay file format.\n");
+		return;
+	}
+
+	ReplaySource *source = calloc(1, sizeof(ReplaySource));
+	if (source == NULL)
+		return;
+	source->format = format;
 
-	// Does file exist?
-	FILE *file = fopen(filepath, "r");
-	if (file == NULL) {
+	// Does file exist? PGN files are mapped rather than read through stdio.
+	bool opened;
+	if (stdin_input)
+		opened = open_replay_stdin(source);
+	else if (format == FORMAT_PGN)
+		opened = open_pgn_reader(&source->reader, filepath);
+	else
+		opened = (source->file = fopen(filepath, "r")) != NULL;
+	if (!opened) {
 		ERROR_LOG("File does not exist or cannot be read.");
+		free(source);
 		return;
 	}
 
+	format = source->format;
 	DEBUG_LOG("Processing file of type %s\n",
 		  FILE_FORMAT_EXTENSIONS[format]);
+	if (format == FORMAT_PGN && !next_replay_game(source, game)) {
+		INFO_LOG("End of file, replay corrupt or incomplete.\n");
+		close_replay_source(source);
+		return;
+	}
 
 	while (true) {
 		// Is the game over?
@@ -160,6 +311,8 @@ void replay_chess(ChessGame *game, const char *filepath)
 						      + 1) %
 						     PLAYER_NUM_COLOURS],
 			       game->move_count);
+			if (next_replay_game(source, game))
+				continue;
 			break;
 		} else if (game->check) {
 			printf(
@@ -172,7 +325,7 @@ void replay_chess(ChessGame *game, const char *filepath)
 		game->input_pointer = 0;
 
 		EReplayInput move_result =
-			READ_NEXT_MOVE[format](file, game,
+			READ_NEXT_MOVE[format](source, game,
 					       game->input_buffer,
 					       &game->input_pointer);
 
@@ -187,11 +340,15 @@ void replay_chess(ChessGame *game, const char *filepath)
 			continue;
 		case REPLAY_INPUT_REPLAY_OVER:
 			INFO_LOG("Replay over but game ongoing\n");
-			fclose(file);
+			if (next_replay_game(source, game))
+				continue;
+			close_replay_source(source);
 			return;
 		case REPLAY_INPUT_DRAW:
 			INFO_LOG("Game ended in draw\n");
-			fclose(file);
+			if (next_replay_game(source, game))
+				continue;
+			close_replay_source(source);
 			return;
 		case REPLAY_INPUT_WIN_WHITE:
 		case REPLAY_INPUT_WIN_BLACK: {
@@ -199,29 +356,33 @@ void replay_chess(ChessGame *game, const char *filepath)
 					       REPLAY_INPUT_WIN_WHITE ?
 					       COLOUR_WHITE :
 					       COLOUR_BLACK;
+			EPlayerColour loser = (winner + 1) % PLAYER_NUM_COLOURS;
 			if (game_over) {
 				printf("Player %d (%s) won!\n", winner + 1,
 				       PLAYER_COLOUR_STRINGS[winner]);
 			} else {
 				printf(
-					"Player %d (%s) forfeited, Player %d %s won!\n",
-					(winner + 1) % PLAYER_NUM_COLOURS,
-					PLAYER_COLOUR_STRINGS[(winner + 1) %
-							      PLAYER_NUM_COLOURS],
+					"Player %d (%s) forfeited, Player %d (%s) won!\n",
+					loser + 1, PLAYER_COLOUR_STRINGS[loser],
 					winner + 1,
 					PLAYER_COLOUR_STRINGS[winner]);
 			}
-			fclose(file);
+			if (next_replay_game(source, game))
+				continue;
+			close_replay_source(source);
 			return;
 		}
 		case REPLAY_INPUT_INVALID:
 			INFO_LOG("(INVALID INPUT) %s\n", game->input_buffer);
-			fclose(file);
-			play_chess(game);
+			close_replay_source(source);
+			// Standard input was the replay, there is nothing left
+			// to play from.
+			if (!stdin_input)
+				play_chess(game);
 			return;
 		case REPLAY_INPUT_EOF:
 			INFO_LOG("End of file, replay corrupt or incomplete.\n");
-			fclose(file);
+			close_replay_source(source);
 			return;
 		default:
 			break;
@@ -242,7 +403,10 @@ void replay_chess(ChessGame *game, const char *filepath)
 			game->input_buffer[0] = game->input_buffer[3];
 			game->input_buffer[1] = game->input_buffer[4];
 			game->input_buffer[2] = '\0';
-			if (!move_piece(game)) {
+			if (!move_piece_to(game, input_to_index(
+						   game->input_buffer[0],
+						   game->input_buffer[1]),
+					   source->promotion)) {
 				clear_piece_selection(game);
 				continue;
 			}
@@ -254,5 +418,168 @@ void replay_chess(ChessGame *game, const char *filepath)
 			break;
 		}
 	}
-	fclose(file);
+	close_replay_source(source);
+}
+
+/**
+ * Play through the moves once, keeping the position every interval plies.
+ */
+bool init_replay_timeline(ReplayTimeline *timeline, const Position *start,
+			  const Move *moves, size_t num_moves, size_t interval)
+{
+	memset(timeline, 0, sizeof(ReplayTimeline));
+	timeline->interval = interval ? interval : REPLAY_KEYFRAME_INTERVAL;
+	timeline->num_keyframes = num_moves / timeline->interval + 1;
+	timeline->moves = malloc((num_moves ? num_moves : 1) *
+				 sizeof(uint16_t));
+	timeline->keyframes = malloc(timeline->num_keyframes *
+				     PACKED_POSITION_SIZE);
+	if (timeline->moves == NULL || timeline->keyframes == NULL) {
+		free_replay_timeline(timeline);
+		return false;
+	}
+	timeline->num_moves = num_moves;
+
+	Position position = *start;
+	for (size_t ply = 0; ply <= num_moves; ply++) {
+		if (ply % timeline->interval == 0)
+			pack_position(&position, timeline->keyframes[
+					      ply / timeline->interval]);
+		if (ply < num_moves) {
+			timeline->moves[ply] = pack_move(moves[ply]);
+			make_move(&position, moves[ply]);
+		}
+	}
+	timeline->ply = 0;
+	timeline->position = *start;
+	return true;
+}
+
+void free_replay_timeline(ReplayTimeline *timeline)
+{
+	free(timeline->moves);
+	free(timeline->keyframes);
+	memset(timeline, 0, sizeof(ReplayTimeline));
+}
+
+/**
+ * Go to a ply, past the end meaning the end. Plays forwards from the current
+ * position if it is on the way, from the keyframe before the ply otherwise.
+ * Returns the number of moves played.
+ */
+size_t seek_replay(ReplayTimeline *timeline, size_t ply)
+{
+	if (ply > timeline->num_moves)
+		ply = timeline->num_moves;
+	size_t keyframe = ply / timeline->interval;
+	if (ply < timeline->ply ||
+	    timeline->ply < keyframe * timeline->interval) {
+		unpack_position(timeline->keyframes[keyframe],
+				&timeline->position);
+		timeline->ply = keyframe * timeline->interval;
+	}
+	size_t played = ply - timeline->ply;
+	for (; timeline->ply < ply; timeline->ply++)
+		make_move(&timeline->position, unpack_move(
+				  timeline->moves[timeline->ply]));
+	return played;
+}
+
+/**
+ * One ply forwards or backwards, false at either end of the game.
+ */
+bool step_replay(ReplayTimeline *timeline, bool forwards)
+{
+	if (forwards ? timeline->ply == timeline->num_moves :
+	    timeline->ply == 0)
+		return false;
+	seek_replay(timeline, forwards ? timeline->ply + 1 :
+		    timeline->ply - 1);
+	return true;
+}
+
+static void show_replay_ply(ReplayTimeline *timeline)
+{
+	char fen[FEN_MAX_LENGTH];
+	format_fen(&timeline->position, fen);
+	view_board(timeline->position.board, -1, 0, NULL);
+	INFO_LOG("Ply %zu of %zu: %s\n", timeline->ply, timeline->num_moves,
+		 fen);
+}
+
+/**
+ * Step through the game as told on standard input: "n" or an empty line for
+ * the next ply, "p" for the previous one, a number to go to that ply, and
+ * "q" or the end of the input to stop.
+ */
+static void browse_replay(ReplayTimeline *timeline)
+{
+	char line[INPUT_BUFFER_SIZE];
+	while (printf("(n)ext, (p)revious, a ply or (q)uit > "),
+	       fflush(stdout), fgets(line, sizeof(line), stdin) != NULL) {
+		bool moved;
+		if (line[0] == 'q')
+			break;
+		else if (line[0] == 'n' || line[0] == '\n')
+			moved = step_replay(timeline, true);
+		else if (line[0] == 'p')
+			moved = step_replay(timeline, false);
+		else if (isdigit((unsigned char)line[0])) {
+			seek_replay(timeline, strtoul(line, NULL, 10));
+			moved = true;
+		} else
+			continue;
+		if (!moved)
+			INFO_LOG("No more plies that way\n");
+		else
+			show_replay_ply(timeline);
+	}
+	printf("\n");
+}
+
+/**
+ * Show one ply of a PGN game without replaying the game through the
+ * interactive game-over checks, then step from there.
+ */
+int run_replay_seek(ReplaySeekArgs *args)
+{
+	PgnReader reader;
+	PgnGame *pgn = malloc(sizeof(PgnGame));
+	if (pgn == NULL || !open_pgn_reader(&reader, args->filepath)) {
+		free(pgn);
+		return 0;
+	}
+	bool found = false;
+	while (!found && read_pgn_game(&reader, pgn))
+		found = reader.games == (args->game ? args->game : 1);
+	close_pgn_reader(&reader);
+	if (!found) {
+		ERROR_LOG("%s has no game %zu\n", args->filepath, args->game);
+		free(pgn);
+		return 0;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ReplayTimeline timeline;
+	bool ok = init_replay_timeline(&timeline, &pgn->start, pgn->moves,
+				       pgn->num_moves, args->interval);
+	free(pgn);
+	if (!ok) {
+		ERROR_LOG("Unable to allocate the replay timeline\n");
+		return 0;
+	}
+	double build_seconds = elapsed_seconds(&start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t played = seek_replay(&timeline, args->ply);
+	double seek_seconds = elapsed_seconds(&start);
+
+	show_replay_ply(&timeline);
+	INFO_LOG("Keyframes: %zu every %zu plies\nMoves played: %zu\n",
+		 timeline.num_keyframes, timeline.interval, played);
+	INFO_LOG("Build time: %.6fs\nSeek time: %.6fs\n", build_seconds,
+		 seek_seconds);
+	browse_replay(&timeline);
+	free_replay_timeline(&timeline);
+	return 1;
 }
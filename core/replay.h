@@ -1,9 +1,17 @@
 #ifndef _REPLAY_H
 #define _REPLAY_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "game.h"
+#include "position.h"
+#include "serialization.h"
+
+// Plies between the positions kept by a replay timeline.
+#define REPLAY_KEYFRAME_INTERVAL 16
 
 typedef enum {
 	REPLAY_INPUT_INVALID,
@@ -19,6 +27,31 @@ typedef enum {
 
 extern char *REPLAY_INPUT_STRINGS[REPLAY_INPUT_NUM_TYPES];
 
+/**
+ * A game as its moves plus the position every interval plies, so any ply is
+ * at most interval moves away, forwards or backwards. Moves take 2 bytes and
+ * keyframes the 40 of a packed position.
+ */
+typedef struct {
+	size_t num_moves;
+	uint16_t *moves;
+	size_t interval;
+	// The position at ply i * interval.
+	size_t num_keyframes;
+	uint8_t (*keyframes)[PACKED_POSITION_SIZE];
+	// Where the timeline is.
+	size_t ply;
+	Position position;
+} ReplayTimeline;
+
+typedef struct {
+	const char *filepath;
+	// Counted from 1, in file order.
+	size_t game;
+	size_t ply;
+	size_t interval;
+} ReplaySeekArgs;
+
 int read_char_from_file(FILE *file, char *input_buffer,
 			size_t *input_pointer);
 
@@ -27,4 +60,11 @@ int read_line_from_file(FILE *file, char *input_buffer,
 
 void replay_chess(ChessGame *game, const char *filepath);
 
+bool init_replay_timeline(ReplayTimeline *timeline, const Position *start,
+			  const Move *moves, size_t num_moves, size_t interval);
+void free_replay_timeline(ReplayTimeline *timeline);
+size_t seek_replay(ReplayTimeline *timeline, size_t ply);
+bool step_replay(ReplayTimeline *timeline, bool forwards);
+int run_replay_seek(ReplaySeekArgs *args);
+
 #endif
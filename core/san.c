@@ -1,7 +1,10 @@
 #include "san.h"
+#include "attacks.h"
 #include "pieces.h"
 #include "players.h"
 #include "board.h"
+#include "logic.h"
+#include "position.h"
 #include "log.h"
 
 #include <stdbool.h>
@@ -9,8 +12,10 @@
 #include <stdio.h>
 #include <string.h>
 
-// Qa6xb7# fxg1=Q+
-#define MAX_SAN_MOVE_LEN 15
+static const char SAN_PIECE_SYMBOLS[PIECE_NUM_PIECES] = {
+	[PIECE_KNIGHT] = 'N', [PIECE_BISHOP] = 'B', [PIECE_ROOK] = 'R',
+	[PIECE_QUEEN] = 'Q', [PIECE_KING] = 'K',
+};
 
 EChessPiece san_sym_to_piece(char sym)
 {
@@ -42,117 +47,301 @@ static inline bool is_valid_file(char sym)
 	return sym >= '1' && sym <= '8';
 }
 
-bool read_san_moves(FILE *file, SanData *data)
+/**
+ * Parse a single SAN token, e.g. "Nbd7", "exd8=Q+" or "O-O-O", for the given
+ * player. Annotations such as "!?" are ignored.
+ */
+bool parse_san(const char *token, size_t length, EPlayerColour colour,
+	       SanData *data)
 {
-	for (int i = 0; i < 2; i++) {
-		char current;
-		SanData *san = &data[i];
-		san->colour = i;
-		san->piece = PIECE_PAWN;
-
-		while ((current = fgetc(file)) != EOF) {
-			// Are we finished processing?
-			if (current == ' ' || current == '\n')
+	*data = EMPTY_SAN_DATA;
+	data->colour = colour;
+	data->piece = PIECE_PAWN;
+
+	// Castling, either with letter or digit O's.
+	if (length >= 3 && (token[0] == 'O' || token[0] == '0')) {
+		size_t o_count = 0;
+		for (size_t i = 0; i < length; i++) {
+			if (token[i] == 'O' || token[i] == '0')
+				o_count++;
+			else if (token[i] != '-')
 				break;
+		}
+		if (o_count != 2 && o_count != 3)
+			return false;
+		data->piece = PIECE_KING;
+		data->castle = true;
+		data->origin[0] = 4;
+		data->origin[1] = colour == COLOUR_WHITE ? 0 : BOARD_SIZE - 1;
+		data->destination[0] = o_count == 2 ? 6 : 2;
+		data->destination[1] = data->origin[1];
+		return true;
+	}
 
-			// First we check for castling.
-			if (current == 'O') {
-				// Are we king side or castle side?
-				size_t o_count = 1;
-				while ((current = fgetc(file)) != EOF) {
-					// Only valid characters.
-					if (current != ' ' && current != 'O' &&
-					    current != '-') {
-						return false;
-					}
-					if (current == ' ') {
-						// Rewind file so we capture it one loop up.
-						fseek(file, -1, SEEK_CUR);
-						break;
-					}
-					if (current == 'O') {
-						o_count++;
-					}
-				}
-				san->piece = PIECE_KING;
-				san->castle = true;
-				san->origin[0] = 4;
-				san->origin[1] = san->colour ==
-						 COLOUR_WHITE ? 0 : BOARD_SIZE -
-						 1;
-				san->destination[1] = san->origin[1];
-
-				if (o_count == 2) {
-					// Kingside.
-					san->destination[0] = san->origin[0] +
-							      2;
-				} else if (o_count == 3) {
-					// Queenside.
-					san->destination[0] = san->origin[0] -
-							      2;
-				} else {
-					return false;
-				}
-			}
+	for (size_t i = 0; i < length; i++) {
+		char current = token[i];
+		EChessPiece piece = san_sym_to_piece(current);
+		if (piece != PIECE_NONE && i == 0) {
+			data->piece = piece;
+		} else if (piece != PIECE_NONE) {
+			// Promotion, with or without the '='.
+			data->promotion = piece;
+		} else if (is_valid_rank(current)) {
+			// The last file given is the destination's.
+			data->origin[0] = data->destination[0];
+			data->destination[0] = current - 'a';
+		} else if (is_valid_file(current)) {
+			data->origin[1] = data->destination[1];
+			data->destination[1] = current - '1';
+		} else if (current == 'x') {
+			data->capture = true;
+		} else if (current == '+') {
+			data->check = true;
+		} else if (current == '#') {
+			data->checkmate = true;
+		} else if (current != '=' && current != '!' && current != '?') {
+			return false;
+		}
+	}
+	return data->destination[0] != -1 && data->destination[1] != -1;
+}
 
-			// Are we seeing a piece?
-			EChessPiece piece = san_sym_to_piece(current);
-			if (piece != PIECE_NONE && san->piece == PIECE_PAWN) {
-				san->piece = piece;
-				continue;
-			}
+// The first eight are diagonal or parallel single steps, for kings and
+// sliders, the last eight are the knight's.
+static const int STEPS[16][2] = {
+	{ 0, 1 }, { 1, 1 }, { 1, 0 }, { 1, -1 },
+	{ 0, -1 }, { -1, -1 }, { -1, 0 }, { -1, 1 },
+	{ 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 },
+	{ -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 },
+};
 
-			// Is this a capture?
-			if (current == 'x') {
-				san->capture = true;
-				continue;
-			}
+static inline bool on_board(int x, int y)
+{
+	return x >= 0 && x < BOARD_SIZE && y >= 0 && y < BOARD_SIZE;
+}
 
-			// Original position.
-			if (is_valid_rank(current)) {
-				// Always given at least a destination row, if we get two the
-				// second is the destination.
-				if (san->destination[0] == -1) {
-					san->destination[0] = current - 'a';
-				} else {
-					san->origin[0] = san->destination[0];
-					san->destination[0] = current - 'a';
-				}
-				continue;
-			}
+static inline bool is_origin(Board board, const SanData *data, int x, int y)
+{
+	PlayPiece *piece = &board[y * BOARD_SIZE + x];
+	return piece->type == data->piece && piece->colour == data->colour &&
+	       (data->origin[0] == -1 || data->origin[0] == x) &&
+	       (data->origin[1] == -1 || data->origin[1] == y);
+}
 
-			if (is_valid_file(current)) {
-				if (san->destination[1] == -1) {
-					san->destination[1] = current - '1';
-				} else {
-					san->origin[1] = san->destination[1];
-					san->destination[1] = current - '1';
-				}
-				continue;
+/**
+ * Squares the piece could be moving from, found by looking outwards from the
+ * destination rather than at every piece on the board. The movement rules
+ * are checked afterwards.
+ */
+static size_t find_origins(Board board, const SanData *data, int origins[16])
+{
+	int x = data->destination[0];
+	int y = data->destination[1];
+	size_t count = 0;
+	switch (data->piece) {
+	case PIECE_PAWN: {
+		// Captures may be written without the 'x', so look at both.
+		int behind = data->colour == COLOUR_WHITE ? -1 : 1;
+		for (int dx = -1; dx <= 1; dx += 2) {
+			if (on_board(x + dx, y + behind) &&
+			    is_origin(board, data, x + dx, y + behind))
+				origins[count++] = (y + behind) * BOARD_SIZE +
+						   x + dx;
+		}
+		// A push, either one square or two from an empty one.
+		for (int steps = 1; steps <= 2; steps++) {
+			int py = y + steps * behind;
+			if (!on_board(x, py))
+				break;
+			if (is_origin(board, data, x, py)) {
+				origins[count++] = py * BOARD_SIZE + x;
+				break;
 			}
-
-			// Promotion?
-			if (current == '=') {
-				current = fgetc(file);
-				EChessPiece piece = san_sym_to_piece(current);
-				if (piece == PIECE_NONE) {
-					// Throw error
-				}
-				san->promotion = piece;
+			if (board[py * BOARD_SIZE + x].type != PIECE_NONE)
+				break;
+		}
+		break;
+	}
+	case PIECE_KNIGHT:
+	case PIECE_KING: {
+		if (data->castle) {
+			if (is_origin(board, data, data->origin[0],
+				      data->origin[1]))
+				origins[count++] = data->origin[1] *
+						   BOARD_SIZE + data->origin[0];
+			break;
+		}
+		size_t first = data->piece == PIECE_KNIGHT ? 8 : 0;
+		for (size_t i = first; i < first + 8; i++) {
+			int sx = x + STEPS[i][0];
+			int sy = y + STEPS[i][1];
+			if (on_board(sx, sy) && is_origin(board, data, sx, sy))
+				origins[count++] = sy * BOARD_SIZE + sx;
+		}
+		break;
+	}
+	default:
+		// Odd steps are diagonal, even steps are parallel.
+		for (size_t i = 0; i < 8; i++) {
+			if ((data->piece == PIECE_ROOK && i % 2) ||
+			    (data->piece == PIECE_BISHOP && !(i % 2)))
 				continue;
+			int sx = x + STEPS[i][0];
+			int sy = y + STEPS[i][1];
+			while (on_board(sx, sy) &&
+			       board[sy * BOARD_SIZE + sx].type == PIECE_NONE) {
+				sx += STEPS[i][0];
+				sy += STEPS[i][1];
 			}
+			if (on_board(sx, sy) && is_origin(board, data, sx, sy))
+				origins[count++] = sy * BOARD_SIZE + sx;
+		}
+		break;
+	}
+	return count;
+}
 
-			// Check or checkmate?
-			if (current == '+') {
-				san->check = true;
-				continue;
-			}
-			if (current == '#') {
-				san->checkmate = true;
-				continue;
-			}
+/**
+ * Find the legal move a parsed SAN token describes. Fails if no move or more
+ * than one move matches.
+ */
+bool resolve_san(Position *position, SanData *data, Move *move)
+{
+	int origins[16];
+	size_t num_origins = find_origins(position->board, data, origins);
+	if (num_origins == 0)
+		return false;
+
+	int king = find_king(position->board, position->turn);
+	if (king == -1)
+		return false;
+	bool check = is_square_attacked(position->board, king,
+					(position->turn + 1) %
+					PLAYER_NUM_COLOURS);
+	int destination = data->destination[1] * BOARD_SIZE +
+			  data->destination[0];
+	size_t matches = 0;
+	for (size_t i = 0; i < num_origins; i++) {
+		Move candidate = {
+			.origin = origins[i],
+			.target = destination,
+			.type = PIECE_MOVEMENT_ALGORITHM[data->piece](
+				position->board, origins[i], destination,
+				position->move_count, check),
+			.promotion = PIECE_NONE,
+		};
+		if (candidate.type == MOVEMENT_ILLEGAL ||
+		    (candidate.type == MOVEMENT_KING_CASTLE) != data->castle)
+			continue;
+		// A promotion without a piece is taken to mean a queen.
+		if (candidate.type == MOVEMENT_PAWN_PROMOTION)
+			candidate.promotion = data->promotion == PIECE_NONE ?
+					      PIECE_QUEEN : data->promotion;
+		if (candidate.promotion != data->promotion &&
+		    data->promotion != PIECE_NONE)
+			continue;
+		if (candidate.promotion == PIECE_PAWN ||
+		    candidate.promotion == PIECE_KING ||
+		    !is_legal(position, king, check, candidate))
+			continue;
+		*move = candidate;
+		matches++;
+	}
+	return matches == 1;
+}
+
+/**
+ * Write the origin file, rank or both if another piece of the same type could
+ * also move to the target. Returns the length written.
+ */
+static size_t disambiguate(Position *position, Move move, char *out)
+{
+	PlayPiece *piece = &position->board[move.origin];
+	SanData data = EMPTY_SAN_DATA;
+	data.colour = piece->colour;
+	data.piece = piece->type;
+	data.destination[0] = move.target % BOARD_SIZE;
+	data.destination[1] = move.target / BOARD_SIZE;
+	int origins[16];
+	size_t num_origins = find_origins(position->board, &data, origins);
+	if (num_origins < 2)
+		return 0;
+
+	int king = find_king(position->board, position->turn);
+	bool check = is_square_attacked(position->board, king,
+					(position->turn + 1) %
+					PLAYER_NUM_COLOURS);
+	bool rivals = false, same_file = false, same_rank = false;
+	for (size_t i = 0; i < num_origins; i++) {
+		if (origins[i] == move.origin)
+			continue;
+		Move rival = {
+			.origin = origins[i],
+			.target = move.target,
+			.type = PIECE_MOVEMENT_ALGORITHM[piece->type](
+				position->board, origins[i], move.target,
+				position->move_count, check),
+		};
+		if (rival.type == MOVEMENT_ILLEGAL ||
+		    !is_legal(position, king, check, rival))
+			continue;
+		rivals = true;
+		same_file |= origins[i] % BOARD_SIZE ==
+			     move.origin % BOARD_SIZE;
+		same_rank |= origins[i] / BOARD_SIZE ==
+			     move.origin / BOARD_SIZE;
+	}
+
+	size_t length = 0;
+	if (rivals && (!same_file || same_rank))
+		out[length++] = move.origin % BOARD_SIZE + 'a';
+	if (same_file)
+		out[length++] = move.origin / BOARD_SIZE + '1';
+	return length;
+}
+
+/**
+ * Write a legal move as SAN, e.g. "Nbd7", "exd8=Q+" or "O-O". Rival pieces
+ * come from the same lookups outwards from the target that resolve SAN and
+ * check from lookups around the enemy king, only telling check from mate
+ * needs the move played. Returns the length written.
+ */
+size_t move_to_san(Position *position, Move move, char buffer[SAN_MAX_LENGTH])
+{
+	PlayPiece *piece = &position->board[move.origin];
+	char *out = buffer;
+	if (move.type == MOVEMENT_KING_CASTLE) {
+		const char *castle = move.target % BOARD_SIZE >
+				     move.origin % BOARD_SIZE ? "O-O" : "O-O-O";
+		strcpy(out, castle);
+		out += strlen(castle);
+	} else {
+		bool capture = position->board[move.target].type !=
+			       PIECE_NONE ||
+			       move.type == MOVEMENT_PAWN_EN_PASSANT;
+		if (piece->type != PIECE_PAWN) {
+			*out++ = SAN_PIECE_SYMBOLS[piece->type];
+			out += disambiguate(position, move, out);
+		} else if (capture) {
+			*out++ = move.origin % BOARD_SIZE + 'a';
+		}
+		if (capture)
+			*out++ = 'x';
+		*out++ = move.target % BOARD_SIZE + 'a';
+		*out++ = move.target / BOARD_SIZE + '1';
+		if (move.promotion != PIECE_NONE) {
+			*out++ = '=';
+			*out++ = SAN_PIECE_SYMBOLS[move.promotion];
 		}
 	}
 
-	return true;
+	// Only a check can be mate, so only then is the move played out.
+	if (gives_check(position, move)) {
+		Position next = *position;
+		make_move(&next, move);
+		Move replies[MAX_LEGAL_MOVES];
+		*out++ = generate_legal_moves(&next, replies) ? '+' : '#';
+	}
+	*out = '\0';
+	return out - buffer;
 }
@@ -1,10 +1,16 @@
 #ifndef _SAN_H
 #define _SAN_H
 
+#include "movement.h"
 #include "pieces.h"
+#include "players.h"
+#include "position.h"
 
 #include <stdbool.h>
-#include <stdio.h>
+#include <stddef.h>
+
+// e.g. "Qa6xb7#" or "fxg1=Q+" and the terminator.
+#define SAN_MAX_LENGTH 8
 
 typedef struct {
 	size_t colour;
@@ -29,6 +35,10 @@ static const SanData EMPTY_SAN_DATA = {
 	.checkmate = 0
 };
 
-bool read_san_moves(FILE *file, SanData *data);
+EChessPiece san_sym_to_piece(char sym);
+bool parse_san(const char *token, size_t length, EPlayerColour colour,
+	       SanData *data);
+bool resolve_san(Position *position, SanData *data, Move *move);
+size_t move_to_san(Position *position, Move move, char buffer[SAN_MAX_LENGTH]);
 
 #endif
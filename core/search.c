@@ -0,0 +1,364 @@
+#include "search.h"
+#include "book.h"
+#include "evaluate.h"
+#include "fen.h"
+#include "history.h"
+#include "position.h"
+#include "tablebase.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+// The clock is read once every this many nodes.
+#define SEARCH_TIME_CHECK_NODES 1024
+
+typedef struct {
+	PositionHistory history;
+	SearchLimits *limits;
+	uint64_t nodes;
+	uint64_t tb_hits;
+	// Moves searched at the root, possibly narrowed by the tablebases.
+	size_t num_root_moves;
+	Move root_moves[MAX_LEGAL_MOVES];
+	bool stopped;
+	// Triangular principal variation table.
+	size_t pv_length[SEARCH_MAX_PLY + 1];
+	Move pv[SEARCH_MAX_PLY + 1][SEARCH_MAX_PLY];
+	// Best move of the previous iteration, searched first at the root.
+	Move root_best;
+	bool has_root_best;
+	// When a time limited search stops.
+	struct timespec deadline;
+} SearchState;
+
+static inline bool same_move(Move a, Move b)
+{
+	return a.origin == b.origin && a.target == b.target &&
+	       a.promotion == b.promotion;
+}
+
+static inline bool is_tactical(Move move)
+{
+	return move.type == MOVEMENT_PIECE_CAPTURE ||
+	       move.type == MOVEMENT_PAWN_EN_PASSANT ||
+	       move.type == MOVEMENT_PAWN_PROMOTION;
+}
+
+/**
+ * Captures first ordered by most valuable victim, least valuable attacker,
+ * then promotions, then quiet moves in generation order.
+ */
+static int move_order_score(Position *position, Move move)
+{
+	int score = 0;
+	if (move.promotion != PIECE_NONE)
+		score += PIECE_VALUES[move.promotion];
+	if (move.type == MOVEMENT_PAWN_EN_PASSANT)
+		score += PIECE_VALUES[PIECE_PAWN] * 16;
+	else if (position->board[move.target].type != PIECE_NONE)
+		score += PIECE_VALUES[position->board[move.target].type] * 16 -
+			 PIECE_VALUES[position->board[move.origin].type];
+	return score;
+}
+
+static void order_moves(Position *position, Move *moves, size_t num_moves,
+			Move *first)
+{
+	int scores[MAX_LEGAL_MOVES];
+	for (size_t i = 0; i < num_moves; i++) {
+		scores[i] = first && same_move(moves[i], *first)
+			    ? SEARCH_INFINITY
+			    : move_order_score(position, moves[i]);
+	}
+	// Stable insertion sort keeps the node count deterministic.
+	for (size_t i = 1; i < num_moves; i++) {
+		Move move = moves[i];
+		int score = scores[i];
+		size_t j = i;
+		for (; j > 0 && scores[j - 1] < score; j--) {
+			moves[j] = moves[j - 1];
+			scores[j] = scores[j - 1];
+		}
+		moves[j] = move;
+		scores[j] = score;
+	}
+}
+
+static bool past_deadline(const struct timespec *deadline)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > deadline->tv_sec ||
+	       (now.tv_sec == deadline->tv_sec &&
+		now.tv_nsec >= deadline->tv_nsec);
+}
+
+static inline bool out_of_limits(SearchState *state)
+{
+	SearchLimits *limits = state->limits;
+	if (limits->nodes && state->nodes >= limits->nodes)
+		state->stopped = true;
+	if (limits->time_ms && state->nodes % SEARCH_TIME_CHECK_NODES == 0 &&
+	    past_deadline(&state->deadline))
+		state->stopped = true;
+	return state->stopped;
+}
+
+static inline int dtm_to_score(EWdl wdl, int plies, size_t ply)
+{
+	if (wdl == TB_WIN)
+		return SEARCH_MATE - (int)ply - plies;
+	if (wdl == TB_LOSS)
+		return -SEARCH_MATE + (int)ply + plies;
+	return 0;
+}
+
+static inline int wdl_to_score(EWdl wdl, size_t ply)
+{
+	// Cursed wins and blessed losses are drawn under the fifty move rule.
+	if (wdl == TB_WIN)
+		return SEARCH_TB_WIN - (int)ply;
+	if (wdl == TB_LOSS)
+		return -SEARCH_TB_WIN + (int)ply;
+	return 0;
+}
+
+static int quiescence(SearchState *state, Position *position, int alpha,
+		      int beta, size_t ply)
+{
+	state->nodes++;
+	if (out_of_limits(state))
+		return 0;
+
+	int stand_pat = evaluate(position);
+	if (ply >= SEARCH_MAX_PLY || stand_pat >= beta)
+		return stand_pat;
+	if (stand_pat > alpha)
+		alpha = stand_pat;
+
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	order_moves(position, moves, num_moves, NULL);
+	for (size_t i = 0; i < num_moves; i++) {
+		// Only queen promotions are worth resolving.
+		if (!is_tactical(moves[i]) ||
+		    (moves[i].promotion != PIECE_NONE &&
+		     moves[i].promotion != PIECE_QUEEN))
+			continue;
+		Position child = *position;
+		make_move(&child, moves[i]);
+		int score = -quiescence(state, &child, -beta, -alpha, ply + 1);
+		if (state->stopped)
+			return 0;
+		if (score >= beta)
+			return score;
+		if (score > alpha)
+			alpha = score;
+	}
+	return alpha;
+}
+
+static int alpha_beta(SearchState *state, Position *position, int alpha,
+		      int beta, size_t depth, size_t ply)
+{
+	state->pv_length[ply] = 0;
+	if (ply > 0 && (is_repetition(&state->history) ||
+			is_fifty_move_draw(&state->history)))
+		return 0;
+	// Tables with distances give exact mate scores.
+	EWdl wdl;
+	int plies;
+	Tablebases *tablebases = state->limits->tablebases;
+	if (ply > 0 && tablebases != NULL &&
+	    probe_dtm(tablebases, position, &wdl, &plies)) {
+		state->tb_hits++;
+		return plies >= 0 ? dtm_to_score(wdl, plies, ply) :
+		       wdl_to_score(wdl, ply);
+	}
+	// Syzygy results hold for a fresh fifty move clock, so right after a
+	// capture or pawn move.
+	if (ply > 0 && tablebases != NULL && position->halfmove_clock == 0 &&
+	    probe_wdl(tablebases, position, &wdl)) {
+		state->tb_hits++;
+		return wdl_to_score(wdl, ply);
+	}
+	if (depth == 0 || ply >= SEARCH_MAX_PLY)
+		return quiescence(state, position, alpha, beta, ply);
+
+	state->nodes++;
+	if (out_of_limits(state))
+		return 0;
+
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = ply == 0 ? state->num_root_moves :
+			   generate_legal_moves(position, moves);
+	if (ply == 0)
+		memcpy(moves, state->root_moves, sizeof(Move) * num_moves);
+	if (num_moves == 0)
+		return is_in_check(position) ? -SEARCH_MATE + (int)ply : 0;
+	order_moves(position, moves, num_moves,
+		    ply == 0 && state->has_root_best ? &state->root_best :
+		    NULL);
+
+	int best = -SEARCH_INFINITY;
+	for (size_t i = 0; i < num_moves; i++) {
+		Position child = *position;
+		make_move(&child, moves[i]);
+		push_position(&state->history, hash_position(&child),
+			      child.halfmove_clock == 0);
+		int score = -alpha_beta(state, &child, -beta, -alpha,
+					depth - 1, ply + 1);
+		pop_position(&state->history);
+		if (state->stopped)
+			return 0;
+
+		if (score > best)
+			best = score;
+		if (score > alpha) {
+			alpha = score;
+			// Extend the principal variation with the child's.
+			state->pv[ply][0] = moves[i];
+			memcpy(&state->pv[ply][1], state->pv[ply + 1],
+			       sizeof(Move) * state->pv_length[ply + 1]);
+			state->pv_length[ply] = state->pv_length[ply + 1] + 1;
+		}
+		if (alpha >= beta)
+			break;
+	}
+	return best;
+}
+
+/**
+ * Iterative deepening alpha-beta search from the root position, or a book
+ * move if the limits name a book with the root in it. The history should end
+ * with the root, it is used to score repetitions as draws. Returns false if
+ * there are no legal moves.
+ */
+bool search_position(Position *root, const PositionHistory *history,
+		     SearchLimits *limits, SearchResult *result)
+{
+	SearchState state;
+	memset(&state, 0, sizeof(SearchState));
+	state.limits = limits;
+	if (limits->time_ms) {
+		clock_gettime(CLOCK_MONOTONIC, &state.deadline);
+		state.deadline.tv_sec += limits->time_ms / 1000;
+		state.deadline.tv_nsec += limits->time_ms % 1000 * 1000000;
+		if (state.deadline.tv_nsec >= 1000000000) {
+			state.deadline.tv_sec++;
+			state.deadline.tv_nsec -= 1000000000;
+		}
+	}
+	if (history != NULL) {
+		state.history = *history;
+	} else {
+		clear_position_history(&state.history);
+		push_position(&state.history, hash_position(root),
+			      root->halfmove_clock == 0);
+	}
+
+	memset(result, 0, sizeof(SearchResult));
+	state.num_root_moves = generate_legal_moves(root, state.root_moves);
+	if (state.num_root_moves == 0)
+		return false;
+	result->best_move = state.root_moves[0];
+
+	// Book moves are played without searching.
+	if (limits->book != NULL &&
+	    pick_book_move(limits->book, root, &result->best_move)) {
+		result->from_book = true;
+		result->pv[0] = result->best_move;
+		result->pv_length = 1;
+		return true;
+	}
+
+	// Only search the moves that keep the best tablebase result.
+	EWdl root_wdl;
+	if (limits->tablebases != NULL) {
+		state.num_root_moves = filter_root_moves(limits->tablebases,
+							 root, state.root_moves,
+							 state.num_root_moves,
+							 &root_wdl);
+		result->best_move = state.root_moves[0];
+	}
+
+	size_t max_depth = limits->depth < SEARCH_MAX_PLY ? limits->depth :
+			   SEARCH_MAX_PLY - 1;
+	for (size_t depth = 1; depth <= max_depth; depth++) {
+		int score = alpha_beta(&state, root, -SEARCH_INFINITY,
+				       SEARCH_INFINITY, depth, 0);
+		if (state.stopped)
+			break;
+		state.root_best = state.pv[0][0];
+		state.has_root_best = state.pv_length[0] > 0;
+		result->score = score;
+		result->depth = depth;
+		result->pv_length = state.pv_length[0];
+		memcpy(result->pv, state.pv[0],
+		       sizeof(Move) * state.pv_length[0]);
+		if (state.pv_length[0] > 0)
+			result->best_move = state.pv[0][0];
+		if (limits->on_iteration != NULL) {
+			result->nodes = state.nodes;
+			result->tb_hits = state.tb_hits;
+			limits->on_iteration(result, limits->context);
+		}
+		// No point searching deeper once a forced mate is found.
+		if (IS_MATE_SCORE(score))
+			break;
+	}
+	result->nodes = state.nodes;
+	result->tb_hits = state.tb_hits;
+	return true;
+}
+
+/**
+ * Search a single position and print the result.
+ */
+int run_search(const char *fen, SearchLimits *limits)
+{
+	Position position;
+	if (!parse_fen(fen, &position)) {
+		ERROR_LOG("Invalid FEN: %s\n", fen);
+		return 0;
+	}
+
+	char move[MOVE_COORDS_LENGTH];
+	if (limits->book != NULL) {
+		Move moves[MAX_BOOK_MOVES];
+		uint16_t weights[MAX_BOOK_MOVES];
+		size_t num_moves = probe_book(limits->book, &position, moves,
+					      weights);
+		INFO_LOG("Book moves:");
+		for (size_t i = 0; i < num_moves; i++) {
+			format_move_coords(moves[i], move);
+			INFO_LOG(" %s (%u)", move, weights[i]);
+		}
+		INFO_LOG("%s\n", num_moves ? "" : " none");
+	}
+
+	SearchResult result;
+	if (!search_position(&position, NULL, limits, &result)) {
+		INFO_LOG("No legal moves, %s\n",
+			 is_in_check(&position) ? "checkmate" : "stalemate");
+		return 1;
+	}
+	if (!result.from_book) {
+		INFO_LOG("Depth: %zu\nScore: %d cp\nNodes: %lu\n",
+			 result.depth, result.score, result.nodes);
+		if (limits->tablebases != NULL)
+			INFO_LOG("Tablebase hits: %lu\n", result.tb_hits);
+		INFO_LOG("PV:");
+		for (size_t i = 0; i < result.pv_length; i++) {
+			format_move_coords(result.pv[i], move);
+			INFO_LOG(" %s", move);
+		}
+		INFO_LOG("\n");
+	}
+	format_move_coords(result.best_move, move);
+	INFO_LOG("Best move: %s%s\n", move, result.from_book ? " (book)" : "");
+	return 1;
+}
@@ -0,0 +1,67 @@
+#ifndef _SEARCH_H
+#define _SEARCH_H
+
+#include "book.h"
+#include "history.h"
+#include "movement.h"
+#include "position.h"
+#include "tablebase.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SEARCH_INFINITY 32767
+#define SEARCH_MATE 32000
+#define SEARCH_MAX_PLY 64
+// Tablebase wins rank below every mate the search can find.
+#define SEARCH_TB_WIN (SEARCH_MATE - 2 * SEARCH_MAX_PLY)
+
+// Scores beyond this are mates, the distance is SEARCH_MATE - score.
+#define IS_MATE_SCORE(score) \
+	((score) > SEARCH_MATE - SEARCH_MAX_PLY || \
+	 (score) < -SEARCH_MATE + SEARCH_MAX_PLY)
+
+typedef struct SearchResult SearchResult;
+
+// Called after every completed iteration of the deepening.
+typedef void (*SearchIterationHandler)(const SearchResult *result,
+				       void *context);
+
+typedef struct {
+	// Iterative deepening stops after this depth.
+	size_t depth;
+	// Stop once this many nodes have been searched, 0 for no limit.
+	uint64_t nodes;
+	// Stop after this many milliseconds, 0 for no limit.
+	uint64_t time_ms;
+	// Optional, with the context it is handed.
+	SearchIterationHandler on_iteration;
+	void *context;
+	// Opening book probed at the root before searching, NULL for none.
+	Book *book;
+	// Endgame tables probed at the root and in the tree, NULL for none.
+	Tablebases *tablebases;
+} SearchLimits;
+
+struct SearchResult {
+	Move best_move;
+	// Centipawns from the point of view of the player to move.
+	int score;
+	// Deepest completed iteration.
+	size_t depth;
+	uint64_t nodes;
+	// Positions scored by the endgame tables.
+	uint64_t tb_hits;
+	// The move came from the opening book, nothing was searched.
+	bool from_book;
+	// Principal variation from the deepest completed iteration.
+	size_t pv_length;
+	Move pv[SEARCH_MAX_PLY];
+};
+
+bool search_position(Position *root, const PositionHistory *history,
+		     SearchLimits *limits, SearchResult *result);
+int run_search(const char *fen, SearchLimits *limits);
+
+#endif
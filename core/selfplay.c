@@ -0,0 +1,128 @@
+#include "selfplay.h"
+#include "book.h"
+#include "fen.h"
+#include "history.h"
+#include "pgn.h"
+#include "position.h"
+#include "search.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static void add_selfplay_tags(PgnGame *game, size_t round, SelfPlayArgs *args)
+{
+	char value[PGN_MAX_TAG_VALUE_LEN];
+	time_t now = time(NULL);
+	struct tm date;
+	localtime_r(&now, &date);
+
+	add_pgn_tag(game, "Event", "Self-play");
+	add_pgn_tag(game, "Site", "?");
+	strftime(value, sizeof(value), "%Y.%m.%d", &date);
+	add_pgn_tag(game, "Date", value);
+	snprintf(value, sizeof(value), "%zu", round);
+	add_pgn_tag(game, "Round", value);
+	snprintf(value, sizeof(value), "chess depth %zu", args->depth);
+	add_pgn_tag(game, "White", value);
+	add_pgn_tag(game, "Black", value);
+}
+
+/**
+ * Play the engine against itself until mate, stalemate, a repetition or the
+ * fifty move rule. Games too long to store are left unfinished.
+ */
+static void play_game(PgnGame *game, SearchLimits *limits,
+		      const Position *start)
+{
+	Position position = *start;
+	game->start = position;
+	game->result = GAME_RESULT_UNKNOWN;
+	game->valid = true;
+	game->num_moves = 0;
+
+	PositionHistory history;
+	start_position_history(&history, hash_position(&position),
+			       position.halfmove_clock);
+	while (game->num_moves < PGN_MAX_PLIES) {
+		if (is_threefold_repetition(&history) ||
+		    is_fifty_move_draw(&history)) {
+			game->result = GAME_RESULT_DRAW;
+			break;
+		}
+		SearchResult result;
+		if (!search_position(&position, &history, limits, &result)) {
+			if (!is_in_check(&position))
+				game->result = GAME_RESULT_DRAW;
+			else if (position.turn == COLOUR_WHITE)
+				game->result = GAME_RESULT_BLACK_WIN;
+			else
+				game->result = GAME_RESULT_WHITE_WIN;
+			break;
+		}
+		Move move = result.best_move;
+		bool irreversible =
+			position.board[move.origin].type == PIECE_PAWN ||
+			position.board[move.target].type != PIECE_NONE;
+		make_move(&position, move);
+		push_position(&history, hash_position(&position), irreversible);
+		game->moves[game->num_moves++] = move;
+	}
+	game->end = position;
+}
+
+/**
+ * Play games of the engine against itself and export them as PGN. Without a
+ * book every game is the same, the book's random picks vary the openings.
+ */
+int run_selfplay(SelfPlayArgs *args)
+{
+	static Book book;
+	Position start;
+	if (args->fen == NULL) {
+		new_position(&start);
+	} else if (!parse_fen(args->fen, &start)) {
+		ERROR_LOG("Invalid FEN: %s\n", args->fen);
+		return 0;
+	}
+	SearchLimits limits = {
+		.depth = args->depth,
+		.nodes = args->nodes,
+		.book = args->book ? &book : NULL,
+	};
+	if (args->book && !open_book(&book, args->book))
+		return 0;
+	static PgnWriter writer;
+	PgnGame *game = malloc(sizeof(PgnGame));
+	if (game == NULL || !open_pgn_writer(&writer, args->output)) {
+		free(game);
+		if (args->book)
+			close_book(&book);
+		return 0;
+	}
+
+	bool ok = true;
+	for (size_t i = 0; ok && i < args->games; i++) {
+		game->num_tags = 0;
+		add_selfplay_tags(game, i + 1, args);
+		play_game(game, &limits, &start);
+		add_pgn_tag(game, "Result", GAME_RESULT_STRINGS[game->result]);
+		INFO_LOG("Game %zu: %s in %zu plies\n", i + 1,
+			 GAME_RESULT_STRINGS[game->result], game->num_moves);
+		ok = write_pgn_game(&writer, game);
+	}
+	if (!close_pgn_writer(&writer))
+		ok = false;
+	if (!ok)
+		ERROR_LOG("Unable to write %s\n", args->output);
+	else
+		INFO_LOG("Games: %zu written to %s\n", writer.games,
+			 args->output);
+
+	free(game);
+	if (args->book)
+		close_book(&book);
+	return ok;
+}
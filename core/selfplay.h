@@ -0,0 +1,24 @@
+#ifndef _SELFPLAY_H
+#define _SELFPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SELFPLAY_DEFAULT_DEPTH 4
+#define SELFPLAY_DEFAULT_OUTPUT "selfplay.pgn"
+
+typedef struct {
+	size_t games;
+	// Search limits for every move.
+	size_t depth;
+	uint64_t nodes;
+	// Opening book to vary the games with, NULL for none.
+	const char *book;
+	// Position every game starts from, NULL for the standard one.
+	const char *fen;
+	const char *output;
+} SelfPlayArgs;
+
+int run_selfplay(SelfPlayArgs *args);
+
+#endif
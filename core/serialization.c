@@ -1,10 +1,16 @@
 #include "serialization.h"
+#include "binary.h"
+#include "fen.h"
 #include "game.h"
+#include "pgn.h"
 #include "pieces.h"
+#include "position.h"
 #include "display.h"
 #include "log.h"
 
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
 
@@ -20,64 +26,291 @@ char *default_filepath = "save.bin";
 #define LOCAL_BUFFER_SIZE 255
 static char local_buffer[LOCAL_BUFFER_SIZE];
 
-// Raw processor/os specific binary dump.
-int serialize_raw(ChessGame *game, FILE *file)
+void pack_position(Position *position, uint8_t packed[PACKED_POSITION_SIZE])
 {
-	if (fwrite(game, sizeof(ChessGame), 1, file) != 1) {
-		return 0;
+	memset(packed, 0, PACKED_POSITION_SIZE);
+	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
+		PlayPiece *piece = &position->board[i];
+		if (piece->type != PIECE_NONE)
+			packed[i / 2] |= (piece->colour << 3 | piece->type) <<
+					 (i % 2 * 4);
 	}
-	return 1;
+	int en_passant = get_en_passant_square(position->board, position->turn,
+					       position->move_count);
+	packed[32] = position->turn;
+	packed[33] = get_castling_rights(position->board) |
+		     (en_passant == -1 ? 0 : en_passant % BOARD_SIZE + 1) << 4;
+	write_le(packed + 34, position->halfmove_clock < UINT16_MAX ?
+		 position->halfmove_clock : UINT16_MAX, 2);
+	write_le(packed + 36, position->move_count, 4);
 }
 
-int deserialize_raw(ChessGame *game, FILE *file)
+bool unpack_position(const uint8_t packed[PACKED_POSITION_SIZE],
+		     Position *position)
 {
-	if (fread(&game, sizeof(ChessGame), 0, file) != 1) {
-		return 0;
+	Position local;
+	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
+		int nibble = packed[i / 2] >> (i % 2 * 4) & 0xf;
+		EChessPiece type = nibble & 0x7;
+		if (type >= PIECE_NUM_PIECES)
+			return false;
+		local.board[i] = empty_space;
+		local.board[i].type = type;
+		local.board[i].colour = type == PIECE_NONE ? COLOUR_WHITE :
+					nibble >> 3;
 	}
-	return 1;
+	if (packed[32] > COLOUR_BLACK || (packed[33] >> 4) > BOARD_SIZE)
+		return false;
+	local.turn = packed[32];
+	local.halfmove_clock = read_le(packed + 34, 2);
+	local.move_count = read_le(packed + 36, 4);
+
+	// The pawn that can be taken sits in front of the square passed over.
+	int en_passant = -1;
+	if (packed[33] >> 4) {
+		en_passant = (packed[33] >> 4) - 1 +
+			     (local.turn == COLOUR_WHITE ? 5 : 2) * BOARD_SIZE;
+		if (local.move_count == 0)
+			return false;
+	}
+	set_position_rights(&local, packed[33] & 0xf, en_passant);
+	memcpy(position, &local, sizeof(Position));
+	return true;
 }
 
-int serialize_text(ChessGame *game, FILE *file)
+uint16_t pack_move(Move move)
 {
-	// Game data.
-	if (fputc(game->player + '0',
-		  file) == EOF) {
-		return 0;
+	unsigned kind = move.type;
+	if (move.type == MOVEMENT_PAWN_PROMOTION &&
+	    move.promotion != PIECE_NONE)
+		kind = MOVEMENT_NUM_TYPES + move.promotion - PIECE_KNIGHT;
+	return move.origin | move.target << 6 | kind << 12;
+}
+
+Move unpack_move(uint16_t packed)
+{
+	unsigned kind = packed >> 12;
+	Move move = {
+		.origin = packed & 0x3f,
+		.target = packed >> 6 & 0x3f,
+		.type = kind,
+		.promotion = PIECE_NONE,
+	};
+	if (kind >= MOVEMENT_NUM_TYPES) {
+		move.type = MOVEMENT_PAWN_PROMOTION;
+		move.promotion = kind - MOVEMENT_NUM_TYPES + PIECE_KNIGHT;
 	}
+	return move;
+}
 
-	if (fputc(game->turn + '0',
-		  file) == EOF) {
-		return 0;
+/**
+ * Pack the hashes of the positions since the last capture or pawn move,
+ * oldest first and 8 bytes each, the only ones a repetition can reach.
+ * Returns how many there are.
+ */
+size_t pack_position_history(const PositionHistory *history,
+			     uint8_t packed[8 * POSITION_HISTORY_SIZE])
+{
+	size_t num_hashes = get_halfmove_clock(history) + 1;
+	if (num_hashes > history->length)
+		num_hashes = history->length;
+	if (num_hashes > POSITION_HISTORY_SIZE)
+		num_hashes = POSITION_HISTORY_SIZE;
+	for (size_t i = 0; i < num_hashes; i++) {
+		size_t ply = history->length - num_hashes + i;
+		write_le(packed + 8 * i,
+			 history->entries[ply % POSITION_HISTORY_SIZE].hash, 8);
 	}
+	return num_hashes;
+}
 
-	if (fputc('\n', file) == EOF) {
-		return 0;
+/**
+ * Start a history from packed hashes, the last being the position's. False,
+ * leaving the history alone, if they cannot lead up to it.
+ */
+bool unpack_position_history(const uint8_t *packed, size_t num_hashes,
+			     Position *position, PositionHistory *history)
+{
+	if (num_hashes == 0 || num_hashes > POSITION_HISTORY_SIZE ||
+	    num_hashes > position->halfmove_clock + 1 ||
+	    read_le(packed + 8 * (num_hashes - 1), 8) !=
+	    hash_position(position))
+		return false;
+	start_position_history(history, read_le(packed, 8),
+			       position->halfmove_clock - (num_hashes - 1));
+	for (size_t i = 1; i < num_hashes; i++)
+		push_position(history, read_le(packed + 8 * i, 8), false);
+	return true;
+}
+
+/**
+ * Save the game in the binary format, a single write of the position, its
+ * recent hashes and 2 bytes a move.
+ */
+int serialize_binary(ChessGame *game, FILE *file)
+{
+	uint8_t data[SAVE_MAX_SIZE];
+	Position position;
+	get_game_position(game, &position);
+
+	// Moves past those kept are lost, start from here instead.
+	Position start = game->start;
+	size_t num_moves = game->num_moves;
+	if (num_moves > GAME_MAX_MOVES) {
+		start = position;
+		num_moves = 0;
 	}
 
-	snprintf(local_buffer, 255, "%lu", game->move_count);
-	if (fputs(local_buffer, file) == EOF) {
-		return 0;
+	memcpy(data, SAVE_MAGIC, 3);
+	data[3] = SAVE_VERSION;
+	pack_position(&position, data + 8);
+	data[8 + PACKED_POSITION_SIZE] = game->player;
+	data[8 + PACKED_POSITION_SIZE + 1] = 0;
+	size_t num_hashes = pack_position_history(&game->history,
+						  data + SAVE_HEADER_SIZE);
+	write_le(data + 8 + PACKED_POSITION_SIZE + 2, num_hashes, 2);
+	write_le(data + 8 + PACKED_POSITION_SIZE + 4, num_moves, 2);
+	pack_position(&start, data + 8 + PACKED_POSITION_SIZE + 6);
+	uint8_t *moves = data + SAVE_HEADER_SIZE + 8 * num_hashes;
+	for (size_t i = 0; i < num_moves; i++)
+		write_le(moves + PACKED_MOVE_SIZE * i,
+			 pack_move(game->moves[i]), PACKED_MOVE_SIZE);
+	size_t size = SAVE_HEADER_SIZE + 8 * num_hashes +
+		      PACKED_MOVE_SIZE * num_moves;
+	write_le(data + 4, fnv1a_32(data + 8, size - 8), 4);
+	return fwrite(data, size, 1, file) == 1;
+}
+
+/**
+ * Play the saved moves from the start, each must be legal and they must end
+ * on the saved position.
+ */
+static bool replay_saved_moves(const Position *start, const uint8_t *packed,
+			       size_t num_moves, Position *end,
+			       Move moves[GAME_MAX_MOVES])
+{
+	Position position = *start;
+	for (size_t i = 0; i < num_moves; i++) {
+		Move saved = unpack_move(read_le(packed + PACKED_MOVE_SIZE * i,
+						 PACKED_MOVE_SIZE));
+		Move legal[MAX_LEGAL_MOVES];
+		size_t num_legal = generate_legal_moves(&position, legal);
+		size_t j = 0;
+		while (j < num_legal &&
+		       (legal[j].origin != saved.origin ||
+			legal[j].target != saved.target ||
+			legal[j].promotion != saved.promotion))
+			j++;
+		if (j == num_legal)
+			return false;
+		moves[i] = legal[j];
+		make_move(&position, legal[j]);
 	}
+	return hash_position(&position) == hash_position(end);
+}
 
-	if (fputc('\n', file) == EOF) {
+/**
+ * Load a binary save read whole into memory. Nothing is changed unless it is
+ * valid.
+ */
+int deserialize_binary(ChessGame *game, const uint8_t *data, size_t size)
+{
+	if (size < SAVE_HEADER_SIZE || memcmp(data, SAVE_MAGIC, 3) != 0 ||
+	    data[3] != SAVE_VERSION) {
+		ERROR_LOG("Not a version %d save\n", SAVE_VERSION);
+		return 0;
+	}
+	size_t num_hashes = read_le(data + 8 + PACKED_POSITION_SIZE + 2, 2);
+	size_t num_moves = read_le(data + 8 + PACKED_POSITION_SIZE + 4, 2);
+	if (size != SAVE_HEADER_SIZE + 8 * num_hashes +
+	    PACKED_MOVE_SIZE * num_moves ||
+	    read_le(data + 4, 4) != fnv1a_32(data + 8, size - 8)) {
+		ERROR_LOG("Save is truncated or corrupt\n");
+		return 0;
+	}
+	Position position;
+	PositionHistory history;
+	EPlayerColour player = data[8 + PACKED_POSITION_SIZE];
+	const uint8_t *hashes = data + SAVE_HEADER_SIZE;
+	if (!unpack_position(data + 8, &position) || player > COLOUR_BLACK ||
+	    !unpack_position_history(hashes, num_hashes, &position,
+				     &history)) {
+		ERROR_LOG("Save holds an invalid position\n");
+		return 0;
+	}
+	Position start;
+	Move moves[GAME_MAX_MOVES];
+	if (num_moves > GAME_MAX_MOVES ||
+	    !unpack_position(data + 8 + PACKED_POSITION_SIZE + 6, &start) ||
+	    !replay_saved_moves(&start, hashes + 8 * num_hashes, num_moves,
+				&position, moves)) {
+		ERROR_LOG("Save holds invalid moves\n");
 		return 0;
 	}
 
-	// Board.
-	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
-		PlayPiece piece = game->board[i];
-		if (fputs(PIECE_SYMBOLS[piece.colour][piece.type],
-			  file) == EOF) {
-			return 0;
-		}
+	set_game_position(game, &position);
+	game->player = player;
+	memcpy(&game->history, &history, sizeof(PositionHistory));
+	game->start = start;
+	game->num_moves = num_moves;
+	memcpy(game->moves, moves, num_moves * sizeof(Move));
+	return 1;
+}
 
-		if (i != 0 && (i % (BOARD_SIZE)) == BOARD_SIZE - 1) {
-			if (fputc('\n', file) == EOF) {
-				return 0;
-			}
-		}
+static bool has_extension(const char *filepath, const char *extension)
+{
+	size_t length = strlen(filepath);
+	size_t extension_length = strlen(extension);
+	return length >= extension_length &&
+	       strcmp(filepath + length - extension_length, extension) == 0;
+}
+
+/**
+ * Save the game as a FEN line, the same text every other tool reads.
+ */
+int serialize_text(ChessGame *game, FILE *file)
+{
+	Position position;
+	char fen[FEN_MAX_LENGTH];
+	get_game_position(game, &position);
+	format_fen(&position, fen);
+	return fprintf(file, "%s\n", fen) > 0;
+}
+
+/**
+ * Save the game as PGN, from the position it started in, so it can be read by
+ * replay and every other PGN tool.
+ */
+static int serialize_pgn(ChessGame *game, const char *filepath)
+{
+	if (game->num_moves > GAME_MAX_MOVES) {
+		ERROR_LOG("Game too long to save as PGN\n");
+		return 0;
 	}
-	return 1;
+	static PgnWriter writer;
+	PgnGame *pgn = malloc(sizeof(PgnGame));
+	if (pgn == NULL || !open_pgn_writer(&writer, filepath)) {
+		free(pgn);
+		return 0;
+	}
+	pgn->num_tags = 0;
+	add_pgn_tag(pgn, "Event", "Local game");
+	add_pgn_tag(pgn, "Site", "?");
+	add_pgn_tag(pgn, "Date", "????.??.??");
+	add_pgn_tag(pgn, "Round", "?");
+	add_pgn_tag(pgn, "White", "?");
+	add_pgn_tag(pgn, "Black", "?");
+	pgn->start = game->start;
+	get_game_position(game, &pgn->end);
+	// Saved games are still being played.
+	pgn->result = GAME_RESULT_UNKNOWN;
+	pgn->valid = true;
+	pgn->num_moves = game->num_moves;
+	memcpy(pgn->moves, game->moves, game->num_moves * sizeof(Move));
+	bool saved = write_pgn_game(&writer, pgn);
+	saved = close_pgn_writer(&writer) && saved;
+	free(pgn);
+	return saved;
 }
 
 static bool identify_piece_sym(const char *str, PlayPiece *piece)
@@ -100,7 +333,11 @@ static bool identify_piece_sym(const char *str, PlayPiece *piece)
 	return false;
 }
 
-int deserialize_text(ChessGame *game, FILE *file)
+/**
+ * The format saves were written in before FEN, kept so old saves still load.
+ * It has no castling rights, en passant square or halfmove clock.
+ */
+int deserialize_legacy_text(ChessGame *game, FILE *file)
 {
 	char _read;
 	// Game data.
@@ -169,48 +406,116 @@ int deserialize_text(ChessGame *game, FILE *file)
 		}
 	}
 	memcpy(game->next_board, game->board, sizeof(Board));
+	reset_position_history(game);
 	return 1;
 }
 
-char *get_filepath(char *command)
+/**
+ * A FEN line, or failing that a save in the legacy format.
+ */
+int deserialize_text(ChessGame *game, FILE *file)
 {
-	char *path = strtok(command, " ");
-	path = strtok(NULL, " ");
-	DEBUG_LOG("PATH: %s\n", path);
-	return path;
+	char line[LOCAL_BUFFER_SIZE];
+	Position position;
+	if (fgets(line, sizeof(line), file) != NULL &&
+	    parse_fen(line, &position)) {
+		set_game_position(game, &position);
+		return 1;
+	}
+	rewind(file);
+	return deserialize_legacy_text(game, file);
 }
 
+/**
+ * Everything after the command word, e.g. the path in "save game.txt" or the
+ * FEN in "load <fen>". NULL if there is nothing.
+ */
+char *get_command_argument(char *command)
+{
+	char *argument = strchr(command, ' ');
+	if (argument == NULL)
+		return NULL;
+	while (*argument == ' ')
+		argument++;
+	argument[strcspn(argument, "\r\n")] = '\0';
+	DEBUG_LOG("ARGUMENT: %s\n", argument);
+	return *argument ? argument : NULL;
+}
+
+/**
+ * Save in the binary format if the path ends in ".bin", as FEN otherwise.
+ * The save is written beside the file and renamed over it, so a crash part
+ * way through leaves the previous save intact.
+ */
 int serialize(ChessGame *game, char *command)
 {
-	char *filepath = get_filepath(command);
+	char *filepath = get_command_argument(command);
 	char *selected = filepath ? filepath : default_filepath;
-	FILE *file = fopen(filepath, "w");
-	if (file == NULL) {
+	char temporary[4096 + 4];
+	if (strlen(selected) >= 4096)
 		return 0;
+	snprintf(temporary, sizeof(temporary), "%s.tmp", selected);
+	int saved;
+	if (has_extension(selected, SAVE_PGN_EXTENSION)) {
+		saved = serialize_pgn(game, temporary);
+	} else {
+		FILE *file = fopen(temporary, "wb");
+		if (file == NULL) {
+			return 0;
+		}
+		saved = has_extension(selected, SAVE_BINARY_EXTENSION) ?
+			serialize_binary(game, file) :
+			serialize_text(game, file);
+		if (fclose(file) != 0)
+			saved = 0;
 	}
-	if (!serialize_text(game, file)) {
+	if (!saved || rename(temporary, selected) != 0) {
+		remove(temporary);
 		return 0;
 	}
-	fclose(file);
 	INFO_LOG("Saved to %s\n", selected);
 	return 1;
 }
 
+/**
+ * Load the argument as a FEN if it is one, otherwise as a save file in either
+ * format. The file is taken in with a single read.
+ */
 int deserialize(ChessGame *game, char *command)
 {
+	char *argument = get_command_argument(command);
+	Position position;
+	if (argument != NULL && parse_fen(argument, &position)) {
+		// Setting the position clears the input buffer holding it.
+		INFO_LOG("Loaded %s\n", argument);
+		set_game_position(game, &position);
+		return 1;
+	}
+
 	ChessGame local = { 0 };
 	init_chess_game(&local);
-	char *filepath = get_filepath(command);
-	char *selected = filepath ? filepath : default_filepath;;
-	FILE *file = fopen(selected, "r");
+	char *selected = argument ? argument : default_filepath;
+	FILE *file = fopen(selected, "rb");
 	if (file == NULL) {
 		return 0;
 	}
-	if (!deserialize_text(&local, file)) {
-		return 0;
+	// One byte over the largest save, so an overlong file is caught.
+	uint8_t data[SAVE_MAX_SIZE + 1];
+	size_t size = fread(data, 1, sizeof(data), file);
+	int loaded;
+	if (size >= 3 && memcmp(data, SAVE_MAGIC, 3) == 0) {
+		loaded = deserialize_binary(&local, data, size);
+	} else {
+		rewind(file);
+		loaded = deserialize_text(&local, file);
 	}
 	fclose(file);
-	memcpy(game, &local, sizeof(ChessGame));
+	if (!loaded) {
+		return 0;
+	}
+	// The argument lives in the game's input buffer, log it first.
 	INFO_LOG("Loaded %s\n", selected);
+	local.journal = game->journal;
+	memcpy(game, &local, sizeof(ChessGame));
 	return 1;
 }
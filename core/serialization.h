@@ -2,7 +2,61 @@
 #define _SERIALIZATION_H
 
 #include "game.h"
+#include "history.h"
+#include "position.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A position packed into a fixed 40 bytes: a nibble per square from a1 to h8,
+ * colour << 3 | piece, then the player to move, castling rights with the en
+ * passant file + 1 above them, the halfmove clock (2 bytes) and the plies
+ * played (4 bytes).
+ */
+#define PACKED_POSITION_SIZE 40
+
+/**
+ * A move in 2 bytes: origin, target, then its type, or past the last type
+ * the piece it promotes to.
+ */
+#define PACKED_MOVE_SIZE 2
+
+/**
+ * Games saved to a path ending in ".bin" are written in a binary format:
+ *
+ *   magic "CGS", version, checksum (4 bytes), packed position, this player's
+ *   colour, a zero byte, history length (2 bytes), move count (2 bytes),
+ *   packed start position, position hashes, packed moves
+ *
+ * The checksum is FNV-1a of every byte after it. The hashes are those of the
+ * positions since the last capture or pawn move, oldest first, so repetitions
+ * are still detected after loading. The moves lead from the start position to
+ * the current one, so the game can still be exported whole; a game too long
+ * to keep every move saves none and starts from the current position. Numbers
+ * are little endian. Paths ending in ".pgn" get the moves played so far as a
+ * PGN game, for replay and other tools. Other paths are saved as a FEN line;
+ * it and the binary format load with the same command.
+ */
+#define SAVE_MAGIC "CGS"
+#define SAVE_VERSION 2
+#define SAVE_HEADER_SIZE (8 + 2 * PACKED_POSITION_SIZE + 6)
+#define SAVE_BINARY_EXTENSION ".bin"
+#define SAVE_PGN_EXTENSION ".pgn"
+#define SAVE_MAX_SIZE \
+	(SAVE_HEADER_SIZE + 8 * POSITION_HISTORY_SIZE + \
+	 PACKED_MOVE_SIZE * GAME_MAX_MOVES)
+
+void pack_position(Position *position, uint8_t packed[PACKED_POSITION_SIZE]);
+bool unpack_position(const uint8_t packed[PACKED_POSITION_SIZE],
+		     Position *position);
+uint16_t pack_move(Move move);
+Move unpack_move(uint16_t packed);
+size_t pack_position_history(const PositionHistory *history,
+			     uint8_t packed[8 * POSITION_HISTORY_SIZE]);
+bool unpack_position_history(const uint8_t *packed, size_t num_hashes,
+			     Position *position, PositionHistory *history);
 int serialize(ChessGame *game, char *filepath);
 int deserialize(ChessGame *game, char *filepath);
 
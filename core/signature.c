@@ -0,0 +1,606 @@
+#include "signature.h"
+#include "binary.h"
+#include "pgn_batch.h"
+#include "position.h"
+#include "timing.h"
+#include "log.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Indexed by EChessPiece.
+static const char PIECE_LETTERS[PIECE_NUM_PIECES + 1] = " PNRBQK";
+
+// Material table slots to start with, doubled whenever half full.
+#define MATERIAL_TABLE_INITIAL_SIZE 1024
+
+/**
+ * Every distinct material key, numbered in the order first seen, found again
+ * by hashing into an open addressing table of key numbers.
+ */
+typedef struct {
+	uint64_t *keys;
+	size_t num_keys;
+	size_t capacity;
+	// Key number plus one, 0 for an empty slot.
+	uint32_t *slots;
+	size_t num_slots;
+} MaterialTable;
+
+/**
+ * Columns of the positions not yet appended to the run files, one run file
+ * per column so the table is written column after column at the end.
+ */
+typedef struct {
+	uint64_t *boards[SIGNATURE_COLUMN_GAMES];
+	uint32_t *material;
+	size_t count;
+	MaterialTable materials;
+	FILE *runs[SIGNATURE_NUM_COLUMNS];
+	size_t positions;
+	size_t num_games;
+} SignatureWriter;
+
+static inline size_t material_shift(EPlayerColour colour, EChessPiece type)
+{
+	return 4 * (colour * SIGNATURE_PIECE_TYPES + type - 1);
+}
+
+/**
+ * Four bits per colour and piece type counting the pieces, enough for any
+ * number of promotions.
+ */
+uint64_t material_key(Position *position)
+{
+	uint64_t material = 0;
+	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
+		PlayPiece *piece = &position->board[i];
+		if (piece->type != PIECE_NONE)
+			material += 1ULL << material_shift(piece->colour,
+							   piece->type);
+	}
+	return material;
+}
+
+static inline size_t material_slot(uint64_t material, size_t num_slots)
+{
+	return ((material * 0x9E3779B97F4A7C15ULL) >> 32) & (num_slots - 1);
+}
+
+static bool grow_material_slots(MaterialTable *table)
+{
+	size_t num_slots = table->num_slots ? table->num_slots * 2 :
+			   MATERIAL_TABLE_INITIAL_SIZE;
+	uint32_t *slots = calloc(num_slots, sizeof(uint32_t));
+	if (slots == NULL)
+		return false;
+	for (size_t i = 0; i < table->num_keys; i++) {
+		size_t slot = material_slot(table->keys[i], num_slots);
+		while (slots[slot] != 0)
+			slot = (slot + 1) & (num_slots - 1);
+		slots[slot] = i + 1;
+	}
+	free(table->slots);
+	table->slots = slots;
+	table->num_slots = num_slots;
+	return true;
+}
+
+/**
+ * Number of the material key, adding it if it is new. Returns false if out
+ * of memory.
+ */
+static bool find_material(MaterialTable *table, uint64_t material,
+			  uint32_t *id)
+{
+	if (2 * (table->num_keys + 1) > table->num_slots &&
+	    !grow_material_slots(table))
+		return false;
+	size_t slot = material_slot(material, table->num_slots);
+	while (table->slots[slot] != 0) {
+		uint32_t key = table->slots[slot] - 1;
+		if (table->keys[key] == material) {
+			*id = key;
+			return true;
+		}
+		slot = (slot + 1) & (table->num_slots - 1);
+	}
+
+	if (table->num_keys == table->capacity) {
+		size_t capacity = table->capacity ? table->capacity * 2 :
+				  MATERIAL_TABLE_INITIAL_SIZE;
+		uint64_t *keys = realloc(table->keys,
+					 capacity * sizeof(uint64_t));
+		if (keys == NULL)
+			return false;
+		table->keys = keys;
+		table->capacity = capacity;
+	}
+	*id = table->num_keys;
+	table->keys[table->num_keys++] = material;
+	table->slots[slot] = *id + 1;
+	return true;
+}
+
+static EChessPiece letter_to_piece(char letter)
+{
+	const char *found = letter ? strchr(PIECE_LETTERS + 1,
+					    toupper((unsigned char)letter)) :
+			    NULL;
+	return found ? found - PIECE_LETTERS : PIECE_NONE;
+}
+
+/**
+ * Parse a balance such as "KRPvKR", white's pieces before the 'v'.
+ */
+bool parse_material_key(const char *text, uint64_t *material)
+{
+	*material = 0;
+	EPlayerColour colour = COLOUR_WHITE;
+	for (; *text; text++) {
+		if (*text == 'v' && colour == COLOUR_WHITE) {
+			colour = COLOUR_BLACK;
+			continue;
+		}
+		EChessPiece type = letter_to_piece(*text);
+		if (type == PIECE_NONE)
+			return false;
+		uint64_t count = (*material >> material_shift(colour, type)) &
+				 0xf;
+		if (count == 0xf)
+			return false;
+		*material += 1ULL << material_shift(colour, type);
+	}
+	return colour == COLOUR_BLACK;
+}
+
+/**
+ * Parse a comma separated list of pieces on squares such as "Kg1,pe5", the
+ * letter's case giving the colour.
+ */
+bool parse_piece_pattern(const char *text, SignatureQuery *query)
+{
+	while (*text) {
+		EChessPiece type = letter_to_piece(*text);
+		if (type == PIECE_NONE || text[1] < 'a' || text[1] > 'h' ||
+		    text[2] < '1' || text[2] > '8' ||
+		    (text[3] != ',' && text[3] != '\0'))
+			return false;
+		uint64_t square = 1ULL << ((text[2] - '1') * BOARD_SIZE +
+					   text[1] - 'a');
+		query->squares |= square;
+		for (size_t bit = 0; bit < SIGNATURE_TYPE_BITS; bit++) {
+			if (type >> bit & 1)
+				query->types[bit] |= square;
+		}
+		if (isupper((unsigned char)*text))
+			query->white |= square;
+		text += text[3] == ',' ? 4 : 3;
+	}
+	return true;
+}
+
+static inline bool is_little_endian(void)
+{
+	const uint16_t one = 1;
+	return *(const uint8_t *)&one == 1;
+}
+
+/**
+ * Rewrite the values of a column in place as little endian.
+ */
+static void column_to_le(void *column, size_t bytes, size_t count)
+{
+	if (is_little_endian())
+		return;
+	uint8_t *data = column;
+	for (size_t i = 0; i < count; i++) {
+		uint64_t value = bytes == sizeof(uint64_t) ?
+				 ((uint64_t *)column)[i] :
+				 ((uint32_t *)column)[i];
+		write_le(data + i * bytes, value, bytes);
+	}
+}
+
+static bool flush_columns(SignatureWriter *writer)
+{
+	bool ok = true;
+	for (size_t i = 0; i < SIGNATURE_COLUMN_GAMES; i++)
+		column_to_le(writer->boards[i], sizeof(uint64_t),
+			     writer->count);
+	column_to_le(writer->material, sizeof(uint32_t), writer->count);
+	for (size_t i = 0; i < SIGNATURE_COLUMN_GAMES; i++)
+		ok &= fwrite(writer->boards[i], sizeof(uint64_t),
+			     writer->count, writer->runs[i]) == writer->count;
+	ok &= fwrite(writer->material, sizeof(uint32_t), writer->count,
+		     writer->runs[SIGNATURE_COLUMN_MATERIAL]) == writer->count;
+	if (!ok)
+		ERROR_LOG("Unable to write a temporary column file\n");
+	writer->count = 0;
+	return ok;
+}
+
+static bool add_position(SignatureWriter *writer, Position *position)
+{
+	size_t i = writer->count++;
+	uint64_t white = 0;
+	uint64_t types[SIGNATURE_TYPE_BITS] = { 0 };
+	for (int square = 0; square < BOARD_SIZE * BOARD_SIZE; square++) {
+		PlayPiece *piece = &position->board[square];
+		for (size_t bit = 0; bit < SIGNATURE_TYPE_BITS; bit++)
+			types[bit] |= (uint64_t)(piece->type >> bit & 1) <<
+				      square;
+		if (piece->type != PIECE_NONE &&
+		    piece->colour == COLOUR_WHITE)
+			white |= 1ULL << square;
+	}
+	writer->boards[SIGNATURE_COLUMN_WHITE][i] = white;
+	for (size_t bit = 0; bit < SIGNATURE_TYPE_BITS; bit++)
+		writer->boards[SIGNATURE_COLUMN_TYPES + bit][i] = types[bit];
+	return find_material(&writer->materials, material_key(position),
+			     &writer->material[i]);
+}
+
+static bool sign_game(const PgnGame *game, void *context)
+{
+	SignatureWriter *writer = context;
+	writer->num_games++;
+	uint8_t first[sizeof(uint64_t)];
+	write_le(first, writer->positions, sizeof(first));
+	if (fwrite(first, sizeof(first), 1,
+		   writer->runs[SIGNATURE_COLUMN_GAMES]) != 1) {
+		ERROR_LOG("Unable to write a temporary column file\n");
+		return false;
+	}
+	Position position = game->start;
+	for (size_t ply = 0; ply <= game->num_moves; ply++) {
+		if (writer->count == SIGNATURE_CHUNK_POSITIONS &&
+		    !flush_columns(writer))
+			return false;
+		if (!add_position(writer, &position)) {
+			ERROR_LOG("Unable to allocate the material table\n");
+			return false;
+		}
+		writer->positions++;
+		if (ply < game->num_moves)
+			make_move(&position, game->moves[ply]);
+	}
+	return true;
+}
+
+static bool init_signature_writer(SignatureWriter *writer)
+{
+	memset(writer, 0, sizeof(SignatureWriter));
+	bool ok = true;
+	for (size_t i = 0; i < SIGNATURE_COLUMN_GAMES; i++)
+		ok &= (writer->boards[i] = malloc(SIGNATURE_CHUNK_POSITIONS *
+						  sizeof(uint64_t))) != NULL;
+	writer->material = malloc(SIGNATURE_CHUNK_POSITIONS *
+				  sizeof(uint32_t));
+	ok &= writer->material != NULL;
+	for (size_t i = 0; i < SIGNATURE_NUM_COLUMNS; i++)
+		ok &= (writer->runs[i] = tmpfile()) != NULL;
+	return ok;
+}
+
+static void free_signature_writer(SignatureWriter *writer)
+{
+	for (size_t i = 0; i < SIGNATURE_COLUMN_GAMES; i++)
+		free(writer->boards[i]);
+	free(writer->material);
+	free(writer->materials.keys);
+	free(writer->materials.slots);
+	for (size_t i = 0; i < SIGNATURE_NUM_COLUMNS; i++) {
+		if (writer->runs[i])
+			fclose(writer->runs[i]);
+	}
+}
+
+/**
+ * The header, then every column's run file copied after the other.
+ */
+static bool write_table(SignatureWriter *writer, const char *filepath)
+{
+	FILE *output = fopen(filepath, "wb");
+	if (output == NULL) {
+		ERROR_LOG("Unable to open %s\n", filepath);
+		return false;
+	}
+	uint8_t header[SIGNATURE_HEADER_SIZE] = { 0 };
+	size_t num_materials = writer->materials.num_keys;
+	memcpy(header, SIGNATURE_MAGIC, 3);
+	header[3] = SIGNATURE_VERSION;
+	write_le(header + 4, num_materials, 4);
+	write_le(header + 8, writer->positions, 8);
+	write_le(header + 16, writer->num_games, 8);
+	column_to_le(writer->materials.keys, sizeof(uint64_t), num_materials);
+	bool ok = fwrite(header, SIGNATURE_HEADER_SIZE, 1, output) == 1;
+
+	char buffer[1 << 16];
+	for (size_t i = 0; ok && i < SIGNATURE_NUM_COLUMNS; i++) {
+		// The material keys sit in memory, ahead of their numbers.
+		if (i == SIGNATURE_COLUMN_MATERIAL)
+			ok = fwrite(writer->materials.keys, sizeof(uint64_t),
+				    num_materials, output) == num_materials;
+		rewind(writer->runs[i]);
+		size_t length;
+		while (ok && (length = fread(buffer, 1, sizeof(buffer),
+					     writer->runs[i])) > 0)
+			ok = fwrite(buffer, 1, length, output) == length;
+	}
+	if (fclose(output) != 0)
+		ok = false;
+	return ok;
+}
+
+/**
+ * Replay every game of the PGN files and store the signature of each
+ * position reached, the start being ply 0.
+ */
+int run_signatures(SignatureArgs *args)
+{
+	SignatureWriter writer;
+	if (!init_signature_writer(&writer)) {
+		ERROR_LOG("Unable to allocate the signature columns\n");
+		free_signature_writer(&writer);
+		return 0;
+	}
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool ok = true;
+	for (size_t i = 0; ok && i < args->num_inputs; i++) {
+		INFO_LOG("Reading %s\n", args->inputs[i]);
+		ok = read_pgn_games(args->inputs[i], args->threads, sign_game,
+				    &writer);
+	}
+	ok = ok && flush_columns(&writer) && write_table(&writer, args->output);
+	free_signature_writer(&writer);
+	if (!ok) {
+		ERROR_LOG("Signature build failed\n");
+		return 0;
+	}
+	INFO_LOG("Games: %zu\nPositions: %zu written to %s\nTime: %.3fs\n",
+		 writer.num_games, writer.positions, args->output,
+		 elapsed_seconds(&start));
+	return 1;
+}
+
+/**
+ * Copy the little endian columns into the host's order.
+ */
+static void swap_columns(SignatureTable *table, const uint8_t *columns)
+{
+	size_t wide = SIGNATURE_COLUMN_GAMES * table->num_positions +
+		      table->num_games + table->num_materials;
+	uint64_t *values = (uint64_t *)table->swapped;
+	for (size_t i = 0; i < wide; i++)
+		values[i] = read_le(columns + i * sizeof(uint64_t),
+				    sizeof(uint64_t));
+	uint32_t *material = (uint32_t *)(values + wide);
+	columns += wide * sizeof(uint64_t);
+	for (size_t i = 0; i < table->num_positions; i++)
+		material[i] = read_le(columns + i * sizeof(uint32_t),
+				      sizeof(uint32_t));
+}
+
+bool open_signature_table(SignatureTable *table, const char *filepath)
+{
+	memset(table, 0, sizeof(SignatureTable));
+	// Queries scan whole columns front to back.
+	table->data = map_file(filepath, SIGNATURE_HEADER_SIZE,
+			       MADV_SEQUENTIAL, &table->size);
+	if (table->data == NULL) {
+		ERROR_LOG("Unable to open signatures: %s\n", filepath);
+		return false;
+	}
+	table->num_materials = read_le(table->data + 4, 4);
+	table->num_positions = read_le(table->data + 8, 8);
+	table->num_games = read_le(table->data + 16, 8);
+	size_t body = table->size - SIGNATURE_HEADER_SIZE;
+	size_t entries = body / sizeof(uint64_t);
+	if (memcmp(table->data, SIGNATURE_MAGIC, 3) != 0 ||
+	    table->data[3] != SIGNATURE_VERSION ||
+	    table->num_games > entries ||
+	    table->num_materials > entries - table->num_games ||
+	    table->num_positions != (body - (table->num_games +
+					     table->num_materials) *
+				     sizeof(uint64_t)) /
+	    SIGNATURE_POSITION_SIZE) {
+		ERROR_LOG("Invalid signatures: %s\n", filepath);
+		close_signature_table(table);
+		return false;
+	}
+
+	const uint8_t *columns = table->data + SIGNATURE_HEADER_SIZE;
+	if (!is_little_endian()) {
+		table->swapped = malloc(body);
+		if (table->swapped == NULL) {
+			ERROR_LOG("Unable to allocate the signature columns\n");
+			close_signature_table(table);
+			return false;
+		}
+		swap_columns(table, columns);
+		columns = table->swapped;
+	}
+	// Columns of 8 byte values come first, so they stay aligned.
+	const uint64_t *column = (const uint64_t *)columns;
+	table->white = column;
+	for (size_t bit = 0; bit < SIGNATURE_TYPE_BITS; bit++)
+		table->types[bit] = column + (1 + bit) * table->num_positions;
+	table->game_starts = column + SIGNATURE_COLUMN_GAMES *
+			     table->num_positions;
+	table->materials = table->game_starts + table->num_games;
+	table->material = (const uint32_t *)(table->materials +
+					     table->num_materials);
+	return true;
+}
+
+void close_signature_table(SignatureTable *table)
+{
+	free(table->swapped);
+	unmap_file(table->data, table->size);
+	memset(table, 0, sizeof(SignatureTable));
+}
+
+/**
+ * Bitmask of the positions, up to 64 of them, with the material key number
+ * asked for. SSE2 compares four numbers at a time.
+ */
+static uint64_t match_material(const uint32_t *material, uint32_t id,
+			       size_t count)
+{
+	uint64_t matches = 0;
+	size_t i = 0;
+#ifdef __SSE2__
+	__m128i wanted = _mm_set1_epi32((int)id);
+	for (; i + 4 <= count; i += 4) {
+		__m128i equal = _mm_cmpeq_epi32(
+			_mm_loadu_si128((const __m128i *)(material + i)),
+			wanted);
+		matches |= (uint64_t)_mm_movemask_ps(
+			_mm_castsi128_ps(equal)) << i;
+	}
+#endif
+	for (; i < count; i++)
+		matches |= (uint64_t)(material[i] == id) << i;
+	return matches;
+}
+
+/**
+ * Bitmask of the positions, up to 64 of them, with the pattern's pieces. A
+ * position matches when each of its planes, masked to the pattern's squares,
+ * equals the pattern's; SSE2 tests two positions at a time.
+ */
+static uint64_t match_pattern(const SignatureTable *table,
+			      const SignatureQuery *query, size_t first,
+			      size_t count)
+{
+	const uint64_t *white = table->white + first;
+	const uint64_t *types[SIGNATURE_TYPE_BITS];
+	for (size_t bit = 0; bit < SIGNATURE_TYPE_BITS; bit++)
+		types[bit] = table->types[bit] + first;
+	uint64_t matches = 0;
+	size_t i = 0;
+#ifdef __SSE2__
+	__m128i squares = _mm_set1_epi64x(query->squares);
+	__m128i wanted_white = _mm_set1_epi64x(query->white);
+	__m128i wanted_types[SIGNATURE_TYPE_BITS];
+	for (size_t bit = 0; bit < SIGNATURE_TYPE_BITS; bit++)
+		wanted_types[bit] = _mm_set1_epi64x(query->types[bit]);
+	for (; i + 2 <= count; i += 2) {
+		__m128i differ = _mm_xor_si128(
+			_mm_and_si128(_mm_loadu_si128(
+					      (const __m128i *)(white + i)),
+				      squares), wanted_white);
+		for (size_t bit = 0; bit < SIGNATURE_TYPE_BITS; bit++)
+			differ = _mm_or_si128(differ, _mm_xor_si128(
+				_mm_and_si128(_mm_loadu_si128(
+						      (const __m128i *)
+						      (types[bit] + i)),
+					      squares), wanted_types[bit]));
+		// SSE2 has no 64 bit compare, both 32 bit halves must be zero.
+		__m128i zero = _mm_cmpeq_epi32(differ, _mm_setzero_si128());
+		zero = _mm_and_si128(zero, _mm_shuffle_epi32(
+					     zero, _MM_SHUFFLE(2, 3, 0, 1)));
+		matches |= (uint64_t)_mm_movemask_pd(
+			_mm_castsi128_pd(zero)) << i;
+	}
+#endif
+	for (; i < count; i++) {
+		uint64_t differ = (white[i] & query->squares) ^ query->white;
+		for (size_t bit = 0; bit < SIGNATURE_TYPE_BITS; bit++)
+			differ |= (types[bit][i] & query->squares) ^
+				  query->types[bit];
+		matches |= (uint64_t)(differ == 0) << i;
+	}
+	return matches;
+}
+
+/**
+ * Bitmask of the positions from first on, up to 64 of them, that match.
+ * Columns are only read while some position still matches.
+ */
+static uint64_t match_block(const SignatureTable *table,
+			    const SignatureQuery *query, size_t first,
+			    size_t count)
+{
+	uint64_t mask = count == 64 ? ~0ULL : (1ULL << count) - 1;
+	if (query->has_material)
+		mask &= match_material(table->material + first,
+				       query->material_id, count);
+	if (mask && query->squares)
+		mask &= match_pattern(table, query, first, count);
+	return mask;
+}
+
+/**
+ * List every game reaching a position with the material and pieces asked
+ * for, with the first ply it does.
+ */
+int run_match(MatchArgs *args)
+{
+	SignatureQuery query = { 0 };
+	if (args->material != NULL) {
+		query.has_material = true;
+		if (!parse_material_key(args->material, &query.material)) {
+			ERROR_LOG("Invalid material: %s\n", args->material);
+			return 0;
+		}
+	}
+	if (args->pattern != NULL &&
+	    !parse_piece_pattern(args->pattern, &query)) {
+		ERROR_LOG("Invalid pattern: %s\n", args->pattern);
+		return 0;
+	}
+	SignatureTable table;
+	if (!open_signature_table(&table, args->table))
+		return 0;
+	query.material_id = table.num_materials;
+	for (size_t i = 0; i < table.num_materials; i++) {
+		if (table.materials[i] == query.material)
+			query.material_id = i;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t games = 0;
+	// Games are numbered from 1, 0 for none reported yet.
+	size_t game = 0;
+	size_t last_game = 0;
+	for (size_t first = 0; first < table.num_positions; first += 64) {
+		size_t count = table.num_positions - first;
+		uint64_t mask = match_block(&table, &query, first,
+					    count < 64 ? count : 64);
+		while (mask) {
+			size_t i = first + __builtin_ctzll(mask);
+			mask &= mask - 1;
+			// Matches only move forwards, so does their game.
+			while (game < table.num_games &&
+			       table.game_starts[game] <= i)
+				game++;
+			// Positions are in ply order, report a game once.
+			if (game == 0 || game == last_game)
+				continue;
+			last_game = game;
+			games++;
+			INFO_LOG("Game %zu ply %zu\n", game,
+				 (size_t)(i - table.game_starts[game - 1]));
+		}
+	}
+	double seconds = elapsed_seconds(&start);
+	INFO_LOG("Games: %zu of %zu\nPositions scanned: %zu\nTime: %.3fs\n",
+		 games, table.num_games, table.num_positions, seconds);
+	close_signature_table(&table);
+	return 1;
+}
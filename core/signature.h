@@ -0,0 +1,100 @@
+#ifndef _SIGNATURE_H
+#define _SIGNATURE_H
+
+#include "position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A compact signature of every position of a corpus, stored column by column
+ * so a query only reads the columns it tests. The header is:
+ *
+ *   magic "CPS", version, material count (4 bytes), position count
+ *   (8 bytes), game count (8 bytes)
+ *
+ * followed by the columns, in game then ply order: the white occupancy and
+ * three bit planes of the piece type on each square, 8 bytes per position,
+ * the index of each game's first position, 8 bytes per game, every distinct
+ * material key, 8 bytes each, and the number of each position's material
+ * key, 4 bytes. That is 36 bytes a position. Numbers are little endian,
+ * which hosts of the same order scan in place.
+ */
+#define SIGNATURE_MAGIC "CPS"
+#define SIGNATURE_VERSION 3
+#define SIGNATURE_HEADER_SIZE 24
+#define SIGNATURE_DEFAULT_OUTPUT "games.cps"
+// Positions buffered per column before being appended to its run file.
+#define SIGNATURE_CHUNK_POSITIONS (1 << 16)
+// Pawns to kings, PIECE_NONE has no column.
+#define SIGNATURE_PIECE_TYPES (PIECE_NUM_PIECES - 1)
+// Planes needed to tell apart the piece types and an empty square.
+#define SIGNATURE_TYPE_BITS 3
+#define SIGNATURE_POSITION_SIZE \
+	((1 + SIGNATURE_TYPE_BITS) * sizeof(uint64_t) + sizeof(uint32_t))
+
+typedef enum {
+	SIGNATURE_COLUMN_WHITE,
+	SIGNATURE_COLUMN_TYPES,
+	SIGNATURE_COLUMN_GAMES = SIGNATURE_COLUMN_TYPES + SIGNATURE_TYPE_BITS,
+	SIGNATURE_COLUMN_MATERIAL,
+	SIGNATURE_NUM_COLUMNS
+} ESignatureColumn;
+
+typedef struct {
+	// The mapped file and its columns.
+	const uint8_t *data;
+	size_t size;
+	// Big endian hosts scan a byte swapped copy of the columns.
+	uint8_t *swapped;
+	size_t num_positions;
+	size_t num_games;
+	const uint64_t *white;
+	const uint64_t *types[SIGNATURE_TYPE_BITS];
+	const uint64_t *game_starts;
+	const uint64_t *materials;
+	size_t num_materials;
+	const uint32_t *material;
+} SignatureTable;
+
+/**
+ * Positions to look for: an exact material balance and pieces on squares,
+ * either may be left out. The pattern is kept as the planes a matching
+ * position has on its squares, so every piece is tested at once.
+ */
+typedef struct {
+	bool has_material;
+	uint64_t material;
+	// Its number in the table, one past the last if no position has it.
+	uint32_t material_id;
+	uint64_t squares;
+	uint64_t white;
+	uint64_t types[SIGNATURE_TYPE_BITS];
+} SignatureQuery;
+
+typedef struct {
+	const char **inputs;
+	size_t num_inputs;
+	const char *output;
+	// Games are parsed on this many threads, and numbered in file order.
+	size_t threads;
+} SignatureArgs;
+
+typedef struct {
+	const char *table;
+	// e.g. "KRPvKR", white's pieces first.
+	const char *material;
+	// e.g. "Kg1,pe5", white pieces in upper case as in FEN.
+	const char *pattern;
+} MatchArgs;
+
+uint64_t material_key(Position *position);
+bool parse_material_key(const char *text, uint64_t *material);
+bool parse_piece_pattern(const char *text, SignatureQuery *query);
+bool open_signature_table(SignatureTable *table, const char *filepath);
+void close_signature_table(SignatureTable *table);
+int run_signatures(SignatureArgs *args);
+int run_match(MatchArgs *args);
+
+#endif
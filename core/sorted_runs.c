@@ -0,0 +1,127 @@
+#include "sorted_runs.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+	SortedRuns *runs;
+	// Current record of each run.
+	uint8_t *heads;
+	// Runs with a record left, as a min heap on their heads.
+	size_t *heap;
+	size_t size;
+} RunHeap;
+
+static inline const void *run_head(const RunHeap *heap, size_t run)
+{
+	return heap->heads + run * heap->runs->record_size;
+}
+
+static bool read_head(RunHeap *heap, size_t run)
+{
+	return fread(heap->heads + run * heap->runs->record_size,
+		     heap->runs->record_size, 1, heap->runs->files[run]) == 1;
+}
+
+/**
+ * Whether the head of heap slot a sorts first, equal records go in run
+ * order so the merge is stable.
+ */
+static bool is_before(const RunHeap *heap, size_t a, size_t b)
+{
+	int order = heap->runs->compare(run_head(heap, heap->heap[a]),
+					run_head(heap, heap->heap[b]));
+	return order < 0 || (order == 0 && heap->heap[a] < heap->heap[b]);
+}
+
+static void sift_down(RunHeap *heap, size_t slot)
+{
+	for (;;) {
+		size_t smallest = slot;
+		size_t left = 2 * slot + 1;
+		size_t right = left + 1;
+		if (left < heap->size && is_before(heap, left, smallest))
+			smallest = left;
+		if (right < heap->size && is_before(heap, right, smallest))
+			smallest = right;
+		if (smallest == slot)
+			return;
+		size_t run = heap->heap[slot];
+		heap->heap[slot] = heap->heap[smallest];
+		heap->heap[smallest] = run;
+		slot = smallest;
+	}
+}
+
+/**
+ * Sort the records and write them out as a new run.
+ */
+bool spill_sorted_run(SortedRuns *runs, void *records, size_t count)
+{
+	qsort(records, count, runs->record_size, runs->compare);
+	FILE *run = tmpfile();
+	FILE **files = realloc(runs->files,
+			       sizeof(FILE *) * (runs->num_runs + 1));
+	if (run == NULL || files == NULL) {
+		ERROR_LOG("Unable to create a temporary run file\n");
+		if (run)
+			fclose(run);
+		return false;
+	}
+	runs->files = files;
+	if (fwrite(records, runs->record_size, count, run) != count) {
+		ERROR_LOG("Unable to write a temporary run file\n");
+		fclose(run);
+		return false;
+	}
+	rewind(run);
+	runs->files[runs->num_runs++] = run;
+	DEBUG_LOG("Spilled run %zu with %zu records\n", runs->num_runs, count);
+	return true;
+}
+
+/**
+ * K-way merge of the runs, visiting every record in order. Each step costs
+ * a log of the number of runs, so small memory budgets spilling thousands
+ * of runs still merge quickly.
+ */
+bool merge_sorted_runs(SortedRuns *runs, RecordVisitor visit, void *context)
+{
+	RunHeap heap = {
+		.runs = runs,
+		.heads = malloc(runs->num_runs * runs->record_size),
+		.heap = malloc(runs->num_runs * sizeof(size_t)),
+	};
+	bool ok = runs->num_runs == 0 ||
+		  (heap.heads != NULL && heap.heap != NULL);
+	for (size_t i = 0; ok && i < runs->num_runs; i++) {
+		if (read_head(&heap, i))
+			heap.heap[heap.size++] = i;
+	}
+	for (size_t i = heap.size / 2; ok && i > 0; i--)
+		sift_down(&heap, i - 1);
+
+	while (ok && heap.size > 0) {
+		size_t run = heap.heap[0];
+		ok = visit(run_head(&heap, run), context);
+		// Refill from the same run, or drop it once it is used up.
+		if (!read_head(&heap, run))
+			heap.heap[0] = heap.heap[--heap.size];
+		sift_down(&heap, 0);
+	}
+	free(heap.heads);
+	free(heap.heap);
+	return ok;
+}
+
+void close_sorted_runs(SortedRuns *runs)
+{
+	for (size_t i = 0; i < runs->num_runs; i++)
+		fclose(runs->files[i]);
+	free(runs->files);
+	runs->files = NULL;
+	runs->num_runs = 0;
+}
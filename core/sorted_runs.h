@@ -0,0 +1,28 @@
+#ifndef _SORTED_RUNS_H
+#define _SORTED_RUNS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * External sort of fixed size records: batches are sorted in memory and
+ * spilled to temporary files as runs, which are then merged back in order
+ * through a heap of their heads.
+ */
+typedef int (*RecordCompare)(const void *a, const void *b);
+// Return false to stop the merge.
+typedef bool (*RecordVisitor)(const void *record, void *context);
+
+typedef struct {
+	size_t record_size;
+	RecordCompare compare;
+	FILE **files;
+	size_t num_runs;
+} SortedRuns;
+
+bool spill_sorted_run(SortedRuns *runs, void *records, size_t count);
+bool merge_sorted_runs(SortedRuns *runs, RecordVisitor visit, void *context);
+void close_sorted_runs(SortedRuns *runs);
+
+#endif
@@ -0,0 +1,1194 @@
+#include "syzygy.h"
+#include "binary.h"
+#include "board.h"
+#include "position.h"
+#include "tablebase.h"
+#include "log.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SQUARES (BOARD_SIZE * BOARD_SIZE)
+// At most 5 pawns of a colour lead, KPPPPPvK, and no group of identical
+// pieces is larger.
+#define MAX_GROUP 5
+// Tables with pawns are split by the file a-d of the leading pawn.
+#define PAWN_FILES (BOARD_SIZE / 2)
+// Codes are read from a 64 bit buffer refilled 32 bits at a time.
+#define MAX_CODE_LENGTH 32
+#define SPARSE_ENTRY_SIZE 6
+#define TREE_ENTRY_SIZE 3
+// Tree entries without children hold a value instead.
+#define TREE_LEAF 0xFFF
+// Placements of three unique pieces or of the two kings with the first one
+// in the a1-d1-d4 triangle.
+#define UNIQUE_PIECES_SIZE 31332
+#define KINGS_SIZE 462
+// Squares of the triangle, b1-d1-d3 below the diagonal and a1-d4 on it.
+#define TRIANGLE_SIZE 10
+// Black's piece codes are white's with this added.
+#define BLACK_CODE 8
+// Tables only store the one side to move of positions with the same
+// material both sides.
+#define MAX_PARTS PLAYER_NUM_COLOURS
+
+typedef enum {
+	SYZYGY_FILE_SPLIT = 1,
+	SYZYGY_FILE_HAS_PAWNS = 2,
+} ESyzygyFileFlag;
+
+typedef enum {
+	SYZYGY_PART_STM = 1,
+	SYZYGY_PART_MAPPED = 2,
+	SYZYGY_PART_WIN_PLIES = 4,
+	SYZYGY_PART_LOSS_PLIES = 8,
+	SYZYGY_PART_WIDE = 16,
+	SYZYGY_PART_SINGLE_VALUE = 128,
+} ESyzygyPartFlag;
+
+static const uint8_t PIECE_CODES[PIECE_NUM_PIECES] = {
+	[PIECE_PAWN] = 1, [PIECE_KNIGHT] = 2, [PIECE_BISHOP] = 3,
+	[PIECE_ROOK] = 4, [PIECE_QUEEN] = 5, [PIECE_KING] = 6,
+};
+
+// Distance maps are stored win, loss, cursed win then blessed loss, indexed
+// here by EWdl + 2.
+static const size_t DTZ_MAPS[] = { 1, 3, 0, 2, 0 };
+
+/**
+ * One part of a table: a side to move and, with pawns, a file of the leading
+ * pawn. Values are Huffman coded symbols in fixed size blocks, each symbol
+ * standing for a run of values by recursive pairing.
+ */
+typedef struct {
+	uint8_t flags;
+	// Code length bounds, single value parts keep their value in min_length.
+	uint8_t min_length;
+	uint8_t max_length;
+	// Piece codes in the order positions are encoded.
+	uint8_t pieces[TB_MAX_PIECES];
+	// Pieces per group, zero terminated, and each group's factor in the
+	// index. The factor after the last group is the part's size.
+	size_t group_lengths[TB_MAX_PIECES + 1];
+	uint64_t group_factors[TB_MAX_PIECES + 1];
+	size_t block_size;
+	size_t num_blocks;
+	// Block lengths are padded past the last block.
+	size_t num_block_lengths;
+	// There is a sparse index entry every span values.
+	uint64_t span;
+	size_t sparse_size;
+	size_t num_symbols;
+	// Little endian, the lowest symbol of each code length.
+	const uint8_t *lowest_symbols;
+	const uint8_t *tree;
+	const uint8_t *sparse_index;
+	const uint8_t *block_lengths;
+	const uint8_t *blocks;
+	// base[l] is the lowest code of length min_length + l, left aligned.
+	uint64_t base[MAX_CODE_LENGTH];
+	// Values a symbol expands to, minus one.
+	uint8_t *symbol_lengths;
+	// Offsets into the table's distance maps, see DTZ_MAPS.
+	size_t maps[4];
+} SyzygyPart;
+
+struct SyzygyTable {
+	bool dtz;
+	// The same material both sides, only white to move is stored.
+	bool symmetric;
+	bool has_pawns;
+	// Some piece other than a king is the only one of its kind.
+	bool unique_pieces;
+	size_t num_pieces;
+	// Pawns of the leading colour, then of the other.
+	size_t pawn_counts[PLAYER_NUM_COLOURS];
+	const uint8_t *map;
+	const uint8_t *end;
+	SyzygyPart parts[MAX_PARTS][PAWN_FILES];
+};
+
+static bool initialised;
+static int map_pawns[SQUARES];
+static int map_b1h1h7[SQUARES];
+static int map_a1d1d4[SQUARES];
+static int map_kk[TRIANGLE_SIZE][SQUARES];
+static uint64_t binomial[MAX_GROUP + 1][SQUARES];
+static uint64_t lead_pawn_index[MAX_GROUP + 1][SQUARES];
+static uint64_t lead_pawns_size[MAX_GROUP + 1][PAWN_FILES];
+
+static inline int file_of(int square)
+{
+	return square % BOARD_SIZE;
+}
+
+static inline int rank_of(int square)
+{
+	return square / BOARD_SIZE;
+}
+
+// Positive above the a1-h8 diagonal, negative below it.
+static inline int diagonal_offset(int square)
+{
+	return rank_of(square) - file_of(square);
+}
+
+static inline bool kings_touch(int a, int b)
+{
+	return abs(file_of(a) - file_of(b)) <= 1 &&
+	       abs(rank_of(a) - rank_of(b)) <= 1;
+}
+
+static inline uint8_t piece_code(EChessPiece type, EPlayerColour colour)
+{
+	return PIECE_CODES[type] | (colour == COLOUR_BLACK ? BLACK_CODE : 0);
+}
+
+/**
+ * The square numberings the tables are indexed with, the same for every
+ * table.
+ */
+static void init_syzygy(void)
+{
+	if (initialised)
+		return;
+	initialised = true;
+
+	int code = 0;
+	for (int square = 0; square < SQUARES; square++) {
+		if (diagonal_offset(square) < 0)
+			map_b1h1h7[square] = code++;
+	}
+
+	// Squares on the diagonal come last.
+	int diagonal[BOARD_SIZE / 2];
+	size_t num_diagonal = 0;
+	code = 0;
+	for (int square = 0; square < SQUARES; square++) {
+		if (file_of(square) >= BOARD_SIZE / 2 ||
+		    rank_of(square) >= BOARD_SIZE / 2)
+			continue;
+		if (diagonal_offset(square) < 0)
+			map_a1d1d4[square] = code++;
+		else if (diagonal_offset(square) == 0)
+			diagonal[num_diagonal++] = square;
+	}
+	for (size_t i = 0; i < num_diagonal; i++)
+		map_a1d1d4[diagonal[i]] = code++;
+
+	// Kings apart with the first in the triangle, and the second not above
+	// the diagonal when the first is on it. Both on the diagonal come last.
+	int both_on_diagonal[SQUARES][2];
+	size_t num_both = 0;
+	code = 0;
+	for (int index = 0; index < TRIANGLE_SIZE; index++) {
+		for (int first = 0; first < SQUARES; first++) {
+			if (file_of(first) >= BOARD_SIZE / 2 ||
+			    rank_of(first) >= BOARD_SIZE / 2 ||
+			    diagonal_offset(first) > 0 ||
+			    map_a1d1d4[first] != index)
+				continue;
+			for (int second = 0; second < SQUARES; second++) {
+				if (kings_touch(first, second) ||
+				    (diagonal_offset(first) == 0 &&
+				     diagonal_offset(second) > 0))
+					continue;
+				if (diagonal_offset(first) == 0 &&
+				    diagonal_offset(second) == 0) {
+					both_on_diagonal[num_both][0] = index;
+					both_on_diagonal[num_both++][1] = second;
+				} else {
+					map_kk[index][second] = code++;
+				}
+			}
+		}
+	}
+	for (size_t i = 0; i < num_both; i++)
+		map_kk[both_on_diagonal[i][0]][both_on_diagonal[i][1]] = code++;
+
+	binomial[0][0] = 1;
+	for (int n = 1; n < SQUARES; n++) {
+		for (int k = 0; k <= MAX_GROUP && k <= n; k++) {
+			binomial[k][n] = (k > 0 ? binomial[k - 1][n - 1] : 0) +
+					 (k < n ? binomial[k][n - 1] : 0);
+		}
+	}
+
+	// Pawn squares a2-h7 from the edges in, lowest rank first, counting
+	// down from 47 so the leading pawn has the highest number.
+	int available = 47;
+	for (int count = 1; count <= MAX_GROUP; count++) {
+		for (int file = 0; file < PAWN_FILES; file++) {
+			uint64_t index = 0;
+			for (int rank = 1; rank < BOARD_SIZE - 1; rank++) {
+				int square = rank * BOARD_SIZE + file;
+				if (count == 1) {
+					map_pawns[square] = available--;
+					map_pawns[square ^ (BOARD_SIZE - 1)] =
+						available--;
+				}
+				lead_pawn_index[count][square] = index;
+				index += binomial[count - 1][map_pawns[square]];
+			}
+			lead_pawns_size[count][file] = index;
+		}
+	}
+}
+
+static inline int tree_left(const SyzygyPart *part, size_t symbol)
+{
+	const uint8_t *entry = part->tree + symbol * TREE_ENTRY_SIZE;
+	return (entry[1] & 0xF) << 8 | entry[0];
+}
+
+static inline int tree_right(const SyzygyPart *part, size_t symbol)
+{
+	const uint8_t *entry = part->tree + symbol * TREE_ENTRY_SIZE;
+	return entry[2] << 4 | entry[1] >> 4;
+}
+
+/**
+ * Group the pieces that are encoded together, and work out each group's
+ * factor in the index from the order the table gives the groups. The leading
+ * group is the pawns of the leading colour, or three unique pieces, or the
+ * two kings; the rest are runs of identical pieces.
+ */
+static bool set_groups(const struct SyzygyTable *table, SyzygyPart *part,
+		       const int order[2], int file)
+{
+	int n = 0;
+	int first = table->has_pawns ? 0 : table->unique_pieces ? 3 : 2;
+	part->group_lengths[0] = 1;
+	for (size_t i = 1; i < table->num_pieces; i++) {
+		if (--first > 0 || part->pieces[i] == part->pieces[i - 1])
+			part->group_lengths[n]++;
+		else
+			part->group_lengths[++n] = 1;
+	}
+	part->group_lengths[++n] = 0;
+	for (int i = 0; i < n; i++) {
+		if (part->group_lengths[i] > MAX_GROUP)
+			return false;
+	}
+
+	bool both_pawns = table->has_pawns && table->pawn_counts[1];
+	int next = both_pawns ? 2 : 1;
+	int free_squares = SQUARES - part->group_lengths[0] -
+			   (both_pawns ? part->group_lengths[1] : 0);
+	uint64_t factor = 1;
+	for (int k = 0; next < n || k == order[0] || k == order[1]; k++) {
+		if (k == order[0]) {
+			part->group_factors[0] = factor;
+			factor *= table->has_pawns ?
+				  lead_pawns_size[part->group_lengths[0]][file] :
+				  table->unique_pieces ? UNIQUE_PIECES_SIZE :
+				  KINGS_SIZE;
+		} else if (k == order[1]) {
+			part->group_factors[1] = factor;
+			factor *= binomial[part->group_lengths[1]]
+					  [48 - part->group_lengths[0]];
+		} else {
+			part->group_factors[next] = factor;
+			factor *= binomial[part->group_lengths[next]]
+					  [free_squares];
+			free_squares -= part->group_lengths[next++];
+		}
+	}
+	part->group_factors[n] = factor;
+	return part->group_factors[0] != 0 &&
+	       (!both_pawns || part->group_factors[1] != 0);
+}
+
+static void set_symbol_length(SyzygyPart *part, size_t symbol, bool *visited)
+{
+	visited[symbol] = true;
+	int right = tree_right(part, symbol);
+	if (right == TREE_LEAF) {
+		part->symbol_lengths[symbol] = 0;
+		return;
+	}
+	int left = tree_left(part, symbol);
+	if (!visited[left])
+		set_symbol_length(part, left, visited);
+	if (!visited[right])
+		set_symbol_length(part, right, visited);
+	part->symbol_lengths[symbol] = part->symbol_lengths[left] +
+				       part->symbol_lengths[right] + 1;
+}
+
+/**
+ * Read a part's block and code sizes starting at offset, returning the
+ * offset after them or 0 if they run past the end of the file.
+ */
+static size_t read_part_sizes(const TableFile *file, SyzygyPart *part,
+			      size_t offset)
+{
+	const uint8_t *data = file->data;
+	if (offset + 2 > file->size)
+		return 0;
+	part->flags = data[offset++];
+	if (part->flags & SYZYGY_PART_SINGLE_VALUE) {
+		part->min_length = data[offset++];
+		return offset;
+	}
+
+	if (offset + 9 > file->size || data[offset] >= 32 ||
+	    data[offset + 1] >= 64)
+		return 0;
+	size_t groups = 0;
+	while (part->group_lengths[groups] != 0)
+		groups++;
+	part->block_size = (size_t)1 << data[offset];
+	part->span = (uint64_t)1 << data[offset + 1];
+	part->sparse_size = (part->group_factors[groups] + part->span - 1) /
+			    part->span;
+	part->num_blocks = read_le(data + offset + 3, 4);
+	part->num_block_lengths = part->num_blocks + data[offset + 2];
+	part->max_length = data[offset + 7];
+	part->min_length = data[offset + 8];
+	offset += 9;
+	if (part->min_length == 0 || part->max_length < part->min_length ||
+	    part->max_length > MAX_CODE_LENGTH)
+		return 0;
+
+	// Longer codes have lower values, base[l] is the lowest code of its
+	// length scaled up to 64 bits, so a code's length is the first base
+	// not above it.
+	size_t lengths = part->max_length - part->min_length + 1;
+	if (offset + lengths * 2 + 2 > file->size)
+		return 0;
+	part->lowest_symbols = data + offset;
+	part->base[lengths - 1] = 0;
+	for (size_t i = lengths - 1; i > 0; i--) {
+		part->base[i - 1] =
+			(part->base[i] +
+			 read_le(part->lowest_symbols + 2 * (i - 1), 2) -
+			 read_le(part->lowest_symbols + 2 * i, 2)) / 2;
+	}
+	for (size_t i = 0; i < lengths; i++)
+		part->base[i] <<= 64 - i - part->min_length;
+	offset += lengths * 2;
+
+	part->num_symbols = read_le(data + offset, 2);
+	offset += 2;
+	size_t tree_size = part->num_symbols * TREE_ENTRY_SIZE;
+	if (offset + tree_size > file->size)
+		return 0;
+	part->tree = data + offset;
+	for (size_t i = 0; i < part->num_symbols; i++) {
+		if (tree_right(part, i) != TREE_LEAF &&
+		    ((size_t)tree_left(part, i) >= part->num_symbols ||
+		     (size_t)tree_right(part, i) >= part->num_symbols))
+			return 0;
+	}
+	part->symbol_lengths = calloc(part->num_symbols, 1);
+	bool *visited = calloc(part->num_symbols, sizeof(bool));
+	if (part->num_symbols > 0 &&
+	    (part->symbol_lengths == NULL || visited == NULL)) {
+		free(visited);
+		return 0;
+	}
+	for (size_t i = 0; i < part->num_symbols; i++) {
+		if (!visited[i])
+			set_symbol_length(part, i, visited);
+	}
+	free(visited);
+	// Padded to an even length.
+	return offset + tree_size + (part->num_symbols & 1);
+}
+
+/**
+ * Distance to zeroing values are numbered by how often they occur, each
+ * mapped part has four maps back to the distances, one per result.
+ */
+static size_t read_dtz_maps(const TableFile *file, struct SyzygyTable *table,
+			    size_t offset, size_t files)
+{
+	const uint8_t *data = file->data;
+	size_t map = offset;
+	table->map = data + map;
+	for (size_t f = 0; f < files; f++) {
+		SyzygyPart *part = &table->parts[0][f];
+		if (!(part->flags & SYZYGY_PART_MAPPED))
+			continue;
+		bool wide = part->flags & SYZYGY_PART_WIDE;
+		offset += wide ? offset & 1 : 0;
+		for (size_t i = 0; i < 4; i++) {
+			if (offset + (wide ? 2 : 1) > file->size)
+				return 0;
+			part->maps[i] = wide ? (offset - map) / 2 + 1 :
+					offset - map + 1;
+			offset += wide ? 2 * read_le(data + offset, 2) + 2 :
+				  data[offset] + 1u;
+		}
+	}
+	return offset + (offset & 1);
+}
+
+/**
+ * Work out where every part's data lies in the mapping. The header gives
+ * each part's piece order and group order, then come the code tables, the
+ * distance maps, the sparse indices, the block lengths and the blocks.
+ */
+static bool read_layout(const TableFile *file, struct SyzygyTable *table)
+{
+	const uint8_t *data = file->data;
+	size_t offset = 4;
+	if (file->size < offset + 1)
+		return false;
+	uint8_t flags = data[offset++];
+	if (!(flags & SYZYGY_FILE_HAS_PAWNS) != !table->has_pawns ||
+	    !(flags & SYZYGY_FILE_SPLIT) != table->symmetric)
+		return false;
+
+	size_t sides = !table->dtz && !table->symmetric ? 2 : 1;
+	size_t files = table->has_pawns ? PAWN_FILES : 1;
+	bool both_pawns = table->has_pawns && table->pawn_counts[1];
+	for (size_t f = 0; f < files; f++) {
+		if (offset + 1 + both_pawns + table->num_pieces > file->size)
+			return false;
+		int order[2][2] = {
+			{ data[offset] & 0xF,
+			  both_pawns ? data[offset + 1] & 0xF : 0xF },
+			{ data[offset] >> 4,
+			  both_pawns ? data[offset + 1] >> 4 : 0xF },
+		};
+		offset += 1 + both_pawns;
+		for (size_t k = 0; k < table->num_pieces; k++, offset++) {
+			for (size_t i = 0; i < sides; i++) {
+				table->parts[i][f].pieces[k] =
+					i ? data[offset] >> 4 :
+					data[offset] & 0xF;
+			}
+		}
+		for (size_t i = 0; i < sides; i++) {
+			SyzygyPart *part = &table->parts[i][f];
+			// Tables with pawns start with the leading pawns.
+			if ((table->has_pawns &&
+			     (part->pieces[0] & ~BLACK_CODE) !=
+			     PIECE_CODES[PIECE_PAWN]) ||
+			    !set_groups(table, part, order[i], f))
+				return false;
+		}
+	}
+	offset += offset & 1;
+
+	for (size_t f = 0; f < files; f++) {
+		for (size_t i = 0; i < sides; i++) {
+			offset = read_part_sizes(file, &table->parts[i][f],
+						 offset);
+			if (offset == 0)
+				return false;
+		}
+	}
+	if (table->dtz) {
+		offset = read_dtz_maps(file, table, offset, files);
+		if (offset == 0)
+			return false;
+	}
+	for (size_t f = 0; f < files; f++) {
+		for (size_t i = 0; i < sides; i++) {
+			SyzygyPart *part = &table->parts[i][f];
+			part->sparse_index = data + offset;
+			offset += part->sparse_size * SPARSE_ENTRY_SIZE;
+		}
+	}
+	for (size_t f = 0; f < files; f++) {
+		for (size_t i = 0; i < sides; i++) {
+			SyzygyPart *part = &table->parts[i][f];
+			part->block_lengths = data + offset;
+			offset += part->num_block_lengths * 2;
+		}
+	}
+	for (size_t f = 0; f < files; f++) {
+		for (size_t i = 0; i < sides; i++) {
+			SyzygyPart *part = &table->parts[i][f];
+			// Blocks start on a cache line.
+			offset = (offset + 63) & ~(size_t)63;
+			part->blocks = data + offset;
+			offset += part->num_blocks * part->block_size;
+		}
+	}
+	return offset <= file->size;
+}
+
+/**
+ * Check a mapped Syzygy table against its name and work out its layout.
+ * Every piece code in the header must match the material in the name.
+ */
+bool open_syzygy_table(TableFile *file)
+{
+	init_syzygy();
+	struct SyzygyTable *table = calloc(1, sizeof(struct SyzygyTable));
+	if (table == NULL)
+		return false;
+	const TablePieces *material = &file->material;
+	size_t counts[PLAYER_NUM_COLOURS][PIECE_NUM_PIECES] = { { 0 } };
+	for (size_t i = 0; i < material->num_pieces; i++)
+		counts[material->colours[i]][material->types[i]]++;
+	for (int colour = 0; colour < PLAYER_NUM_COLOURS; colour++) {
+		for (int type = PIECE_PAWN; type < PIECE_KING; type++)
+			table->unique_pieces |= counts[colour][type] == 1;
+	}
+	size_t white_pawns = counts[COLOUR_WHITE][PIECE_PAWN];
+	size_t black_pawns = counts[COLOUR_BLACK][PIECE_PAWN];
+	// The side with fewer pawns leads, it compresses better.
+	bool white_leads = black_pawns == 0 ||
+			   (white_pawns && black_pawns >= white_pawns);
+	table->pawn_counts[0] = white_leads ? white_pawns : black_pawns;
+	table->pawn_counts[1] = white_leads ? black_pawns : white_pawns;
+	table->dtz = file->format == TABLE_FORMAT_SYZYGY_DTZ;
+	table->symmetric = table_key(material, COLOUR_WHITE) ==
+			   table_key(material, COLOUR_BLACK);
+	table->has_pawns = white_pawns + black_pawns > 0;
+	table->num_pieces = material->num_pieces;
+	table->end = file->data + file->size;
+	file->syzygy = table;
+
+	bool ok = read_layout(file, table);
+	for (size_t f = 0; ok && f < PAWN_FILES; f++) {
+		for (size_t i = 0; ok && i < MAX_PARTS; i++) {
+			const SyzygyPart *part = &table->parts[i][f];
+			if (part->group_lengths[0] == 0)
+				continue;
+			size_t codes[2 * BLACK_CODE] = { 0 };
+			for (size_t k = 0; k < material->num_pieces; k++) {
+				codes[piece_code(material->types[k],
+						 material->colours[k])]++;
+			}
+			for (size_t k = 0; ok && k < table->num_pieces; k++)
+				ok = codes[part->pieces[k]]-- > 0;
+		}
+	}
+	if (!ok)
+		close_syzygy_table(file);
+	return ok;
+}
+
+void close_syzygy_table(TableFile *file)
+{
+	if (file->syzygy == NULL)
+		return;
+	for (size_t f = 0; f < PAWN_FILES; f++) {
+		for (size_t i = 0; i < MAX_PARTS; i++)
+			free(file->syzygy->parts[i][f].symbol_lengths);
+	}
+	free(file->syzygy);
+	file->syzygy = NULL;
+}
+
+static void sort_squares(uint8_t *squares, size_t count, const int *order)
+{
+	for (size_t i = 1; i < count; i++) {
+		uint8_t square = squares[i];
+		size_t j = i;
+		for (; j > 0 && (order ? order[squares[j - 1]] > order[square] :
+				 squares[j - 1] > square); j--)
+			squares[j] = squares[j - 1];
+		squares[j] = square;
+	}
+}
+
+/**
+ * The part a position is stored in and its index there. The board is
+ * mirrored so the leading pawn is on files a-d, or the leading piece is in
+ * the a1-d1-d4 triangle; each group of pieces is then encoded as a
+ * combination of squares, skipping those the groups before it hold.
+ */
+static ESyzygyProbe locate(const TableFile *file, const TablePieces *pieces,
+			   EPlayerColour turn, const SyzygyPart **located,
+			   int *pawn_file, uint64_t *index)
+{
+	const struct SyzygyTable *table = file->syzygy;
+	if (table == NULL || pieces->num_pieces != table->num_pieces)
+		return SYZYGY_FAIL;
+	// Tables of equal material only store white to move.
+	int flip = table->symmetric && turn == COLOUR_BLACK;
+	int stm = turn ^ flip;
+
+	// In square order, lined up with the table's colours.
+	uint8_t squares[TB_MAX_PIECES];
+	uint8_t codes[TB_MAX_PIECES];
+	size_t size = pieces->num_pieces;
+	for (size_t i = 0; i < size; i++) {
+		uint8_t square = pieces->squares[i] ^ (flip ? 56 : 0);
+		uint8_t code = piece_code(pieces->types[i],
+					  pieces->colours[i] ^ flip);
+		size_t j = i;
+		for (; j > 0 && squares[j - 1] > square; j--) {
+			squares[j] = squares[j - 1];
+			codes[j] = codes[j - 1];
+		}
+		squares[j] = square;
+		codes[j] = code;
+	}
+
+	// The leading pawns go first, the one nearest the edge and lowest
+	// picks the part.
+	size_t lead_pawns = 0;
+	*pawn_file = 0;
+	if (table->has_pawns) {
+		uint8_t lead = table->parts[0][0].pieces[0];
+		for (size_t i = 0; i < size; i++) {
+			if (codes[i] != lead)
+				continue;
+			uint8_t square = squares[i];
+			memmove(squares + lead_pawns + 1, squares + lead_pawns,
+				i - lead_pawns);
+			memmove(codes + lead_pawns + 1, codes + lead_pawns,
+				i - lead_pawns);
+			squares[lead_pawns] = square;
+			codes[lead_pawns++] = lead;
+		}
+		if (lead_pawns == 0)
+			return SYZYGY_FAIL;
+		size_t leader = 0;
+		for (size_t i = 1; i < lead_pawns; i++) {
+			if (map_pawns[squares[i]] > map_pawns[squares[leader]])
+				leader = i;
+		}
+		uint8_t swap = squares[0];
+		squares[0] = squares[leader];
+		squares[leader] = swap;
+		int f = file_of(squares[0]);
+		*pawn_file = f < BOARD_SIZE - 1 - f ? f : BOARD_SIZE - 1 - f;
+	}
+
+	const SyzygyPart *part = &table->parts[table->dtz ? 0 : stm]
+					      [*pawn_file];
+	*located = part;
+	if (table->dtz && (part->flags & SYZYGY_PART_STM) != stm &&
+	    !(table->symmetric && !table->has_pawns))
+		return SYZYGY_OTHER_SIDE;
+
+	// The rest in the table's piece order.
+	for (size_t i = lead_pawns; i + 1 < size; i++) {
+		for (size_t j = i + 1; j < size; j++) {
+			if (part->pieces[i] != codes[j])
+				continue;
+			uint8_t code = codes[i];
+			uint8_t square = squares[i];
+			codes[i] = codes[j];
+			squares[i] = squares[j];
+			codes[j] = code;
+			squares[j] = square;
+			break;
+		}
+	}
+
+	if (file_of(squares[0]) >= BOARD_SIZE / 2) {
+		for (size_t i = 0; i < size; i++)
+			squares[i] ^= BOARD_SIZE - 1;
+	}
+
+	uint64_t idx;
+	if (table->has_pawns) {
+		idx = lead_pawn_index[lead_pawns][squares[0]];
+		sort_squares(squares + 1, lead_pawns - 1, map_pawns);
+		for (size_t i = 1; i < lead_pawns; i++)
+			idx += binomial[i][map_pawns[squares[i]]];
+	} else {
+		if (rank_of(squares[0]) >= BOARD_SIZE / 2) {
+			for (size_t i = 0; i < size; i++)
+				squares[i] ^= (BOARD_SIZE - 1) * BOARD_SIZE;
+		}
+		// The first leading piece off the diagonal goes below it.
+		for (size_t i = 0; i < part->group_lengths[0]; i++) {
+			if (diagonal_offset(squares[i]) == 0)
+				continue;
+			if (diagonal_offset(squares[i]) > 0) {
+				for (size_t j = i; j < size; j++) {
+					squares[j] = ((squares[j] >> 3) |
+						      (squares[j] << 3)) & 63;
+				}
+			}
+			break;
+		}
+
+		if (table->unique_pieces) {
+			int s0 = squares[0];
+			int s1 = squares[1];
+			int s2 = squares[2];
+			int adjust1 = s1 > s0;
+			int adjust2 = (s2 > s0) + (s2 > s1);
+			if (diagonal_offset(s0)) {
+				idx = ((uint64_t)map_a1d1d4[s0] * 63 +
+				       (s1 - adjust1)) * 62 + s2 - adjust2;
+			} else if (diagonal_offset(s1)) {
+				idx = (6 * 63 + rank_of(s0) * 28 +
+				       (uint64_t)map_b1h1h7[s1]) * 62 + s2 -
+				      adjust2;
+			} else if (diagonal_offset(s2)) {
+				idx = 6 * 63 * 62 + 4 * 28 * 62 +
+				      rank_of(s0) * 7 * 28 +
+				      (rank_of(s1) - adjust1) * 28 +
+				      map_b1h1h7[s2];
+			} else {
+				idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 +
+				      rank_of(s0) * 7 * 6 +
+				      (rank_of(s1) - adjust1) * 6 +
+				      (rank_of(s2) - adjust2);
+			}
+		} else {
+			idx = map_kk[map_a1d1d4[squares[0]]][squares[1]];
+		}
+	}
+
+	idx *= part->group_factors[0];
+	size_t start = part->group_lengths[0];
+	bool remaining_pawns = table->has_pawns && table->pawn_counts[1];
+	for (size_t next = 1; part->group_lengths[next] != 0; next++) {
+		uint8_t *group = squares + start;
+		size_t length = part->group_lengths[next];
+		sort_squares(group, length, NULL);
+		uint64_t n = 0;
+		for (size_t i = 0; i < length; i++) {
+			// Squares taken by earlier groups are skipped.
+			int adjust = 0;
+			for (size_t j = 0; j < start; j++)
+				adjust += group[i] > squares[j];
+			int square = group[i] - adjust -
+				     (remaining_pawns ? BOARD_SIZE : 0);
+			if (square < 0)
+				return SYZYGY_FAIL;
+			n += binomial[i + 1][square];
+		}
+		remaining_pawns = false;
+		idx += n * part->group_factors[next];
+		start += length;
+	}
+	*index = idx;
+	return SYZYGY_OK;
+}
+
+/**
+ * Value at an index of a part. The sparse index gives the block and offset
+ * of every span-th value, so only a few block lengths are summed to find the
+ * block. Its codes are then read in turn, each symbol expanding to a run of
+ * values, and the one holding the index is split down the pairing tree.
+ * Returns -1 if the data points outside the table.
+ */
+static int decompress(const struct SyzygyTable *table, const SyzygyPart *part,
+		      uint64_t index)
+{
+	if (part->flags & SYZYGY_PART_SINGLE_VALUE)
+		return part->min_length;
+
+	uint64_t k = index / part->span;
+	if (k >= part->sparse_size)
+		return -1;
+	const uint8_t *entry = part->sparse_index + k * SPARSE_ENTRY_SIZE;
+	size_t block = read_le(entry, 4);
+	int64_t offset = read_le(entry + 4, 2) +
+			 (int64_t)(index % part->span) -
+			 (int64_t)(part->span / 2);
+	while (offset < 0) {
+		if (block == 0 || block > part->num_block_lengths)
+			return -1;
+		block--;
+		offset += read_le(part->block_lengths + 2 * block, 2) + 1;
+	}
+	for (;;) {
+		if (block >= part->num_block_lengths)
+			return -1;
+		int64_t length = read_le(part->block_lengths + 2 * block, 2);
+		if (offset <= length)
+			break;
+		offset -= length + 1;
+		block++;
+	}
+	if (block >= part->num_blocks)
+		return -1;
+
+	// Codes are big endian bit strings.
+	const uint8_t *next = part->blocks + block * part->block_size;
+	if (next + 8 > table->end)
+		return -1;
+	uint64_t buffer = read_be(next, 8);
+	next += 8;
+	int bits = 64;
+	size_t symbol;
+	for (;;) {
+		size_t length = 0;
+		while (buffer < part->base[length])
+			length++;
+		symbol = (buffer - part->base[length]) >>
+			 (64 - length - part->min_length);
+		symbol = (symbol + read_le(part->lowest_symbols + 2 * length,
+					   2)) & 0xFFFF;
+		if (symbol >= part->num_symbols)
+			return -1;
+		if (offset < part->symbol_lengths[symbol] + 1)
+			break;
+		offset -= part->symbol_lengths[symbol] + 1;
+		length += part->min_length;
+		buffer <<= length;
+		bits -= length;
+		if (bits <= 32) {
+			if (next + 4 > table->end)
+				return -1;
+			bits += 32;
+			buffer |= read_be(next, 4) << (64 - bits);
+			next += 4;
+		}
+	}
+
+	// Children are adjacent runs, a broken tree cannot loop forever.
+	for (size_t depth = 0; part->symbol_lengths[symbol] != 0; depth++) {
+		if (depth == part->num_symbols)
+			return -1;
+		int left = tree_left(part, symbol);
+		if (offset < part->symbol_lengths[left] + 1) {
+			symbol = left;
+		} else {
+			offset -= part->symbol_lengths[left] + 1;
+			symbol = tree_right(part, symbol);
+		}
+	}
+	return tree_left(part, symbol);
+}
+
+/**
+ * Stored distances to zeroing are numbered by frequency per result, and in
+ * moves rather than plies where that is exact enough. Returns the distance in
+ * plies, or -1 if the map points outside the table.
+ */
+static int map_dtz(const struct SyzygyTable *table, int pawn_file, int value,
+		   EWdl wdl)
+{
+	const SyzygyPart *part = &table->parts[0][pawn_file];
+	if (part->flags & SYZYGY_PART_MAPPED) {
+		size_t i = part->maps[DTZ_MAPS[wdl + 2]] + value;
+		bool wide = part->flags & SYZYGY_PART_WIDE;
+		if (table->map + (wide ? 2 * i + 2 : i + 1) > table->end)
+			return -1;
+		value = wide ? (int)read_le(table->map + 2 * i, 2) :
+			table->map[i];
+	}
+	if ((wdl == TB_WIN && !(part->flags & SYZYGY_PART_WIN_PLIES)) ||
+	    (wdl == TB_LOSS && !(part->flags & SYZYGY_PART_LOSS_PLIES)) ||
+	    wdl == TB_CURSED_WIN || wdl == TB_BLESSED_LOSS)
+		value *= 2;
+	return value + 1;
+}
+
+/**
+ * Index of the pieces in the part of the table they are stored in, false if
+ * the table does not store the player to move.
+ */
+bool syzygy_table_index(const TableFile *table, const TablePieces *pieces,
+			EPlayerColour turn, uint64_t *index)
+{
+	const SyzygyPart *part;
+	int pawn_file;
+	return locate(table, pieces, turn, &part, &pawn_file, index) ==
+	       SYZYGY_OK;
+}
+
+/**
+ * Read one position out of one table, the pieces and turn lined up with the
+ * table's colours. Win/draw/loss tables give an EWdl, distance to zeroing
+ * tables the distance in plies for the given result. The value is the
+ * table's, captures are not looked at.
+ */
+ESyzygyProbe probe_syzygy_table(const TableFile *table,
+				const TablePieces *pieces, EPlayerColour turn,
+				EWdl wdl, int *value)
+{
+	const SyzygyPart *part;
+	int pawn_file;
+	uint64_t index;
+	ESyzygyProbe result = locate(table, pieces, turn, &part, &pawn_file,
+				     &index);
+	if (result != SYZYGY_OK)
+		return result;
+	int stored = decompress(table->syzygy, part, index);
+	if (stored < 0)
+		return SYZYGY_FAIL;
+	if (!table->syzygy->dtz) {
+		*value = stored - 2;
+		return stored <= TB_WIN - TB_LOSS ? SYZYGY_OK : SYZYGY_FAIL;
+	}
+	*value = map_dtz(table->syzygy, pawn_file, stored, wdl);
+	return *value > 0 ? SYZYGY_OK : SYZYGY_FAIL;
+}
+
+static inline bool is_capture(Position *position, Move move)
+{
+	return position->board[move.target].type != PIECE_NONE ||
+	       move.type == MOVEMENT_PAWN_EN_PASSANT;
+}
+
+static inline int sign(int value)
+{
+	return (value > 0) - (value < 0);
+}
+
+static bool is_mate(Position *position)
+{
+	Move moves[MAX_LEGAL_MOVES];
+	return is_in_check(position) &&
+	       generate_legal_moves(position, moves) == 0;
+}
+
+/**
+ * Distance tables store nothing for the move that zeroes the clock, it
+ * follows from the result.
+ */
+static int dtz_before_zeroing(EWdl wdl)
+{
+	switch (wdl) {
+	case TB_WIN:
+		return 1;
+	case TB_CURSED_WIN:
+		return 101;
+	case TB_BLESSED_LOSS:
+		return -101;
+	case TB_LOSS:
+		return -1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Read the position out of the table of the given format holding its
+ * material.
+ */
+static ESyzygyProbe probe_material(Tablebases *tablebases, Position *position,
+				   ETableFormat format, EWdl wdl, int *value)
+{
+	TablePieces pieces;
+	if (!get_table_pieces(position, &pieces))
+		return SYZYGY_FAIL;
+	// Bare kings are drawn and have no table.
+	if (pieces.num_pieces == 2) {
+		*value = 0;
+		return SYZYGY_OK;
+	}
+	EPlayerColour turn = position->turn;
+	const TableFile *table = find_material_table(tablebases, &pieces,
+						     &turn, format);
+	if (table == NULL)
+		return SYZYGY_FAIL;
+	return probe_syzygy_table(table, &pieces, turn, wdl, value);
+}
+
+/**
+ * Tables store whatever compresses best where the player to move has a
+ * winning capture, and may store a loss where a capture draws, so captures
+ * are searched and the best of them and the table is the result. Distance
+ * tables store nothing useful when the best move zeroes the clock, with
+ * zeroing_moves pawn moves are searched too and the result says when one of
+ * them is best.
+ */
+static EWdl search_wdl(Tablebases *tablebases, Position *position,
+		       bool zeroing_moves, ESyzygyProbe *result)
+{
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	size_t searched = 0;
+	EWdl best = TB_LOSS;
+	for (size_t i = 0; i < num_moves; i++) {
+		if (!is_capture(position, moves[i]) &&
+		    (!zeroing_moves ||
+		     position->board[moves[i].origin].type != PIECE_PAWN))
+			continue;
+		searched++;
+		Position child = *position;
+		make_move(&child, moves[i]);
+		EWdl value = -search_wdl(tablebases, &child, false, result);
+		if (*result == SYZYGY_FAIL)
+			return TB_DRAW;
+		if (value > best) {
+			best = value;
+			if (value >= TB_WIN) {
+				*result = SYZYGY_ZEROING_BEST_MOVE;
+				return value;
+			}
+		}
+	}
+
+	// With every move searched the table is not needed, it would be wrong
+	// where the only moves are en passant captures.
+	bool all_searched = searched > 0 && searched == num_moves;
+	EWdl value = best;
+	if (!all_searched) {
+		int stored;
+		*result = probe_material(tablebases, position,
+					 TABLE_FORMAT_SYZYGY_WDL, TB_DRAW,
+					 &stored);
+		if (*result == SYZYGY_FAIL)
+			return TB_DRAW;
+		value = stored;
+	}
+	if (best >= value) {
+		*result = best > TB_DRAW || all_searched ?
+			  SYZYGY_ZEROING_BEST_MOVE : SYZYGY_OK;
+		return best;
+	}
+	*result = SYZYGY_OK;
+	return value;
+}
+
+/**
+ * Plies to the move that zeroes the clock in the best line, positive for
+ * wins and negative for losses, 0 for draws. Cursed wins and blessed losses
+ * are 100 plies further out.
+ */
+static int search_dtz(Tablebases *tablebases, Position *position,
+		      ESyzygyProbe *result)
+{
+	*result = SYZYGY_OK;
+	EWdl wdl = search_wdl(tablebases, position, true, result);
+	if (*result == SYZYGY_FAIL || wdl == TB_DRAW)
+		return 0;
+	if (*result == SYZYGY_ZEROING_BEST_MOVE)
+		return dtz_before_zeroing(wdl);
+
+	int dtz;
+	*result = probe_material(tablebases, position, TABLE_FORMAT_SYZYGY_DTZ,
+				 wdl, &dtz);
+	if (*result == SYZYGY_FAIL)
+		return 0;
+	if (*result != SYZYGY_OTHER_SIDE) {
+		return (dtz + 100 * (wdl == TB_BLESSED_LOSS ||
+				     wdl == TB_CURSED_WIN)) * sign(wdl);
+	}
+
+	// Only the other side to move is stored, take the best move's
+	// distance one ply on.
+	int best = INT_MAX;
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	for (size_t i = 0; i < num_moves; i++) {
+		bool zeroing = is_capture(position, moves[i]) ||
+			       position->board[moves[i].origin].type ==
+			       PIECE_PAWN;
+		Position child = *position;
+		make_move(&child, moves[i]);
+		// A zeroing move's own distance follows from the result after
+		// it, the sign tells whether it throws the win away.
+		dtz = zeroing ?
+		      -dtz_before_zeroing(search_wdl(tablebases, &child, false,
+						     result)) :
+		      -search_dtz(tablebases, &child, result);
+		if (*result == SYZYGY_FAIL)
+			return 0;
+		if (dtz == 1 && is_mate(&child))
+			best = 1;
+		if (!zeroing)
+			dtz += sign(dtz);
+		if (dtz < best && sign(dtz) == sign(wdl))
+			best = dtz;
+	}
+	// No legal moves, mated.
+	return best == INT_MAX ? -1 : best;
+}
+
+/**
+ * The tables only hold positions with few enough pieces and no castling
+ * rights.
+ */
+static bool syzygy_covers(Tablebases *tablebases, Position *position,
+			  ETableFormat format)
+{
+	TablePieces pieces;
+	EPlayerColour turn = position->turn;
+	return tablebases != NULL &&
+	       count_pieces(position) <= tablebases->max_pieces &&
+	       get_castling_rights(position->board) == CASTLE_NONE &&
+	       get_table_pieces(position, &pieces) &&
+	       (pieces.num_pieces == 2 ||
+		find_material_table(tablebases, &pieces, &turn, format) != NULL);
+}
+
+/**
+ * Win/draw/loss for the player to move from the Syzygy tables, assuming the
+ * fifty move clock was just reset.
+ */
+bool probe_syzygy_wdl(Tablebases *tablebases, Position *position, EWdl *wdl)
+{
+	if (!syzygy_covers(tablebases, position, TABLE_FORMAT_SYZYGY_WDL))
+		return false;
+	ESyzygyProbe result = SYZYGY_OK;
+	*wdl = search_wdl(tablebases, position, false, &result);
+	return result != SYZYGY_FAIL;
+}
+
+/**
+ * Plies to the next capture or pawn move in the best line from the Syzygy
+ * tables, positive if the player to move wins and negative if they lose.
+ */
+bool probe_syzygy_dtz(Tablebases *tablebases, Position *position, int *dtz)
+{
+	if (!syzygy_covers(tablebases, position, TABLE_FORMAT_SYZYGY_DTZ))
+		return false;
+	ESyzygyProbe result;
+	*dtz = search_dtz(tablebases, position, &result);
+	return result != SYZYGY_FAIL;
+}
+
+// Root moves rank by result, then by distance, with plenty of room between.
+#define ROOT_RESULT_RANK 10000
+
+static EWdl root_result(int dtz, size_t clock)
+{
+	if (dtz > 0)
+		return dtz + clock <= 99 ? TB_WIN : TB_CURSED_WIN;
+	if (dtz < 0)
+		return -dtz + clock <= 99 ? TB_LOSS : TB_BLESSED_LOSS;
+	return TB_DRAW;
+}
+
+/**
+ * Keep the root moves with the best result given the fifty move clock, and
+ * of those the wins that zero the clock soonest or the losses that put it
+ * off longest, so a won ending always makes progress. Returns false and
+ * leaves the moves alone if the distance tables do not cover the root.
+ */
+bool filter_syzygy_root_moves(Tablebases *tablebases, Position *position,
+			      Move moves[MAX_LEGAL_MOVES], size_t *num_moves,
+			      EWdl *wdl)
+{
+	if (!syzygy_covers(tablebases, position, TABLE_FORMAT_SYZYGY_DTZ))
+		return false;
+
+	int ranks[MAX_LEGAL_MOVES];
+	EWdl results[MAX_LEGAL_MOVES];
+	int best = INT_MIN;
+	for (size_t i = 0; i < *num_moves; i++) {
+		Position child = *position;
+		make_move(&child, moves[i]);
+		ESyzygyProbe result = SYZYGY_OK;
+		int dtz;
+		if (child.halfmove_clock == 0) {
+			dtz = dtz_before_zeroing(-search_wdl(tablebases, &child,
+							     false, &result));
+		} else {
+			dtz = -search_dtz(tablebases, &child, &result);
+			dtz += sign(dtz);
+		}
+		if (result == SYZYGY_FAIL)
+			return false;
+		if (dtz == 2 && is_mate(&child))
+			dtz = 1;
+		results[i] = root_result(dtz, position->halfmove_clock);
+		ranks[i] = results[i] * ROOT_RESULT_RANK - dtz;
+		if (ranks[i] > best)
+			best = ranks[i];
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < *num_moves; i++) {
+		if (ranks[i] != best)
+			continue;
+		*wdl = results[i];
+		moves[kept++] = moves[i];
+	}
+	*num_moves = kept;
+	return kept > 0;
+}
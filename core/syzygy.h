@@ -0,0 +1,35 @@
+#ifndef _SYZYGY_H
+#define _SYZYGY_H
+
+#include "movement.h"
+#include "position.h"
+#include "tablebase.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Outcome of reading one position out of one Syzygy table.
+typedef enum {
+	SYZYGY_FAIL,
+	SYZYGY_OK,
+	// Distance to zeroing tables only store one side to move.
+	SYZYGY_OTHER_SIDE,
+	// The best move captures or moves a pawn, the stored value is not used.
+	SYZYGY_ZEROING_BEST_MOVE,
+} ESyzygyProbe;
+
+bool open_syzygy_table(TableFile *table);
+void close_syzygy_table(TableFile *table);
+bool syzygy_table_index(const TableFile *table, const TablePieces *pieces,
+			EPlayerColour turn, uint64_t *index);
+ESyzygyProbe probe_syzygy_table(const TableFile *table,
+				const TablePieces *pieces, EPlayerColour turn,
+				EWdl wdl, int *value);
+bool probe_syzygy_wdl(Tablebases *tablebases, Position *position, EWdl *wdl);
+bool probe_syzygy_dtz(Tablebases *tablebases, Position *position, int *dtz);
+bool filter_syzygy_root_moves(Tablebases *tablebases, Position *position,
+			      Move moves[MAX_LEGAL_MOVES], size_t *num_moves,
+			      EWdl *wdl);
+
+#endif
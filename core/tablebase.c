@@ -0,0 +1,617 @@
+#include "tablebase.h"
+#include "binary.h"
+#include "board.h"
+#include "position.h"
+#include "syzygy.h"
+#include "log.h"
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+const char *TABLE_FORMAT_EXTENSIONS[TABLE_FORMAT_NUM_FORMATS] = {
+	[TABLE_FORMAT_NATIVE] = ".ctb",
+	[TABLE_FORMAT_SYZYGY_WDL] = ".rtbw",
+	[TABLE_FORMAT_SYZYGY_DTZ] = ".rtbz",
+};
+
+const uint8_t TABLE_FORMAT_MAGIC[TABLE_FORMAT_NUM_FORMATS][4] = {
+	[TABLE_FORMAT_NATIVE] = { 'C', 'T', 'B', 0x01 },
+	[TABLE_FORMAT_SYZYGY_WDL] = { 0x71, 0xE8, 0x23, 0x5D },
+	[TABLE_FORMAT_SYZYGY_DTZ] = { 0xD7, 0x66, 0x0C, 0xA5 },
+};
+
+// Squares a1-d1-d4, where pawnless tables keep the white king.
+static const int8_t KING_TRIANGLE[BOARD_SIZE * BOARD_SIZE] = {
+	0, 1, 3, 6, -1, -1, -1, -1, -1, 2, 4, 7, -1, -1, -1, -1,
+	-1, -1, 5, 8, -1, -1, -1, -1, -1, -1, -1, 9, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+static const uint8_t TRIANGLE_SQUARES[] = { 0, 1, 9, 2, 10, 18, 3, 11, 19, 27 };
+#define TRIANGLE_SIZE (sizeof(TRIANGLE_SQUARES) / sizeof(uint8_t))
+// Tables with pawns only mirror files, the white king stays on files a-d.
+#define HALF_BOARD_SIZE (BOARD_SIZE * BOARD_SIZE / 2)
+
+// Bits per piece count in a table key.
+#define TABLE_KEY_BITS 4
+// Smallest table index, grown to keep it at most half full.
+#define TABLE_MIN_SLOTS 16
+
+// Signature order, strongest piece first.
+static const EChessPiece SIGNATURE_PIECES[] = {
+	PIECE_KING, PIECE_QUEEN, PIECE_ROOK, PIECE_BISHOP, PIECE_KNIGHT,
+	PIECE_PAWN,
+};
+
+static const char SIGNATURE_SYMBOLS[PIECE_NUM_PIECES] = {
+	[PIECE_PAWN] = 'P', [PIECE_KNIGHT] = 'N', [PIECE_BISHOP] = 'B',
+	[PIECE_ROOK] = 'R', [PIECE_QUEEN] = 'Q', [PIECE_KING] = 'K',
+};
+
+static ETableFormat format_from_name(const char *name)
+{
+	size_t length = strlen(name);
+	for (ETableFormat format = 0; format < TABLE_FORMAT_NUM_FORMATS;
+	     format++) {
+		size_t ext = strlen(TABLE_FORMAT_EXTENSIONS[format]);
+		if (length > ext &&
+		    strcmp(name + length - ext,
+			   TABLE_FORMAT_EXTENSIONS[format]) == 0)
+			return format;
+	}
+	return TABLE_FORMAT_NUM_FORMATS;
+}
+
+static uint64_t read_le64(const uint8_t *bytes)
+{
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; i--)
+		value = (value << 8) | bytes[i];
+	return value;
+}
+
+static bool check_native(TableFile *table, const char *path)
+{
+	if (table->size < NATIVE_TABLE_HEADER_SIZE) {
+		ERROR_LOG("Bad native table: %s\n", path);
+		return false;
+	}
+	size_t entries = native_table_entries(&table->material);
+	size_t bits = table->data[NATIVE_TABLE_BITS_OFFSET];
+	if (bits == 0 || bits > 8 ||
+	    read_le64(table->data + NATIVE_TABLE_ENTRIES_OFFSET) != entries ||
+	    table->size < NATIVE_TABLE_HEADER_SIZE +
+	    (entries * bits + 7) / 8 + NATIVE_TABLE_PADDING) {
+		ERROR_LOG("Truncated native table: %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+static bool map_table(TableFile *table, const char *directory,
+		      const char *name, ETableFormat format)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	size_t size;
+	const uint8_t *data = map_file(path, 4, MADV_NORMAL, &size);
+	if (data == NULL)
+		return false;
+	if (memcmp(data, TABLE_FORMAT_MAGIC[format], 4) != 0) {
+		ERROR_LOG("Bad table magic: %s\n", path);
+		unmap_file(data, size);
+		return false;
+	}
+
+	memset(table, 0, sizeof(TableFile));
+	size_t length = strlen(name) - strlen(TABLE_FORMAT_EXTENSIONS[format]);
+	if (length >= TB_NAME_LENGTH)
+		length = TB_NAME_LENGTH - 1;
+	memcpy(table->name, name, length);
+	for (size_t i = 0; i < length; i++)
+		table->pieces += table->name[i] != 'v';
+	table->format = format;
+	table->data = data;
+	table->size = size;
+	if (table->pieces > TB_MAX_PIECES ||
+	    !parse_material(table->name, &table->material)) {
+		ERROR_LOG("Bad table name: %s\n", path);
+		unmap_file(data, size);
+		return false;
+	}
+	table->key = table_key(&table->material, COLOUR_WHITE);
+	bool ok = format == TABLE_FORMAT_NATIVE ? check_native(table, path) :
+		  open_syzygy_table(table);
+	if (!ok) {
+		if (format != TABLE_FORMAT_NATIVE)
+			ERROR_LOG("Bad Syzygy table: %s\n", path);
+		unmap_file(data, size);
+		return false;
+	}
+	return true;
+}
+
+static inline size_t key_slot(const Tablebases *tablebases, uint64_t key)
+{
+	return (key * 0x9e3779b97f4a7c15ULL >> 32) &
+	       (tablebases->num_slots - 1);
+}
+
+static void index_table(Tablebases *tablebases, size_t file)
+{
+	size_t slot = key_slot(tablebases, tablebases->files[file].key);
+	while (tablebases->slots[slot] != 0)
+		slot = (slot + 1) & (tablebases->num_slots - 1);
+	tablebases->slots[slot] = file + 1;
+}
+
+/**
+ * Make room for one more table, rehashing every file into a table twice the
+ * size once it would be over half full.
+ */
+static bool reserve_slot(Tablebases *tablebases)
+{
+	if ((tablebases->num_files + 1) * 2 <= tablebases->num_slots)
+		return true;
+	size_t num_slots = tablebases->num_slots ? tablebases->num_slots * 2 :
+			   TABLE_MIN_SLOTS;
+	size_t *slots = calloc(num_slots, sizeof(size_t));
+	if (slots == NULL)
+		return false;
+	free(tablebases->slots);
+	tablebases->slots = slots;
+	tablebases->num_slots = num_slots;
+	for (size_t i = 0; i < tablebases->num_files; i++)
+		index_table(tablebases, i);
+	return true;
+}
+
+static TableFile *find_table(const Tablebases *tablebases, uint64_t key,
+			     ETableFormat format)
+{
+	if (tablebases->num_slots == 0)
+		return NULL;
+	for (size_t slot = key_slot(tablebases, key);
+	     tablebases->slots[slot] != 0;
+	     slot = (slot + 1) & (tablebases->num_slots - 1)) {
+		TableFile *table = tablebases->files + tablebases->slots[slot] - 1;
+		if (table->key == key && table->format == format)
+			return table;
+	}
+	return NULL;
+}
+
+/**
+ * Map a single table file and add it to the set.
+ */
+bool load_table(Tablebases *tablebases, const char *directory,
+		const char *name)
+{
+	ETableFormat format = format_from_name(name);
+	if (format == TABLE_FORMAT_NUM_FORMATS || !reserve_slot(tablebases))
+		return false;
+	TableFile *files = realloc(tablebases->files, sizeof(TableFile) *
+				   (tablebases->num_files + 1));
+	if (files == NULL)
+		return false;
+	tablebases->files = files;
+	TableFile *table = &tablebases->files[tablebases->num_files];
+	if (!map_table(table, directory, name, format))
+		return false;
+	if (table->pieces > tablebases->max_pieces)
+		tablebases->max_pieces = table->pieces;
+	index_table(tablebases, tablebases->num_files++);
+	return true;
+}
+
+/**
+ * Map every table in the directory. Tables are plain files mapped read only,
+ * pages are only read in as they are probed.
+ */
+bool open_tablebases(Tablebases *tablebases, const char *directory,
+		     size_t max_pieces)
+{
+	memset(tablebases, 0, sizeof(Tablebases));
+	DIR *dir = opendir(directory);
+	if (dir == NULL) {
+		ERROR_LOG("Unable to open tablebase directory: %s\n",
+			  directory);
+		return false;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+		load_table(tablebases, directory, entry->d_name);
+	closedir(dir);
+
+	if (max_pieces && max_pieces < tablebases->max_pieces)
+		tablebases->max_pieces = max_pieces;
+	INFO_LOG("Tablebases: %zu files, up to %zu pieces\n",
+		 tablebases->num_files, tablebases->max_pieces);
+	return true;
+}
+
+void close_tablebases(Tablebases *tablebases)
+{
+	for (size_t i = 0; i < tablebases->num_files; i++) {
+		close_syzygy_table(&tablebases->files[i]);
+		unmap_file(tablebases->files[i].data,
+			   tablebases->files[i].size);
+	}
+	free(tablebases->files);
+	free(tablebases->slots);
+	memset(tablebases, 0, sizeof(Tablebases));
+}
+
+size_t count_pieces(Position *position)
+{
+	size_t pieces = 0;
+	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++)
+		pieces += position->board[i].type != PIECE_NONE;
+	return pieces;
+}
+
+/**
+ * The pieces on the board in square order, false if there are too many for
+ * any table.
+ */
+bool get_table_pieces(Position *position, TablePieces *pieces)
+{
+	memset(pieces, 0, sizeof(TablePieces));
+	for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
+		PlayPiece *piece = &position->board[i];
+		if (piece->type == PIECE_NONE)
+			continue;
+		if (pieces->num_pieces == TB_MAX_PIECES)
+			return false;
+		pieces->types[pieces->num_pieces] = piece->type;
+		pieces->colours[pieces->num_pieces] = piece->colour;
+		pieces->squares[pieces->num_pieces] = i;
+		pieces->num_pieces++;
+	}
+	return true;
+}
+
+/**
+ * Piece counts packed into an integer with the given colour's pieces first,
+ * equal for positions that share a material signature.
+ */
+uint64_t table_key(const TablePieces *pieces, EPlayerColour first)
+{
+	uint64_t key = 0;
+	for (size_t i = 0; i < pieces->num_pieces; i++) {
+		int side = pieces->colours[i] != first;
+		key += 1ULL << (TABLE_KEY_BITS *
+				(side * PIECE_NUM_PIECES + pieces->types[i]));
+	}
+	return key;
+}
+
+/**
+ * Material signature with the given colour's pieces first, e.g. "KRPvKR".
+ */
+void material_signature(const TablePieces *pieces, EPlayerColour first,
+			char name[TB_NAME_LENGTH])
+{
+	size_t counts[PLAYER_NUM_COLOURS][PIECE_NUM_PIECES] = { { 0 } };
+	for (size_t i = 0; i < pieces->num_pieces; i++)
+		counts[pieces->colours[i]][pieces->types[i]]++;
+	size_t length = 0;
+	for (int side = 0; side < PLAYER_NUM_COLOURS; side++) {
+		EPlayerColour colour = (first + side) % PLAYER_NUM_COLOURS;
+		if (side == 1)
+			name[length++] = 'v';
+		for (size_t p = 0; p < sizeof(SIGNATURE_PIECES) /
+		     sizeof(EChessPiece); p++) {
+			EChessPiece type = SIGNATURE_PIECES[p];
+			for (size_t n = 0; n < counts[colour][type] &&
+			     length < TB_NAME_LENGTH - 1; n++)
+				name[length++] = SIGNATURE_SYMBOLS[type];
+		}
+	}
+	name[length] = '\0';
+}
+
+/**
+ * Piece order of a table from its signature, e.g. "KQvKR" is the white king
+ * and queen, then the black king and rook.
+ */
+bool parse_material(const char *name, TablePieces *material)
+{
+	memset(material, 0, sizeof(TablePieces));
+	EPlayerColour colour = COLOUR_WHITE;
+	for (const char *c = name; *c != '\0'; c++) {
+		if (*c == 'v' && colour == COLOUR_WHITE) {
+			colour = COLOUR_BLACK;
+			continue;
+		}
+		EChessPiece type = PIECE_NONE;
+		for (EChessPiece p = 0; p < PIECE_NUM_PIECES; p++) {
+			if (SIGNATURE_SYMBOLS[p] == *c)
+				type = p;
+		}
+		if (type == PIECE_NONE || material->num_pieces == TB_MAX_PIECES)
+			return false;
+		material->types[material->num_pieces] = type;
+		material->colours[material->num_pieces] = colour;
+		material->num_pieces++;
+	}
+	return colour == COLOUR_BLACK && material->num_pieces >= 2 &&
+	       material->types[0] == PIECE_KING;
+}
+
+static bool has_pawns(const TablePieces *pieces)
+{
+	for (size_t i = 0; i < pieces->num_pieces; i++) {
+		if (pieces->types[i] == PIECE_PAWN)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Symmetry 0-7: bit 0 mirrors files, bit 1 mirrors ranks and bit 2 swaps them
+ * about the a1-h8 diagonal.
+ */
+static inline uint8_t transform_square(uint8_t square, int symmetry)
+{
+	int x = square % BOARD_SIZE;
+	int y = square / BOARD_SIZE;
+	if (symmetry & 1)
+		x = BOARD_SIZE - 1 - x;
+	if (symmetry & 2)
+		y = BOARD_SIZE - 1 - y;
+	if (symmetry & 4) {
+		int swap = x;
+		x = y;
+		y = swap;
+	}
+	return y * BOARD_SIZE + x;
+}
+
+size_t native_table_entries(const TablePieces *material)
+{
+	size_t entries = PLAYER_NUM_COLOURS *
+			 (has_pawns(material) ? HALF_BOARD_SIZE :
+			  TRIANGLE_SIZE);
+	for (size_t i = 1; i < material->num_pieces; i++)
+		entries *= BOARD_SIZE * BOARD_SIZE;
+	return entries;
+}
+
+/**
+ * Index of a position in a native table. The board is mirrored so the white
+ * king, the first piece, lands in the region the table stores; the other
+ * pieces take a full 64 square slot each.
+ */
+size_t native_table_index(const TablePieces *pieces, EPlayerColour turn)
+{
+	bool pawns = has_pawns(pieces);
+	int symmetry = 0;
+	size_t king;
+	for (;; symmetry++) {
+		uint8_t square = transform_square(pieces->squares[0], symmetry);
+		if (pawns && square % BOARD_SIZE < BOARD_SIZE / 2) {
+			king = square / BOARD_SIZE * (BOARD_SIZE / 2) +
+			       square % BOARD_SIZE;
+			break;
+		}
+		if (!pawns && KING_TRIANGLE[square] >= 0) {
+			king = KING_TRIANGLE[square];
+			break;
+		}
+	}
+
+	// A king on the diagonal leaves a mirror image, the first piece off the
+	// diagonal goes below it.
+	for (size_t i = 1; !pawns &&
+	     TRIANGLE_SQUARES[king] % (BOARD_SIZE + 1) == 0 &&
+	     i < pieces->num_pieces; i++) {
+		uint8_t square = transform_square(pieces->squares[i], symmetry);
+		if (square / BOARD_SIZE == square % BOARD_SIZE)
+			continue;
+		if (square / BOARD_SIZE > square % BOARD_SIZE)
+			symmetry ^= 4;
+		break;
+	}
+
+	size_t index = turn * (pawns ? HALF_BOARD_SIZE : TRIANGLE_SIZE) + king;
+	for (size_t i = 1; i < pieces->num_pieces; i++) {
+		index = index * BOARD_SIZE * BOARD_SIZE +
+			transform_square(pieces->squares[i], symmetry);
+	}
+	return index;
+}
+
+/**
+ * Inverse of native_table_index, the types and colours of pieces must
+ * already be filled in.
+ */
+void native_table_position(size_t index, TablePieces *pieces,
+			   EPlayerColour *turn)
+{
+	for (size_t i = pieces->num_pieces - 1; i > 0; i--) {
+		pieces->squares[i] = index % (BOARD_SIZE * BOARD_SIZE);
+		index /= BOARD_SIZE * BOARD_SIZE;
+	}
+	if (has_pawns(pieces)) {
+		size_t king = index % HALF_BOARD_SIZE;
+		pieces->squares[0] = king / (BOARD_SIZE / 2) * BOARD_SIZE +
+				     king % (BOARD_SIZE / 2);
+		*turn = index / HALF_BOARD_SIZE;
+	} else {
+		pieces->squares[0] = TRIANGLE_SQUARES[index % TRIANGLE_SIZE];
+		*turn = index / TRIANGLE_SIZE;
+	}
+}
+
+/**
+ * The table of the given format holding the pieces' material. If the table
+ * has black's pieces first the colours are swapped and the board flipped, so
+ * the pieces and turn line up with the table.
+ */
+const TableFile *find_material_table(const Tablebases *tablebases,
+				     TablePieces *pieces, EPlayerColour *turn,
+				     ETableFormat format)
+{
+	TableFile *table = find_table(tablebases,
+				      table_key(pieces, COLOUR_WHITE), format);
+	if (table != NULL)
+		return table;
+	table = find_table(tablebases, table_key(pieces, COLOUR_BLACK),
+			   format);
+	if (table == NULL)
+		return NULL;
+	for (size_t i = 0; i < pieces->num_pieces; i++) {
+		pieces->colours[i] = !pieces->colours[i];
+		pieces->squares[i] ^= (BOARD_SIZE - 1) * BOARD_SIZE;
+	}
+	*turn = !*turn;
+	return table;
+}
+
+static bool decode_native(const TableFile *table, const TablePieces *pieces,
+			  EPlayerColour turn, EWdl *wdl, int *plies)
+{
+	// Line the pieces up with the table's order.
+	TablePieces ordered = table->material;
+	bool used[TB_MAX_PIECES] = { false };
+	for (size_t i = 0; i < ordered.num_pieces; i++) {
+		size_t j = 0;
+		while (j < pieces->num_pieces &&
+		       (used[j] || pieces->types[j] != ordered.types[i] ||
+			pieces->colours[j] != ordered.colours[i]))
+			j++;
+		if (j == pieces->num_pieces)
+			return false;
+		used[j] = true;
+		ordered.squares[i] = pieces->squares[j];
+	}
+
+	size_t bits = table->data[NATIVE_TABLE_BITS_OFFSET];
+	size_t bit = native_table_index(&ordered, turn) * bits;
+	const uint8_t *bytes = table->data + NATIVE_TABLE_HEADER_SIZE + bit / 8;
+	int value = ((bytes[0] | bytes[1] << 8) >> (bit % 8)) &
+		    ((1 << bits) - 1);
+	if (value == 0) {
+		*wdl = TB_DRAW;
+		*plies = -1;
+		return true;
+	}
+	*plies = value - 1;
+	*wdl = *plies % 2 ? TB_WIN : TB_LOSS;
+	return true;
+}
+
+/**
+ * Look the pieces up in the native table holding their material.
+ */
+bool probe_pieces(Tablebases *tablebases, const TablePieces *pieces,
+		  EPlayerColour turn, EWdl *wdl, int *plies)
+{
+	TablePieces oriented = *pieces;
+	const TableFile *table = find_material_table(tablebases, &oriented,
+						     &turn,
+						     TABLE_FORMAT_NATIVE);
+	return table != NULL &&
+	       decode_native(table, &oriented, turn, wdl, plies);
+}
+
+/**
+ * A double pawn push only leaves an en passant square, the tables still
+ * cover the position unless a pawn can take on it.
+ */
+static bool has_en_passant_capture(Position *position)
+{
+	if (get_en_passant_square(position->board, position->turn,
+				  position->move_count) == -1)
+		return false;
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	for (size_t i = 0; i < num_moves; i++) {
+		if (moves[i].type == MOVEMENT_PAWN_EN_PASSANT)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Positions with castling rights, an en passant capture or too many pieces
+ * are never in a table.
+ */
+static bool probe_position(Tablebases *tablebases, Position *position,
+			   EWdl *wdl, int *plies)
+{
+	if (tablebases == NULL || tablebases->num_files == 0 ||
+	    count_pieces(position) > tablebases->max_pieces ||
+	    get_castling_rights(position->board) != CASTLE_NONE ||
+	    has_en_passant_capture(position))
+		return false;
+
+	TablePieces pieces;
+	return get_table_pieces(position, &pieces) &&
+	       probe_pieces(tablebases, &pieces, position->turn, wdl, plies);
+}
+
+/**
+ * Win/draw/loss for the player to move, if a table covers the position.
+ * Native tables are exact, Syzygy results assume the fifty move clock was
+ * just reset.
+ */
+bool probe_wdl(Tablebases *tablebases, Position *position, EWdl *wdl)
+{
+	int plies;
+	return probe_position(tablebases, position, wdl, &plies) ||
+	       probe_syzygy_wdl(tablebases, position, wdl);
+}
+
+/**
+ * Win/draw/loss for the player to move and the distance to mate in plies, if
+ * a native table covers the position. The distance is -1 for draws.
+ */
+bool probe_dtm(Tablebases *tablebases, Position *position, EWdl *wdl,
+	       int *plies)
+{
+	return probe_position(tablebases, position, wdl, plies);
+}
+
+/**
+ * Keep only the root moves that hold the best result the tables promise, so
+ * the search cannot throw away a won or drawn ending. Syzygy distance to
+ * zeroing tables also keep the moves that make progress fastest. Returns the
+ * number of moves kept, the moves are left alone if the root is not covered.
+ */
+size_t filter_root_moves(Tablebases *tablebases, Position *position,
+			 Move moves[MAX_LEGAL_MOVES], size_t num_moves,
+			 EWdl *wdl)
+{
+	if (filter_syzygy_root_moves(tablebases, position, moves, &num_moves,
+				     wdl))
+		return num_moves;
+
+	EWdl results[MAX_LEGAL_MOVES];
+	EWdl best = TB_LOSS;
+	for (size_t i = 0; i < num_moves; i++) {
+		Position child = *position;
+		make_move(&child, moves[i]);
+		EWdl child_wdl;
+		if (!probe_wdl(tablebases, &child, &child_wdl))
+			return num_moves;
+		results[i] = -child_wdl;
+		if (results[i] > best)
+			best = results[i];
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < num_moves; i++) {
+		if (results[i] == best)
+			moves[kept++] = moves[i];
+	}
+	*wdl = best;
+	return kept;
+}
@@ -0,0 +1,107 @@
+#ifndef _TABLEBASE_H
+#define _TABLEBASE_H
+
+#include "movement.h"
+#include "position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TB_MAX_PIECES 7
+// e.g. "KRPPvKRP" and the terminator.
+#define TB_NAME_LENGTH 16
+
+// Win/draw/loss from the point of view of the player to move. Cursed wins
+// and blessed losses are drawn by the fifty move rule.
+typedef enum {
+	TB_LOSS = -2,
+	TB_BLESSED_LOSS = -1,
+	TB_DRAW = 0,
+	TB_CURSED_WIN = 1,
+	TB_WIN = 2,
+} EWdl;
+
+typedef enum {
+	// Built by tb-gen, win/draw/loss and distance to mate per position.
+	TABLE_FORMAT_NATIVE,
+	// Syzygy win/draw/loss and distance to zeroing tables.
+	TABLE_FORMAT_SYZYGY_WDL,
+	TABLE_FORMAT_SYZYGY_DTZ,
+	TABLE_FORMAT_NUM_FORMATS
+} ETableFormat;
+
+// Native table layout: a header, then one value per position packed into
+// bits wide fields. 0 is a draw, otherwise the value is the distance to mate
+// in plies plus one, odd distances win for the player to move.
+#define NATIVE_TABLE_HEADER_SIZE 16
+#define NATIVE_TABLE_BITS_OFFSET 4
+#define NATIVE_TABLE_ENTRIES_OFFSET 8
+// Readers load 8 bytes at a time, the data is padded so they stay in the file.
+#define NATIVE_TABLE_PADDING 8
+
+// Pieces in table order: white's pieces strongest first, then black's.
+typedef struct {
+	size_t num_pieces;
+	EChessPiece types[TB_MAX_PIECES];
+	EPlayerColour colours[TB_MAX_PIECES];
+	uint8_t squares[TB_MAX_PIECES];
+} TablePieces;
+
+typedef struct {
+	// Material signature, white's pieces then black's, e.g. "KQvK".
+	char name[TB_NAME_LENGTH];
+	ETableFormat format;
+	size_t pieces;
+	// Piece order of the table, squares unused.
+	TablePieces material;
+	// table_key of the table's white pieces first.
+	uint64_t key;
+	const uint8_t *data;
+	size_t size;
+	// Layout of a Syzygy table, NULL for native tables.
+	struct SyzygyTable *syzygy;
+} TableFile;
+
+typedef struct {
+	TableFile *files;
+	size_t num_files;
+	// Open addressed by material key, file index + 1 per slot, 0 if empty.
+	// Tables of different formats for the same material share a key.
+	size_t *slots;
+	size_t num_slots;
+	// Positions with more pieces than this are never probed.
+	size_t max_pieces;
+} Tablebases;
+
+extern const char *TABLE_FORMAT_EXTENSIONS[TABLE_FORMAT_NUM_FORMATS];
+extern const uint8_t TABLE_FORMAT_MAGIC[TABLE_FORMAT_NUM_FORMATS][4];
+
+bool open_tablebases(Tablebases *tablebases, const char *directory,
+		     size_t max_pieces);
+bool load_table(Tablebases *tablebases, const char *directory,
+		const char *name);
+void close_tablebases(Tablebases *tablebases);
+size_t count_pieces(Position *position);
+bool get_table_pieces(Position *position, TablePieces *pieces);
+const TableFile *find_material_table(const Tablebases *tablebases,
+				     TablePieces *pieces, EPlayerColour *turn,
+				     ETableFormat format);
+uint64_t table_key(const TablePieces *pieces, EPlayerColour first);
+void material_signature(const TablePieces *pieces, EPlayerColour first,
+			char name[TB_NAME_LENGTH]);
+bool parse_material(const char *name, TablePieces *material);
+size_t native_table_entries(const TablePieces *material);
+size_t native_table_index(const TablePieces *pieces, EPlayerColour turn);
+void native_table_position(size_t index, TablePieces *pieces,
+			   EPlayerColour *turn);
+bool probe_pieces(Tablebases *tablebases, const TablePieces *pieces,
+		  EPlayerColour turn, EWdl *wdl, int *plies);
+bool probe_wdl(Tablebases *tablebases, Position *position, EWdl *wdl);
+bool probe_dtm(Tablebases *tablebases, Position *position, EWdl *wdl,
+	       int *plies);
+size_t filter_root_moves(Tablebases *tablebases, Position *position,
+			 Move moves[MAX_LEGAL_MOVES], size_t num_moves,
+			 EWdl *wdl);
+
+#endif
@@ -0,0 +1,473 @@
+#include "tag_index.h"
+#include "binary.h"
+#include "pgn.h"
+#include "timing.h"
+#include "log.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Player table slots to start with, doubled whenever half full.
+#define PLAYER_TABLE_INITIAL_SIZE 1024
+
+/**
+ * Player names numbered in the order they are first seen, found again by
+ * hashing into an open addressing table of player numbers.
+ */
+typedef struct {
+	char **names;
+	size_t num_names;
+	size_t capacity;
+	// Player number plus one, 0 for an empty slot.
+	uint32_t *slots;
+	size_t num_slots;
+} PlayerTable;
+
+static inline uint64_t hash_name(const char *name)
+{
+	return fnv1a_64(name, strlen(name));
+}
+
+static bool grow_player_slots(PlayerTable *table)
+{
+	size_t num_slots = table->num_slots ? table->num_slots * 2 :
+			   PLAYER_TABLE_INITIAL_SIZE;
+	uint32_t *slots = calloc(num_slots, sizeof(uint32_t));
+	if (slots == NULL)
+		return false;
+	for (size_t i = 0; i < table->num_names; i++) {
+		size_t slot = hash_name(table->names[i]) & (num_slots - 1);
+		while (slots[slot] != 0)
+			slot = (slot + 1) & (num_slots - 1);
+		slots[slot] = i + 1;
+	}
+	free(table->slots);
+	table->slots = slots;
+	table->num_slots = num_slots;
+	return true;
+}
+
+/**
+ * Number of the player with this name, adding them if they are new. Names
+ * are cut to the longest the index stores first, so names that only differ
+ * past it are the same player. Returns false if out of memory.
+ */
+static bool find_player(PlayerTable *table, const char *full_name,
+			uint32_t *id)
+{
+	if (2 * (table->num_names + 1) > table->num_slots &&
+	    !grow_player_slots(table))
+		return false;
+	char name[TAG_INDEX_MAX_NAME_LEN + 1];
+	snprintf(name, sizeof(name), "%s", full_name);
+	size_t slot = hash_name(name) & (table->num_slots - 1);
+	while (table->slots[slot] != 0) {
+		uint32_t player = table->slots[slot] - 1;
+		if (strcmp(table->names[player], name) == 0) {
+			*id = player;
+			return true;
+		}
+		slot = (slot + 1) & (table->num_slots - 1);
+	}
+
+	if (table->num_names == table->capacity) {
+		size_t capacity = table->capacity ? table->capacity * 2 :
+				  PLAYER_TABLE_INITIAL_SIZE;
+		char **names = realloc(table->names,
+				       capacity * sizeof(char *));
+		if (names == NULL)
+			return false;
+		table->names = names;
+		table->capacity = capacity;
+	}
+	char *copy = strdup(name);
+	if (copy == NULL)
+		return false;
+	*id = table->num_names;
+	table->names[table->num_names++] = copy;
+	table->slots[slot] = *id + 1;
+	return true;
+}
+
+static void free_player_table(PlayerTable *table)
+{
+	for (size_t i = 0; i < table->num_names; i++)
+		free(table->names[i]);
+	free(table->names);
+	free(table->slots);
+}
+
+/**
+ * A PGN date such as "2022.07.31" as 20220731, unknown parts such as "??"
+ * are 0.
+ */
+uint32_t parse_pgn_date(const char *date)
+{
+	uint32_t parts[3] = { 0 };
+	for (size_t i = 0; i < 3 && *date; i++) {
+		if (isdigit((unsigned char)*date))
+			parts[i] = strtoul(date, NULL, 10);
+		date = strchr(date, '.');
+		if (date == NULL)
+			break;
+		date++;
+	}
+	if (parts[1] > 99 || parts[2] > 99)
+		return 0;
+	return parts[0] * 10000 + parts[1] * 100 + parts[2];
+}
+
+static uint16_t parse_elo(const char *elo)
+{
+	unsigned long value = elo ? strtoul(elo, NULL, 10) : 0;
+	return value > UINT16_MAX ? UINT16_MAX : value;
+}
+
+static bool write_tag_record(FILE *output, const TagRecord *record)
+{
+	uint8_t bytes[TAG_INDEX_RECORD_SIZE] = { 0 };
+	write_le(bytes, record->offset, 8);
+	write_le(bytes + 8, record->white, 4);
+	write_le(bytes + 12, record->black, 4);
+	write_le(bytes + 16, record->white_elo, 2);
+	write_le(bytes + 18, record->black_elo, 2);
+	write_le(bytes + 20, record->date, 4);
+	bytes[24] = record->result;
+	return fwrite(bytes, TAG_INDEX_RECORD_SIZE, 1, output) == 1;
+}
+
+static bool index_tags(PgnReader *reader, FILE *output, PlayerTable *players,
+		       size_t *games)
+{
+	PgnGame *game = malloc(sizeof(PgnGame));
+	bool ok = game != NULL;
+	while (ok && read_pgn_game(reader, game)) {
+		const char *white = get_pgn_tag(game, "White");
+		const char *black = get_pgn_tag(game, "Black");
+		const char *date = get_pgn_tag(game, "Date");
+		TagRecord record = {
+			.offset = game->offset,
+			.white_elo = parse_elo(get_pgn_tag(game, "WhiteElo")),
+			.black_elo = parse_elo(get_pgn_tag(game, "BlackElo")),
+			.date = date ? parse_pgn_date(date) : 0,
+			.result = game->result,
+		};
+		ok = find_player(players, white ? white : "?", &record.white) &&
+		     find_player(players, black ? black : "?", &record.black) &&
+		     write_tag_record(output, &record);
+		(*games)++;
+	}
+	free(game);
+	return ok;
+}
+
+/**
+ * Stamp a PGN file by its size, modification time and the hashes of its
+ * first and last blocks. The time is 0 for standard input, whose text is
+ * only hashed if it was mapped.
+ */
+static void stamp_tag_source(const PgnReader *reader, const char *filepath,
+			     TagSourceStamp *stamp)
+{
+	memset(stamp, 0, sizeof(TagSourceStamp));
+	stamp->size = reader->consumed + reader->size;
+	struct stat info;
+	if (strcmp(filepath, PGN_STDIN_PATH) != 0 && stat(filepath, &info) == 0)
+		stamp->mtime_ns = (uint64_t)info.st_mtim.tv_sec * 1000000000 +
+				  info.st_mtim.tv_nsec;
+	if (!reader->mapped)
+		return;
+	size_t block = reader->size < TAG_INDEX_CHECK_BLOCK ? reader->size :
+		       TAG_INDEX_CHECK_BLOCK;
+	stamp->first_hash = fnv1a_64(reader->data, block);
+	stamp->last_hash = fnv1a_64(reader->data + reader->size - block,
+				    block);
+}
+
+static bool write_player_names(FILE *output, const PlayerTable *players)
+{
+	bool ok = true;
+	for (size_t i = 0; ok && i < players->num_names; i++) {
+		uint8_t length = strlen(players->names[i]);
+		ok = fwrite(&length, 1, 1, output) == 1 &&
+		     fwrite(players->names[i], 1, length, output) == length;
+	}
+	return ok;
+}
+
+/**
+ * Index the tags of every game of a PGN file. Movetext is only scanned for
+ * where each game ends, its moves are not played.
+ */
+int run_tag_index(TagIndexArgs *args)
+{
+	PgnReader reader;
+	if (!open_pgn_reader(&reader, args->input))
+		return 0;
+	reader.skip_moves = true;
+	FILE *output = fopen(args->output, "wb");
+	if (output == NULL) {
+		ERROR_LOG("Unable to open %s\n", args->output);
+		close_pgn_reader(&reader);
+		return 0;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	PlayerTable players = { 0 };
+	size_t games = 0;
+	// The header is filled in once everything is counted.
+	uint8_t header[TAG_INDEX_HEADER_SIZE] = { 0 };
+	bool ok = fwrite(header, TAG_INDEX_HEADER_SIZE, 1, output) == 1 &&
+		  index_tags(&reader, output, &players, &games) &&
+		  write_player_names(output, &players);
+
+	memcpy(header, TAG_INDEX_MAGIC, 3);
+	header[3] = TAG_INDEX_VERSION;
+	write_le(header + 4, games, 8);
+	write_le(header + 12, players.num_names, 8);
+	TagSourceStamp stamp;
+	stamp_tag_source(&reader, args->input, &stamp);
+	write_le(header + 20, stamp.size, 8);
+	write_le(header + 28, stamp.mtime_ns, 8);
+	write_le(header + 36, stamp.first_hash, 8);
+	write_le(header + 44, stamp.last_hash, 8);
+	ok = ok && fseek(output, 0, SEEK_SET) == 0 &&
+	     fwrite(header, TAG_INDEX_HEADER_SIZE, 1, output) == 1;
+	if (fclose(output) != 0)
+		ok = false;
+	close_pgn_reader(&reader);
+	size_t num_players = players.num_names;
+	free_player_table(&players);
+	if (!ok) {
+		ERROR_LOG("Tag index build failed\n");
+		return 0;
+	}
+	INFO_LOG("Games: %zu\nPlayers: %zu\nWritten to %s\nTime: %.3fs\n",
+		 games, num_players, args->output, elapsed_seconds(&start));
+	return 1;
+}
+
+bool open_tag_index(TagIndex *index, const char *filepath)
+{
+	memset(index, 0, sizeof(TagIndex));
+	index->data = map_file(filepath, TAG_INDEX_HEADER_SIZE, MADV_NORMAL,
+			       &index->size);
+	if (index->data == NULL) {
+		ERROR_LOG("Unable to open tag index: %s\n", filepath);
+		return false;
+	}
+	index->num_games = read_le(index->data + 4, 8);
+	index->num_players = read_le(index->data + 12, 8);
+	index->source.size = read_le(index->data + 20, 8);
+	index->source.mtime_ns = read_le(index->data + 28, 8);
+	index->source.first_hash = read_le(index->data + 36, 8);
+	index->source.last_hash = read_le(index->data + 44, 8);
+	bool ok = memcmp(index->data, TAG_INDEX_MAGIC, 3) == 0 &&
+		  index->data[3] == TAG_INDEX_VERSION &&
+		  index->num_games <= (index->size - TAG_INDEX_HEADER_SIZE) /
+		  TAG_INDEX_RECORD_SIZE;
+
+	// Find where each name starts, they vary in length.
+	index->names = ok ? malloc((index->num_players + 1) *
+				   sizeof(uint8_t *)) : NULL;
+	const uint8_t *name = index->data + TAG_INDEX_HEADER_SIZE +
+			      index->num_games * TAG_INDEX_RECORD_SIZE;
+	const uint8_t *end = index->data + index->size;
+	for (size_t i = 0; index->names && i < index->num_players; i++) {
+		if (name >= end || name + 1 + *name > end) {
+			ok = false;
+			break;
+		}
+		index->names[i] = name;
+		name += 1 + *name;
+	}
+	if (!ok || index->names == NULL) {
+		ERROR_LOG("Invalid tag index: %s\n", filepath);
+		close_tag_index(index);
+		return false;
+	}
+	return true;
+}
+
+void close_tag_index(TagIndex *index)
+{
+	unmap_file(index->data, index->size);
+	free(index->names);
+	memset(index, 0, sizeof(TagIndex));
+}
+
+TagRecord read_tag_record(const TagIndex *index, size_t game)
+{
+	const uint8_t *data = index->data + TAG_INDEX_HEADER_SIZE +
+			      game * TAG_INDEX_RECORD_SIZE;
+	uint32_t white = read_le(data + 8, 4);
+	uint32_t black = read_le(data + 12, 4);
+	// Unknown players get the number one past the last.
+	return (TagRecord){
+		       .offset = read_le(data, 8),
+		       .white = white < index->num_players ? white :
+				index->num_players,
+		       .black = black < index->num_players ? black :
+				index->num_players,
+		       .white_elo = read_le(data + 16, 2),
+		       .black_elo = read_le(data + 18, 2),
+		       .date = read_le(data + 20, 4),
+		       .result = data[24] < GAME_RESULT_NUM_TYPES ?
+				 data[24] : GAME_RESULT_UNKNOWN,
+	};
+}
+
+/**
+ * A player's name, not terminated. Returns its length.
+ */
+size_t get_player_name(const TagIndex *index, uint32_t player,
+		       const char **name)
+{
+	if (player >= index->num_players) {
+		*name = "?";
+		return 1;
+	}
+	*name = (const char *)index->names[player] + 1;
+	return *index->names[player];
+}
+
+/**
+ * Which players' names contain the text, so records are matched by number.
+ */
+static bool *match_players(const TagIndex *index, const char *text)
+{
+	bool *matches = calloc(index->num_players + 1, sizeof(bool));
+	char name[TAG_INDEX_MAX_NAME_LEN + 1];
+	for (size_t i = 0; matches && i < index->num_players; i++) {
+		const char *start;
+		size_t length = get_player_name(index, i, &start);
+		memcpy(name, start, length);
+		name[length] = '\0';
+		matches[i] = strstr(name, text) != NULL;
+	}
+	return matches;
+}
+
+static bool record_matches(const TagFilterArgs *args, const bool *players,
+			   EGameResult result, uint32_t since, uint32_t until,
+			   const TagRecord *record)
+{
+	if (since && record->date < since)
+		return false;
+	if (until && record->date > until)
+		return false;
+	if (result != GAME_RESULT_NUM_TYPES && record->result != result)
+		return false;
+	if (players == NULL)
+		return record->white_elo >= args->min_elo &&
+		       record->black_elo >= args->min_elo;
+	return (players[record->white] &&
+		record->white_elo >= args->min_elo) ||
+	       (players[record->black] && record->black_elo >= args->min_elo);
+}
+
+static EGameResult parse_result(const char *text)
+{
+	for (EGameResult result = GAME_RESULT_UNKNOWN;
+	     result < GAME_RESULT_NUM_TYPES; result++) {
+		if (strcmp(text, GAME_RESULT_STRINGS[result]) == 0)
+			return result;
+	}
+	return GAME_RESULT_NUM_TYPES;
+}
+
+/**
+ * Print the games whose tags match, only those games are parsed, straight
+ * from their offset in the PGN file.
+ */
+int run_tag_filter(TagFilterArgs *args)
+{
+	EGameResult result = GAME_RESULT_NUM_TYPES;
+	if (args->result != NULL &&
+	    (result = parse_result(args->result)) == GAME_RESULT_NUM_TYPES) {
+		ERROR_LOG("Invalid result: %s\n", args->result);
+		return 0;
+	}
+	TagIndex index;
+	if (!open_tag_index(&index, args->index))
+		return 0;
+	PgnReader source;
+	if (!open_pgn_reader(&source, args->input)) {
+		close_tag_index(&index);
+		return 0;
+	}
+	TagSourceStamp stamp;
+	stamp_tag_source(&source, args->input, &stamp);
+	if (!source.mapped ||
+	    memcmp(&stamp, &index.source, sizeof(TagSourceStamp)) != 0) {
+		ERROR_LOG("%s does not match the tag index %s\n", args->input,
+			  args->index);
+		close_pgn_reader(&source);
+		close_tag_index(&index);
+		return 0;
+	}
+
+	PgnWriter *writer = NULL;
+	PgnGame *game = malloc(sizeof(PgnGame));
+	bool *players = args->player ? match_players(&index, args->player) :
+			NULL;
+	bool ok = game != NULL && (args->player == NULL || players != NULL);
+	if (ok && args->output != NULL) {
+		writer = malloc(sizeof(PgnWriter));
+		ok = writer != NULL && open_pgn_writer(writer, args->output);
+		if (!ok) {
+			free(writer);
+			writer = NULL;
+		}
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint32_t since = args->since ? parse_pgn_date(args->since) : 0;
+	uint32_t until = args->until ? parse_pgn_date(args->until) : 0;
+	size_t matches = 0;
+	for (size_t i = 0; ok && i < index.num_games; i++) {
+		TagRecord record = read_tag_record(&index, i);
+		if (!record_matches(args, players, result, since, until,
+				    &record) ||
+		    record.offset >= source.size)
+			continue;
+		matches++;
+		const char *white, *black;
+		int white_length = get_player_name(&index, record.white,
+						   &white);
+		int black_length = get_player_name(&index, record.black,
+						   &black);
+		INFO_LOG("Game %zu: %.*s (%u) - %.*s (%u) %s %08u\n", i + 1,
+			 white_length, white, record.white_elo, black_length,
+			 black, record.black_elo,
+			 GAME_RESULT_STRINGS[record.result], record.date);
+		if (writer == NULL)
+			continue;
+		PgnReader reader;
+		init_pgn_reader_memory(&reader, source.data + record.offset,
+				       source.size - record.offset);
+		ok = read_pgn_game(&reader, game) &&
+		     write_pgn_game(writer, game);
+		close_pgn_reader(&reader);
+	}
+	if (writer != NULL && !close_pgn_writer(writer))
+		ok = false;
+	INFO_LOG("Games: %zu of %zu\nTime: %.3fs\n", matches, index.num_games,
+		 elapsed_seconds(&start));
+	free(writer);
+	free(players);
+	free(game);
+	close_pgn_reader(&source);
+	close_tag_index(&index);
+	return ok;
+}
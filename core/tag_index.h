@@ -0,0 +1,93 @@
+#ifndef _TAG_INDEX_H
+#define _TAG_INDEX_H
+
+#include "pgn.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The tag sections of a PGN file, so games can be filtered without reading
+ * their movetext. The header is:
+ *
+ *   magic "CTI", version, game count (8 bytes), player count (8 bytes),
+ *   size of the PGN file (8 bytes), its modification time in nanoseconds
+ *   (8 bytes), FNV-1a of its first and last blocks (8 bytes each)
+ *
+ * then one record per game: its byte offset in the PGN file (8 bytes), white
+ * and black player numbers (4 bytes each), white and black Elo (2 bytes
+ * each, 0 if unknown), date as YYYYMMDD (4 bytes, unknown parts 0), result
+ * (1 byte) and padding. The player names follow, each one length prefixed
+ * and numbered in order. Numbers are little endian.
+ *
+ * Offsets are only used while the PGN file matches all of its size, time and
+ * block hashes, so an edit that keeps the size is caught too.
+ */
+#define TAG_INDEX_MAGIC "CTI"
+#define TAG_INDEX_VERSION 2
+#define TAG_INDEX_HEADER_SIZE 52
+#define TAG_INDEX_CHECK_BLOCK 4096
+#define TAG_INDEX_RECORD_SIZE 28
+#define TAG_INDEX_MAX_NAME_LEN 255
+#define TAG_INDEX_DEFAULT_OUTPUT "games.cti"
+
+typedef struct {
+	uint64_t offset;
+	uint32_t white;
+	uint32_t black;
+	uint16_t white_elo;
+	uint16_t black_elo;
+	uint32_t date;
+	EGameResult result;
+} TagRecord;
+
+// What the PGN file looked like when it was indexed.
+typedef struct {
+	uint64_t size;
+	uint64_t mtime_ns;
+	uint64_t first_hash;
+	uint64_t last_hash;
+} TagSourceStamp;
+
+typedef struct {
+	// The mapped file.
+	const uint8_t *data;
+	size_t size;
+	size_t num_games;
+	size_t num_players;
+	TagSourceStamp source;
+	// Where each player's length prefixed name starts.
+	const uint8_t **names;
+} TagIndex;
+
+typedef struct {
+	const char *input;
+	const char *output;
+} TagIndexArgs;
+
+typedef struct {
+	const char *input;
+	const char *index;
+	// Players whose name contains this, either colour.
+	const char *player;
+	// The player's Elo, or both players' without a player.
+	size_t min_elo;
+	// Dates as YYYY.MM.DD, inclusive.
+	const char *since;
+	const char *until;
+	const char *result;
+	// Matching games are copied here if set.
+	const char *output;
+} TagFilterArgs;
+
+uint32_t parse_pgn_date(const char *date);
+bool open_tag_index(TagIndex *index, const char *filepath);
+void close_tag_index(TagIndex *index);
+TagRecord read_tag_record(const TagIndex *index, size_t game);
+size_t get_player_name(const TagIndex *index, uint32_t player,
+		       const char **name);
+int run_tag_index(TagIndexArgs *args);
+int run_tag_filter(TagFilterArgs *args);
+
+#endif
@@ -0,0 +1,854 @@
+#include "tb_gen.h"
+#include "board.h"
+#include "evaluate.h"
+#include "tablebase.h"
+#include "timing.h"
+#include "log.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Working values, one byte per position. Resolved positions hold the
+// distance to mate in plies plus one, as in the table files.
+#define VALUE_UNKNOWN 0
+// Cannot be lost, a capture or promotion holds the draw. Still may be won.
+#define VALUE_DRAWN 254
+#define VALUE_INVALID 255
+#define MAX_VALUE_PLIES 252
+
+// Positions handed to a worker at a time.
+#define GEN_CHUNK_SIZE 4096
+// Pseudo legal moves of at most three pieces and a king, promotions expanded.
+#define GEN_MAX_MOVES 128
+
+#define MAX_TABLES 64
+
+typedef struct {
+	uint8_t piece;
+	uint8_t target;
+	// EChessPiece to promote to, PIECE_NONE otherwise.
+	uint8_t promotion;
+} GenMove;
+
+typedef struct {
+	size_t moves;
+	// Fastest win through a child lost for the opponent, INT_MAX if none.
+	int win;
+	// Slowest loss over the children won by the opponent.
+	int loss;
+	// Some child is drawn, so the position cannot be lost.
+	bool drawn;
+	// Some child is not known yet.
+	bool unresolved;
+} MoveSummary;
+
+typedef struct {
+	// Piece order of the table being built, squares unused.
+	TablePieces material;
+	size_t entries;
+	_Atomic uint8_t *values;
+	// Smaller tables already built, for captures and promotions.
+	Tablebases *tables;
+	atomic_bool missing_table;
+} Generator;
+
+typedef struct {
+	Generator *gen;
+	atomic_size_t next;
+	// Distance in plies being propagated, 0 for the initial pass.
+	int ply;
+} GenJob;
+
+typedef struct {
+	GenJob *job;
+	pthread_t thread;
+	// Largest distance written.
+	int max_ply;
+} GenWorker;
+
+static const int8_t KNIGHT_DELTAS[8][2] = {
+	{ 1, 2 }, { 2, 1 }, { 2, -1 }, { 1, -2 },
+	{ -1, -2 }, { -2, -1 }, { -2, 1 }, { -1, 2 },
+};
+
+static const int8_t KING_DELTAS[8][2] = {
+	{ 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 },
+	{ -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 },
+};
+
+// Rook directions first, then bishop directions.
+static const int8_t SLIDER_DIRECTIONS[8][2] = {
+	{ 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 },
+	{ 1, 1 }, { -1, 1 }, { -1, -1 }, { 1, -1 },
+};
+
+static const EChessPiece TABLE_PIECES[] = {
+	PIECE_QUEEN, PIECE_ROOK, PIECE_BISHOP, PIECE_KNIGHT, PIECE_PAWN,
+};
+#define NUM_TABLE_PIECES (sizeof(TABLE_PIECES) / sizeof(EChessPiece))
+
+static const EChessPiece PROMOTION_PIECES[] = {
+	PIECE_QUEEN, PIECE_ROOK, PIECE_BISHOP, PIECE_KNIGHT,
+};
+
+static inline bool on_board(int x, int y)
+{
+	return x >= 0 && x < BOARD_SIZE && y >= 0 && y < BOARD_SIZE;
+}
+
+static inline int pawn_direction(EPlayerColour colour)
+{
+	return colour == COLOUR_WHITE ? 1 : -1;
+}
+
+static int piece_at(const TablePieces *pieces, int square)
+{
+	for (size_t i = 0; i < pieces->num_pieces; i++) {
+		if (pieces->squares[i] == square)
+			return i;
+	}
+	return -1;
+}
+
+static uint64_t occupancy(const TablePieces *pieces)
+{
+	uint64_t occupied = 0;
+	for (size_t i = 0; i < pieces->num_pieces; i++)
+		occupied |= 1ULL << pieces->squares[i];
+	return occupied;
+}
+
+static bool attacks_square(const TablePieces *pieces, size_t i, int target,
+			   uint64_t occupied)
+{
+	int from = pieces->squares[i];
+	int dx = target % BOARD_SIZE - from % BOARD_SIZE;
+	int dy = target / BOARD_SIZE - from / BOARD_SIZE;
+	int adx = abs(dx);
+	int ady = abs(dy);
+	switch (pieces->types[i]) {
+	case PIECE_PAWN:
+		return dy == pawn_direction(pieces->colours[i]) && adx == 1;
+	case PIECE_KNIGHT:
+		return adx * ady == 2;
+	case PIECE_KING:
+		return adx <= 1 && ady <= 1 && (adx | ady);
+	case PIECE_ROOK:
+		if (dx != 0 && dy != 0)
+			return false;
+		break;
+	case PIECE_BISHOP:
+		if (adx != ady)
+			return false;
+		break;
+	case PIECE_QUEEN:
+		if (dx != 0 && dy != 0 && adx != ady)
+			return false;
+		break;
+	default:
+		return false;
+	}
+	if (from == target)
+		return false;
+
+	int step = (dy > 0) - (dy < 0);
+	step = step * BOARD_SIZE + (dx > 0) - (dx < 0);
+	for (int square = from + step; square != target; square += step) {
+		if (occupied & (1ULL << square))
+			return false;
+	}
+	return true;
+}
+
+static bool is_attacked(const TablePieces *pieces, int target,
+			EPlayerColour attacker)
+{
+	uint64_t occupied = occupancy(pieces);
+	for (size_t i = 0; i < pieces->num_pieces; i++) {
+		if (pieces->colours[i] == attacker &&
+		    attacks_square(pieces, i, target, occupied))
+			return true;
+	}
+	return false;
+}
+
+static int king_square(const TablePieces *pieces, EPlayerColour colour)
+{
+	for (size_t i = 0; i < pieces->num_pieces; i++) {
+		if (pieces->types[i] == PIECE_KING &&
+		    pieces->colours[i] == colour)
+			return pieces->squares[i];
+	}
+	return -1;
+}
+
+/**
+ * Pieces on distinct squares, no pawns on the back ranks and the player who
+ * just moved is not in check.
+ */
+static bool is_valid(const TablePieces *pieces, EPlayerColour turn)
+{
+	if ((size_t)__builtin_popcountll(occupancy(pieces)) !=
+	    pieces->num_pieces)
+		return false;
+	for (size_t i = 0; i < pieces->num_pieces; i++) {
+		int rank = pieces->squares[i] / BOARD_SIZE;
+		if (pieces->types[i] == PIECE_PAWN &&
+		    (rank == 0 || rank == BOARD_SIZE - 1))
+			return false;
+	}
+	return !is_attacked(pieces, king_square(pieces, !turn), turn);
+}
+
+static size_t add_pawn_moves(const TablePieces *pieces, size_t i,
+			     int target, GenMove moves[GEN_MAX_MOVES],
+			     size_t num_moves)
+{
+	int rank = target / BOARD_SIZE;
+	if (rank != 0 && rank != BOARD_SIZE - 1) {
+		moves[num_moves++] = (GenMove){ i, target, PIECE_NONE };
+		return num_moves;
+	}
+	for (size_t p = 0; p < sizeof(PROMOTION_PIECES) / sizeof(EChessPiece);
+	     p++)
+		moves[num_moves++] = (GenMove){ i, target, PROMOTION_PIECES[p] };
+	return num_moves;
+}
+
+/**
+ * Pseudo legal moves of one player, captures included. There is never
+ * castling and en passant is left out of the tables.
+ */
+static size_t generate_moves(const TablePieces *pieces, EPlayerColour turn,
+			     GenMove moves[GEN_MAX_MOVES])
+{
+	size_t num_moves = 0;
+	for (size_t i = 0; i < pieces->num_pieces; i++) {
+		if (pieces->colours[i] != turn)
+			continue;
+		int x = pieces->squares[i] % BOARD_SIZE;
+		int y = pieces->squares[i] / BOARD_SIZE;
+		EChessPiece type = pieces->types[i];
+
+		if (type == PIECE_PAWN) {
+			int dir = pawn_direction(turn);
+			int ahead = (y + dir) * BOARD_SIZE + x;
+			if (piece_at(pieces, ahead) == -1) {
+				num_moves = add_pawn_moves(pieces, i, ahead,
+							   moves, num_moves);
+				int start = turn == COLOUR_WHITE ? 1 :
+					    BOARD_SIZE - 2;
+				int jump = ahead + dir * BOARD_SIZE;
+				if (y == start && piece_at(pieces, jump) == -1)
+					moves[num_moves++] =
+						(GenMove){ i, jump, PIECE_NONE };
+			}
+			for (int side = -1; side <= 1; side += 2) {
+				if (!on_board(x + side, y + dir))
+					continue;
+				int target = ahead + side;
+				int victim = piece_at(pieces, target);
+				if (victim != -1 &&
+				    pieces->colours[victim] != turn)
+					num_moves = add_pawn_moves(
+						pieces, i, target, moves,
+						num_moves);
+			}
+			continue;
+		}
+
+		const int8_t (*deltas)[2] = SLIDER_DIRECTIONS;
+		size_t first = 0;
+		size_t last = 8;
+		bool slides = true;
+		if (type == PIECE_KNIGHT || type == PIECE_KING) {
+			deltas = type == PIECE_KNIGHT ? KNIGHT_DELTAS :
+				 KING_DELTAS;
+			slides = false;
+		} else if (type == PIECE_ROOK) {
+			last = 4;
+		} else if (type == PIECE_BISHOP) {
+			first = 4;
+		}
+		for (size_t d = first; d < last; d++) {
+			int tx = x + deltas[d][0];
+			int ty = y + deltas[d][1];
+			for (; on_board(tx, ty); tx += deltas[d][0],
+			     ty += deltas[d][1]) {
+				int target = ty * BOARD_SIZE + tx;
+				int occupant = piece_at(pieces, target);
+				if (occupant == -1 ||
+				    pieces->colours[occupant] != turn)
+					moves[num_moves++] = (GenMove){
+						i, target, PIECE_NONE
+					};
+				if (occupant != -1 || !slides)
+					break;
+			}
+		}
+	}
+	return num_moves;
+}
+
+/**
+ * Play a move, returns false if it leaves the mover in check. Captures and
+ * promotions leave the table and are flagged as conversions.
+ */
+static bool play_move(const TablePieces *pieces, EPlayerColour turn,
+		      GenMove move, TablePieces *child, bool *conversion)
+{
+	*child = *pieces;
+	size_t mover = move.piece;
+	int victim = piece_at(pieces, move.target);
+	if (victim != -1) {
+		for (size_t i = victim; i + 1 < child->num_pieces; i++) {
+			child->types[i] = child->types[i + 1];
+			child->colours[i] = child->colours[i + 1];
+			child->squares[i] = child->squares[i + 1];
+		}
+		child->num_pieces--;
+		if ((size_t)victim < mover)
+			mover--;
+	}
+	child->squares[mover] = move.target;
+	if (move.promotion != PIECE_NONE)
+		child->types[mover] = move.promotion;
+	*conversion = victim != -1 || move.promotion != PIECE_NONE;
+	return !is_attacked(child, king_square(child, turn), !turn);
+}
+
+/**
+ * Value of a position outside the table being built, a bare pair of kings
+ * is drawn and everything else comes from the tables already built.
+ */
+static int conversion_value(Generator *gen, const TablePieces *child,
+			    EPlayerColour turn)
+{
+	if (child->num_pieces == 2)
+		return VALUE_DRAWN;
+	EWdl wdl;
+	int plies;
+	if (!probe_pieces(gen->tables, child, turn, &wdl, &plies)) {
+		atomic_store(&gen->missing_table, true);
+		return VALUE_DRAWN;
+	}
+	return wdl == TB_DRAW ? VALUE_DRAWN : plies + 1;
+}
+
+/**
+ * Sum up the values of every legal move. Children inside the table are only
+ * trusted up to final_ply, a negative final_ply skips them altogether.
+ * Otherwise the summary stops at the first child that is not a win for the
+ * opponent.
+ */
+static void summarise_moves(Generator *gen, const TablePieces *pieces,
+			    EPlayerColour turn, int final_ply,
+			    MoveSummary *summary)
+{
+	memset(summary, 0, sizeof(MoveSummary));
+	summary->win = INT_MAX;
+
+	GenMove moves[GEN_MAX_MOVES];
+	size_t num_moves = generate_moves(pieces, turn, moves);
+	for (size_t i = 0; i < num_moves; i++) {
+		TablePieces child;
+		bool conversion;
+		if (!play_move(pieces, turn, moves[i], &child, &conversion))
+			continue;
+		summary->moves++;
+
+		int value;
+		if (conversion) {
+			value = conversion_value(gen, &child, !turn);
+		} else if (final_ply < 0) {
+			summary->unresolved = true;
+			continue;
+		} else {
+			value = atomic_load_explicit(
+				&gen->values[native_table_index(&child, !turn)],
+				memory_order_relaxed);
+		}
+
+		int plies = value - 1;
+		if (value == VALUE_UNKNOWN) {
+			summary->unresolved = true;
+		} else if (value == VALUE_DRAWN) {
+			summary->drawn = true;
+		} else if (plies % 2 == 0) {
+			if (plies + 1 < summary->win)
+				summary->win = plies + 1;
+		} else if (conversion || plies <= final_ply) {
+			if (plies + 1 > summary->loss)
+				summary->loss = plies + 1;
+		} else {
+			summary->unresolved = true;
+		}
+		// Checking for a loss, any other child settles it.
+		if (final_ply >= 0 && (summary->unresolved || summary->drawn ||
+				       summary->win != INT_MAX))
+			return;
+	}
+}
+
+/**
+ * Value before any propagation: mates, stalemates, and whatever the
+ * captures and promotions already decide.
+ */
+static int initial_value(Generator *gen, const TablePieces *pieces,
+			 EPlayerColour turn, size_t index)
+{
+	// Mirror images of stored positions are never looked up.
+	if (!is_valid(pieces, turn) ||
+	    native_table_index(pieces, turn) != index)
+		return VALUE_INVALID;
+	MoveSummary summary;
+	summarise_moves(gen, pieces, turn, -1, &summary);
+	if (summary.moves == 0)
+		return is_attacked(pieces, king_square(pieces, turn), !turn) ?
+		       1 : VALUE_DRAWN;
+	if (summary.win != INT_MAX)
+		return summary.win + 1;
+	if (summary.drawn)
+		return VALUE_DRAWN;
+	if (!summary.unresolved)
+		return summary.loss + 1;
+	return VALUE_UNKNOWN;
+}
+
+/**
+ * A predecessor of a position just resolved at ply - 1. An odd ply wins it
+ * outright, an even ply loses it if every other move is already won for
+ * the opponent.
+ */
+static int update_predecessor(Generator *gen, const TablePieces *pieces,
+			      EPlayerColour turn, int ply)
+{
+	size_t index = native_table_index(pieces, turn);
+	int value = atomic_load_explicit(&gen->values[index],
+					 memory_order_relaxed);
+	if (ply % 2) {
+		if (value == VALUE_UNKNOWN || value == VALUE_DRAWN ||
+		    (value != VALUE_INVALID && value - 1 > ply)) {
+			atomic_store_explicit(&gen->values[index], ply + 1,
+					      memory_order_relaxed);
+			return ply;
+		}
+		return 0;
+	}
+	if (value != VALUE_UNKNOWN)
+		return 0;
+	MoveSummary summary;
+	summarise_moves(gen, pieces, turn, ply - 1, &summary);
+	if (summary.moves == 0 || summary.win != INT_MAX || summary.drawn ||
+	    summary.unresolved || summary.loss > MAX_VALUE_PLIES)
+		return 0;
+	atomic_store_explicit(&gen->values[index], summary.loss + 1,
+			      memory_order_relaxed);
+	return summary.loss;
+}
+
+/**
+ * Walk every move that could have led to the position, the player who is
+ * not to move undoes a quiet move.
+ */
+static int update_predecessors(Generator *gen, const TablePieces *pieces,
+			       EPlayerColour turn, int ply)
+{
+	EPlayerColour mover = !turn;
+	uint64_t occupied = occupancy(pieces);
+	int max_ply = 0;
+	for (size_t i = 0; i < pieces->num_pieces; i++) {
+		if (pieces->colours[i] != mover)
+			continue;
+		int x = pieces->squares[i] % BOARD_SIZE;
+		int y = pieces->squares[i] / BOARD_SIZE;
+		EChessPiece type = pieces->types[i];
+
+		uint8_t origins[BOARD_SIZE * BOARD_SIZE];
+		size_t num_origins = 0;
+		if (type == PIECE_PAWN) {
+			int dir = pawn_direction(mover);
+			int back = (y - dir) * BOARD_SIZE + x;
+			int start = mover == COLOUR_WHITE ? 1 : BOARD_SIZE - 2;
+			if (y - dir != 0 && y - dir != BOARD_SIZE - 1 &&
+			    !(occupied & (1ULL << back))) {
+				origins[num_origins++] = back;
+				int jump = back - dir * BOARD_SIZE;
+				if (y - 2 * dir == start &&
+				    !(occupied & (1ULL << jump)))
+					origins[num_origins++] = jump;
+			}
+		} else {
+			const int8_t (*deltas)[2] = SLIDER_DIRECTIONS;
+			size_t first = 0;
+			size_t last = 8;
+			bool slides = true;
+			if (type == PIECE_KNIGHT || type == PIECE_KING) {
+				deltas = type == PIECE_KNIGHT ? KNIGHT_DELTAS :
+					 KING_DELTAS;
+				slides = false;
+			} else if (type == PIECE_ROOK) {
+				last = 4;
+			} else if (type == PIECE_BISHOP) {
+				first = 4;
+			}
+			for (size_t d = first; d < last; d++) {
+				int tx = x + deltas[d][0];
+				int ty = y + deltas[d][1];
+				for (; on_board(tx, ty); tx += deltas[d][0],
+				     ty += deltas[d][1]) {
+					int square = ty * BOARD_SIZE + tx;
+					if (occupied & (1ULL << square))
+						break;
+					origins[num_origins++] = square;
+					if (!slides)
+						break;
+				}
+			}
+		}
+
+		for (size_t o = 0; o < num_origins; o++) {
+			TablePieces previous = *pieces;
+			previous.squares[i] = origins[o];
+			if (!is_valid(&previous, mover))
+				continue;
+			int written = update_predecessor(gen, &previous, mover,
+							 ply);
+			if (written > max_ply)
+				max_ply = written;
+		}
+	}
+	return max_ply;
+}
+
+static void *gen_worker(void *arg)
+{
+	GenWorker *worker = arg;
+	GenJob *job = worker->job;
+	Generator *gen = job->gen;
+
+	size_t start;
+	while ((start = atomic_fetch_add(&job->next, GEN_CHUNK_SIZE)) <
+	       gen->entries) {
+		size_t end = start + GEN_CHUNK_SIZE < gen->entries ?
+			     start + GEN_CHUNK_SIZE : gen->entries;
+		for (size_t index = start; index < end; index++) {
+			TablePieces pieces = gen->material;
+			EPlayerColour turn;
+			int value;
+			if (job->ply == 0) {
+				native_table_position(index, &pieces, &turn);
+				value = initial_value(gen, &pieces, turn, index);
+				atomic_store_explicit(&gen->values[index],
+						      value,
+						      memory_order_relaxed);
+				if (value != VALUE_DRAWN &&
+				    value != VALUE_INVALID &&
+				    value - 1 > worker->max_ply)
+					worker->max_ply = value - 1;
+				continue;
+			}
+			value = atomic_load_explicit(&gen->values[index],
+						     memory_order_relaxed);
+			if (value != job->ply)
+				continue;
+			native_table_position(index, &pieces, &turn);
+			int written = update_predecessors(gen, &pieces, turn,
+							  job->ply);
+			if (written > worker->max_ply)
+				worker->max_ply = written;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Run one pass over the table across the workers, ply 0 sets up the initial
+ * values and every later ply propagates the positions resolved at ply - 1.
+ * Returns the largest distance written.
+ */
+static int run_pass(Generator *gen, GenWorker *workers, size_t threads,
+		    int ply)
+{
+	GenJob job = { .gen = gen, .ply = ply };
+	atomic_init(&job.next, 0);
+	for (size_t t = 0; t < threads; t++) {
+		workers[t].job = &job;
+		workers[t].max_ply = 0;
+		pthread_create(&workers[t].thread, NULL, gen_worker,
+			       &workers[t]);
+	}
+	int max_ply = 0;
+	for (size_t t = 0; t < threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		if (workers[t].max_ply > max_ply)
+			max_ply = workers[t].max_ply;
+	}
+	return max_ply;
+}
+
+static bool write_table(Generator *gen, const char *directory,
+			const char *filename, int max_ply)
+{
+	size_t bits = 1;
+	while ((1 << bits) - 1 < max_ply + 1)
+		bits++;
+	size_t size = NATIVE_TABLE_HEADER_SIZE +
+		      (gen->entries * bits + 7) / 8 + NATIVE_TABLE_PADDING;
+	uint8_t *buffer = calloc(size, 1);
+	if (buffer == NULL)
+		return false;
+
+	memcpy(buffer, TABLE_FORMAT_MAGIC[TABLE_FORMAT_NATIVE], 4);
+	buffer[NATIVE_TABLE_BITS_OFFSET] = bits;
+	buffer[NATIVE_TABLE_BITS_OFFSET + 1] = gen->material.num_pieces;
+	for (int i = 0; i < 8; i++)
+		buffer[NATIVE_TABLE_ENTRIES_OFFSET + i] = gen->entries >> (8 * i);
+	uint8_t *data = buffer + NATIVE_TABLE_HEADER_SIZE;
+	for (size_t index = 0; index < gen->entries; index++) {
+		unsigned value = gen->values[index];
+		if (value == VALUE_UNKNOWN || value == VALUE_DRAWN ||
+		    value == VALUE_INVALID)
+			continue;
+		size_t bit = index * bits;
+		unsigned shifted = value << (bit % 8);
+		data[bit / 8] |= shifted;
+		data[bit / 8 + 1] |= shifted >> 8;
+	}
+
+	char path[4096];
+	char temporary[4096 + 4];
+	snprintf(path, sizeof(path), "%s/%s", directory, filename);
+	snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+	FILE *output = fopen(temporary, "wb");
+	bool ok = output != NULL && fwrite(buffer, size, 1, output) == 1;
+	if (output != NULL && fclose(output) != 0)
+		ok = false;
+	free(buffer);
+	if (!ok || rename(temporary, path) != 0) {
+		ERROR_LOG("Unable to write %s\n", path);
+		remove(temporary);
+		return false;
+	}
+	return true;
+}
+
+static bool generate_table(Tablebases *tables, const TablePieces *material,
+			   const char *directory, size_t threads)
+{
+	char name[TB_NAME_LENGTH];
+	material_signature(material, COLOUR_WHITE, name);
+	char filename[TB_NAME_LENGTH + 8];
+	snprintf(filename, sizeof(filename), "%s%s", name,
+		 TABLE_FORMAT_EXTENSIONS[TABLE_FORMAT_NATIVE]);
+
+	Generator gen = {
+		.material = *material,
+		.entries = native_table_entries(material),
+		.tables = tables,
+	};
+	atomic_init(&gen.missing_table, false);
+	gen.values = calloc(gen.entries, sizeof(uint8_t));
+	GenWorker *workers = calloc(threads, sizeof(GenWorker));
+	if (gen.values == NULL || workers == NULL) {
+		ERROR_LOG("Unable to allocate %zu positions for %s\n",
+			  gen.entries, name);
+		free((void *)gen.values);
+		free(workers);
+		return false;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int max_ply = run_pass(&gen, workers, threads, 0);
+	// Every distance up to max_ply is final once its pass has run.
+	for (int ply = 1; ply <= max_ply + 1; ply++) {
+		int written = run_pass(&gen, workers, threads, ply);
+		if (written > max_ply)
+			max_ply = written;
+	}
+	free(workers);
+
+	if (atomic_load(&gen.missing_table)) {
+		ERROR_LOG("%s needs a table that was not built\n", name);
+		free((void *)gen.values);
+		return false;
+	}
+
+	size_t wins = 0;
+	size_t losses = 0;
+	size_t draws = 0;
+	int longest = 0;
+	for (size_t index = 0; index < gen.entries; index++) {
+		int value = gen.values[index];
+		if (value == VALUE_INVALID)
+			continue;
+		if (value == VALUE_UNKNOWN || value == VALUE_DRAWN) {
+			draws++;
+		} else if ((value - 1) % 2) {
+			wins++;
+			if (value - 1 > longest)
+				longest = value - 1;
+		} else {
+			losses++;
+		}
+	}
+	bool ok = write_table(&gen, directory, filename, max_ply);
+	free((void *)gen.values);
+	if (!ok || !load_table(tables, directory, filename))
+		return false;
+	INFO_LOG("%-8s %10zu wins %10zu draws %10zu losses, "
+		 "longest mate %3d plies, %.2fs\n", name, wins, draws, losses,
+		 longest, elapsed_seconds(&start));
+	return true;
+}
+
+static int side_value(const EChessPiece *pieces, size_t count)
+{
+	int value = 0;
+	for (size_t i = 0; i < count; i++)
+		value += PIECE_VALUES[pieces[i]];
+	return value;
+}
+
+static size_t count_pawns(const TablePieces *material)
+{
+	size_t pawns = 0;
+	for (size_t i = 0; i < material->num_pieces; i++)
+		pawns += material->types[i] == PIECE_PAWN;
+	return pawns;
+}
+
+/**
+ * Next combination with repetition of TABLE_PIECES, kept in signature order
+ * so each material is seen once. Returns false after the last one.
+ */
+static bool next_combination(size_t *combination, size_t count)
+{
+	for (size_t i = count; i-- > 0;) {
+		if (combination[i] + 1 < NUM_TABLE_PIECES) {
+			combination[i]++;
+			for (size_t j = i + 1; j < count; j++)
+				combination[j] = combination[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Every material with the given number of pieces, the stronger side as
+ * white.
+ */
+static size_t list_materials(size_t pieces, TablePieces *materials,
+			     size_t num_materials)
+{
+	size_t extra = pieces - 2;
+	for (size_t white = extra; white + white >= extra; white--) {
+		size_t black = extra - white;
+		size_t w[TB_GEN_MAX_PIECES] = { 0 };
+		do {
+			size_t b[TB_GEN_MAX_PIECES] = { 0 };
+			do {
+				EChessPiece ws[TB_GEN_MAX_PIECES];
+				EChessPiece bs[TB_GEN_MAX_PIECES];
+				for (size_t i = 0; i < white; i++)
+					ws[i] = TABLE_PIECES[w[i]];
+				for (size_t i = 0; i < black; i++)
+					bs[i] = TABLE_PIECES[b[i]];
+				int balance = side_value(ws, white) -
+					      side_value(bs, black);
+				if (balance < 0 ||
+				    (balance == 0 && white == black &&
+				     memcmp(w, b, sizeof(w)) > 0))
+					continue;
+
+				TablePieces *material =
+					&materials[num_materials++];
+				memset(material, 0, sizeof(TablePieces));
+				material->types[material->num_pieces] =
+					PIECE_KING;
+				material->colours[material->num_pieces++] =
+					COLOUR_WHITE;
+				for (size_t i = 0; i < white; i++) {
+					material->types[material->num_pieces] =
+						ws[i];
+					material->colours[
+						material->num_pieces++] =
+						COLOUR_WHITE;
+				}
+				material->types[material->num_pieces] =
+					PIECE_KING;
+				material->colours[material->num_pieces++] =
+					COLOUR_BLACK;
+				for (size_t i = 0; i < black; i++) {
+					material->types[material->num_pieces] =
+						bs[i];
+					material->colours[
+						material->num_pieces++] =
+						COLOUR_BLACK;
+				}
+			} while (next_combination(b, black));
+		} while (next_combination(w, white));
+		if (white == 0)
+			break;
+	}
+	return num_materials;
+}
+
+/**
+ * Build every table from three pieces up. Captures lead into tables with
+ * fewer pieces and promotions into tables with fewer pawns, so those are
+ * always built first.
+ */
+int run_tb_gen(TbGenArgs *args)
+{
+	if (args->pieces < TB_GEN_MIN_PIECES || args->pieces > TB_GEN_MAX_PIECES) {
+		ERROR_LOG("Tables can be built for %d to %d pieces\n",
+			  TB_GEN_MIN_PIECES, TB_GEN_MAX_PIECES);
+		return 0;
+	}
+	size_t threads = args->threads ? args->threads : 1;
+
+	TablePieces materials[MAX_TABLES];
+	size_t num_materials = 0;
+	for (size_t pieces = TB_GEN_MIN_PIECES; pieces <= args->pieces;
+	     pieces++) {
+		size_t first = num_materials;
+		num_materials = list_materials(pieces, materials,
+					       num_materials);
+		// Stable sort on pawn count.
+		for (size_t i = first + 1; i < num_materials; i++) {
+			TablePieces material = materials[i];
+			size_t j = i;
+			for (; j > first && count_pawns(&materials[j - 1]) >
+			     count_pawns(&material); j--)
+				materials[j] = materials[j - 1];
+			materials[j] = material;
+		}
+	}
+
+	Tablebases tables = { 0 };
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool ok = true;
+	for (size_t i = 0; i < num_materials && ok; i++)
+		ok = generate_table(&tables, &materials[i], args->directory,
+				    threads);
+	close_tablebases(&tables);
+	if (!ok) {
+		ERROR_LOG("Table generation failed\n");
+		return 0;
+	}
+	INFO_LOG("Built %zu tables in %s with %zu threads, %.2fs\n",
+		 num_materials, args->directory, threads,
+		 elapsed_seconds(&start));
+	return 1;
+}
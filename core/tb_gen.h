@@ -0,0 +1,19 @@
+#ifndef _TB_GEN_H
+#define _TB_GEN_H
+
+#include <stddef.h>
+
+#define TB_GEN_MIN_PIECES 3
+#define TB_GEN_MAX_PIECES 4
+
+typedef struct {
+	// Tables are written here and smaller ones are read back from here.
+	const char *directory;
+	// Every table up to this many pieces is built, smaller ones first.
+	size_t pieces;
+	size_t threads;
+} TbGenArgs;
+
+int run_tb_gen(TbGenArgs *args);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef _TIMING_H
+#define _TIMING_H
+
+#include <time.h>
+
+/**
+ * Seconds since start, both read from CLOCK_MONOTONIC.
+ */
+double elapsed_seconds(const struct timespec *start);
+
+#endif
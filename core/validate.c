@@ -0,0 +1,84 @@
+#include "validate.h"
+#include "fen.h"
+#include "pgn_batch.h"
+#include "timing.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+	const char *filepath;
+	// Games in the current file, they are numbered from 1 in each.
+	size_t file_games;
+	size_t games;
+	size_t illegal;
+	uint64_t moves;
+	// NULL unless the games are exported.
+	PgnWriter *writer;
+} ValidateTotals;
+
+/**
+ * One line per game: where it is, whether every move was legal, how far it
+ * got, the result and the final position.
+ */
+static bool report_game(const PgnGame *game, void *context)
+{
+	ValidateTotals *totals = context;
+	totals->file_games++;
+	totals->games++;
+	totals->moves += game->num_moves;
+	if (!game->valid)
+		totals->illegal++;
+
+	char fen[FEN_MAX_LENGTH];
+	Position end = game->end;
+	format_fen(&end, fen);
+	if (game->valid)
+		INFO_LOG("%s:%zu legal %zu plies %s %s\n", totals->filepath,
+			 totals->file_games, game->num_moves,
+			 GAME_RESULT_STRINGS[game->result], fen);
+	else
+		INFO_LOG("%s:%zu illegal at ply %zu %s %s\n",
+			 totals->filepath, totals->file_games,
+			 game->num_moves + 1,
+			 GAME_RESULT_STRINGS[game->result], fen);
+	return totals->writer == NULL ||
+	       write_pgn_game(totals->writer, game);
+}
+
+/**
+ * Replay every game of the PGN files without a display, reporting each
+ * game's legality and optionally exporting it again. Fails if a file cannot
+ * be read or any game has an illegal move, so archives can be checked from
+ * scripts.
+ */
+int run_validate(ValidateArgs *args)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	static PgnWriter writer;
+	ValidateTotals totals = { .writer = args->output ? &writer : NULL };
+	if (args->output && !open_pgn_writer(&writer, args->output))
+		return 0;
+	bool ok = true;
+	for (size_t i = 0; ok && i < args->num_inputs; i++) {
+		totals.filepath = args->inputs[i];
+		totals.file_games = 0;
+		ok = read_pgn_games(args->inputs[i], args->threads,
+				    report_game, &totals);
+	}
+	if (args->output && !close_pgn_writer(&writer)) {
+		ERROR_LOG("Unable to write %s\n", args->output);
+		ok = false;
+	}
+	double seconds = elapsed_seconds(&start);
+
+	INFO_LOG("Games: %zu (%zu illegal)\nMoves: %lu\nTime: %.3fs\n",
+		 totals.games, totals.illegal, totals.moves, seconds);
+	INFO_LOG("Games/s: %.0f\nMoves/s: %.0f\n",
+		 seconds > 0 ? totals.games / seconds : 0,
+		 seconds > 0 ? totals.moves / seconds : 0);
+	return ok && totals.illegal == 0;
+}
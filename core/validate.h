@@ -0,0 +1,17 @@
+#ifndef _VALIDATE_H
+#define _VALIDATE_H
+
+#include <stddef.h>
+
+typedef struct {
+	const char **inputs;
+	size_t num_inputs;
+	// Games are parsed on this many threads, and reported in file order.
+	size_t threads;
+	// The games are written back out here in export format, NULL for none.
+	const char *output;
+} ValidateArgs;
+
+int run_validate(ValidateArgs *args);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef _ZOBRIST_H
+#define _ZOBRIST_H
+
+#include "board.h"
+#include "players.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Key layout follows Polyglot: 12 * 64 piece keys, 4 castling keys, 8 en
+// passant file keys and one side to move key.
+#define ZOBRIST_NUM_KEYS 781
+#define ZOBRIST_CASTLE_OFFSET 768
+#define ZOBRIST_EN_PASSANT_OFFSET 772
+#define ZOBRIST_TURN_OFFSET 780
+
+extern const uint64_t ZOBRIST_KEYS[ZOBRIST_NUM_KEYS];
+
+uint64_t hash_board(Board board, EPlayerColour turn, size_t move_count);
+
+#endif
@@ -0,0 +1,93 @@
+#include "tests.h"
+#include "core/archive.h"
+#include "core/fen.h"
+#include "core/pgn.h"
+#include "core/position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+// Plies played from each test position for the move coverage games.
+#define COVERAGE_PLIES 12
+
+static bool same_game(const PgnGame *a, const PgnGame *b)
+{
+	if (a->valid != b->valid || a->result != b->result ||
+	    a->num_tags != b->num_tags || a->num_moves != b->num_moves)
+		return false;
+	for (size_t i = 0; i < a->num_tags; i++) {
+		if (strcmp(a->tags[i].name, b->tags[i].name) != 0 ||
+		    strcmp(a->tags[i].value, b->tags[i].value) != 0)
+			return false;
+	}
+	for (size_t i = 0; i < a->num_moves; i++) {
+		if (!same_move(a->moves[i], b->moves[i]))
+			return false;
+	}
+	return same_fen(&a->start, &b->start);
+}
+
+/**
+ * A game from a test position that plays the last legal move, then the
+ * first, and so on, so both ends of the stored index range are used along
+ * with the castling, en passant and promotion moves of the positions.
+ */
+static void coverage_game(const char *fen, PgnGame *game)
+{
+	memset(game, 0, sizeof(PgnGame));
+	parse_fen(fen, &game->start);
+	game->valid = true;
+	game->result = GAME_RESULT_UNKNOWN;
+	Position position = game->start;
+	for (size_t i = 0; i < COVERAGE_PLIES; i++) {
+		Move moves[MAX_LEGAL_MOVES];
+		size_t num_moves = generate_legal_moves(&position, moves);
+		if (num_moves == 0)
+			break;
+		Move move = moves[i % 2 ? 0 : num_moves - 1];
+		game->moves[game->num_moves++] = move;
+		make_move(&position, move);
+	}
+	game->end = position;
+}
+
+/**
+ * Archive the test games and a game from each test position, then read them
+ * all back by index.
+ */
+void test_archive(void)
+{
+	static PgnGame games[TEST_PGN_GAMES + NUM_TEST_FENS];
+	size_t num_games = read_test_games(games);
+	for (size_t i = 0; i < NUM_TEST_FENS; i++)
+		coverage_game(TEST_FENS[i], &games[num_games++]);
+
+	char path[TEST_PATH_SIZE];
+	scratch_path("games.cga", path);
+	ArchiveWriter writer;
+	CHECK(open_archive_writer(&writer, path),
+	      "Unable to create %s", path);
+	for (size_t i = 0; i < num_games; i++)
+		CHECK(write_archive_game(&writer, &games[i]),
+		      "Unable to archive game %zu", i + 1);
+	CHECK(close_archive_writer(&writer), "Unable to close the archive");
+
+	ArchiveReader reader;
+	CHECK(open_archive(&reader, path), "Unable to open %s",
+	      path);
+	CHECK(reader.num_games == num_games, "Archive holds %zu games of %zu",
+	      reader.num_games, num_games);
+	static PgnGame game;
+	for (size_t i = 0; i < reader.num_games && i < num_games; i++) {
+		CHECK(read_archive_game(&reader, i, &game) &&
+		      same_game(&game, &games[i]),
+		      "Archived game %zu did not read back", i + 1);
+	}
+	// Reading past the end fails instead of reading the index.
+	CHECK(!read_archive_game(&reader, num_games, &game),
+	      "Read a game past the end of the archive");
+	close_archive(&reader);
+	unlink(path);
+}
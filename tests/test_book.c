@@ -0,0 +1,198 @@
+#include "tests.h"
+#include "core/book.h"
+#include "core/fen.h"
+#include "core/position.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * The key test sequence published with the Polyglot book format, each key is
+ * for the position after the moves so far.
+ */
+static const struct {
+	const char *move;
+	uint64_t key;
+} POLYGLOT_KEYS[] = {
+	{ NULL, 0x463b96181691fc9cULL },
+	{ "e2e4", 0x823c9b50fd114196ULL },
+	{ "d7d5", 0x0756b94461c50fb0ULL },
+	{ "e4e5", 0x662fafb965db29d4ULL },
+	{ "f7f5", 0x22a48b5a8e47ff78ULL },
+	{ "e1e2", 0x652a607ca3f242c1ULL },
+	{ "e8f7", 0x00fdd303c946bdd9ULL },
+};
+
+static const struct {
+	const char *move;
+	uint64_t key;
+} POLYGLOT_EN_PASSANT_KEYS[] = {
+	{ "a2a4", 0 },
+	{ "b7b5", 0 },
+	{ "h2h4", 0 },
+	{ "b5b4", 0 },
+	{ "c2c4", 0x3c8123ea7b067637ULL },
+	{ "b4c3", 0 },
+	{ "a1a3", 0x5c3f9b829b279560ULL },
+};
+
+static bool play(Position *position, const char *coords, Move *played)
+{
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	for (size_t i = 0; i < num_moves; i++) {
+		char buffer[MOVE_COORDS_LENGTH];
+		format_move_coords(moves[i], buffer);
+		if (strcmp(buffer, coords) != 0)
+			continue;
+		if (played != NULL)
+			*played = moves[i];
+		make_move(position, moves[i]);
+		return true;
+	}
+	return false;
+}
+
+static void test_polyglot_keys(void)
+{
+	Position position;
+	new_position(&position);
+	for (size_t i = 0; i < sizeof(POLYGLOT_KEYS) / sizeof(*POLYGLOT_KEYS);
+	     i++) {
+		if (POLYGLOT_KEYS[i].move != NULL)
+			CHECK(play(&position, POLYGLOT_KEYS[i].move, NULL),
+			      "%s is illegal", POLYGLOT_KEYS[i].move);
+		CHECK(hash_position(&position) == POLYGLOT_KEYS[i].key,
+		      "Key after %s is %016llx, expected %016llx",
+		      POLYGLOT_KEYS[i].move ? POLYGLOT_KEYS[i].move : "nothing",
+		      (unsigned long long)hash_position(&position),
+		      (unsigned long long)POLYGLOT_KEYS[i].key);
+	}
+
+	// The en passant key only counts when a capture is possible.
+	new_position(&position);
+	for (size_t i = 0; i < sizeof(POLYGLOT_EN_PASSANT_KEYS) /
+	     sizeof(*POLYGLOT_EN_PASSANT_KEYS); i++) {
+		CHECK(play(&position, POLYGLOT_EN_PASSANT_KEYS[i].move, NULL),
+		      "%s is illegal", POLYGLOT_EN_PASSANT_KEYS[i].move);
+		if (POLYGLOT_EN_PASSANT_KEYS[i].key == 0)
+			continue;
+		CHECK(hash_position(&position) ==
+		      POLYGLOT_EN_PASSANT_KEYS[i].key,
+		      "Key after %s is %016llx, expected %016llx",
+		      POLYGLOT_EN_PASSANT_KEYS[i].move,
+		      (unsigned long long)hash_position(&position),
+		      (unsigned long long)POLYGLOT_EN_PASSANT_KEYS[i].key);
+	}
+}
+
+static void test_book_moves(void)
+{
+	Position position;
+	Move move;
+	CHECK(parse_fen("r3k2r/1P6/8/8/8/8/8/R3K2R w KQkq - 0 1", &position),
+	      "Invalid castling FEN");
+	// Castling is the king taking its own rook.
+	CHECK(play(&position, "e1g1", &move) &&
+	      encode_book_move(move) == (7 | 4 << 6),
+	      "Short castle encoded as %04x", encode_book_move(move));
+	CHECK(parse_fen("r3k2r/1P6/8/8/8/8/8/R3K2R w KQkq - 0 1", &position),
+	      "Invalid castling FEN");
+	CHECK(play(&position, "e1c1", &move) &&
+	      encode_book_move(move) == (0 | 4 << 6),
+	      "Long castle encoded as %04x", encode_book_move(move));
+	CHECK(parse_fen("r3k2r/1P6/8/8/8/8/8/R3K2R w KQkq - 0 1", &position),
+	      "Invalid castling FEN");
+	// b8=N, the knight is promotion 1.
+	CHECK(play(&position, "b7b8n", &move) &&
+	      encode_book_move(move) == (1 | 7 << 3 | 1 << 6 | 6 << 9 | 1 << 12),
+	      "Knight promotion encoded as %04x", encode_book_move(move));
+}
+
+static void write_entry(FILE *file, uint64_t key, uint16_t move,
+			uint16_t weight)
+{
+	uint8_t entry[BOOK_ENTRY_SIZE] = { 0 };
+	for (size_t i = 0; i < 8; i++)
+		entry[i] = key >> (56 - 8 * i);
+	entry[8] = move >> 8;
+	entry[9] = move;
+	entry[10] = weight >> 8;
+	entry[11] = weight;
+	fwrite(entry, BOOK_ENTRY_SIZE, 1, file);
+}
+
+/**
+ * A four entry book: three weighted moves from the start position, one of
+ * them illegal there, then a reply to 1. e4 under a larger key.
+ */
+static void test_book_probe(void)
+{
+	char path[TEST_PATH_SIZE];
+	scratch_path("book.bin", path);
+	FILE *file = fopen(path, "wb");
+	CHECK(file != NULL, "Unable to create %s", path);
+	if (file == NULL)
+		return;
+	// e2e4, d2d4 and e2e5, from file, row, to file, row.
+	uint16_t e2e4 = 4 | 3 << 3 | 4 << 6 | 1 << 9;
+	uint16_t d2d4 = 3 | 3 << 3 | 3 << 6 | 1 << 9;
+	uint16_t e2e5 = 4 | 4 << 3 | 4 << 6 | 1 << 9;
+	uint16_t e7e5 = 4 | 4 << 3 | 4 << 6 | 6 << 9;
+	write_entry(file, 0x463b96181691fc9cULL, e2e4, 30);
+	write_entry(file, 0x463b96181691fc9cULL, e2e5, 500);
+	write_entry(file, 0x463b96181691fc9cULL, d2d4, 10);
+	write_entry(file, 0x823c9b50fd114196ULL, e7e5, 1);
+	fclose(file);
+
+	Book book;
+	CHECK(open_book(&book, path) && book.num_entries == 4,
+	      "Unable to open the test book");
+	Position position;
+	new_position(&position);
+	Move moves[MAX_BOOK_MOVES];
+	uint16_t weights[MAX_BOOK_MOVES];
+	size_t num_moves = probe_book(&book, &position, moves, weights);
+	CHECK(num_moves == 2 && encode_book_move(moves[0]) == e2e4 &&
+	      weights[0] == 30 && encode_book_move(moves[1]) == d2d4 &&
+	      weights[1] == 10,
+	      "Start position has %zu book moves", num_moves);
+
+	// Picks follow the weights, 3 to 1.
+	size_t picked_e4 = 0;
+	for (size_t i = 0; i < 4000; i++) {
+		Move move;
+		CHECK(pick_book_move(&book, &position, &move),
+		      "No book move picked");
+		picked_e4 += encode_book_move(move) == e2e4;
+	}
+	CHECK(picked_e4 > 2700 && picked_e4 < 3300,
+	      "1. e4 picked %zu times in 4000", picked_e4);
+
+	play(&position, "e2e4", NULL);
+	num_moves = probe_book(&book, &position, moves, weights);
+	CHECK(num_moves == 1 && encode_book_move(moves[0]) == e7e5,
+	      "1. e4 has %zu book moves", num_moves);
+	play(&position, "e7e5", NULL);
+	CHECK(probe_book(&book, &position, moves, weights) == 0,
+	      "Out of book position has book moves");
+	close_book(&book);
+
+	// Not a whole number of entries.
+	file = fopen(path, "ab");
+	fputc(0, file);
+	fclose(file);
+	CHECK(!open_book(&book, path), "Opened a truncated book");
+	unlink(path);
+	CHECK(!open_book(&book, path), "Opened a missing book");
+}
+
+void test_book(void)
+{
+	test_polyglot_keys();
+	test_book_moves();
+	test_book_probe();
+}
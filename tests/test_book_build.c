@@ -0,0 +1,85 @@
+#include "tests.h"
+#include "core/book.h"
+#include "core/book_build.h"
+#include "core/position.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool build(const char *pgn, const char *output, size_t memory_mb)
+{
+	const char *inputs[] = { pgn };
+	BookBuildArgs args = {
+		.inputs = inputs,
+		.num_inputs = 1,
+		.output = output,
+		.plies = BOOK_BUILD_DEFAULT_PLIES,
+		.memory_mb = memory_mb,
+		.threads = 1,
+	};
+	return run_book_build(&args);
+}
+
+static bool same_file(const char *a, const char *b)
+{
+	FILE *file_a = fopen(a, "rb");
+	FILE *file_b = fopen(b, "rb");
+	bool same = file_a != NULL && file_b != NULL;
+	while (same) {
+		int byte = fgetc(file_a);
+		same = byte == fgetc(file_b);
+		if (byte == EOF)
+			break;
+	}
+	if (file_a)
+		fclose(file_a);
+	if (file_b)
+		fclose(file_b);
+	return same;
+}
+
+/**
+ * Build a book from the test games and check the weights, 2 per win and 1
+ * per draw or unknown result. A book built with no memory spills every
+ * record as its own run, the merge must still give the same book.
+ */
+void test_book_build(void)
+{
+	char pgn[TEST_PATH_SIZE];
+	char path[TEST_PATH_SIZE];
+	char spilled[TEST_PATH_SIZE];
+	CHECK(write_test_pgn(pgn), "Unable to write the test games");
+	scratch_path("built.bin", path);
+	scratch_path("spilled.bin", spilled);
+	CHECK(build(pgn, path, 1), "Unable to build a book");
+	CHECK(build(pgn, spilled, 0), "Unable to build a book in runs");
+	CHECK(same_file(path, spilled), "Book built in runs differs");
+
+	Book book;
+	CHECK(open_book(&book, path), "Unable to open the built book");
+	Position position;
+	new_position(&position);
+	Move moves[MAX_BOOK_MOVES];
+	uint16_t weights[MAX_BOOK_MOVES];
+	// 1. e4 drew, won and was unfinished.
+	size_t num_moves = probe_book(&book, &position, moves, weights);
+	CHECK(num_moves == 1 && weights[0] == 4,
+	      "Start position has %zu book moves", num_moves);
+	// 1... e5 drew and was unfinished, 1... a6 lost and is left out.
+	make_move(&position, moves[0]);
+	num_moves = probe_book(&book, &position, moves, weights);
+	char coords[MOVE_COORDS_LENGTH] = "";
+	if (num_moves > 0)
+		format_move_coords(moves[0], coords);
+	CHECK(num_moves == 1 && weights[0] == 2 &&
+	      strcmp(coords, "e7e5") == 0,
+	      "1. e4 has %zu book moves", num_moves);
+	close_book(&book);
+
+	unlink(pgn);
+	unlink(path);
+	unlink(spilled);
+}
@@ -0,0 +1,90 @@
+#include "tests.h"
+#include "core/archive.h"
+#include "core/dedupe.h"
+#include "core/pgn.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// The same moves five times: repeated with other players, with another
+// result, cut short by an illegal move and repeated again.
+static const char DEDUPE_PGN[] =
+	"[Event \"Test\"]\n[White \"A\"]\n[Result \"1-0\"]\n\n"
+	"1. e4 e5 1-0\n\n"
+	"[Event \"Test\"]\n[White \"C\"]\n[Result \"1-0\"]\n\n"
+	"1. e4 e5 1-0\n\n"
+	"[Event \"Test\"]\n[White \"A\"]\n[Result \"0-1\"]\n\n"
+	"1. e4 e5 0-1\n\n"
+	"[Event \"Test\"]\n[White \"A\"]\n[Result \"1-0\"]\n\n"
+	"1. e4 e5 2. Ke3 1-0\n\n"
+	"[Event \"Test\"]\n[White \"E\"]\n[Result \"1-0\"]\n\n"
+	"1. e4 e5 1-0\n";
+
+#define DEDUPE_UNIQUE 3
+
+static bool dedupe(const char *input, const char *output)
+{
+	const char *inputs[] = { input };
+	DedupeArgs args = {
+		.inputs = inputs,
+		.num_inputs = 1,
+		.output = output,
+		.memory_mb = 1,
+		.threads = 1,
+	};
+	return run_dedupe(&args);
+}
+
+/**
+ * Dedupe games with the same moves into an archive, keeping the first of
+ * each and telling apart results and games cut short. An archive deduped
+ * again loses nothing.
+ */
+void test_dedupe(void)
+{
+	char pgn[TEST_PATH_SIZE];
+	char path[TEST_PATH_SIZE];
+	char again[TEST_PATH_SIZE];
+	scratch_path("duplicates.pgn", pgn);
+	scratch_path("unique.cga", path);
+	scratch_path("again.cga", again);
+	FILE *file = fopen(pgn, "w");
+	CHECK(file != NULL && fputs(DEDUPE_PGN, file) >= 0 &&
+	      fclose(file) == 0, "Unable to write %s", pgn);
+	CHECK(dedupe(pgn, path), "Unable to dedupe %s", pgn);
+	CHECK(dedupe(path, again), "Unable to dedupe %s", path);
+
+	ArchiveReader reader;
+	bool opened = open_archive(&reader, path);
+	CHECK(opened && reader.num_games == DEDUPE_UNIQUE,
+	      "Deduped to %zu games, not %d", opened ? reader.num_games : 0,
+	      DEDUPE_UNIQUE);
+	static const EGameResult results[DEDUPE_UNIQUE] = {
+		GAME_RESULT_WHITE_WIN, GAME_RESULT_BLACK_WIN,
+		GAME_RESULT_WHITE_WIN,
+	};
+	for (size_t i = 0; opened && i < reader.num_games &&
+	     i < DEDUPE_UNIQUE; i++) {
+		PgnGame game;
+		const char *white = NULL;
+		bool read = read_archive_game(&reader, i, &game);
+		if (read)
+			white = get_pgn_tag(&game, "White");
+		CHECK(read && white != NULL && strcmp(white, "A") == 0 &&
+		      game.result == results[i] && game.num_moves == 2,
+		      "Game %zu kept is not the first of its kind", i + 1);
+	}
+	if (opened)
+		close_archive(&reader);
+
+	opened = open_archive(&reader, again);
+	CHECK(opened && reader.num_games == DEDUPE_UNIQUE,
+	      "Deduped archive lost games");
+	if (opened)
+		close_archive(&reader);
+	unlink(pgn);
+	unlink(path);
+	unlink(again);
+}
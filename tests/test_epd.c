@@ -0,0 +1,100 @@
+#include "tests.h"
+#include "core/epd.h"
+#include "core/fen.h"
+#include "core/position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SCHOLAR "r1bqkbnr/pppp1ppp/2n5/4p3/2B1P3/5Q2/PPPP1PPP/RNB1K1NR w KQkq -"
+
+static inline int square(const char *name)
+{
+	return (name[1] - '1') * BOARD_SIZE + name[0] - 'a';
+}
+
+static const struct {
+	const char *line;
+	bool valid;
+	const char *id;
+	size_t num_best;
+	size_t num_avoid;
+	// Origin and target of the first best move, if any.
+	const char *best;
+} EPD_CASES[] = {
+	{ SCHOLAR " bm Qxf7#; id \"scholar\";", true, "scholar", 1, 0,
+	  "f3f7" },
+	// A full FEN's counters, a semicolon in a quoted id and an unknown
+	// operation.
+	{ SCHOLAR " 0 1 c0 \"mate\"; id \"a;b\"; bm Qxf7#;", true, "a;b", 1,
+	  0, "f3f7" },
+	{ SCHOLAR " am Qh5 Qg4; bm Qxf7# Bxf7+;", true, "", 2, 2, "f3f7" },
+	{ SCHOLAR " id \"none\";", true, "none", 0, 0, NULL },
+	{ SCHOLAR " bm Qxa8;", false, NULL, 0, 0, NULL },
+	{ SCHOLAR " am Ke3;", false, NULL, 0, 0, NULL },
+	{ "r1bqkbnr/pppp1ppp/2n5/4p3/2B1P3/5Q2/PPPP1PPP w KQkq - bm Qxf7#;",
+	  false, NULL, 0, 0, NULL },
+};
+
+static void test_parse(void)
+{
+	Position scholar;
+	parse_fen(SCHOLAR " 0 1", &scholar);
+	for (size_t i = 0; i < sizeof(EPD_CASES) / sizeof(*EPD_CASES); i++) {
+		EpdRecord record;
+		bool valid = parse_epd(EPD_CASES[i].line, &record);
+		CHECK(valid == EPD_CASES[i].valid, "EPD \"%s\" parsed as %d",
+		      EPD_CASES[i].line, valid);
+		if (!valid || !EPD_CASES[i].valid)
+			continue;
+		CHECK(strcmp(record.id, EPD_CASES[i].id) == 0 &&
+		      record.num_best == EPD_CASES[i].num_best &&
+		      record.num_avoid == EPD_CASES[i].num_avoid,
+		      "EPD \"%s\" read as id \"%s\" with %zu best and %zu "
+		      "avoided moves", EPD_CASES[i].line, record.id,
+		      record.num_best, record.num_avoid);
+		CHECK(EPD_CASES[i].best == NULL || (record.num_best > 0 &&
+		      record.best[0].origin == square(EPD_CASES[i].best) &&
+		      record.best[0].target == square(EPD_CASES[i].best + 2)),
+		      "EPD \"%s\" has the wrong best move", EPD_CASES[i].line);
+		Position position = record.position;
+		CHECK(same_fen(&position, &scholar),
+		      "EPD \"%s\" has the wrong position", EPD_CASES[i].line);
+	}
+
+	char line[256];
+	char id[EPD_MAX_ID_LENGTH + 16];
+	memset(id, 'x', sizeof(id) - 1);
+	id[sizeof(id) - 1] = '\0';
+	snprintf(line, sizeof(line), SCHOLAR " id \"%s\";", id);
+	EpdRecord record;
+	CHECK(parse_epd(line, &record) &&
+	      strlen(record.id) == EPD_MAX_ID_LENGTH - 1,
+	      "Long id not cut to %d characters", EPD_MAX_ID_LENGTH - 1);
+}
+
+/**
+ * Parse EPD records, then run a small suite with comments, blank lines and
+ * a bad record that is skipped.
+ */
+void test_epd(void)
+{
+	test_parse();
+
+	char path[TEST_PATH_SIZE];
+	scratch_path("suite.epd", path);
+	FILE *file = fopen(path, "w");
+	CHECK(file != NULL && fputs("# Mates in one\n\n"
+				    SCHOLAR " bm Qxf7#; id \"scholar\";\n"
+				    "6k1/5ppp/8/8/8/8/8/R5K1 w - - bm Ra8#;\n"
+				    SCHOLAR " bm Qxa8;\n", file) >= 0 &&
+	      fclose(file) == 0, "Unable to write %s", path);
+	EpdArgs args = { .input = path, .depth = 2, .threads = 2 };
+	CHECK(run_epd(&args), "Unable to run %s", path);
+
+	unlink(path);
+	CHECK(!run_epd(&args), "Ran a missing suite");
+}
@@ -0,0 +1,76 @@
+#include "tests.h"
+#include "core/fen.h"
+#include "core/input.h"
+#include "core/position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *INVALID_FEN_CASES[] = {
+	"",
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1",
+	"rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP w KQkq - 0 1",
+	// Kings missing or doubled, pawns on the back ranks.
+	"8/8/8/8/8/8/8/4K3 w - - 0 1",
+	"4k3/8/8/8/8/8/8/3KK3 w - - 0 1",
+	"P3k3/8/8/8/8/8/8/4K3 w - - 0 1",
+	"4k3/8/8/8/8/8/8/p3K3 b - - 0 1",
+};
+
+// Save and load take a file name, and must not swallow the promotion
+// answers that sort after them.
+static const struct {
+	const char *input;
+	EOperationMode mode;
+	ECommand command;
+} COMMAND_CASES[] = {
+	{ "save", OPERATION_SELECT, COMMAND_SAVE },
+	{ "save game.fen", OPERATION_SELECT, COMMAND_SAVE },
+	{ "load game.fen", OPERATION_MOVE, COMMAND_LOAD },
+	{ "saved", OPERATION_SELECT, COMMAND_INVALID },
+	{ "q", OPERATION_PROMOTION, COMMAND_PROMOTION },
+	{ "n", OPERATION_PROMOTION, COMMAND_PROMOTION },
+	{ "r", OPERATION_PROMOTION, COMMAND_PROMOTION },
+	{ "n", OPERATION_QUESTION, COMMAND_ANSWER },
+	{ "e2", OPERATION_SELECT, COMMAND_SELECT },
+};
+
+static void test_parsing(void)
+{
+	for (size_t i = 0; i < NUM_TEST_FENS; i++) {
+		Position position;
+		char fen[FEN_MAX_LENGTH];
+		CHECK(parse_fen(TEST_FENS[i], &position), "Invalid FEN %s",
+		      TEST_FENS[i]);
+		format_fen(&position, fen);
+		CHECK(strcmp(fen, TEST_FENS[i]) == 0, "FEN %s written as %s",
+		      TEST_FENS[i], fen);
+	}
+	for (size_t i = 0;
+	     i < sizeof(INVALID_FEN_CASES) / sizeof(*INVALID_FEN_CASES); i++) {
+		Position position;
+		CHECK(!parse_fen(INVALID_FEN_CASES[i], &position),
+		      "Accepted FEN \"%s\"", INVALID_FEN_CASES[i]);
+	}
+}
+
+/**
+ * Write back the test FENs, reject malformed ones and parse the save and
+ * load commands.
+ */
+void test_fen(void)
+{
+	test_parsing();
+	for (size_t i = 0; i < sizeof(COMMAND_CASES) / sizeof(*COMMAND_CASES);
+	     i++) {
+		char input[INPUT_BUFFER_SIZE];
+		snprintf(input, sizeof(input), "%s", COMMAND_CASES[i].input);
+		ECommand command = parse_input(input, COMMAND_CASES[i].mode);
+		CHECK(command == COMMAND_CASES[i].command,
+		      "\"%s\" parsed as %s", COMMAND_CASES[i].input,
+		      COMMAND_STRINGS[command]);
+	}
+}
@@ -0,0 +1,117 @@
+#include "tests.h"
+#include "core/fen.h"
+#include "core/history.h"
+#include "core/position.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * Play a move given in coordinates, e.g. "g1f3", and record the position
+ * reached the way the game does.
+ */
+static bool play(Position *position, PositionHistory *history,
+		 const char *coords)
+{
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	for (size_t i = 0; i < num_moves; i++) {
+		char buffer[MOVE_COORDS_LENGTH];
+		format_move_coords(moves[i], buffer);
+		if (strcmp(buffer, coords) != 0)
+			continue;
+		bool irreversible =
+			position->board[moves[i].origin].type == PIECE_PAWN ||
+			position->board[moves[i].target].type != PIECE_NONE;
+		make_move(position, moves[i]);
+		push_position(history, hash_position(position), irreversible);
+		return true;
+	}
+	return false;
+}
+
+static void test_repetition(void)
+{
+	static const char *SHUFFLE[] = { "g1f3", "g8f6", "f3g1", "f6g8" };
+	Position position;
+	PositionHistory history;
+	new_position(&position);
+	start_position_history(&history, hash_position(&position), 0);
+
+	for (size_t i = 0; i < 4; i++)
+		CHECK(play(&position, &history, SHUFFLE[i]), "%s is illegal",
+		      SHUFFLE[i]);
+	CHECK(count_repetitions(&history) == 2 && is_repetition(&history) &&
+	      !is_threefold_repetition(&history),
+	      "Start position seen twice counted %zu times",
+	      count_repetitions(&history));
+	for (size_t i = 0; i < 4; i++)
+		play(&position, &history, SHUFFLE[i]);
+	CHECK(is_threefold_repetition(&history),
+	      "Start position seen three times counted %zu times",
+	      count_repetitions(&history));
+
+	// A pawn move cuts the history, the same shuffle starts counting over.
+	play(&position, &history, "e2e4");
+	CHECK(get_halfmove_clock(&history) == 0 && !is_repetition(&history),
+	      "Pawn move did not reset the history");
+	play(&position, &history, "e7e5");
+	for (size_t i = 0; i < 4; i++)
+		play(&position, &history, SHUFFLE[i]);
+	CHECK(count_repetitions(&history) == 2,
+	      "Repetitions after a pawn move counted %zu times",
+	      count_repetitions(&history));
+}
+
+static void test_fifty_moves(void)
+{
+	Position position;
+	PositionHistory history;
+	CHECK(parse_fen("4k3/8/8/8/8/8/4P3/R3K3 w - - 97 80", &position),
+	      "Invalid fifty move FEN");
+	start_position_history(&history, hash_position(&position),
+			       position.halfmove_clock);
+	play(&position, &history, "a1a2");
+	play(&position, &history, "e8d8");
+	CHECK(get_halfmove_clock(&history) == 99 &&
+	      !is_fifty_move_draw(&history),
+	      "Drawn with the clock at %zu", get_halfmove_clock(&history));
+	play(&position, &history, "a2a1");
+	CHECK(is_fifty_move_draw(&history),
+	      "Not drawn with the clock at %zu", get_halfmove_clock(&history));
+	pop_position(&history);
+	CHECK(!is_fifty_move_draw(&history), "Draw not taken back with the move");
+	push_position(&history, hash_position(&position), false);
+
+	// A pawn move resets the clock however long it has run.
+	play(&position, &history, "d8c8");
+	play(&position, &history, "e2e4");
+	CHECK(get_halfmove_clock(&history) == 0 &&
+	      !is_fifty_move_draw(&history), "Pawn move did not reset the clock");
+}
+
+/**
+ * Long games wrap the ring, repetitions are still found among the latest
+ * positions and nothing older is compared.
+ */
+static void test_history_ring(void)
+{
+	PositionHistory history;
+	start_position_history(&history, 1, 0);
+	for (size_t i = 0; i < 3 * POSITION_HISTORY_SIZE; i++)
+		push_position(&history, i % 7 == 0 ? 42 : 1000 + i, i % 7 == 0);
+	push_position(&history, 5, true);
+	push_position(&history, 42, false);
+	push_position(&history, 7, false);
+	push_position(&history, 42, false);
+	CHECK(count_repetitions(&history) == 2,
+	      "Repetition after wrapping counted %zu times",
+	      count_repetitions(&history));
+}
+
+void test_history(void)
+{
+	test_repetition();
+	test_fifty_moves();
+	test_history_ring();
+}
@@ -0,0 +1,122 @@
+#include "tests.h"
+#include "core/game.h"
+#include "core/history.h"
+#include "core/journal.h"
+#include "core/position.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+static bool game_at(ChessGame *game, const Position *expected)
+{
+	Position position;
+	get_game_position(game, &position);
+	return same_fen(&position, expected);
+}
+
+/**
+ * The legal move between two squares.
+ */
+static Move find_move(Position *position, int origin, int target)
+{
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	for (size_t i = 0; i < num_moves; i++) {
+		if (moves[i].origin == origin && moves[i].target == target)
+			return moves[i];
+	}
+	return moves[0];
+}
+
+/**
+ * Knights out and back twice brings the start round a third time. A journal
+ * restarted there must still know the two before.
+ */
+static void test_restart_history(const char *path)
+{
+	static const int squares[][2] = {
+		{ 6, 21 }, { 62, 45 }, { 21, 6 }, { 45, 62 },
+		{ 6, 21 }, { 62, 45 }, { 21, 6 }, { 45, 62 },
+	};
+	static ChessGame game;
+	static ChessGame restarted;
+	static MoveJournal journal;
+	init_chess_game(&game);
+	Position position;
+	get_game_position(&game, &position);
+	CHECK(open_journal(&journal, path, &game, 0, 0),
+	      "Unable to create %s", path);
+	for (size_t i = 0; i < sizeof(squares) / sizeof(*squares); i++) {
+		Move move = find_move(&position, squares[i][0], squares[i][1]);
+		CHECK(append_journal_move(&journal, move),
+		      "Unable to journal move %zu", i + 1);
+		make_move(&position, move);
+	}
+	CHECK(close_journal(&journal), "Unable to close the journal");
+
+	init_chess_game(&game);
+	CHECK(open_journal(&journal, path, &game, 0, 0) &&
+	      is_threefold_repetition(&game.history),
+	      "Recovered game is not a threefold repetition");
+	CHECK(restart_journal(&journal, &game), "Unable to restart journal");
+	CHECK(close_journal(&journal), "Unable to close the journal");
+	init_chess_game(&restarted);
+	CHECK(open_journal(&journal, path, &restarted, 0, 0) &&
+	      is_threefold_repetition(&restarted.history),
+	      "Restarted journal lost the repetitions");
+	close_journal(&journal);
+	unlink(path);
+}
+
+/**
+ * Journal a game's moves, then recover it into a fresh game. A torn record
+ * at the end is dropped, and restarting leaves an empty journal that still
+ * holds the positions a repetition can reach.
+ */
+void test_journal(void)
+{
+	PgnGame games[TEST_PGN_GAMES];
+	if (read_test_games(games) == 0)
+		return;
+	const PgnGame *pgn = &games[0];
+	char path[TEST_PATH_SIZE];
+	scratch_path("game.cgj", path);
+	static ChessGame game;
+	static MoveJournal journal;
+	init_chess_game(&game);
+	CHECK(open_journal(&journal, path, &game, 0, 0),
+	      "Unable to create %s", path);
+	for (size_t i = 0; i < pgn->num_moves; i++)
+		CHECK(append_journal_move(&journal, pgn->moves[i]),
+		      "Unable to journal move %zu", i + 1);
+	// Half a record, as if the process died mid-write.
+	static const uint8_t torn[JOURNAL_RECORD_SIZE / 2] = { 1, 2, 3 };
+	CHECK(write(journal.fd, torn, sizeof(torn)) == sizeof(torn),
+	      "Unable to tear the journal");
+	CHECK(close_journal(&journal), "Unable to close the journal");
+
+	init_chess_game(&game);
+	CHECK(open_journal(&journal, path, &game, 0, 0),
+	      "Unable to reopen %s", path);
+	CHECK(journal.num_moves == pgn->num_moves,
+	      "Recovered %zu moves of %zu", journal.num_moves, pgn->num_moves);
+	CHECK(game_at(&game, &pgn->end),
+	      "Recovered game is not at the journaled position");
+	// A fresh game's header holds the one hash of its start.
+	CHECK(lseek(journal.fd, 0, SEEK_END) ==
+	      JOURNAL_HEADER_SIZE + 8 + JOURNAL_RECORD_SIZE * pgn->num_moves,
+	      "Torn record was not cut off");
+
+	CHECK(restart_journal(&journal, &game), "Unable to restart journal");
+	CHECK(close_journal(&journal), "Unable to close the journal");
+	static ChessGame restarted;
+	init_chess_game(&restarted);
+	CHECK(open_journal(&journal, path, &restarted, 0, 0) &&
+	      journal.num_moves == 0 && game_at(&restarted, &pgn->end),
+	      "Restarted journal did not start from the game's position");
+	close_journal(&journal);
+	unlink(path);
+
+	test_restart_history(path);
+}
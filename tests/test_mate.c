@@ -0,0 +1,78 @@
+#include "tests.h"
+#include "core/fen.h"
+#include "core/mate.h"
+#include "core/position.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define TEST_HASH_MB 16
+
+static const struct {
+	const char *fen;
+	size_t max_moves;
+	// 0 if there is no mate within max_moves.
+	size_t moves;
+} MATE_CASES[] = {
+	{ "4k3/8/4K3/8/8/8/8/Q7 w - - 0 1", 4, 1 },
+	{ "6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1", 4, 1 },
+	{ "k7/8/2K5/8/8/8/8/7R w - - 0 1", 4, 2 },
+	// Legal's mate, the knight check draws the pawn away from f6.
+	{ "r2qkb1r/pp2nppp/3p4/2pNN1B1/2BnP3/3P4/PPP2PPP/R2bK2R w KQkq - 1 1",
+	  4, 2 },
+	{ "r2qkb1r/pp2nppp/3p4/2pNN1B1/2BnP3/3P4/PPP2PPP/R2bK2R w KQkq - 1 1",
+	  1, 0 },
+	{ "r1b2k1r/ppppq3/5N1p/4P2Q/4PP2/1B6/PP5P/n2K2R1 w - - 1 1", 4, 2 },
+	// Bare kings and a stalemate.
+	{ "4k3/8/8/8/8/8/8/4K3 w - - 0 1", 3, 0 },
+	{ "k7/2Q5/1K6/8/8/8/8/8 b - - 0 1", 3, 0 },
+};
+
+/**
+ * Play the line out: every move must be legal and the last one mate.
+ */
+static bool ends_in_mate(Position *position, const MateResult *result)
+{
+	for (size_t i = 0; i < result->length; i++) {
+		Move moves[MAX_LEGAL_MOVES];
+		size_t num_moves = generate_legal_moves(position, moves);
+		bool legal = false;
+		for (size_t j = 0; j < num_moves && !legal; j++)
+			legal = same_move(moves[j], result->line[i]);
+		if (!legal)
+			return false;
+		make_move(position, result->line[i]);
+	}
+	Move moves[MAX_LEGAL_MOVES];
+	return is_in_check(position) &&
+	       generate_legal_moves(position, moves) == 0;
+}
+
+/**
+ * The solver must find the shortest mate, or none past the move limit, and
+ * give a line of that length ending in mate.
+ */
+void test_mate(void)
+{
+	for (size_t i = 0; i < sizeof(MATE_CASES) / sizeof(*MATE_CASES); i++) {
+		Position position;
+		MateResult result;
+		CHECK(parse_fen(MATE_CASES[i].fen, &position),
+		      "Invalid FEN %s", MATE_CASES[i].fen);
+		CHECK(solve_mate(&position, MATE_CASES[i].max_moves,
+				 TEST_HASH_MB, &result),
+		      "Unable to solve %s", MATE_CASES[i].fen);
+		CHECK(result.moves == MATE_CASES[i].moves,
+		      "%s is mate in %zu, expected %zu", MATE_CASES[i].fen,
+		      result.moves, MATE_CASES[i].moves);
+		if (MATE_CASES[i].moves == 0) {
+			CHECK(result.length == 0, "%s has a %zu move line",
+			      MATE_CASES[i].fen, result.length);
+			continue;
+		}
+		CHECK(result.length == 2 * result.moves - 1 &&
+		      ends_in_mate(&position, &result),
+		      "%s line does not mate", MATE_CASES[i].fen);
+	}
+}
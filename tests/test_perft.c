@@ -0,0 +1,53 @@
+#include "tests.h"
+#include "core/fen.h"
+#include "core/perft.h"
+#include "core/position.h"
+
+#include <stdint.h>
+
+/**
+ * The usual perft test positions with their published node counts, kept to
+ * depths that run in well under a second.
+ */
+static const struct {
+	const char *fen;
+	size_t depth;
+	uint64_t nodes;
+} PERFT_CASES[] = {
+	{ STARTING_FEN, 1, 20 },
+	{ STARTING_FEN, 2, 400 },
+	{ STARTING_FEN, 3, 8902 },
+	{ STARTING_FEN, 4, 197281 },
+	// Kiwipete.
+	{ "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+	  1, 48 },
+	{ "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+	  2, 2039 },
+	{ "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+	  3, 97862 },
+	{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 1, 14 },
+	{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 3, 2812 },
+	{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 4, 43238 },
+	{ "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+	  1, 6 },
+	{ "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+	  3, 9467 },
+	{ "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 1, 44 },
+	{ "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 3, 62379 },
+};
+
+void test_perft(void)
+{
+	for (size_t i = 0; i < sizeof(PERFT_CASES) / sizeof(*PERFT_CASES);
+	     i++) {
+		Position position;
+		CHECK(parse_fen(PERFT_CASES[i].fen, &position), "Invalid FEN %s",
+		      PERFT_CASES[i].fen);
+		uint64_t nodes = perft(&position, PERFT_CASES[i].depth);
+		CHECK(nodes == PERFT_CASES[i].nodes,
+		      "perft %zu of %s: %llu, expected %llu",
+		      PERFT_CASES[i].depth, PERFT_CASES[i].fen,
+		      (unsigned long long)nodes,
+		      (unsigned long long)PERFT_CASES[i].nodes);
+	}
+}
@@ -0,0 +1,72 @@
+#include "tests.h"
+#include "core/pgn.h"
+#include "core/pgn_batch.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Enough copies of the test games for several batches.
+#define BATCH_TEST_COPIES (3 * PGN_BATCH_GAMES / TEST_PGN_GAMES)
+#define BATCH_TEST_GAMES (BATCH_TEST_COPIES * TEST_PGN_GAMES)
+
+typedef struct {
+	size_t offsets[BATCH_TEST_GAMES];
+	size_t moves[BATCH_TEST_GAMES];
+	size_t num_games;
+} BatchRecord;
+
+static bool record_game(const PgnGame *game, void *context)
+{
+	BatchRecord *record = context;
+	if (record->num_games == BATCH_TEST_GAMES)
+		return false;
+	record->offsets[record->num_games] = game->offset;
+	record->moves[record->num_games++] = game->num_moves;
+	return true;
+}
+
+/**
+ * Games read in parallel batches must come out in file order with the same
+ * offsets into the file as games read one by one.
+ */
+void test_pgn_batch(void)
+{
+	char path[TEST_PATH_SIZE];
+	scratch_path("batches.pgn", path);
+	FILE *file = fopen(path, "w");
+	CHECK(file != NULL, "Unable to create %s", path);
+	if (file == NULL)
+		return;
+	size_t length = strlen(TEST_PGN);
+	for (size_t i = 0; i < BATCH_TEST_COPIES; i++)
+		fprintf(file, "%s\n", TEST_PGN);
+	fclose(file);
+
+	static BatchRecord serial;
+	static BatchRecord parallel;
+	memset(&serial, 0, sizeof(serial));
+	memset(&parallel, 0, sizeof(parallel));
+	CHECK(read_pgn_games(path, 1, record_game, &serial) &&
+	      read_pgn_games(path, 4, record_game, &parallel),
+	      "Unable to read %s", path);
+	CHECK(serial.num_games == BATCH_TEST_GAMES &&
+	      parallel.num_games == BATCH_TEST_GAMES,
+	      "Read %zu and %zu games of %d", serial.num_games,
+	      parallel.num_games, BATCH_TEST_GAMES);
+	size_t mismatches = 0;
+	for (size_t i = 0; i < parallel.num_games; i++) {
+		mismatches += parallel.offsets[i] != serial.offsets[i] ||
+			      parallel.moves[i] != serial.moves[i];
+	}
+	CHECK(mismatches == 0, "%zu games read in batches differ",
+	      mismatches);
+	// Each copy of the test games starts one copy further on.
+	CHECK(parallel.offsets[TEST_PGN_GAMES] == length + 1 &&
+	      parallel.offsets[BATCH_TEST_GAMES - TEST_PGN_GAMES] ==
+	      (BATCH_TEST_COPIES - 1) * (length + 1),
+	      "Batched game offsets are not file offsets");
+	unlink(path);
+}
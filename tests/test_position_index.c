@@ -0,0 +1,102 @@
+#include "tests.h"
+#include "core/position.h"
+#include "core/position_index.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static bool build(const char *pgn, const char *output, size_t memory_mb)
+{
+	const char *inputs[] = { pgn };
+	IndexArgs args = {
+		.inputs = inputs,
+		.num_inputs = 1,
+		.output = output,
+		.memory_mb = memory_mb,
+		.threads = 1,
+	};
+	return run_index(&args);
+}
+
+/**
+ * Whether the game is listed for the position, first reaching it no later
+ * than ply.
+ */
+static bool has_game(const PositionIndex *index, Position *position,
+		     uint32_t game, uint32_t ply)
+{
+	size_t first;
+	size_t count = find_position(index, hash_position(position), &first);
+	for (size_t i = first; i < first + count; i++) {
+		IndexEntry entry = read_index_entry(index, i);
+		if (entry.game == game)
+			return entry.ply <= ply;
+	}
+	return false;
+}
+
+/**
+ * Index the test games with no memory, spilling a run per game, and with
+ * plenty. The merges must give the same sorted table, listing every
+ * position of every game once.
+ */
+void test_position_index(void)
+{
+	char pgn[TEST_PATH_SIZE];
+	char path[TEST_PATH_SIZE];
+	char spilled[TEST_PATH_SIZE];
+	CHECK(write_test_pgn(pgn), "Unable to write the test games");
+	scratch_path("games.cpi", path);
+	scratch_path("spilled.cpi", spilled);
+	CHECK(build(pgn, path, 1), "Unable to build an index");
+	CHECK(build(pgn, spilled, 0), "Unable to build an index in runs");
+
+	PositionIndex index;
+	PositionIndex runs;
+	bool opened = open_position_index(&index, path) &&
+		      open_position_index(&runs, spilled);
+	CHECK(opened, "Unable to open the indexes");
+	if (!opened)
+		return;
+	CHECK(index.num_games == TEST_PGN_GAMES &&
+	      runs.num_entries == index.num_entries,
+	      "Index of %zu games has %zu entries, %zu in runs",
+	      index.num_games, index.num_entries, runs.num_entries);
+	size_t unsorted = 0;
+	size_t different = 0;
+	for (size_t i = 0; i < index.num_entries; i++) {
+		IndexEntry entry = read_index_entry(&index, i);
+		IndexEntry other = read_index_entry(&runs, i);
+		different += entry.key != other.key ||
+			     entry.game != other.game || entry.ply != other.ply;
+		if (i == 0)
+			continue;
+		IndexEntry previous = read_index_entry(&index, i - 1);
+		unsorted += previous.key > entry.key ||
+			    (previous.key == entry.key &&
+			     previous.game >= entry.game);
+	}
+	CHECK(unsorted == 0 && different == 0,
+	      "%zu entries out of order, %zu differ in runs", unsorted,
+	      different);
+
+	PgnGame games[TEST_PGN_GAMES];
+	size_t num_games = read_test_games(games);
+	for (size_t i = 0; i < num_games; i++) {
+		Position position = games[i].start;
+		size_t missing = 0;
+		for (size_t ply = 0; ply <= games[i].num_moves; ply++) {
+			missing += !has_game(&index, &position, i + 1, ply);
+			if (ply < games[i].num_moves)
+				make_move(&position, games[i].moves[ply]);
+		}
+		CHECK(missing == 0, "Game %zu missing at %zu positions", i + 1,
+		      missing);
+	}
+	close_position_index(&index);
+	close_position_index(&runs);
+	unlink(path);
+	unlink(spilled);
+}
@@ -0,0 +1,87 @@
+#include "tests.h"
+#include "core/fen.h"
+#include "core/position.h"
+#include "core/san.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+static const struct {
+	const char *fen;
+	const char *coords;
+	const char *san;
+} SAN_CASES[] = {
+	{ "4k3/8/4K3/8/8/8/8/Q7 w - - 0 1", "a1a8", "Qa8#" },
+	{ "4k3/8/4K3/8/8/8/8/Q7 w - - 0 1", "a1a4", "Qa4+" },
+	{ "4k3/8/4K3/8/8/8/8/Q7 w - - 0 1", "a1a2", "Qa2" },
+	// Castling and promotion with check, a discovered check.
+	{ "5k2/8/8/8/8/8/8/4K2R w K - 0 1", "e1g1", "O-O+" },
+	{ "8/1P6/8/8/8/8/8/k3K3 w - - 0 1", "b7b8q", "b8=Q" },
+	{ "k7/1P6/8/8/8/8/8/4K3 w - - 0 1", "b7b8q", "b8=Q+" },
+	{ "4k3/8/8/8/8/8/4N3/4RK2 w - - 0 1", "e2c3", "Nc3+" },
+};
+
+static bool ends_with(const char *text, size_t length, char last)
+{
+	return length > 0 && text[length - 1] == last;
+}
+
+/**
+ * Every legal move written as SAN must read back as the same move, and end
+ * in # when it mates or + when it only checks, two plies deep from each
+ * test position.
+ */
+static void test_san_moves(Position *position, size_t depth)
+{
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	for (size_t i = 0; i < num_moves; i++) {
+		char san[SAN_MAX_LENGTH];
+		size_t length = move_to_san(position, moves[i], san);
+		SanData data = EMPTY_SAN_DATA;
+		Move move;
+		bool parsed = parse_san(san, length, position->turn, &data) &&
+			      resolve_san(position, &data, &move);
+		CHECK(parsed && same_move(move, moves[i]),
+		      "SAN %s did not read back", san);
+
+		Position child = *position;
+		make_move(&child, moves[i]);
+		Move replies[MAX_LEGAL_MOVES];
+		bool check = is_in_check(&child);
+		bool mate = check && generate_legal_moves(&child, replies) == 0;
+		CHECK(ends_with(san, length, '#') == mate &&
+		      ends_with(san, length, '+') == (check && !mate),
+		      "SAN %s has the wrong check mark", san);
+		if (depth > 1)
+			test_san_moves(&child, depth - 1);
+	}
+}
+
+void test_san(void)
+{
+	for (size_t i = 0; i < NUM_TEST_FENS; i++) {
+		Position position;
+		if (parse_fen(TEST_FENS[i], &position))
+			test_san_moves(&position, 2);
+	}
+
+	for (size_t i = 0; i < sizeof(SAN_CASES) / sizeof(*SAN_CASES); i++) {
+		Position position;
+		parse_fen(SAN_CASES[i].fen, &position);
+		Move moves[MAX_LEGAL_MOVES];
+		size_t num_moves = generate_legal_moves(&position, moves);
+		char san[SAN_MAX_LENGTH] = "";
+		for (size_t j = 0; j < num_moves; j++) {
+			char coords[MOVE_COORDS_LENGTH];
+			format_move_coords(moves[j], coords);
+			if (strcmp(coords, SAN_CASES[i].coords) == 0)
+				move_to_san(&position, moves[j], san);
+		}
+		CHECK(strcmp(san, SAN_CASES[i].san) == 0,
+		      "%s in %s written as %s, expected %s",
+		      SAN_CASES[i].coords, SAN_CASES[i].fen, san,
+		      SAN_CASES[i].san);
+	}
+}
@@ -0,0 +1,142 @@
+#include "tests.h"
+#include "core/binary.h"
+#include "core/game.h"
+#include "core/history.h"
+#include "core/input.h"
+#include "core/position.h"
+#include "core/serialization.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Play a game's moves into a fresh game, as the board would.
+ */
+static void play_game(ChessGame *game, const PgnGame *pgn)
+{
+	Position position = pgn->start;
+	set_game_position(game, &position);
+	for (size_t i = 0; i < pgn->num_moves; i++) {
+		Move move = pgn->moves[i];
+		bool irreversible =
+			position.board[move.origin].type == PIECE_PAWN ||
+			position.board[move.target].type != PIECE_NONE;
+		make_move(&position, move);
+		push_position(&game->history, hash_position(&position),
+			      irreversible);
+		record_game_move(game, move);
+	}
+	memcpy(game->board, position.board, sizeof(Board));
+	set_board(game->board, game->next_board);
+	game->turn = position.turn;
+	game->move_count = position.move_count;
+	game->player = position.turn;
+}
+
+static bool same_game(ChessGame *a, ChessGame *b)
+{
+	Position position_a;
+	Position position_b;
+	get_game_position(a, &position_a);
+	get_game_position(b, &position_b);
+	bool same = same_fen(&position_a, &position_b) &&
+		    same_fen(&a->start, &b->start) &&
+		    a->player == b->player && a->num_moves == b->num_moves;
+	for (size_t i = 0; same && i < a->num_moves; i++)
+		same = same_move(a->moves[i], b->moves[i]);
+	return same;
+}
+
+static bool save(ChessGame *game, const char *path)
+{
+	char command[INPUT_BUFFER_SIZE];
+	snprintf(command, sizeof(command), "save %s", path);
+	return serialize(game, command);
+}
+
+static bool load(ChessGame *game, const char *path)
+{
+	char command[INPUT_BUFFER_SIZE];
+	snprintf(command, sizeof(command), "load %s", path);
+	return deserialize(game, command);
+}
+
+static size_t read_save(const char *path, uint8_t data[SAVE_MAX_SIZE])
+{
+	FILE *file = fopen(path, "rb");
+	size_t size = file ? fread(data, 1, SAVE_MAX_SIZE, file) : 0;
+	if (file)
+		fclose(file);
+	return size;
+}
+
+static bool write_save(const char *path, const uint8_t *data, size_t size)
+{
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+	bool ok = fwrite(data, 1, size, file) == size;
+	return fclose(file) == 0 && ok;
+}
+
+/**
+ * A damaged save must not load, nor change the game it was loaded into.
+ */
+static void check_rejected(ChessGame *game, const char *path,
+			   const uint8_t *data, size_t size, const char *what)
+{
+	static ChessGame before;
+	memcpy(&before, game, sizeof(ChessGame));
+	CHECK(write_save(path, data, size), "Unable to write %s", path);
+	CHECK(!load(game, path), "Loaded a save with %s", what);
+	CHECK(same_game(game, &before), "Save with %s changed the game",
+	      what);
+}
+
+/**
+ * Save games in the binary format and load them back whole, moves and all,
+ * then check damaged saves are refused.
+ */
+void test_save(void)
+{
+	PgnGame games[TEST_PGN_GAMES];
+	size_t num_games = read_test_games(games);
+	char path[TEST_PATH_SIZE];
+	scratch_path("game" SAVE_BINARY_EXTENSION, path);
+	static ChessGame game;
+	static ChessGame loaded;
+	for (size_t i = 0; i < num_games; i++) {
+		if (!games[i].valid)
+			continue;
+		play_game(&game, &games[i]);
+		init_chess_game(&loaded);
+		CHECK(save(&game, path) && load(&loaded, path) &&
+		      same_game(&game, &loaded),
+		      "Game %zu did not load as saved", i + 1);
+	}
+
+	// The last game saved is the one with promotions.
+	uint8_t data[SAVE_MAX_SIZE];
+	uint8_t damaged[SAVE_MAX_SIZE];
+	size_t size = read_save(path, data);
+	CHECK(size > SAVE_HEADER_SIZE && game.num_moves > 0,
+	      "Save of %zu bytes has no moves", size);
+	if (size <= SAVE_HEADER_SIZE || game.num_moves == 0)
+		return;
+	init_chess_game(&loaded);
+	memcpy(damaged, data, size);
+	damaged[size / 2] ^= 1;
+	check_rejected(&loaded, path, damaged, size, "a bad checksum");
+	check_rejected(&loaded, path, data, size - 1, "a short file");
+
+	// An illegal move under a good checksum, from an empty square.
+	memcpy(damaged, data, size);
+	uint8_t *move = damaged + size - PACKED_MOVE_SIZE;
+	write_le(move, read_le(move, PACKED_MOVE_SIZE) ^ 2, PACKED_MOVE_SIZE);
+	write_le(damaged + 4, fnv1a_32(damaged + 8, size - 8), 4);
+	check_rejected(&loaded, path, damaged, size, "an illegal move");
+	unlink(path);
+}
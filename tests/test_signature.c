@@ -0,0 +1,158 @@
+#include "tests.h"
+#include "core/binary.h"
+#include "core/fen.h"
+#include "core/position.h"
+#include "core/signature.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static const struct {
+	const char *text;
+	bool valid;
+} MATERIAL_CASES[] = {
+	{ "KRPvKR", true },
+	{ "KvK", true },
+	{ "KQQQQQQQQQvK", true },
+	{ "KRvKR v", false },
+	{ "KRK", false },
+	{ "KXvK", false },
+};
+
+static const struct {
+	const char *text;
+	bool valid;
+} PATTERN_CASES[] = {
+	{ "Kg1,pe5", true },
+	{ "", true },
+	{ "Kg9", false },
+	{ "Xa1", false },
+	{ "Ka1pe5", false },
+};
+
+/**
+ * Whether the stored columns of the position are those of the board.
+ */
+static bool signed_as(const SignatureTable *table, size_t i,
+		      Position *position)
+{
+	uint64_t white = 0;
+	uint64_t types[SIGNATURE_TYPE_BITS] = { 0 };
+	for (int square = 0; square < BOARD_SIZE * BOARD_SIZE; square++) {
+		PlayPiece *piece = &position->board[square];
+		for (size_t bit = 0; bit < SIGNATURE_TYPE_BITS; bit++)
+			types[bit] |= (uint64_t)(piece->type >> bit & 1) <<
+				      square;
+		if (piece->type != PIECE_NONE &&
+		    piece->colour == COLOUR_WHITE)
+			white |= 1ULL << square;
+	}
+	bool same = table->white[i] == white &&
+		    table->material[i] < table->num_materials &&
+		    table->materials[table->material[i]] ==
+		    material_key(position);
+	for (size_t bit = 0; bit < SIGNATURE_TYPE_BITS; bit++)
+		same &= table->types[bit][i] == types[bit];
+	return same;
+}
+
+static void test_parsing(void)
+{
+	for (size_t i = 0; i < sizeof(MATERIAL_CASES) /
+	     sizeof(*MATERIAL_CASES); i++) {
+		uint64_t material;
+		CHECK(parse_material_key(MATERIAL_CASES[i].text, &material) ==
+		      MATERIAL_CASES[i].valid, "Material %s parsed wrongly",
+		      MATERIAL_CASES[i].text);
+	}
+	Position position;
+	uint64_t material;
+	parse_fen("8/8/4k3/8/8/8/3PK3/8 w - - 0 1", &position);
+	CHECK(parse_material_key("KPvK", &material) &&
+	      material == material_key(&position),
+	      "KPvK does not match its position");
+
+	for (size_t i = 0; i < sizeof(PATTERN_CASES) / sizeof(*PATTERN_CASES);
+	     i++) {
+		SignatureQuery query = { 0 };
+		CHECK(parse_piece_pattern(PATTERN_CASES[i].text, &query) ==
+		      PATTERN_CASES[i].valid, "Pattern %s parsed wrongly",
+		      PATTERN_CASES[i].text);
+	}
+	SignatureQuery query = { 0 };
+	parse_piece_pattern("Kg1,pe5", &query);
+	uint64_t g1 = 1ULL << 6;
+	uint64_t e5 = 1ULL << 36;
+	CHECK(query.squares == (g1 | e5) && query.white == g1 &&
+	      query.types[0] == e5 && query.types[1] == g1 &&
+	      query.types[2] == g1, "Pattern Kg1,pe5 has the wrong planes");
+}
+
+/**
+ * Sign the test games and check the header is little endian and the columns
+ * hold every position of every game in order.
+ */
+void test_signature(void)
+{
+	test_parsing();
+
+	char pgn[TEST_PATH_SIZE];
+	char path[TEST_PATH_SIZE];
+	CHECK(write_test_pgn(pgn), "Unable to write the test games");
+	scratch_path("games.cps", path);
+	const char *inputs[] = { pgn };
+	SignatureArgs args = {
+		.inputs = inputs,
+		.num_inputs = 1,
+		.output = path,
+		.threads = 1,
+	};
+	CHECK(run_signatures(&args), "Unable to sign the test games");
+
+	PgnGame games[TEST_PGN_GAMES];
+	size_t num_games = read_test_games(games);
+	size_t positions = 0;
+	for (size_t i = 0; i < num_games; i++)
+		positions += games[i].num_moves + 1;
+
+	uint8_t header[SIGNATURE_HEADER_SIZE] = { 0 };
+	FILE *file = fopen(path, "rb");
+	CHECK(file != NULL && fread(header, sizeof(header), 1, file) == 1,
+	      "Unable to read %s", path);
+	if (file)
+		fclose(file);
+	CHECK(read_le(header + 8, 8) == positions &&
+	      read_le(header + 16, 8) == num_games,
+	      "Header does not count %zu positions of %zu games", positions,
+	      num_games);
+
+	SignatureTable table;
+	bool opened = open_signature_table(&table, path);
+	CHECK(opened, "Unable to open %s", path);
+	if (!opened)
+		return;
+	CHECK(table.num_positions == positions && table.num_games == num_games,
+	      "Table has %zu positions of %zu games", table.num_positions,
+	      table.num_games);
+	size_t first = 0;
+	for (size_t i = 0; i < num_games && i < table.num_games; i++) {
+		CHECK(table.game_starts[i] == first,
+		      "Game %zu starts at %zu, not %zu", i + 1,
+		      (size_t)table.game_starts[i], first);
+		Position position = games[i].start;
+		size_t wrong = 0;
+		for (size_t ply = 0; ply <= games[i].num_moves &&
+		     first + ply < table.num_positions; ply++) {
+			wrong += !signed_as(&table, first + ply, &position);
+			if (ply < games[i].num_moves)
+				make_move(&position, games[i].moves[ply]);
+		}
+		CHECK(wrong == 0, "Game %zu has %zu wrong signatures", i + 1,
+		      wrong);
+		first += games[i].num_moves + 1;
+	}
+	close_signature_table(&table);
+	unlink(path);
+}
@@ -0,0 +1,440 @@
+#include "tests.h"
+#include "core/binary.h"
+#include "core/fen.h"
+#include "core/position.h"
+#include "core/syzygy.h"
+#include "core/tablebase.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+// Room for the largest test table.
+#define TABLE_BUFFER_SIZE (1 << 16)
+// Test tables code every value as a 3 bit symbol standing for itself, 85 to
+// a 32 byte block, with a sparse index entry every 64 values.
+#define CODE_BITS 3
+#define NUM_SYMBOLS 5
+#define BLOCK_BITS 5
+#define BLOCK_SIZE (1 << BLOCK_BITS)
+#define BLOCK_VALUES (BLOCK_SIZE * 8 / CODE_BITS)
+#define SPAN_BITS 6
+#define SPAN (1 << SPAN_BITS)
+// Pawnless tables with three unique pieces, and KPvK per pawn file.
+#define KRVK_SIZE 31332
+#define KPVK_FILE_SIZE (6 * 63 * 62)
+#define PAWN_FILES 4
+#define SINGLE_VALUE 128
+#define SYZYGY_SPLIT 1
+#define SYZYGY_HAS_PAWNS 2
+
+typedef struct {
+	uint8_t data[TABLE_BUFFER_SIZE];
+	size_t size;
+} TableBuffer;
+
+static TableBuffer buffer;
+
+static void put(uint64_t value, size_t bytes)
+{
+	write_le(buffer.data + buffer.size, value, bytes);
+	buffer.size += bytes;
+}
+
+static void align(size_t alignment)
+{
+	while (buffer.size % alignment)
+		buffer.data[buffer.size++] = 0;
+}
+
+/**
+ * Magic, flags and the piece order of every pawn file, both sides listing
+ * the pieces the same way.
+ */
+static void put_header(ETableFormat format, uint8_t flags,
+		       const uint8_t *codes, size_t num_pieces, size_t files)
+{
+	memset(&buffer, 0, sizeof(buffer));
+	memcpy(buffer.data, TABLE_FORMAT_MAGIC[format], 4);
+	buffer.size = 4;
+	put(flags, 1);
+	for (size_t f = 0; f < files; f++) {
+		put(0, 1);
+		for (size_t k = 0; k < num_pieces; k++)
+			put(codes[k] | codes[k] << 4, 1);
+	}
+	align(2);
+}
+
+static bool save_table(const char *directory, const char *name)
+{
+	char path[2 * TEST_PATH_SIZE];
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+	bool ok = fwrite(buffer.data, 1, buffer.size, file) == buffer.size;
+	return fclose(file) == 0 && ok;
+}
+
+// Stored win/draw/loss + 2 of the value at an index of a coded KRvK side.
+static int coded_value(int side, uint64_t index)
+{
+	return (index * (side ? 3 : 7) + index / BLOCK_VALUES) % NUM_SYMBOLS;
+}
+
+/**
+ * KRvK win/draw/loss table with both sides Huffman coded in blocks, so
+ * probes go through the sparse index, the block lengths and the codes.
+ */
+static bool write_coded_krvk(const char *directory)
+{
+	static const uint8_t codes[] = { 6, 4, 14 };
+	put_header(TABLE_FORMAT_SYZYGY_WDL, SYZYGY_SPLIT, codes, 3, 1);
+	size_t num_blocks = (KRVK_SIZE + BLOCK_VALUES - 1) / BLOCK_VALUES;
+	size_t sparse_size = (KRVK_SIZE + SPAN - 1) / SPAN;
+	for (int side = 0; side < 2; side++) {
+		put(0, 1);
+		put(BLOCK_BITS, 1);
+		put(SPAN_BITS, 1);
+		put(0, 1);
+		put(num_blocks, 4);
+		put(CODE_BITS, 1);
+		put(CODE_BITS, 1);
+		put(0, 2);
+		// Every symbol a leaf standing for itself.
+		put(NUM_SYMBOLS, 2);
+		for (uint64_t symbol = 0; symbol < NUM_SYMBOLS; symbol++)
+			put(symbol | 0xFFF << 12, 3);
+		put(0, NUM_SYMBOLS & 1);
+	}
+	// Each entry points at the middle of its span.
+	for (int side = 0; side < 2; side++) {
+		for (size_t k = 0; k < sparse_size; k++) {
+			size_t middle = k * SPAN + SPAN / 2;
+			put(middle / BLOCK_VALUES, 4);
+			put(middle % BLOCK_VALUES, 2);
+		}
+	}
+	for (int side = 0; side < 2; side++) {
+		for (size_t block = 0; block < num_blocks; block++) {
+			size_t values = KRVK_SIZE - block * BLOCK_VALUES;
+			put((values < BLOCK_VALUES ? values : BLOCK_VALUES) - 1,
+			    2);
+		}
+	}
+	for (int side = 0; side < 2; side++) {
+		align(64);
+		for (uint64_t index = 0; index < KRVK_SIZE; index++) {
+			uint8_t *block = buffer.data + buffer.size +
+					 index / BLOCK_VALUES * BLOCK_SIZE;
+			size_t bit = index % BLOCK_VALUES * CODE_BITS;
+			int symbol = coded_value(side, index);
+			for (int i = 0; i < CODE_BITS; i++, bit++) {
+				int set = symbol >> (CODE_BITS - 1 - i) & 1;
+				block[bit / 8] |= set << (7 - bit % 8);
+			}
+		}
+		buffer.size += num_blocks * BLOCK_SIZE;
+	}
+	// Readers load a little past the last block.
+	put(0, 8);
+	return save_table(directory, "KRvK.rtbw");
+}
+
+/**
+ * Table where every part holds one value, the win/draw/loss tables keep a
+ * part per side.
+ */
+static bool write_single_value(const char *directory, const char *name,
+			       ETableFormat format, uint8_t flags,
+			       const uint8_t *codes, size_t num_pieces,
+			       size_t files, const uint8_t values[2])
+{
+	put_header(format, flags, codes, num_pieces, files);
+	size_t sides = format == TABLE_FORMAT_SYZYGY_WDL ? 2 : 1;
+	for (size_t f = 0; f < files; f++) {
+		for (size_t side = 0; side < sides; side++) {
+			put(SINGLE_VALUE, 1);
+			put(values[side], 1);
+		}
+	}
+	align(64);
+	return save_table(directory, name);
+}
+
+static uint8_t transform(uint8_t square, int symmetry)
+{
+	if (symmetry & 1)
+		square ^= BOARD_SIZE - 1;
+	if (symmetry & 2)
+		square ^= (BOARD_SIZE - 1) * BOARD_SIZE;
+	if (symmetry & 4)
+		square = ((square >> 3) | (square << 3)) & 63;
+	return square;
+}
+
+static bool kings_apart(uint8_t a, uint8_t b)
+{
+	return abs(a % BOARD_SIZE - b % BOARD_SIZE) > 1 ||
+	       abs(a / BOARD_SIZE - b / BOARD_SIZE) > 1;
+}
+
+/**
+ * Placements of the three pieces must map onto distinct indices, the same
+ * for every placement the board's symmetries turn into each other, and the
+ * coded values must read back at those indices.
+ */
+static void test_krvk_index(const Tablebases *tablebases)
+{
+	static uint32_t classes[KRVK_SIZE];
+	memset(classes, 0xFF, sizeof(classes));
+	TablePieces pieces = {
+		.num_pieces = 3,
+		.types = { PIECE_KING, PIECE_ROOK, PIECE_KING },
+		.colours = { COLOUR_WHITE, COLOUR_WHITE, COLOUR_BLACK },
+	};
+	EPlayerColour turn = COLOUR_WHITE;
+	const TableFile *table = find_material_table(tablebases, &pieces,
+						     &turn,
+						     TABLE_FORMAT_SYZYGY_WDL);
+	CHECK(table != NULL, "KRvK table did not load");
+	if (table == NULL)
+		return;
+
+	size_t outside = 0;
+	size_t clashes = 0;
+	size_t misreads = 0;
+	size_t indices = 0;
+	for (uint32_t placement = 0; placement < 1 << 18; placement++) {
+		uint8_t squares[3] = {
+			placement >> 12, placement >> 6 & 63, placement & 63,
+		};
+		if (squares[0] == squares[1] || squares[1] == squares[2] ||
+		    !kings_apart(squares[0], squares[2]))
+			continue;
+		uint32_t class = UINT32_MAX;
+		for (int symmetry = 0; symmetry < 8; symmetry++) {
+			uint32_t image = 0;
+			for (size_t i = 0; i < 3; i++) {
+				image = image << 6 |
+					transform(squares[i], symmetry);
+			}
+			if (image < class)
+				class = image;
+		}
+
+		memcpy(pieces.squares, squares, sizeof(squares));
+		uint64_t index;
+		if (!syzygy_table_index(table, &pieces, COLOUR_WHITE, &index) ||
+		    index >= KRVK_SIZE) {
+			outside++;
+			continue;
+		}
+		if (classes[index] == UINT32_MAX) {
+			classes[index] = class;
+			indices++;
+		}
+		clashes += classes[index] != class;
+
+		for (EPlayerColour side = COLOUR_WHITE; side <= COLOUR_BLACK;
+		     side++) {
+			int value;
+			misreads += probe_syzygy_table(table, &pieces, side,
+						       TB_DRAW, &value) !=
+				    SYZYGY_OK ||
+				    value != coded_value(side, index) - 2;
+		}
+	}
+	CHECK(outside == 0, "%zu KRvK placements indexed outside the table",
+	      outside);
+	CHECK(clashes == 0, "%zu KRvK placements share an index", clashes);
+	CHECK(misreads == 0, "%zu KRvK values read back wrong", misreads);
+	CHECK(indices > KRVK_SIZE / 2, "Only %zu KRvK indices used", indices);
+}
+
+/**
+ * Tables with pawns only mirror the files, and keep a part per file of the
+ * leading pawn.
+ */
+static void test_kpvk_index(const Tablebases *tablebases)
+{
+	static uint32_t classes[PAWN_FILES][KPVK_FILE_SIZE];
+	memset(classes, 0xFF, sizeof(classes));
+	TablePieces pieces = {
+		.num_pieces = 3,
+		.types = { PIECE_KING, PIECE_PAWN, PIECE_KING },
+		.colours = { COLOUR_WHITE, COLOUR_WHITE, COLOUR_BLACK },
+	};
+	EPlayerColour turn = COLOUR_WHITE;
+	const TableFile *table = find_material_table(tablebases, &pieces,
+						     &turn,
+						     TABLE_FORMAT_SYZYGY_WDL);
+	CHECK(table != NULL, "KPvK table did not load");
+	if (table == NULL)
+		return;
+
+	size_t outside = 0;
+	size_t clashes = 0;
+	for (uint32_t placement = 0; placement < 1 << 18; placement++) {
+		uint8_t squares[3] = {
+			placement >> 12, placement >> 6 & 63, placement & 63,
+		};
+		int rank = squares[1] / BOARD_SIZE;
+		if (squares[0] == squares[1] || squares[1] == squares[2] ||
+		    !kings_apart(squares[0], squares[2]) || rank == 0 ||
+		    rank == BOARD_SIZE - 1)
+			continue;
+		uint32_t class = UINT32_MAX;
+		for (int symmetry = 0; symmetry < 2; symmetry++) {
+			uint32_t image = 0;
+			for (size_t i = 0; i < 3; i++) {
+				image = image << 6 |
+					transform(squares[i], symmetry);
+			}
+			if (image < class)
+				class = image;
+		}
+		int file = squares[1] % BOARD_SIZE;
+		if (file >= BOARD_SIZE / 2)
+			file = BOARD_SIZE - 1 - file;
+
+		memcpy(pieces.squares, squares, sizeof(squares));
+		uint64_t index;
+		if (!syzygy_table_index(table, &pieces, COLOUR_BLACK, &index) ||
+		    index >= KPVK_FILE_SIZE) {
+			outside++;
+			continue;
+		}
+		if (classes[file][index] == UINT32_MAX)
+			classes[file][index] = class;
+		clashes += classes[file][index] != class;
+	}
+	CHECK(outside == 0, "%zu KPvK placements indexed outside the table",
+	      outside);
+	CHECK(clashes == 0, "%zu KPvK placements share an index", clashes);
+}
+
+static void check_wdl(Tablebases *tablebases, const char *fen, bool covered,
+		      EWdl expected)
+{
+	Position position;
+	CHECK(parse_fen(fen, &position), "Invalid FEN %s", fen);
+	EWdl wdl = TB_DRAW;
+	bool probed = probe_syzygy_wdl(tablebases, &position, &wdl);
+	CHECK(probed == covered && (!covered || wdl == expected),
+	      "%s probed %d with %d", fen, probed, wdl);
+}
+
+static void check_dtz(Tablebases *tablebases, const char *fen, int expected)
+{
+	Position position;
+	CHECK(parse_fen(fen, &position), "Invalid FEN %s", fen);
+	int dtz = 0;
+	CHECK(probe_syzygy_dtz(tablebases, &position, &dtz) && dtz == expected,
+	      "%s has distance %d, expected %d", fen, dtz, expected);
+}
+
+/**
+ * KRvK tables where white to move always wins in 5 moves to zeroing. The
+ * captures the tables leave out are searched, black's table positions are
+ * read through the flipped board, and the root keeps the moves that do not
+ * hang the rook.
+ */
+static void test_probes(Tablebases *tablebases)
+{
+	check_wdl(tablebases, "4k3/8/8/8/8/8/8/R3K3 w - - 0 1", true, TB_WIN);
+	check_wdl(tablebases, "4k3/8/8/8/8/8/8/R3K3 b - - 0 1", true, TB_LOSS);
+	check_wdl(tablebases, "8/8/8/8/8/8/1k6/R3K3 b - - 0 1", true, TB_DRAW);
+	check_wdl(tablebases, "r3k3/8/8/8/8/8/8/4K3 b - - 0 1", true, TB_WIN);
+	check_wdl(tablebases, "r3k3/8/8/8/8/8/8/4K3 w - - 0 1", true, TB_LOSS);
+	check_wdl(tablebases, "4k3/8/8/8/8/8/8/4K3 w - - 0 1", true, TB_DRAW);
+	// No tables for castling rights or other material.
+	check_wdl(tablebases, "4k3/8/8/8/8/8/8/R3K3 w Q - 0 1", false, TB_DRAW);
+	check_wdl(tablebases, "4k3/8/8/8/8/8/8/Q3K3 w - - 0 1", false, TB_DRAW);
+
+	// Only white to move is stored, black's distance is one ply on.
+	check_dtz(tablebases, "4k3/8/8/8/8/8/8/R3K3 w - - 0 1", 11);
+	check_dtz(tablebases, "4k3/8/8/8/8/8/8/R3K3 b - - 0 1", -12);
+	check_dtz(tablebases, "8/8/8/8/8/8/1k6/R3K3 b - - 0 1", 0);
+
+	// Ra2, Ra3 and Ra4 hang the rook to the king on b3.
+	Position position;
+	parse_fen("8/8/8/8/8/1k6/8/R3K3 w - - 0 1", &position);
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(&position, moves);
+	EWdl wdl = TB_DRAW;
+	size_t kept = filter_root_moves(tablebases, &position, moves,
+					num_moves, &wdl);
+	CHECK(kept == num_moves - 3 && wdl == TB_WIN,
+	      "Kept %zu root moves of %zu", kept, num_moves);
+	for (size_t i = 0; i < kept; i++) {
+		char coords[MOVE_COORDS_LENGTH];
+		format_move_coords(moves[i], coords);
+		CHECK(strcmp(coords, "a1a2") != 0 &&
+		      strcmp(coords, "a1a3") != 0 &&
+		      strcmp(coords, "a1a4") != 0, "Kept %s", coords);
+	}
+}
+
+static void remove_tables(const char *directory, const char **names,
+			  size_t num_names)
+{
+	for (size_t i = 0; i < num_names; i++) {
+		char path[2 * TEST_PATH_SIZE];
+		snprintf(path, sizeof(path), "%s/%s", directory, names[i]);
+		unlink(path);
+	}
+	rmdir(directory);
+}
+
+void test_syzygy(void)
+{
+	static const uint8_t KPVK_CODES[] = { 1, 6, 14 };
+	static const uint8_t KRVK_CODES[] = { 6, 4, 14 };
+	static const uint8_t DRAWN[] = { 2, 2 };
+	static const uint8_t WHITE_WINS[] = { 4, 0 };
+	static const uint8_t FIVE_MOVES[] = { 5, 5 };
+	char directory[TEST_PATH_SIZE];
+	Tablebases tablebases;
+
+	scratch_path("syzygy_index", directory);
+	static const char *index_tables[] = { "KRvK.rtbw", "KPvK.rtbw" };
+	CHECK(mkdir(directory, 0700) == 0 && write_coded_krvk(directory) &&
+	      write_single_value(directory, "KPvK.rtbw",
+				 TABLE_FORMAT_SYZYGY_WDL,
+				 SYZYGY_SPLIT | SYZYGY_HAS_PAWNS, KPVK_CODES,
+				 3, PAWN_FILES, DRAWN),
+	      "Unable to write the index test tables");
+	if (open_tablebases(&tablebases, directory, 0)) {
+		CHECK(tablebases.num_files == 2, "Loaded %zu of 2 tables",
+		      tablebases.num_files);
+		test_krvk_index(&tablebases);
+		test_kpvk_index(&tablebases);
+		close_tablebases(&tablebases);
+	}
+	remove_tables(directory, index_tables, 2);
+
+	scratch_path("syzygy_probe", directory);
+	static const char *probe_tables[] = { "KRvK.rtbw", "KRvK.rtbz" };
+	CHECK(mkdir(directory, 0700) == 0 &&
+	      write_single_value(directory, "KRvK.rtbw",
+				 TABLE_FORMAT_SYZYGY_WDL, SYZYGY_SPLIT,
+				 KRVK_CODES, 3, 1, WHITE_WINS) &&
+	      write_single_value(directory, "KRvK.rtbz",
+				 TABLE_FORMAT_SYZYGY_DTZ, SYZYGY_SPLIT,
+				 KRVK_CODES, 3, 1, FIVE_MOVES),
+	      "Unable to write the probe test tables");
+	if (open_tablebases(&tablebases, directory, 0)) {
+		CHECK(tablebases.num_files == 2, "Loaded %zu of 2 tables",
+		      tablebases.num_files);
+		test_probes(&tablebases);
+		close_tablebases(&tablebases);
+	}
+	remove_tables(directory, probe_tables, 2);
+}
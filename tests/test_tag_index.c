@@ -0,0 +1,187 @@
+#include "tests.h"
+#include "core/pgn.h"
+#include "core/tag_index.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Longer than any name the index stores.
+#define LONG_NAME_LEN 300
+
+static const struct {
+	const char *date;
+	uint32_t value;
+} DATE_CASES[] = {
+	{ "2022.07.31", 20220731 },
+	{ "2023.??.??", 20230000 },
+	{ "????.??.??", 0 },
+	{ "2022.7.1", 20220701 },
+	{ "2022.123.01", 0 },
+};
+
+static const struct {
+	const char *player;
+	size_t min_elo;
+	const char *since;
+	const char *until;
+	const char *result;
+	size_t games;
+} FILTER_CASES[] = {
+	{ NULL, 0, NULL, NULL, NULL, 4 },
+	{ "Carlsen", 0, NULL, NULL, NULL, 3 },
+	{ "Carlsen", 2855, NULL, NULL, NULL, 1 },
+	{ NULL, 2700, NULL, NULL, NULL, 2 },
+	{ NULL, 0, "2022.01.01", "2022.12.31", NULL, 1 },
+	{ NULL, 0, NULL, NULL, "0-1", 1 },
+	{ "Nobody", 0, NULL, NULL, NULL, 0 },
+};
+
+/**
+ * Four games, the last two by players whose names only differ past the
+ * longest name the index stores.
+ */
+static size_t format_pgn(char *pgn, size_t size)
+{
+	char long_name[LONG_NAME_LEN + 1];
+	memset(long_name, 'a', LONG_NAME_LEN);
+	long_name[LONG_NAME_LEN] = '\0';
+	return snprintf(pgn, size,
+			"[Event \"Test\"]\n[White \"Carlsen, Magnus\"]\n"
+			"[Black \"Nakamura, Hikaru\"]\n[WhiteElo \"2850\"]\n"
+			"[BlackElo \"2780\"]\n[Date \"2022.07.31\"]\n"
+			"[Result \"1-0\"]\n\n1. e4 e5 1-0\n\n"
+			"[Event \"Test\"]\n[White \"Nakamura, Hikaru\"]\n"
+			"[Black \"Carlsen, Magnus\"]\n[WhiteElo \"2790\"]\n"
+			"[BlackElo \"2860\"]\n[Date \"2023.??.??\"]\n"
+			"[Result \"1/2-1/2\"]\n\n1. d4 d5 1/2-1/2\n\n"
+			"[Event \"Test\"]\n[White \"%sx\"]\n"
+			"[Result \"0-1\"]\n\n1. f3 e5 2. g4 Qh4# 0-1\n\n"
+			"[Event \"Test\"]\n[White \"%sy\"]\n"
+			"[Black \"Carlsen, Magnus\"]\n[BlackElo \"2500\"]\n"
+			"[Result \"*\"]\n\n1. c4 *\n",
+			long_name, long_name);
+}
+
+static bool write_file(const char *path, const char *text, size_t length)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+		return false;
+	bool ok = fwrite(text, 1, length, file) == length;
+	return fclose(file) == 0 && ok;
+}
+
+static size_t count_games(const char *path)
+{
+	char line[PGN_MAX_TAG_VALUE_LEN + 64];
+	size_t games = 0;
+	FILE *file = fopen(path, "r");
+	while (file != NULL && fgets(line, sizeof(line), file) != NULL)
+		games += strncmp(line, "[Event ", 7) == 0;
+	if (file)
+		fclose(file);
+	return games;
+}
+
+static void test_records(const TagIndex *index, const char *pgn)
+{
+	CHECK(index->num_games == 4 && index->num_players == 4,
+	      "Index has %zu games and %zu players", index->num_games,
+	      index->num_players);
+	if (index->num_games != 4 || index->num_players != 4)
+		return;
+	TagRecord records[4];
+	for (size_t i = 0; i < 4; i++) {
+		records[i] = read_tag_record(index, i);
+		CHECK(strncmp(pgn + records[i].offset, "[Event", 6) == 0,
+		      "Game %zu offset %zu is not at its tags", i + 1,
+		      (size_t)records[i].offset);
+	}
+	CHECK(records[0].white == 0 && records[0].black == 1 &&
+	      records[1].white == 1 && records[1].black == 0,
+	      "Players are numbered wrongly");
+	CHECK(records[0].white_elo == 2850 && records[1].black_elo == 2860 &&
+	      records[2].white_elo == 0, "Elos are read wrongly");
+	CHECK(records[0].date == 20220731 && records[1].date == 20230000 &&
+	      records[2].date == 0, "Dates are read wrongly");
+	CHECK(records[0].result == GAME_RESULT_WHITE_WIN &&
+	      records[2].result == GAME_RESULT_BLACK_WIN &&
+	      records[3].result == GAME_RESULT_UNKNOWN,
+	      "Results are read wrongly");
+
+	const char *name;
+	size_t length = get_player_name(index, records[2].white, &name);
+	CHECK(records[3].white == records[2].white &&
+	      length == TAG_INDEX_MAX_NAME_LEN,
+	      "Long names are players %u and %u, stored in %zu bytes",
+	      records[2].white, records[3].white, length);
+	length = get_player_name(index, records[2].black, &name);
+	CHECK(length == 1 && *name == '?', "Missing player is not ?");
+}
+
+/**
+ * Index the tags of some games, read the records back and filter on them.
+ * The filter must refuse a PGN file changed since it was indexed.
+ */
+void test_tag_index(void)
+{
+	for (size_t i = 0; i < sizeof(DATE_CASES) / sizeof(*DATE_CASES); i++) {
+		uint32_t date = parse_pgn_date(DATE_CASES[i].date);
+		CHECK(date == DATE_CASES[i].value, "Date %s read as %u",
+		      DATE_CASES[i].date, date);
+	}
+
+	static char pgn[4096];
+	size_t length = format_pgn(pgn, sizeof(pgn));
+	char pgn_path[TEST_PATH_SIZE];
+	char index_path[TEST_PATH_SIZE];
+	char output_path[TEST_PATH_SIZE];
+	scratch_path("tags.pgn", pgn_path);
+	scratch_path("tags.cti", index_path);
+	scratch_path("filtered.pgn", output_path);
+	CHECK(write_file(pgn_path, pgn, length), "Unable to write %s",
+	      pgn_path);
+	TagIndexArgs args = { .input = pgn_path, .output = index_path };
+	CHECK(run_tag_index(&args), "Unable to index %s", pgn_path);
+
+	TagIndex index;
+	bool opened = open_tag_index(&index, index_path);
+	CHECK(opened, "Unable to open %s", index_path);
+	if (opened) {
+		test_records(&index, pgn);
+		close_tag_index(&index);
+	}
+
+	for (size_t i = 0; i < sizeof(FILTER_CASES) / sizeof(*FILTER_CASES);
+	     i++) {
+		TagFilterArgs filter = {
+			.input = pgn_path,
+			.index = index_path,
+			.player = FILTER_CASES[i].player,
+			.min_elo = FILTER_CASES[i].min_elo,
+			.since = FILTER_CASES[i].since,
+			.until = FILTER_CASES[i].until,
+			.result = FILTER_CASES[i].result,
+			.output = output_path,
+		};
+		bool filtered = run_tag_filter(&filter);
+		size_t games = count_games(output_path);
+		CHECK(filtered && games == FILTER_CASES[i].games,
+		      "Filter %zu copied %zu games, not %zu", i, games,
+		      FILTER_CASES[i].games);
+	}
+
+	// Same size, different text.
+	pgn[strstr(pgn, "Carlsen") - pgn] = 'K';
+	CHECK(write_file(pgn_path, pgn, length), "Unable to write %s",
+	      pgn_path);
+	TagFilterArgs stale = { .input = pgn_path, .index = index_path };
+	CHECK(!run_tag_filter(&stale), "Filter used a stale index");
+
+	unlink(pgn_path);
+	unlink(index_path);
+	unlink(output_path);
+}
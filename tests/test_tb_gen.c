@@ -0,0 +1,207 @@
+#include "tests.h"
+#include "core/fen.h"
+#include "core/position.h"
+#include "core/tablebase.h"
+#include "core/tb_gen.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+// Every third placement is checked, enough to cover each king and piece
+// square many times over.
+#define PLACEMENT_STEP 3
+// Only the result is known.
+#define ANY_PLIES -2
+
+static const struct {
+	const char *fen;
+	EWdl wdl;
+	int plies;
+} KNOWN_RESULTS[] = {
+	{ "4k3/8/4K3/8/8/8/8/Q7 w - - 0 1", TB_WIN, 1 },
+	{ "4k3/4Q3/4K3/8/8/8/8/8 b - - 0 1", TB_LOSS, 0 },
+	{ "k7/2Q5/1K6/8/8/8/8/8 b - - 0 1", TB_DRAW, -1 },
+	// A bishop or knight alone cannot mate.
+	{ "4k3/8/8/8/8/8/8/2B1K3 w - - 0 1", TB_DRAW, -1 },
+	{ "4k3/8/8/8/8/8/8/1N2K3 w - - 0 1", TB_DRAW, -1 },
+	// A king on the sixth in front of its pawn wins whoever moves, a
+	// defender with the opposition in front of the pawn draws.
+	{ "4k3/8/4K3/4P3/8/8/8/8 w - - 0 1", TB_WIN, ANY_PLIES },
+	{ "4k3/8/4K3/4P3/8/8/8/8 b - - 0 1", TB_LOSS, ANY_PLIES },
+	{ "8/8/8/4k3/8/4K3/4P3/8 w - - 0 1", TB_DRAW, -1 },
+	// An en passant square no pawn can take on is still in the table.
+	{ "8/8/8/8/P7/8/8/K3k3 b - a3 0 1", TB_LOSS, 26 },
+};
+
+/**
+ * FEN of the pieces on their squares, white's as upper case.
+ */
+static void placement_fen(const char *symbols, const uint8_t *squares,
+			  size_t count, EPlayerColour turn,
+			  char fen[FEN_MAX_LENGTH])
+{
+	char board[BOARD_SIZE * BOARD_SIZE] = { 0 };
+	for (size_t i = 0; i < count; i++)
+		board[squares[i]] = symbols[i];
+	size_t length = 0;
+	for (int rank = BOARD_SIZE - 1; rank >= 0; rank--) {
+		int empty = 0;
+		for (int file = 0; file < BOARD_SIZE; file++) {
+			char symbol = board[rank * BOARD_SIZE + file];
+			if (symbol == 0) {
+				empty++;
+				continue;
+			}
+			if (empty)
+				fen[length++] = '0' + empty;
+			empty = 0;
+			fen[length++] = symbol;
+		}
+		if (empty)
+			fen[length++] = '0' + empty;
+		if (rank > 0)
+			fen[length++] = '/';
+	}
+	snprintf(fen + length, FEN_MAX_LENGTH - length, " %c - - 0 1",
+		 turn == COLOUR_WHITE ? 'w' : 'b');
+}
+
+static bool probe_child(Tablebases *tablebases, Position *child, EWdl *wdl,
+			int *plies)
+{
+	// Bare kings have no table.
+	if (count_pieces(child) == 2) {
+		*wdl = TB_DRAW;
+		*plies = -1;
+		return true;
+	}
+	return probe_dtm(tablebases, child, wdl, plies);
+}
+
+/**
+ * A table entry must agree with the entries one move on: the quickest mate
+ * of the moves that win, else a draw, else the slowest of the losses.
+ */
+static bool is_consistent(Tablebases *tablebases, Position *position)
+{
+	EWdl wdl;
+	int plies;
+	if (!probe_dtm(tablebases, position, &wdl, &plies))
+		return false;
+	Move moves[MAX_LEGAL_MOVES];
+	size_t num_moves = generate_legal_moves(position, moves);
+	if (num_moves == 0) {
+		return is_in_check(position) ? wdl == TB_LOSS && plies == 0 :
+		       wdl == TB_DRAW;
+	}
+
+	int win = INT_MAX;
+	int loss = -1;
+	bool draw = false;
+	for (size_t i = 0; i < num_moves; i++) {
+		Position child = *position;
+		make_move(&child, moves[i]);
+		EWdl child_wdl;
+		int child_plies;
+		if (!probe_child(tablebases, &child, &child_wdl, &child_plies))
+			return false;
+		if (child_wdl == TB_LOSS && child_plies + 1 < win)
+			win = child_plies + 1;
+		else if (child_wdl == TB_WIN && child_plies + 1 > loss)
+			loss = child_plies + 1;
+		draw |= child_wdl == TB_DRAW;
+	}
+	if (win != INT_MAX)
+		return wdl == TB_WIN && plies == win;
+	if (draw)
+		return wdl == TB_DRAW;
+	return wdl == TB_LOSS && plies == loss;
+}
+
+static void test_material(Tablebases *tablebases, const char *symbols)
+{
+	size_t checked = 0;
+	size_t wrong = 0;
+	for (uint32_t placement = 0; placement < 1 << 18;
+	     placement += PLACEMENT_STEP) {
+		uint8_t squares[3] = {
+			placement >> 12, placement >> 6 & 63, placement & 63,
+		};
+		if (squares[0] == squares[1] || squares[0] == squares[2] ||
+		    squares[1] == squares[2])
+			continue;
+		for (EPlayerColour turn = COLOUR_WHITE; turn <= COLOUR_BLACK;
+		     turn++) {
+			char fen[FEN_MAX_LENGTH];
+			Position position;
+			Position other;
+			placement_fen(symbols, squares, 3, !turn, fen);
+			// The player not to move may not be in check.
+			if (!parse_fen(fen, &other) || is_in_check(&other))
+				continue;
+			placement_fen(symbols, squares, 3, turn, fen);
+			if (!parse_fen(fen, &position))
+				continue;
+			checked++;
+			if (!is_consistent(tablebases, &position) &&
+			    wrong++ == 0)
+				ERROR_LOG("Inconsistent entry for %s\n", fen);
+		}
+	}
+	CHECK(checked > 0 && wrong == 0, "%zu of %zu %s entries inconsistent",
+	      wrong, checked, symbols);
+}
+
+/**
+ * Build every three piece table, check some known results and that each
+ * entry agrees with the entries a move on.
+ */
+void test_tb_gen(void)
+{
+	char directory[TEST_PATH_SIZE];
+	scratch_path("tables", directory);
+	TbGenArgs args = {
+		.directory = directory,
+		.pieces = TB_GEN_MIN_PIECES,
+		.threads = 2,
+	};
+	CHECK(mkdir(directory, 0700) == 0 && run_tb_gen(&args),
+	      "Unable to build the tables");
+	Tablebases tablebases;
+	CHECK(open_tablebases(&tablebases, directory, 0) &&
+	      tablebases.num_files == 5, "Built tables did not load");
+
+	for (size_t i = 0; i < sizeof(KNOWN_RESULTS) / sizeof(*KNOWN_RESULTS);
+	     i++) {
+		Position position;
+		parse_fen(KNOWN_RESULTS[i].fen, &position);
+		EWdl wdl;
+		int plies;
+		bool probed = probe_dtm(&tablebases, &position, &wdl, &plies);
+		CHECK(probed && wdl == KNOWN_RESULTS[i].wdl &&
+		      (KNOWN_RESULTS[i].plies == ANY_PLIES ||
+		       plies == KNOWN_RESULTS[i].plies),
+		      "%s probed %d with %d in %d plies", KNOWN_RESULTS[i].fen,
+		      probed, wdl, plies);
+	}
+	test_material(&tablebases, "KQk");
+	test_material(&tablebases, "KRk");
+	test_material(&tablebases, "KPk");
+	close_tablebases(&tablebases);
+
+	static const char *names[] = {
+		"KQvK.ctb", "KRvK.ctb", "KBvK.ctb", "KNvK.ctb", "KPvK.ctb",
+	};
+	for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+		char path[2 * TEST_PATH_SIZE];
+		snprintf(path, sizeof(path), "%s/%s", directory, names[i]);
+		unlink(path);
+	}
+	rmdir(directory);
+}
@@ -0,0 +1,142 @@
+#include "tests.h"
+#include "core/fen.h"
+#include "core/pgn.h"
+#include "core/position.h"
+#include "core/log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+size_t checks;
+size_t failures;
+
+// Made fresh for each run, tests remove their own files from it.
+static char scratch_directory[] = "/tmp/chess_tests.XXXXXX";
+
+void scratch_path(const char *name, char path[TEST_PATH_SIZE])
+{
+	snprintf(path, TEST_PATH_SIZE, "%s/%s", scratch_directory, name);
+}
+
+bool same_fen(const Position *a, const Position *b)
+{
+	Position copy_a = *a;
+	Position copy_b = *b;
+	char fen_a[FEN_MAX_LENGTH];
+	char fen_b[FEN_MAX_LENGTH];
+	format_fen(&copy_a, fen_a);
+	format_fen(&copy_b, fen_b);
+	return strcmp(fen_a, fen_b) == 0;
+}
+
+// Written back exactly as read by the FEN test, walked by the SAN test.
+const char *const TEST_FENS[NUM_TEST_FENS] = {
+	STARTING_FEN,
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+	"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+	"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+	"rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+	"4k3/8/8/8/8/8/8/4K2R b K - 12 40",
+};
+
+// Castling both ways, en passant, promotion, a FEN start and a game cut
+// short by an illegal move.
+const char TEST_PGN[] =
+	"[Event \"Test\"]\n"
+	"[White \"A\"]\n"
+	"[Black \"B\"]\n"
+	"[Result \"1/2-1/2\"]\n"
+	"\n"
+	"1. e4 e5 2. Nf3 Nc6 3. Bc4 Bc5 4. O-O Nf6 5. d4 exd4 6. e5 d5 "
+	"7. exf6 dxc4 8. Re1+ Be6 9. Ng5 Qd5 10. Nc3 Qf5 11. Nce4 O-O-O "
+	"1/2-1/2\n"
+	"\n"
+	"[Event \"Test\"]\n"
+	"[Result \"1-0\"]\n"
+	"\n"
+	"1. e4 a6 2. e5 d5 3. exd6 cxd6 4. d4 1-0\n"
+	"\n"
+	"[Event \"Test\"]\n"
+	"[SetUp \"1\"]\n"
+	"[FEN \"4k3/P7/8/8/8/8/1p6/4K3 w - - 0 1\"]\n"
+	"[Result \"*\"]\n"
+	"\n"
+	"1. a8=Q+ Kd7 2. Qd5+ Ke7 3. Kd2 b1=N+ 4. Kc1 *\n"
+	"\n"
+	"[Event \"Test\"]\n"
+	"[Result \"*\"]\n"
+	"\n"
+	"1. e4 e5 2. Ke3 *\n";
+
+bool same_move(Move a, Move b)
+{
+	return a.origin == b.origin && a.target == b.target &&
+	       a.type == b.type && a.promotion == b.promotion;
+}
+
+size_t read_test_games(PgnGame games[TEST_PGN_GAMES])
+{
+	PgnReader reader;
+	init_pgn_reader_memory(&reader, TEST_PGN, sizeof(TEST_PGN) - 1);
+	size_t num_games = 0;
+	while (num_games < TEST_PGN_GAMES &&
+	       read_pgn_game(&reader, &games[num_games]))
+		num_games++;
+	close_pgn_reader(&reader);
+	return num_games;
+}
+
+bool write_test_pgn(char path[TEST_PATH_SIZE])
+{
+	scratch_path("test.pgn", path);
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+		return false;
+	bool ok = fwrite(TEST_PGN, 1, sizeof(TEST_PGN) - 1, file) ==
+		  sizeof(TEST_PGN) - 1;
+	return fclose(file) == 0 && ok;
+}
+
+int main(void)
+{
+	if (mkdtemp(scratch_directory) == NULL) {
+		ERROR_LOG("Unable to make %s\n", scratch_directory);
+		return 1;
+	}
+
+	test_perft();
+	test_history();
+	test_book();
+	test_book_build();
+	test_position_index();
+	test_syzygy();
+	test_tb_gen();
+	test_mate();
+	test_pgn_batch();
+	test_san();
+	test_archive();
+	test_signature();
+	test_tag_index();
+	test_dedupe();
+	test_epd();
+	test_save();
+	test_fen();
+
+	static PgnGame games[TEST_PGN_GAMES];
+	size_t num_games = read_test_games(games);
+	CHECK(num_games == TEST_PGN_GAMES, "Read %zu test games of %d",
+	      num_games, TEST_PGN_GAMES);
+	for (size_t i = 0; i < num_games; i++)
+		CHECK(games[i].valid == (i < TEST_PGN_VALID_GAMES),
+		      "Test game %zu valid is %d", i + 1, games[i].valid);
+	test_journal();
+
+	rmdir(scratch_directory);
+	INFO_LOG("%zu of %zu checks passed\n", checks - failures, checks);
+	return failures != 0;
+}
@@ -0,0 +1,65 @@
+#ifndef _TESTS_H
+#define _TESTS_H
+
+#include "core/movement.h"
+#include "core/pgn.h"
+#include "core/position.h"
+#include "core/log.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Long enough for a scratch directory and a file name.
+#define TEST_PATH_SIZE 256
+
+// Games in TEST_PGN, the last one is cut short by an illegal move.
+#define TEST_PGN_GAMES 4
+#define TEST_PGN_VALID_GAMES 3
+
+extern size_t checks;
+extern size_t failures;
+
+#define CHECK(condition, ...) \
+	do { \
+		checks++; \
+		if (!(condition)) { \
+			failures++; \
+			ERROR_LOG("%s:%d: ", __FILE__, __LINE__); \
+			fprintf(stderr, __VA_ARGS__); \
+			fprintf(stderr, "\n"); \
+		} \
+	} while (0)
+
+// Positions with castling, en passant and promotions, see TEST_FENS.
+#define NUM_TEST_FENS 7
+
+extern const char TEST_PGN[];
+extern const char *const TEST_FENS[NUM_TEST_FENS];
+
+void scratch_path(const char *name, char path[TEST_PATH_SIZE]);
+size_t read_test_games(PgnGame games[TEST_PGN_GAMES]);
+bool write_test_pgn(char path[TEST_PATH_SIZE]);
+bool same_move(Move a, Move b);
+bool same_fen(const Position *a, const Position *b);
+
+void test_fen(void);
+void test_perft(void);
+void test_history(void);
+void test_book(void);
+void test_book_build(void);
+void test_position_index(void);
+void test_syzygy(void);
+void test_tb_gen(void);
+void test_mate(void);
+void test_pgn_batch(void);
+void test_san(void);
+void test_archive(void);
+void test_signature(void);
+void test_tag_index(void);
+void test_dedupe(void);
+void test_epd(void);
+void test_save(void);
+void test_journal(void);
+
+#endif